@@ -6,6 +6,7 @@ in vec3 v_world_position;
 //uniform float u_ending_position;    // Ending position (tb)
 
 uniform mat4 u_model;
+uniform mat4 u_viewprojection;
 uniform vec3 u_camera_position;
 uniform vec4 u_color;
 uniform vec4 u_ambient_light;
@@ -17,8 +18,19 @@ uniform int u_volume_type;
 uniform float u_step_length;
 uniform int u_noise_detail;
 uniform float u_noise_scale;
+uniform bool u_baked_noise;        // noise fetched from the baked volume instead of evaluating the octaves
+uniform sampler3D u_noise_texture; // tileable fBm remapped to [0, 1], repeated
+uniform float u_noise_period;      // lattice cells of the first octave across the noise texture
+uniform bool u_premultiplied;      // offscreen volume pass: radiance and opacity instead of over the background
+uniform bool u_depth_clamp;        // offscreen volume pass: the rays stop at the opaque geometry
+uniform sampler2D u_opaque_depth;  // full resolution depth of the opaque scene
+uniform int u_depth_ratio;         // full resolution pixels per volume pixel
+uniform mat4 u_inverse_viewprojection;
 
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 VolumeDepth;  // offscreen pass: view depth of the entry point times the opacity
+
+float entry_depth = 0.0;
 
 vec3 fade(vec3 t) {
     return t * t * t * (t * (t * 6.0 - 15.0) + 10.0);
@@ -70,6 +82,12 @@ float fractalPerlin(vec3 position, float scale, int detail) {
     return noiseValue;
 }
 
+// tileable fBm of gradient noise baked with the octaves of u_noise_detail, one fetch instead of fractalPerlin.
+// gradientNoise is signed, so the [0, 1] of the texture goes back to [-1, 1] before the clamp
+float bakedNoise(vec3 position) {
+    return texture(u_noise_texture, position * u_noise_scale / u_noise_period).r * 2.0 - 1.0;
+}
+
 vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax) {
     vec3 tMin = (boxMin - rayOrigin) / rayDir;
     vec3 tMax = (boxMax - rayOrigin) / rayDir;
@@ -80,7 +98,25 @@ vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax) {
     return vec2(tNear, tFar);
 };
 
-void main()
+// distance along the local ray to the opaque scene, with the farthest depth of the footprint like
+// the depth test of the proxy so the edges of the geometry are left to the upsample
+float opaqueDistance(vec3 origin, vec3 dir, mat4 inverseModel) {
+    ivec2 size = textureSize(u_opaque_depth, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * u_depth_ratio;
+    float depth = 0.0;
+    for (int y = 0; y < u_depth_ratio; y++)
+        for (int x = 0; x < u_depth_ratio; x++)
+            depth = max(depth, texelFetch(u_opaque_depth, min(base + ivec2(x, y), size - 1), 0).r);
+    if (depth >= 1.0)
+        return 1e30;  // background
+
+    vec2 uv = (vec2(base) + 0.5 * float(u_depth_ratio)) / vec2(size);
+    vec4 world = u_inverse_viewprojection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 local = (inverseModel * vec4(world.xyz / world.w, 1.0)).xyz;
+    return dot(local - origin, dir);
+}
+
+void rayMarch()
 {
     mat4 inverseModel = inverse(u_model);
     vec4 temp = vec4(u_camera_position, 1.0);
@@ -97,15 +133,18 @@ void main()
     vec2 intersection = intersectAABB(local_camera_pos, r, u_boxMin, u_boxMax);
 
     float ta = intersection.x;
+    entry_depth = (u_viewprojection * u_model * vec4(local_camera_pos + r * max(ta, 0.0), 1.0)).w;
     float tb = intersection.y;
+    if (u_depth_clamp)
+        tb = min(tb, opaqueDistance(local_camera_pos, r, inverseModel));
 
-    float opticalThickness = tb - ta;
+    float opticalThickness = max(tb - ta, 0.0);  // zero when the opaque scene is in front of the volume
 
     if(u_volume_type == 0){
         // Compute transmittance using Beer-Lambert Law
         float transmittance = exp(-u_absorption_coefficient * opticalThickness);
 
-        FragColor = u_background_color * transmittance + u_color * (1.0 - transmittance);
+        FragColor = u_premultiplied ? vec4(u_color.rgb, 1.0) * (1.0 - transmittance) : u_background_color * transmittance + u_color * (1.0 - transmittance);
     }
 
     else{
@@ -120,17 +159,23 @@ void main()
         //}
         while (t < tb){
             vec3 P = local_camera_pos + r * t;
-            float noiseValue = clamp(fractalPerlin(P, u_noise_scale, u_noise_detail), 0.0, 1.0) * u_absorption_coefficient;
+            float noiseValue = clamp(u_baked_noise ? bakedNoise(P) : fractalPerlin(P, u_noise_scale, u_noise_detail), 0.0, 1.0) * u_absorption_coefficient;
             //float localAbsorption = u_absorption_coefficient * noiseValue;
             tau += noiseValue * u_step_length;
             t += u_step_length;
         }
 
         float transmittance = exp(-tau);
-        FragColor = u_background_color * transmittance + u_color * (1.0 - transmittance);
+        FragColor = u_premultiplied ? vec4(u_color.rgb, 1.0) * (1.0 - transmittance) : u_background_color * transmittance + u_color * (1.0 - transmittance);
 
     }
 
 
 
-}
\ No newline at end of file
+}
+
+// the depth blends like the color, the temporal resolve divides by the opacity to reproject the volumes
+void main() {
+    rayMarch();
+    VolumeDepth = vec4(entry_depth, 0.0, 0.0, 1.0) * FragColor.a;
+}
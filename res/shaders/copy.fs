@@ -0,0 +1,15 @@
+#version 330 core
+
+in vec2 v_uv;
+
+uniform sampler2D u_texture;
+uniform sampler2D u_depth_texture;
+
+out vec4 FragColor;
+
+void main()
+{
+    // copies color and depth so the passes drawn after are still depth tested
+    FragColor = texture(u_texture, v_uv);
+    gl_FragDepth = texture(u_depth_texture, v_uv).r;
+}
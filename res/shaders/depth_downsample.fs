@@ -0,0 +1,17 @@
+#version 330 core
+
+uniform sampler2D u_depth_texture;  // full resolution scene depth
+uniform int u_ratio;                // full resolution pixels per low resolution pixel
+
+void main()
+{
+    // keep the farthest depth of the footprint so the volumes are not cut at the edges of the
+    // geometry, the upsample rejects the samples that leak using the full resolution depth
+    ivec2 size = textureSize(u_depth_texture, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * u_ratio;
+    float depth = 0.0;
+    for (int y = 0; y < u_ratio; y++)
+        for (int x = 0; x < u_ratio; x++)
+            depth = max(depth, texelFetch(u_depth_texture, min(base + ivec2(x, y), size - 1), 0).r);
+    gl_FragDepth = depth;
+}
@@ -4,6 +4,7 @@ in vec3 v_world_position;
 
 // Uniforms for transformations and volume parameters
 uniform mat4 u_model;
+uniform mat4 u_viewprojection;
 uniform vec3 u_camera_position;
 uniform vec4 u_color;
 uniform vec4 u_ambient_light;
@@ -21,6 +22,42 @@ uniform float u_scattering_coefficient;
 uniform int u_max_light_steps;
 uniform float u_isotropy_parameter;
 uniform bool u_jittering;
+uniform float u_jitter_seed;       // golden ratio sequence, changes every frame when the volumes are accumulated
+uniform sampler2D u_blue_noise;    // tileable, void and cluster
+uniform bool u_premultiplied;      // offscreen volume pass: radiance and opacity instead of over the background
+uniform bool u_depth_clamp;        // offscreen volume pass: the rays stop at the opaque geometry
+uniform sampler2D u_opaque_depth;  // full resolution depth of the opaque scene
+uniform int u_depth_ratio;         // full resolution pixels per volume pixel
+uniform mat4 u_inverse_viewprojection;
+uniform bool u_use_proxy;          // marching the occupancy hull instead of the box
+uniform sampler2D u_ray_bounds;    // of the hull: 1/depth of the entry in r, depth of the exit in a
+uniform bool u_adaptive_step;       // step length from the bricks of the volume and the distance to the camera
+uniform sampler3D u_brick_texture;  // max density and range of every brick
+uniform float u_brick_extent;       // side of a brick in texture space
+uniform float u_max_step_scale;
+uniform float u_step_distance_scale;
+uniform float u_step_tau;           // optical depth allowed in a step at the max density of the brick
+uniform bool u_use_transfer;       // density mapped by the transfer function instead of used as is
+uniform sampler2D u_transfer_texture;  // of the raw density: albedo and extinction in the first row, emission in the second
+uniform float u_transfer_size;     // entries of the function and of both axes of the tables
+uniform bool u_preintegrated;      // the segments between two samples come from the pre-integrated tables
+uniform sampler2D u_preintegration_table;     // of the densities at the front and back: scattering weight in rgb, opacity in a
+uniform sampler2D u_preintegration_emission;  // emitted radiance of the segment
+uniform float u_preintegration_step;          // length of the segments of the tables
+uniform bool u_isosurface;         // opaque surface where the raw density crosses u_isovalue, the volume in front is still marched
+uniform float u_isovalue;
+uniform vec4 u_surface_color;
+uniform bool u_gradient_normals;   // normals from the precomputed gradient volume, central differences otherwise
+uniform sampler3D u_gradient_texture;  // direction of the density gradient in texture space, RGB10A2
+uniform bool u_surface_only;       // only the surface: coarse steps until the isovalue is crossed, no volume in front
+uniform float u_iso_step_scale;    // of the step length in the surface only march
+uniform int u_refine_steps;        // bisections of the segment with the crossing before the linear interpolation
+uniform bool u_debug_steps;        // density samples of the view ray as a heat map instead of the color
+uniform int u_debug_max_steps;     // samples shown in red
+uniform bool u_sphere_tracing;     // surface only: steps of the distance field instead of fixed ones
+uniform sampler3D u_distance_texture;  // signed distance to the isosurface in voxels, negative inside
+uniform bool u_density_lod;        // the light march samples the coarser levels of the mip chain of the density
+uniform float u_light_lod;         // level of the light march, its steps grow with it
 
 
 //light uniforms
@@ -32,7 +69,11 @@ uniform vec3 u_light_position;
 uniform vec3 u_local_light_position;
 
 // Output color
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 VolumeDepth;  // offscreen pass: view depth of the entry point times the opacity
+
+float entry_depth = 0.0;
+int march_steps = 0;  // density samples along the view ray, for the debug view
 
 // Noise function utilities (for 3D noise-based density)
 float fractalPerlin(vec3 position, float scale, int detail) {
@@ -60,13 +101,206 @@ vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax) {
     return vec2(tNear, tFar);
 }
 
-float random (vec2 st) {
-    return fract(sin(dot(st.xy,
-                         vec2(12.9898,78.233)))*
-        43758.5453123);
+// blue noise offset of the ray start, rotated every frame by the golden ratio sequence
+float rayOffset() {
+    ivec2 coord = ivec2(gl_FragCoord.xy) % textureSize(u_blue_noise, 0);
+    return fract(texelFetch(u_blue_noise, coord, 0).r + u_jitter_seed);
 }
 
-void main() {
+// distance along the local ray to the opaque scene, with the farthest depth of the footprint like
+// the depth test of the proxy so the edges of the geometry are left to the upsample
+float opaqueDistance(vec3 origin, vec3 dir, mat4 inverseModel) {
+    ivec2 size = textureSize(u_opaque_depth, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * u_depth_ratio;
+    float depth = 0.0;
+    for (int y = 0; y < u_depth_ratio; y++)
+        for (int x = 0; x < u_depth_ratio; x++)
+            depth = max(depth, texelFetch(u_opaque_depth, min(base + ivec2(x, y), size - 1), 0).r);
+    if (depth >= 1.0)
+        return 1e30;  // background
+
+    vec2 uv = (vec2(base) + 0.5 * float(u_depth_ratio)) / vec2(size);
+    vec4 world = u_inverse_viewprojection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 local = (inverseModel * vec4(world.xyz / world.w, 1.0)).xyz;
+    return dot(local - origin, dir);
+}
+
+// entry and exit of the occupancy hull. Every front face of the hull runs the shader but only the
+// nearest one marches, it is found comparing with the depth of the entry
+vec2 proxyInterval(vec3 origin, vec3 dir, vec2 box) {
+    vec4 bounds = texelFetch(u_ray_bounds, ivec2(gl_FragCoord.xy), 0);
+    if (abs(gl_FragCoord.w - bounds.r) > 1e-4 * bounds.r)
+        discard;
+
+    // the view depth is linear along the ray
+    float w0 = (u_viewprojection * u_model * vec4(origin, 1.0)).w;
+    float dw = (u_viewprojection * u_model * vec4(dir, 0.0)).w;
+    return vec2(max(box.x, (1.0 / bounds.r - w0) / dw), min(box.y, (bounds.a - w0) / dw));
+}
+
+// longer steps where a fixed step would barely add opacity and far from the camera, but never past the
+// exit of the brick so a denser one is not skipped. Same as VolumeProxy::getStep
+float adaptiveStep(vec3 P, vec3 dir, float t, float sigma) {
+    vec3 size = u_boxMax - u_boxMin;
+    vec3 uvw = clamp((P - u_boxMin) / size, 0.0, 1.0);
+    vec2 brick = texture(u_brick_texture, uvw).rg;
+    float scale = brick.r > 0.0 ? u_step_tau / (brick.r * sigma * u_step_length) : u_max_step_scale;
+    scale = min(scale, mix(u_max_step_scale, 1.0, brick.g));
+    float dt = u_step_length * clamp(scale, 1.0, u_max_step_scale) * (1.0 + u_step_distance_scale * t);
+
+    vec3 lo = u_boxMin + min(floor(uvw / u_brick_extent), vec3(textureSize(u_brick_texture, 0) - 1)) * u_brick_extent * size;
+    vec3 exits = (lo + step(0.0, dir) * u_brick_extent * size - P) / dir;
+    float to_exit = min(min(exits.x, exits.y), exits.z);
+    return max(min(dt, to_exit + u_step_length * 0.01), u_step_length);
+}
+
+// texel centers of the tables, a density between two entries is interpolated linearly
+float transferCoord(float density) {
+    return (clamp(density, 0.0, 1.0) * (u_transfer_size - 1.0) + 0.5) / u_transfer_size;
+}
+
+// albedo in rgb and extinction in a of a raw density of the texture
+vec4 transferFunction(float density) {
+    if (!u_use_transfer)
+        return vec4(1.0, 1.0, 1.0, density);
+    return texture(u_transfer_texture, vec2(transferCoord(density), 0.25));
+}
+
+vec3 transferEmission(float density) {
+    if (!u_use_transfer)
+        return vec3(0.0);
+    return texture(u_transfer_texture, vec2(transferCoord(density), 0.75)).rgb;
+}
+
+// raw density of the texture at a local position, always of the full resolution: the surface is where it
+// crosses the isovalue and the filtered levels would move it
+float sampleDensity(vec3 P) {
+    return textureLod(u_density_texture, (P - u_boxMin) / (u_boxMax - u_boxMin), 0.0).r;
+}
+
+// of the light reaching P, marched through the density of the texture with the fixed step, or longer ones
+// through a coarser level of the mip chain
+float lightTransmittance(vec3 P, vec3 lightDir) {
+    float lod = u_density_lod ? u_light_lod : 0.0;
+    float lightStep = u_step_length * exp2(lod);
+    vec3 currentLightPos = P + lightDir * lightStep / 2.0;
+    float lightTau = 0.0;
+    for (int step = 0; step < u_max_light_steps; step++) {
+        vec3 lightTexCoords = (currentLightPos - u_boxMin) / (u_boxMax - u_boxMin);
+        if (any(lessThan(lightTexCoords, vec3(0.0))) || any(greaterThan(lightTexCoords, vec3(1.0))))
+            break;
+
+        // Sample density along the light ray
+        float lightDensity = transferFunction(textureLod(u_density_texture, lightTexCoords, lod).r).a * u_density_scale;
+        lightTau += lightDensity * u_scattering_coefficient * lightStep;
+
+        // Advance the light ray
+        currentLightPos += lightDir * lightStep;
+    }
+    return exp(-lightTau);
+}
+
+// outward normal in local space, the density grows inwards. The gradient is in texture space, dividing by the
+// size of the box keeps its direction in a box that is not a cube
+vec3 surfaceNormal(vec3 P, vec3 dir) {
+    vec3 size = u_boxMax - u_boxMin;
+    vec3 uvw = (P - u_boxMin) / size;
+    vec3 gradient;
+    if (u_gradient_normals) {
+        // the flat voxels have no direction, they are packed with alpha 0 and decode close to zero but not to it
+        vec4 texel = texture(u_gradient_texture, uvw);
+        if (texel.a < 0.5)
+            return -dir;
+        gradient = texel.rgb * 2.0 - 1.0;
+    } else {
+        vec3 h = 1.0 / vec3(textureSize(u_density_texture, 0));
+        gradient.x = textureLod(u_density_texture, uvw + vec3(h.x, 0.0, 0.0), 0.0).r - textureLod(u_density_texture, uvw - vec3(h.x, 0.0, 0.0), 0.0).r;
+        gradient.y = textureLod(u_density_texture, uvw + vec3(0.0, h.y, 0.0), 0.0).r - textureLod(u_density_texture, uvw - vec3(0.0, h.y, 0.0), 0.0).r;
+        gradient.z = textureLod(u_density_texture, uvw + vec3(0.0, 0.0, h.z), 0.0).r - textureLod(u_density_texture, uvw - vec3(0.0, 0.0, h.z), 0.0).r;
+    }
+    gradient /= size;
+    return dot(gradient, gradient) > 1e-12 ? -normalize(gradient) : -dir;
+}
+
+// surface only: the bisection finds the crossing inside a coarse step again. With the bricks, the ones with
+// a max density under the isovalue are skipped to their exit, the max is stored in 8 bits
+float isoStep(vec3 P, vec3 dir) {
+    float dt = u_step_length * u_iso_step_scale;
+    if (!u_adaptive_step)
+        return dt;
+    vec3 size = u_boxMax - u_boxMin;
+    vec3 uvw = clamp((P - u_boxMin) / size, 0.0, 1.0);
+    if (texture(u_brick_texture, uvw).r + 1.0 / 255.0 >= u_isovalue)
+        return dt;
+
+    vec3 lo = u_boxMin + min(floor(uvw / u_brick_extent), vec3(textureSize(u_brick_texture, 0) - 1)) * u_brick_extent * size;
+    vec3 exits = (lo + step(0.0, dir) * u_brick_extent * size - P) / dir;
+    return min(min(exits.x, exits.y), exits.z) + u_step_length * 0.01;
+}
+
+// the isovalue is crossed between t0, density d0 under it, and t1. The bisections keep the half with the
+// crossing and the last interval is interpolated linearly
+float refineHit(vec3 origin, vec3 dir, float t0, float t1, float d0, float d1) {
+    for (int i = 0; i < u_refine_steps; i++) {
+        float tm = 0.5 * (t0 + t1);
+        float dm = sampleDensity(origin + dir * tm);
+        march_steps++;
+        if (dm >= u_isovalue) {
+            t1 = tm;
+            d1 = dm;
+        } else {
+            t0 = tm;
+            d0 = dm;
+        }
+    }
+    return t0 + (t1 - t0) * clamp((u_isovalue - d0) / max(d1 - d0, 1e-6), 0.0, 1.0);
+}
+
+// surface only with the distance field: steps as long as the distance to the surface, never shorter than half
+// a voxel. The density is fetched only where the field is negative, and then the last step is bisected
+bool sphereTrace(vec3 origin, vec3 dir, float ta, float tb, out float t_hit) {
+    vec3 size = u_boxMax - u_boxMin;
+    float voxel = min(min(size.x, size.y), size.z) / float(textureSize(u_distance_texture, 0).x);
+    float t = ta;
+    float t_prev = ta;
+    while (t < tb) {
+        vec3 P = origin + dir * t;
+        float distance = texture(u_distance_texture, (P - u_boxMin) / size).r * voxel;
+        march_steps++;
+        if (distance <= 0.0) {
+            float back = sampleDensity(P);
+            march_steps++;
+            if (back >= u_isovalue) {
+                march_steps++;
+                t_hit = refineHit(origin, dir, t_prev, t, sampleDensity(origin + dir * t_prev), back);
+                return true;
+            }
+        }
+        t_prev = t;
+        t += max(distance, voxel * 0.5);
+    }
+    return false;
+}
+
+// blue for a few samples, green, red at u_debug_max_steps
+vec3 stepHeat(int steps) {
+    float x = clamp(float(steps) / float(max(u_debug_max_steps, 1)), 0.0, 1.0);
+    return clamp(vec3(2.0 * x - 0.5, 1.0 - abs(2.0 * x - 1.0), 1.5 - 2.0 * x), 0.0, 1.0);
+}
+
+// Blinn-Phong with the light of the march, shadowed by the same transmittance as the volume
+vec4 shadeSurface(vec3 P, vec3 dir) {
+    vec3 N = surfaceNormal(P, dir);
+    vec3 L = normalize(u_light_position - P);
+    vec3 H = normalize(L - dir);
+    float NdotL = max(dot(N, L), 0.0);
+    float specular = NdotL > 0.0 ? pow(max(dot(N, H), 0.0), max(u_light_shininess, 1.0)) : 0.0;
+    float shadow = lightTransmittance(P + N * u_step_length, L);
+    vec3 color = u_surface_color.rgb * (u_ambient_light.rgb + u_light_color.rgb * NdotL * shadow) + u_light_color.rgb * specular * shadow;
+    return vec4(color, 1.0);
+}
+
+void rayMarch() {
     // Transform camera position to local space
     mat4 inverseModel = inverse(u_model);
     vec3 local_camera_pos = (inverseModel * vec4(u_camera_position, 1.0)).xyz;
@@ -78,80 +312,130 @@ void main() {
 
     // Intersect ray with the bounding box
     vec2 intersection = intersectAABB(local_camera_pos, r, u_boxMin, u_boxMax);
+    if (u_use_proxy)
+        intersection = proxyInterval(local_camera_pos, r, intersection);
     float ta = intersection.x;
+    entry_depth = (u_viewprojection * u_model * vec4(local_camera_pos + r * max(ta, 0.0), 1.0)).w;
     float tb = intersection.y;
+    if (u_depth_clamp)
+        tb = min(tb, opaqueDistance(local_camera_pos, r, inverseModel));
 
     // If no intersection, return background color
     if (ta > tb || tb < 0.0) {
-        FragColor = u_background_color;
+        FragColor = u_premultiplied ? vec4(0.0) : u_background_color;
+        return;
+    }
+
+    // the distance field finds the surface without marching the volume
+    bool surface_only = u_isosurface && u_surface_only;
+    if (surface_only && u_sphere_tracing) {
+        float t_hit;
+        if (!sphereTrace(local_camera_pos, r, ta, tb, t_hit)) {
+            FragColor = u_premultiplied ? vec4(0.0) : u_background_color;
+            return;
+        }
+        vec3 hit = local_camera_pos + r * t_hit;
+        entry_depth = (u_viewprojection * u_model * vec4(hit, 1.0)).w;
+        FragColor = shadeSurface(hit, r);
         return;
     }
 
     // Initialize variables for ray marching
     float tau = 0.0;
-    float t = ta + u_step_length / 2.0;
+    float t = ta;  // start of the step, the sample goes inside it
+    float ray_offset = u_jittering ? rayOffset() : 0.0;
     vec4 accumulatedScattering = vec4(0.0);
     float g = u_isotropy_parameter;
+    float front = sampleDensity(local_camera_pos + r * t);  // raw density at the start of the segment
+    bool opaque = false;
+    march_steps = 1;
     while (t < tb) {
 
-        float jitter = u_jittering ? random(gl_FragCoord.xy + t) : 0.0;
-        //vec3 P = local_camera_pos + r * t; // Current sample position
-        vec3 P = local_camera_pos + r * (t + jitter * u_step_length);
-        //vec3 P = local_camera_pos + r * t;
-
-        vec3 viewDir = normalize(u_camera_position - P);
-
-        // Compute normalized texture coordinates
-        vec3 texCoords = (P - u_boxMin) / (u_boxMax - u_boxMin);
-
-        // Sample density from the 3D texture
-        float density = texture(u_density_texture, texCoords).r * u_density_scale;
-
-        float extinction = density * (u_absorption_coefficient + u_scattering_coefficient);
-
-        // Accumulate optical thickness
-        tau += extinction * u_absorption_coefficient * u_step_length;
+        // the integrals use the actual step, the opacity matches the fixed steps
+        float dt;
+        if (surface_only)
+            dt = isoStep(local_camera_pos + r * t, r);
+        else
+            dt = u_adaptive_step ? adaptiveStep(local_camera_pos + r * t, r, t, u_density_scale * (u_absorption_coefficient + u_scattering_coefficient) * u_absorption_coefficient) : u_step_length;
+        dt = min(dt, tb - t);
+
+        // the density at the end of the segment finds the surface and is the back of the pre-integrated segment
+        float back = u_isosurface || u_preintegrated ? sampleDensity(local_camera_pos + r * (t + dt)) : 0.0;
+        march_steps++;
+        if (u_isosurface && back >= u_isovalue) {
+            float t_hit = refineHit(local_camera_pos, r, t, t + dt, front, back);
+            vec3 hit = local_camera_pos + r * t_hit;
+            entry_depth = (u_viewprojection * u_model * vec4(hit, 1.0)).w;
+            accumulatedScattering += exp(-tau) * shadeSurface(hit, r);
+            opaque = true;
+            break;
+        }
+        if (surface_only) {
+            front = back;
+            t += dt;
+            continue;
+        }
 
-        float transmittance = exp(-tau);
+        float jitter = u_jittering ? ray_offset : 0.5;
+        vec3 P = local_camera_pos + r * (t + jitter * dt);
 
+        vec3 viewDir = normalize(u_camera_position - P);
         vec3 lightDir = normalize(u_light_position - P);
-        vec3 currentLightPos = P + lightDir * u_step_length / 2.0;
-
-        // Compute light contribution
-        float lightTau = 0.0;
-        vec3 lightAccumulation = vec3(0.0);
-        for (int step = 0; step < u_max_light_steps; step++) {
-            vec3 lightTexCoords = (currentLightPos - u_boxMin) / (u_boxMax - u_boxMin);
-            if (any(lessThan(lightTexCoords, vec3(0.0))) || any(greaterThan(lightTexCoords, vec3(1.0))))
-                break;
-
-            // Sample density along the light ray
-            float lightDensity = texture(u_density_texture, lightTexCoords).r * u_density_scale;
-            lightTau += lightDensity * u_scattering_coefficient * u_step_length;
-
-            // Advance the light ray
-            currentLightPos += lightDir * u_step_length;
-        }
-
         float cosTheta = dot(lightDir, viewDir);
         float phase = (1.0 - g * g) / pow(1.0 + g * g - 2.0 * g * cosTheta, 1.5);
         // Compute scattered light contribution
-        vec4 Ls = u_light_color * exp(-lightTau) * phase;
-
-        // Accumulate scattering
-        accumulatedScattering += u_scattering_coefficient * Ls * transmittance * density * u_step_length;
+        vec4 Ls = u_light_color * lightTransmittance(P, lightDir) * phase;
+
+        if (u_preintegrated) {
+            // the tables are for segments of u_preintegration_step: the opacity of this one is the one of
+            // the table to the power of the ratio and the radiance is weighted like the opacity
+            vec2 uv = vec2(transferCoord(front), transferCoord(back));
+            vec4 segment = texture(u_preintegration_table, uv);
+            vec3 emission = texture(u_preintegration_emission, uv).rgb;
+            float ratio = dt / u_preintegration_step;
+            float opacity = 1.0 - pow(1.0 - segment.a, ratio);
+            float weight = segment.a > 1e-5 ? opacity / segment.a : ratio;
+
+            // the tables integrate the transmittance inside the segment, so the one at its front is used
+            accumulatedScattering += exp(-tau) * (vec4(segment.rgb, 1.0) * Ls + vec4(emission, 0.0)) * weight;
+            tau -= log(max(1.0 - opacity, 1e-6));
+        } else {
+            float raw_density = sampleDensity(P);
+            vec4 transfer = transferFunction(raw_density);
+            float density = transfer.a * u_density_scale;
+
+            float extinction = density * (u_absorption_coefficient + u_scattering_coefficient);
+
+            // Accumulate optical thickness
+            tau += extinction * u_absorption_coefficient * dt;
+
+            float transmittance = exp(-tau);
+
+            // Accumulate scattering
+            accumulatedScattering += u_scattering_coefficient * Ls * vec4(transfer.rgb, 1.0) * transmittance * density * dt;
+            accumulatedScattering.rgb += transferEmission(raw_density) * transmittance * dt;
+        }
+        front = back;
 
         // Break early if transmittance becomes negligible
         if (exp(-tau) < 0.01) {
             break;
         }
 
-        t += u_step_length;
+        t += dt;
     }
 
     // Compute final transmittance
-    float transmittance = exp(-tau);
+    float transmittance = opaque ? 0.0 : exp(-tau);
 
     // Final color combining background and material color
-    FragColor = u_background_color * transmittance + accumulatedScattering;
+    FragColor = u_premultiplied ? vec4(accumulatedScattering.rgb, 1.0 - transmittance) : u_background_color * transmittance + accumulatedScattering;
+}
+
+// the depth blends like the color, the temporal resolve divides by the opacity to reproject the volumes
+void main() {
+    rayMarch();
+    if (u_debug_steps)
+        FragColor = vec4(stepHeat(march_steps), 1.0);
+    VolumeDepth = vec4(entry_depth, 0.0, 0.0, 1.0) * FragColor.a;
 }
@@ -0,0 +1,11 @@
+#version 330 core
+
+out vec4 FragColor;
+
+void main()
+{
+    // blended with max over all the faces of the hull: 1/depth of the nearest one in r, so the
+    // march pass can find it again in gl_FragCoord.w, and the depth of the farthest one in a
+    float depth = 1.0 / gl_FragCoord.w;
+    FragColor = vec4(gl_FragCoord.w, 0.0, 0.0, depth);
+}
@@ -1,9 +1,16 @@
 #version 330 core
 
+// channels of the VDB texture, defined by the material for the grids it packed: the density in r and the temperature
+// in VOLUME_TEMPERATURE_CHANNEL when there is one
+#ifndef VOLUME_CHANNELS
+#define VOLUME_CHANNELS 1
+#endif
+
 in vec3 v_world_position;
 
 // Uniforms for transformations and volume parameters
 uniform mat4 u_model;
+uniform mat4 u_viewprojection;
 uniform vec3 u_camera_position;
 uniform vec4 u_color;
 uniform vec4 u_ambient_light;
@@ -15,6 +22,9 @@ uniform int u_density_source;  // 0: constant, 1: noise
 uniform float u_constant_density;  // Density for constant mode
 uniform float u_noise_scale;       // Scale for procedural noise
 uniform int u_noise_detail;        // Detail level for procedural noise
+uniform bool u_baked_noise;        // noise fetched from the baked volume instead of evaluating the octaves
+uniform sampler3D u_noise_texture; // tileable fBm remapped to [0, 1], repeated
+uniform float u_noise_period;      // lattice cells of the first octave across the noise texture
 uniform float u_step_length;
 uniform sampler3D u_density_texture;  // 3D texture for VDB
 uniform float u_density_scale;        // Scale for density values
@@ -22,6 +32,40 @@ uniform float u_scattering_coefficient;
 uniform int u_max_light_steps;
 uniform float u_isotropy_parameter;
 uniform bool u_jittering;
+uniform float u_jitter_seed;       // golden ratio sequence, changes every frame when the volumes are accumulated
+uniform sampler2D u_blue_noise;    // tileable, void and cluster
+uniform bool u_premultiplied;      // offscreen volume pass: radiance and opacity instead of over the background
+uniform bool u_depth_clamp;        // offscreen volume pass: the rays stop at the opaque geometry
+uniform sampler2D u_opaque_depth;  // full resolution depth of the opaque scene
+uniform int u_depth_ratio;         // full resolution pixels per volume pixel
+uniform mat4 u_inverse_viewprojection;
+uniform bool u_use_proxy;          // marching the occupancy hull instead of the box
+uniform sampler2D u_ray_bounds;    // of the hull: 1/depth of the entry in r, depth of the exit in a
+uniform bool u_adaptive_step;       // step length from the bricks of the volume and the distance to the camera
+uniform sampler3D u_brick_texture;  // max density and range of every brick
+uniform float u_brick_extent;       // side of a brick in texture space
+uniform float u_max_step_scale;
+uniform float u_step_distance_scale;
+uniform float u_step_tau;           // optical depth allowed in a step at the max density of the brick
+uniform bool u_use_transfer;       // density mapped by the transfer function instead of used as is
+uniform sampler2D u_transfer_texture;  // of the raw density: albedo and extinction in the first row, emission in the second
+uniform float u_transfer_size;     // entries of the function and of both axes of the tables
+uniform bool u_preintegrated;      // the segments between two samples come from the pre-integrated tables
+uniform sampler2D u_preintegration_table;     // of the densities at the front and back: scattering weight in rgb, opacity in a
+uniform sampler2D u_preintegration_emission;  // emitted radiance of the segment
+uniform float u_preintegration_step;          // length of the segments of the tables
+uniform bool u_density_lod;        // density sampled from the level of its mip chain covered by a pixel
+uniform float u_pixel_footprint;   // local size of a pixel at distance 1 of the camera
+uniform float u_lod_bias;          // levels added to the one of the footprint
+uniform float u_light_lod;         // levels coarser than the view sample for the light march, its steps grow with them
+uniform vec4 u_channel_scale;      // the value of every channel of the VDB texture is texel * scale + offset
+uniform vec4 u_channel_offset;
+uniform vec2 u_temperature_range;  // cold and hot ends of the emission ramp
+uniform float u_temperature_emission;
+#ifdef VOLUME_BRICK_RANGES
+uniform sampler3D u_range_texture;  // offset and scale of the density at the brick centers, linear
+uniform float u_range_extent;       // texture space covered by the bricks
+#endif
 
 
 //light uniforms
@@ -33,7 +77,10 @@ uniform vec3 u_light_position;
 uniform vec3 u_local_light_position;
 
 // Output color
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 VolumeDepth;  // offscreen pass: view depth of the entry point times the opacity
+
+float entry_depth = 0.0;
 
 // Noise function utilities (for 3D noise-based density)
 float fractalPerlin(vec3 position, float scale, int detail) {
@@ -50,6 +97,11 @@ float fractalPerlin(vec3 position, float scale, int detail) {
     return noiseValue;
 }
 
+// tileable fBm of gradient noise baked with the octaves of u_noise_detail, one fetch instead of fractalPerlin
+float bakedNoise(vec3 position) {
+    return texture(u_noise_texture, position * u_noise_scale / u_noise_period).r;
+}
+
 // Function to compute ray-box intersection
 vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax) {
     vec3 tMin = (boxMin - rayOrigin) / rayDir;
@@ -61,13 +113,146 @@ vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax) {
     return vec2(tNear, tFar);
 }
 
-float random (vec2 st) {
-    return fract(sin(dot(st.xy,
-                         vec2(12.9898,78.233)))*
-        43758.5453123);
+// blue noise offset of the ray start, rotated every frame by the golden ratio sequence
+float rayOffset() {
+    ivec2 coord = ivec2(gl_FragCoord.xy) % textureSize(u_blue_noise, 0);
+    return fract(texelFetch(u_blue_noise, coord, 0).r + u_jitter_seed);
 }
 
-void main() {
+// distance along the local ray to the opaque scene, with the farthest depth of the footprint like
+// the depth test of the proxy so the edges of the geometry are left to the upsample
+float opaqueDistance(vec3 origin, vec3 dir, mat4 inverseModel) {
+    ivec2 size = textureSize(u_opaque_depth, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * u_depth_ratio;
+    float depth = 0.0;
+    for (int y = 0; y < u_depth_ratio; y++)
+        for (int x = 0; x < u_depth_ratio; x++)
+            depth = max(depth, texelFetch(u_opaque_depth, min(base + ivec2(x, y), size - 1), 0).r);
+    if (depth >= 1.0)
+        return 1e30;  // background
+
+    vec2 uv = (vec2(base) + 0.5 * float(u_depth_ratio)) / vec2(size);
+    vec4 world = u_inverse_viewprojection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 local = (inverseModel * vec4(world.xyz / world.w, 1.0)).xyz;
+    return dot(local - origin, dir);
+}
+
+// entry and exit of the occupancy hull. Every front face of the hull runs the shader but only the
+// nearest one marches, it is found comparing with the depth of the entry
+vec2 proxyInterval(vec3 origin, vec3 dir, vec2 box) {
+    vec4 bounds = texelFetch(u_ray_bounds, ivec2(gl_FragCoord.xy), 0);
+    if (abs(gl_FragCoord.w - bounds.r) > 1e-4 * bounds.r)
+        discard;
+
+    // the view depth is linear along the ray
+    float w0 = (u_viewprojection * u_model * vec4(origin, 1.0)).w;
+    float dw = (u_viewprojection * u_model * vec4(dir, 0.0)).w;
+    return vec2(max(box.x, (1.0 / bounds.r - w0) / dw), min(box.y, (bounds.a - w0) / dw));
+}
+
+// longer steps where a fixed step would barely add opacity and far from the camera, but never past the
+// exit of the brick so a denser one is not skipped. Same as VolumeProxy::getStep
+float adaptiveStep(vec3 P, vec3 dir, float t, float sigma) {
+    vec3 size = u_boxMax - u_boxMin;
+    vec3 uvw = clamp((P - u_boxMin) / size, 0.0, 1.0);
+    vec2 brick = texture(u_brick_texture, uvw).rg;
+    float scale = brick.r > 0.0 ? u_step_tau / (brick.r * sigma * u_step_length) : u_max_step_scale;
+    scale = min(scale, mix(u_max_step_scale, 1.0, brick.g));
+    float dt = u_step_length * clamp(scale, 1.0, u_max_step_scale) * (1.0 + u_step_distance_scale * t);
+
+    vec3 lo = u_boxMin + min(floor(uvw / u_brick_extent), vec3(textureSize(u_brick_texture, 0) - 1)) * u_brick_extent * size;
+    vec3 exits = (lo + step(0.0, dir) * u_brick_extent * size - P) / dir;
+    float to_exit = min(min(exits.x, exits.y), exits.z);
+    return max(min(dt, to_exit + u_step_length * 0.01), u_step_length);
+}
+
+// texel centers of the tables, a density between two entries is interpolated linearly
+float transferCoord(float density) {
+    return (clamp(density, 0.0, 1.0) * (u_transfer_size - 1.0) + 0.5) / u_transfer_size;
+}
+
+// albedo in rgb and extinction in a of a raw density of the texture
+vec4 transferFunction(float density) {
+    if (!u_use_transfer)
+        return vec4(1.0, 1.0, 1.0, density);
+    return texture(u_transfer_texture, vec2(transferCoord(density), 0.25));
+}
+
+vec3 transferEmission(float density) {
+    if (!u_use_transfer)
+        return vec3(0.0);
+    return texture(u_transfer_texture, vec2(transferCoord(density), 0.75)).rgb;
+}
+
+// level of the density at the current sample, set by the march
+float density_lod = 0.0;
+
+// local side of a voxel of the full resolution
+float voxelSize() {
+    vec3 size = u_boxMax - u_boxMin;
+    return min(min(size.x, size.y), size.z) / float(textureSize(u_density_texture, 0).x);
+}
+
+// level where a voxel covers the pixel at distance t of the camera
+float densityLod(float t) {
+    if (!u_density_lod)
+        return 0.0;
+    return max(log2(max(u_pixel_footprint * t / voxelSize(), 1e-6)) + u_lod_bias, 0.0);
+}
+
+// every grid packed in the texture at texture coordinates, one fetch. With brick ranges the filtered density is
+// dequantized with the range interpolated at the sample, the one the texels around it were quantized with
+vec4 textureChannels(vec3 uvw, float lod) {
+    vec4 channels = textureLod(u_density_texture, uvw, lod) * u_channel_scale + u_channel_offset;
+#ifdef VOLUME_BRICK_RANGES
+    vec2 range = textureLod(u_range_texture, uvw / u_range_extent, 0.0).rg;
+    channels.r = range.x + channels.r * range.y;
+#endif
+    return channels;
+}
+
+// every grid packed in the texture at a local position
+vec4 sampleChannels(vec3 P) {
+    return textureChannels((P - u_boxMin) / (u_boxMax - u_boxMin), density_lod);
+}
+
+// raw density of the texture at a local position
+float sampleDensity(vec3 P) {
+    return sampleChannels(P).r;
+}
+
+#ifdef VOLUME_TEMPERATURE_CHANNEL
+// radiance emitted per unit of length, black through red and yellow to white over the temperature range
+vec3 temperatureEmission(vec4 channels) {
+    float heat = clamp((channels[VOLUME_TEMPERATURE_CHANNEL] - u_temperature_range.x) / max(u_temperature_range.y - u_temperature_range.x, 1e-6), 0.0, 1.0);
+    return clamp(vec3(heat * 3.0, heat * 3.0 - 1.0, heat * 3.0 - 2.0), 0.0, 1.0) * u_temperature_emission;
+}
+#endif
+
+// of the light reaching P, marched through the density of the texture with the fixed step, or longer ones
+// through the coarser levels of the mip chain
+float lightTransmittance(vec3 P, vec3 lightDir) {
+    float coarser = u_density_lod ? u_light_lod : 0.0;
+    float lod = density_lod + coarser;
+    float lightStep = u_step_length * exp2(coarser);
+    vec3 currentLightPos = P + lightDir * lightStep / 2.0;
+    float lightTau = 0.0;
+    for (int step = 0; step < u_max_light_steps; step++) {
+        vec3 lightTexCoords = (currentLightPos - u_boxMin) / (u_boxMax - u_boxMin);
+        if (any(lessThan(lightTexCoords, vec3(0.0))) || any(greaterThan(lightTexCoords, vec3(1.0))))
+            break;
+
+        // Sample density along the light ray
+        float lightDensity = transferFunction(textureChannels(lightTexCoords, lod).r).a * u_density_scale;
+        lightTau += lightDensity * u_scattering_coefficient * lightStep;
+
+        // Advance the light ray
+        currentLightPos += lightDir * lightStep;
+    }
+    return exp(-lightTau);
+}
+
+void rayMarch() {
     // Transform camera position to local space
     mat4 inverseModel = inverse(u_model);
     vec3 local_camera_pos = (inverseModel * vec4(u_camera_position, 1.0)).xyz;
@@ -78,18 +263,24 @@ void main() {
 
     // Intersect ray with the bounding box
     vec2 intersection = intersectAABB(local_camera_pos, r, u_boxMin, u_boxMax);
+    if (u_use_proxy)
+        intersection = proxyInterval(local_camera_pos, r, intersection);
     float ta = intersection.x;
+    entry_depth = (u_viewprojection * u_model * vec4(local_camera_pos + r * max(ta, 0.0), 1.0)).w;
     float tb = intersection.y;
+    if (u_depth_clamp)
+        tb = min(tb, opaqueDistance(local_camera_pos, r, inverseModel));
 
     // If no intersection, return background color
     if (ta > tb || tb < 0.0) {
-        FragColor = u_background_color;
+        FragColor = u_premultiplied ? vec4(0.0) : u_background_color;
         return;
     }
 
     // Initialize variables for ray marching
     float tau = 0.0;
     float t = ta + u_step_length / 2.0;
+    float ray_offset = u_jittering ? rayOffset() : 0.0;
     vec4 accumulatedScattering = vec4(0.0);
     float g = u_isotropy_parameter;
 
@@ -98,7 +289,7 @@ void main() {
     if (u_density_source == 0) {
         // Ray marching loop
         while (t < tb) {
-            float jitter = u_jittering ? random(gl_FragCoord.xy + t) : 0.0;
+            float jitter = ray_offset;
             //vec3 P = local_camera_pos + r * t; // Current sample position
             vec3 P = local_camera_pos + r * (t + jitter * u_step_length); 
             vec3 viewDir = normalize(u_camera_position - P);
@@ -147,7 +338,7 @@ void main() {
         // Combine transmittance, scattering, and background color
         float finalTransmittance = exp(-tau);
 
-        FragColor = u_background_color * finalTransmittance + accumulatedScattering;
+        FragColor = u_premultiplied ? vec4(accumulatedScattering.rgb, 1.0 - finalTransmittance) : u_background_color * finalTransmittance + accumulatedScattering;
 
     } else if (u_density_source == 1) {
 
@@ -156,7 +347,7 @@ void main() {
 
             vec3 viewDir = normalize(u_camera_position - P);
 
-            float noiseValue = clamp(fractalPerlin(P, u_noise_scale, u_noise_detail), 0.0, 1.0) * u_absorption_coefficient;
+            float noiseValue = (u_baked_noise ? bakedNoise(P) : clamp(fractalPerlin(P, u_noise_scale, u_noise_detail), 0.0, 1.0)) * u_absorption_coefficient;
 
             float extinction = noiseValue * (u_absorption_coefficient + u_scattering_coefficient); //NOise is density 
             tau += extinction * u_step_length;
@@ -175,7 +366,7 @@ void main() {
                 vec3 lightTexCoords = currentLightPos;
 
                 // Sample density along the light ray
-                float lightDensity = clamp(fractalPerlin(currentLightPos, u_noise_scale, u_noise_detail), 0.0, 1.0);
+                float lightDensity = u_baked_noise ? bakedNoise(currentLightPos) : clamp(fractalPerlin(currentLightPos, u_noise_scale, u_noise_detail), 0.0, 1.0);
                 lightTau += lightDensity * u_scattering_coefficient * u_step_length;
 
                 // Stop marching if light ray exits the volume
@@ -200,69 +391,89 @@ void main() {
         }
 
         float transmittance = exp(-tau);
-        FragColor = u_background_color * transmittance + accumulatedScattering;
+        FragColor = u_premultiplied ? vec4(accumulatedScattering.rgb, 1.0 - transmittance) : u_background_color * transmittance + accumulatedScattering;
     } else if (u_density_source == 2) {
+        // t is the start of the step, the sample goes inside it
+        t = ta;
+        density_lod = densityLod(t);
+        float front = sampleDensity(local_camera_pos + r * t);  // raw density at the start of the segment
         while (t < tb) {
 
-            float jitter = u_jittering ? random(gl_FragCoord.xy + t) : 0.0;
-            //vec3 P = local_camera_pos + r * t; // Current sample position
-            vec3 P = local_camera_pos + r * (t + jitter * u_step_length);
-            //vec3 P = local_camera_pos + r * t;
+            // the integrals use the actual step, the opacity matches the fixed steps
+            float dt = u_adaptive_step ? adaptiveStep(local_camera_pos + r * t, r, t, u_density_scale * (u_absorption_coefficient + u_scattering_coefficient) * u_absorption_coefficient) : u_step_length;
+            // the voxels of a coarser level are larger, so are the steps
+            density_lod = densityLod(t);
+            if (u_density_lod)
+                dt = max(dt, voxelSize() * exp2(density_lod) * 0.5);
+            dt = min(dt, tb - t);
+            float jitter = u_jittering ? ray_offset : 0.5;
+            vec3 P = local_camera_pos + r * (t + jitter * dt);
 
             vec3 viewDir = normalize(u_camera_position - P);
-
-            // Compute normalized texture coordinates
-            vec3 texCoords = (P - u_boxMin) / (u_boxMax - u_boxMin);
-
-            // Sample density from the 3D texture
-            float density = texture(u_density_texture, texCoords).r * u_density_scale;
-
-            float extinction = density * (u_absorption_coefficient + u_scattering_coefficient);
-
-            // Accumulate optical thickness
-            tau += extinction * u_absorption_coefficient * u_step_length;
-
-            float transmittance = exp(-tau);
-
             vec3 lightDir = normalize(u_light_position - P);
-            vec3 currentLightPos = P + lightDir * u_step_length / 2.0;
-
-            // Compute light contribution
-            float lightTau = 0.0;
-            vec3 lightAccumulation = vec3(0.0);
-            for (int step = 0; step < u_max_light_steps; step++) {
-                vec3 lightTexCoords = (currentLightPos - u_boxMin) / (u_boxMax - u_boxMin);
-                if (any(lessThan(lightTexCoords, vec3(0.0))) || any(greaterThan(lightTexCoords, vec3(1.0))))
-                    break;
-
-                // Sample density along the light ray
-                float lightDensity = texture(u_density_texture, lightTexCoords).r * u_density_scale;
-                lightTau += lightDensity * u_scattering_coefficient * u_step_length;
-
-                // Advance the light ray
-                currentLightPos += lightDir * u_step_length;
-            }
-
             float cosTheta = dot(lightDir, viewDir);
             float phase = (1.0 - g * g) / pow(1.0 + g * g - 2.0 * g * cosTheta, 1.5);
             // Compute scattered light contribution
-            vec4 Ls = u_light_color * exp(-lightTau) * phase;
-
-            // Accumulate scattering
-            accumulatedScattering += u_scattering_coefficient * Ls * transmittance * density * u_step_length;
+            vec4 Ls = u_light_color * lightTransmittance(P, lightDir) * phase;
+
+            if (u_preintegrated) {
+                // the tables are for segments of u_preintegration_step: the opacity of this one is the one of
+                // the table to the power of the ratio and the radiance is weighted like the opacity
+                vec4 channels = sampleChannels(local_camera_pos + r * (t + dt));
+                float back = channels.r;
+                vec2 uv = vec2(transferCoord(front), transferCoord(back));
+                vec4 segment = texture(u_preintegration_table, uv);
+                vec3 emission = texture(u_preintegration_emission, uv).rgb;
+                float ratio = dt / u_preintegration_step;
+                float opacity = 1.0 - pow(1.0 - segment.a, ratio);
+                float weight = segment.a > 1e-5 ? opacity / segment.a : ratio;
+
+                // the tables integrate the transmittance inside the segment, so the one at its front is used
+                accumulatedScattering += exp(-tau) * (vec4(segment.rgb, 1.0) * Ls + vec4(emission, 0.0)) * weight;
+#ifdef VOLUME_TEMPERATURE_CHANNEL
+                accumulatedScattering.rgb += exp(-tau) * temperatureEmission(channels) * dt;
+#endif
+                tau -= log(max(1.0 - opacity, 1e-6));
+                front = back;
+            } else {
+                vec4 channels = sampleChannels(P);
+                float raw_density = channels.r;
+                vec4 transfer = transferFunction(raw_density);
+                float density = transfer.a * u_density_scale;
+
+                float extinction = density * (u_absorption_coefficient + u_scattering_coefficient);
+
+                // Accumulate optical thickness
+                tau += extinction * u_absorption_coefficient * dt;
+
+                float transmittance = exp(-tau);
+
+                // Accumulate scattering
+                accumulatedScattering += u_scattering_coefficient * Ls * vec4(transfer.rgb, 1.0) * transmittance * density * dt;
+                accumulatedScattering.rgb += transferEmission(raw_density) * transmittance * dt;
+#ifdef VOLUME_TEMPERATURE_CHANNEL
+                accumulatedScattering.rgb += temperatureEmission(channels) * transmittance * dt;
+#endif
+            }
 
             // Break early if transmittance becomes negligible
             if (exp(-tau) < 0.01) {
                 break;
             }
 
-            t += u_step_length;
+            t += dt;
         }
 
         // Compute final transmittance
         float transmittance = exp(-tau);
 
         // Final color combining background and material color
-        FragColor = u_background_color * transmittance + accumulatedScattering;
+        FragColor = u_premultiplied ? vec4(accumulatedScattering.rgb, 1.0 - transmittance) : u_background_color * transmittance + accumulatedScattering;
     }
 }
+
+// the depth blends like the color, the temporal resolve divides by the opacity to reproject the volumes
+void main() {
+    rayMarch();
+    VolumeDepth = vec4(entry_depth, 0.0, 0.0, 1.0) * FragColor.a;
+}
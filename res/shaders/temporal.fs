@@ -0,0 +1,62 @@
+#version 330 core
+
+in vec2 v_uv;
+
+uniform sampler2D u_texture;        // volumes of this frame, premultiplied alpha
+uniform sampler2D u_volume_depth;   // view depth times opacity
+uniform sampler2D u_history;        // accumulated volumes of the previous frames
+uniform mat4 u_inverse_viewprojection;
+uniform mat4 u_previous_viewprojection;
+uniform vec2 u_camera_nearfar;
+uniform float u_blend;              // weight of this frame
+uniform bool u_history_valid;
+uniform bool u_progressive;         // static view: running average of the same pixel, no reprojection
+
+out vec4 FragColor;
+
+void main()
+{
+    ivec2 size = textureSize(u_texture, 0);
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    vec4 current = texelFetch(u_texture, coord, 0);
+
+    if (!u_history_valid) {
+        FragColor = current;
+        return;
+    }
+
+    if (u_progressive) {
+        FragColor = mix(texelFetch(u_history, coord, 0), current, u_blend);
+        return;
+    }
+
+    // world position of the volume in this pixel, at the far plane when there is no volume
+    float n = u_camera_nearfar.x;
+    float f = u_camera_nearfar.y;
+    vec4 volume_depth = texelFetch(u_volume_depth, coord, 0);
+    float depth = volume_depth.a > 0.001 ? volume_depth.r / volume_depth.a : f;
+    float ndc_z = (f + n) / (f - n) - 2.0 * f * n / ((f - n) * depth);
+    vec4 world = u_inverse_viewprojection * vec4(v_uv * 2.0 - 1.0, ndc_z, 1.0);
+    world /= world.w;
+
+    // where it was in the previous frame
+    vec4 previous = u_previous_viewprojection * world;
+    vec2 previous_uv = previous.xy / previous.w * 0.5 + 0.5;
+    if (previous.w <= 0.0 || any(lessThan(previous_uv, vec2(0.0))) || any(greaterThan(previous_uv, vec2(1.0)))) {
+        FragColor = current;
+        return;
+    }
+
+    // history outside the colors of the neighbourhood is stale (disocclusion, the volume changed)
+    vec4 color_min = current;
+    vec4 color_max = current;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++) {
+            vec4 neighbour = texelFetch(u_texture, clamp(coord + ivec2(x, y), ivec2(0), size - 1), 0);
+            color_min = min(color_min, neighbour);
+            color_max = max(color_max, neighbour);
+        }
+    vec4 history = clamp(texture(u_history, previous_uv), color_min, color_max);
+
+    FragColor = mix(history, current, u_blend);
+}
@@ -0,0 +1,58 @@
+#version 330 core
+
+in vec2 v_uv;
+
+uniform sampler2D u_texture;        // low resolution volumes, premultiplied alpha
+uniform sampler2D u_low_depth;      // low resolution depth used by the volumes
+uniform sampler2D u_depth_texture;  // full resolution scene depth
+uniform vec2 u_camera_nearfar;
+uniform bool u_depth_aware;
+
+out vec4 FragColor;
+
+float linearDepth(float depth)
+{
+    float n = u_camera_nearfar.x;
+    float f = u_camera_nearfar.y;
+    return n * f / (f - depth * (f - n));
+}
+
+void main()
+{
+    if (!u_depth_aware) {
+        FragColor = texture(u_texture, v_uv);
+        return;
+    }
+
+    // bilateral upsample: bilinear weights of the 4 closest low resolution texels scaled by how
+    // similar their depth is to the depth of this pixel
+    ivec2 size = textureSize(u_texture, 0);
+    vec2 p = v_uv * vec2(size) - 0.5;
+    ivec2 base = ivec2(floor(p));
+    vec2 f = p - vec2(base);
+    float depth = linearDepth(texture(u_depth_texture, v_uv).r);
+
+    vec4 color = vec4(0.0);
+    float weight = 0.0;
+    vec4 nearest_color = vec4(0.0);
+    float nearest_distance = 1e20;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 coord = clamp(base + offset, ivec2(0), size - 1);
+        vec4 sample_color = texelFetch(u_texture, coord, 0);
+        float distance = abs(linearDepth(texelFetch(u_low_depth, coord, 0).r) - depth);
+
+        float bilinear = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+        float w = bilinear / (distance / depth + 0.001);
+        color += sample_color * w;
+        weight += w;
+
+        if (distance < nearest_distance) {
+            nearest_distance = distance;
+            nearest_color = sample_color;
+        }
+    }
+
+    // no similar sample, use the closest in depth instead of blurring across the edge
+    FragColor = nearest_distance > 0.1 * depth ? nearest_color : color / weight;
+}
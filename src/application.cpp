@@ -1,4 +1,8 @@
 #include "application.h"
+#include "graphics/fbo.h"
+
+#include <algorithm>
+#include <chrono>
 
 bool render_wireframe = false;
 Camera* Application::camera = nullptr;
@@ -19,20 +23,33 @@ void Application::init(GLFWwindow* window)
 
     this->flag_grid = true;
     this->flag_wireframe = false;
+    this->flag_occlusion = true;
+    this->volume_downsample = 2;
+    this->flag_volume_upsample = true;
+    this->flag_volume_depth_clamp = true;
+    this->flag_volume_proxy = true;
+    this->flag_baked_noise = true;
+    this->volume_upload_budget = 256;
+    this->flag_volume_temporal = true;
+    this->temporal_blend = 0.1f;
+    this->flag_progressive = true;
+    this->flag_progressive_fine_steps = false;
+    this->progressive_delay = 8;
+    this->progressive_budget = 256;
 
     this->ambient_light = glm::vec4(0.75f, 0.75f, 0.75f, 1.f);
     this->background_color = glm::vec4(0.75f, 0.75f, 0.75f, 1.f);
 
     /* ADD NODES TO THE SCENE 
     SceneNode* example = new SceneNode("Example Node");
-    example->mesh = Mesh::Get("res/meshes/sphere.obj");
-    example->material = new StandardMaterial();
+    example->setMesh(Mesh::Get("res/meshes/sphere.obj"));
+    example->setMaterial(new StandardMaterial());
     this->node_list.push_back(example);*/
 
     VolumeNode* volumeNode = new VolumeNode("Scattering");
-    volumeNode->mesh = Mesh::Get("res/meshes/cube.obj");
+    volumeNode->setMesh(Mesh::Get("res/meshes/cube.obj"));
     VolumeMaterial* volumeMaterial = new VolumeMaterial();
-    volumeNode->material = volumeMaterial;
+    volumeNode->setMaterial(volumeMaterial);
     volumeMaterial->loadVDB("res/meshes/bunny_cloud.vdb");
     this->node_list.push_back(volumeNode);
 
@@ -44,9 +61,9 @@ void Application::init(GLFWwindow* window)
 
     //isosurface material
     VolumeNode* volumeNode2 = new VolumeNode("IsoSurface");
-    volumeNode2->mesh = Mesh::Get("res/meshes/cube.obj");
+    volumeNode2->setMesh(Mesh::Get("res/meshes/cube.obj"));
     IsoMaterial* isoMaterial = new IsoMaterial();
-    volumeNode2->material = isoMaterial;
+    volumeNode2->setMaterial(isoMaterial);
     isoMaterial->loadVDB("res/meshes/bunny_cloud.vdb");
     this->node_list.push_back(volumeNode2);
 }
@@ -59,6 +76,98 @@ void Application::update(float dt)
         this->camera->orbit(-delta.x * dt, delta.y * dt);
     }
     this->lastMousePosition = this->mousePosition;
+
+    // animated materials, every material once even if it is shared
+    for (Material* material : SceneStore::Get()->materials)
+        if (material)
+            material->update(dt);
+
+    updateSceneBVH();
+
+    // the occluders are rasterized in a worker while the main thread gets to the render
+    if (this->flag_occlusion)
+    {
+        SceneStore* store = SceneStore::Get();
+        std::vector<SoftwareOcclusion::sOccluder> occluders;
+        for (size_t i = 0; i < store->size(); ++i)
+            if ((store->flags[i] & (SCENE_OCCLUDER | SCENE_VISIBLE)) == (SCENE_OCCLUDER | SCENE_VISIBLE) && store->mesh_ids[i] != SCENE_INVALID_ID)
+                occluders.push_back({ store->meshes[store->mesh_ids[i]], store->models[i] });
+        if (occluders.size())
+            this->occlusion.beginFrame(this->camera->viewprojection_matrix, occluders);
+        else
+        {
+            // the raster of the previous frame may still be running when occlusion was turned off and on
+            this->occlusion.wait();
+            this->occlusion.num_triangles = 0;
+        }
+    }
+}
+
+void Application::updateSceneBVH()
+{
+    // only nodes whose model changed get new bounds, most of the time the fat box still contains the node
+    SceneStore::Get()->update();
+
+    for (Light* light : this->light_list)
+    {
+        if (light->light_type == LIGHT_DIRECTIONAL)
+        {
+            if (light->light_bvh_proxy != -1)
+                this->light_bvh.destroyProxy(light->light_bvh_proxy);
+            light->light_bvh_proxy = -1;
+            continue;
+        }
+
+        glm::vec3 range = glm::vec3(light->max_distance);
+        glm::vec3 position = light->getPosition();
+        if (light->light_bvh_proxy == -1)
+            light->light_bvh_proxy = this->light_bvh.createProxy(position - range, position + range, light);
+        else
+            this->light_bvh.moveProxy(light->light_bvh_proxy, position - range, position + range);
+    }
+}
+
+void Application::gatherLights(const glm::vec3& box_min, const glm::vec3& box_max)
+{
+    this->node_lights.clear();
+
+    for (Light* light : this->light_list)
+        if (light->light_type == LIGHT_DIRECTIONAL)
+            this->node_lights.push_back(light);
+
+    static std::vector<void*> result;
+    result.clear();
+    BoundingBox box = BoundingBox((box_min + box_max) * 0.5f, (box_max - box_min) * 0.5f);
+    this->light_bvh.queryAABB(box_min, box_max, result);
+    for (void* data : result)
+    {
+        Light* light = (Light*)data;
+        if (light->affects(box))
+            this->node_lights.push_back(light);
+    }
+}
+
+SceneNode* Application::pickNode(glm::vec2 mouse_position)
+{
+    ImGuiIO& io = ImGui::GetIO();
+    glm::vec3 origin = this->camera->eye;
+    glm::vec3 direction = this->camera->getRayDirection(mouse_position.x, mouse_position.y, io.DisplaySize.x, io.DisplaySize.y);
+
+    // nodes are visited from near to far, the precise test against the mesh BVH clips the ray
+    SceneStore* store = SceneStore::Get();
+    SceneNode* picked = nullptr;
+    store->bvh.raycast(origin, direction, this->camera->far_plane, [&](void* data, float max_dist) {
+        uint32_t index = store->getIndex((SceneHandle)(uintptr_t)data);
+        glm::vec3 collision, normal;
+        if (!(store->flags[index] & SCENE_VISIBLE) || !store->owners[index])
+            return max_dist;
+        if (!store->meshes[store->mesh_ids[index]]->testRayCollision(store->models[index], origin, direction, collision, normal, max_dist))
+            return max_dist;
+        picked = store->owners[index];
+        return glm::length(collision - origin);
+    });
+
+    return picked;
 }
 
 void Application::render()
@@ -74,15 +183,236 @@ void Application::render()
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
 
-    for (unsigned int i = 0; i < this->node_list.size(); i++)
+    // frustum culling as a linear scan over the bounds in the store
+    SceneStore* store = SceneStore::Get();
+    store->cull(this->camera->viewprojection_matrix, this->visible_nodes);
+
+    // occlusion culling against the software depth buffer. The worker writes the triangles it rasterized, they are read after the wait
+    if (this->flag_occlusion)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        this->occlusion.wait();
+        this->occlusion.num_tested = this->occlusion.num_occluded = 0;
+        if (this->occlusion.num_triangles)
+            this->visible_nodes.erase(std::remove_if(this->visible_nodes.begin(), this->visible_nodes.end(), [&](uint32_t index) {
+                glm::vec3 box_min, box_max;
+                store->getWorldBounds(index, box_min, box_max);
+                return !(store->flags[index] & SCENE_OCCLUDER) && this->occlusion.isOccluded(box_min, box_max);
+            }), this->visible_nodes.end());
+        this->occlusion.test_time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+        this->occlusion_stats = this->occlusion.getStats();
+    }
+
+    // sorted back to front so the volumes blend in order
+    store->buildPackets(this->visible_nodes, this->camera->eye, this->render_packets);
+
+    // refine once nothing changed for a few frames, any change restarts the accumulation
+    bool changed = this->camera->viewprojection_matrix != this->last_viewprojection || store->version != this->last_scene_version || ImGui::IsAnyItemActive();
+    this->last_viewprojection = this->camera->viewprojection_matrix;
+    this->last_scene_version = store->version;
+    if (changed || !this->flag_progressive)
+        this->static_frames = this->progressive_samples = 0;
+    else
+        this->static_frames++;
+    this->refining = this->flag_progressive && this->static_frames >= this->progressive_delay;
+    this->volume_step_scale = this->refining && this->flag_progressive_fine_steps ? 0.5f : 1.f;
+
+    // new jitter every frame (golden ratio sequence over the blue noise), the accumulation averages it out
+    this->frame++;
+    this->jitter_seed = this->flag_volume_temporal || this->refining ? (float)fmod(this->frame * 0.6180339887, 1.0) : 0.f;
+
+    // the rest of the scene goes to a texture so the volume upsample can read its depth, the opaque
+    // packets are always rendered before the volumes so their depth is complete when the rays are clamped
+    bool offscreen_volumes = this->volume_downsample > 1 || this->flag_volume_temporal || this->flag_progressive || this->flag_volume_depth_clamp;
+    if (!this->flag_volume_temporal && !this->refining)
+        this->history_valid = false;
+    if (offscreen_volumes)
     {
-        this->node_list[i]->render(this->camera);
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        resizeRenderTargets(viewport[2], viewport[3]);
+        this->scene_fbo->bind();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
 
-        if (this->flag_wireframe) this->node_list[i]->renderWireframe(this->camera);
+    for (const sRenderPacket& packet : this->render_packets)
+        if (!offscreen_volumes || !store->materials[packet.material_id]->is_volume)
+            renderPacket(packet);
+
+    if (offscreen_volumes)
+    {
+        if (this->flag_grid) drawGrid();
+        this->scene_fbo->unbind();
+        renderVolumes();
     }
 
+    if (this->selected_node && this->selected_node->getMesh())
+        this->selected_node->getMesh()->renderBounding(this->selected_node->getModel());
+
     // Draw the floor grid
-    if (this->flag_grid) drawGrid();
+    if (this->flag_grid && !offscreen_volumes) drawGrid();
+}
+
+void Application::renderPacket(const sRenderPacket& packet)
+{
+    static WireframeMaterial wireframe;
+    SceneStore* store = SceneStore::Get();
+
+    glm::vec3 box_min, box_max;
+    store->getWorldBounds(packet.node, box_min, box_max);
+    gatherLights(box_min, box_max);
+
+    Mesh* mesh = store->meshes[packet.mesh_id];
+    const glm::mat4& model = store->models[packet.node];
+    store->materials[packet.material_id]->render(mesh, model, this->camera);
+
+    if (this->flag_wireframe) wireframe.render(mesh, model, this->camera);
+}
+
+void Application::renderVolumes()
+{
+    Mesh* quad = Mesh::getQuad();
+    glDisable(GL_CULL_FACE);
+
+    // the accumulation reached its budget, keep showing it without marching again
+    Texture* volumes;
+    if (this->refining && this->progressive_samples >= this->progressive_budget)
+        volumes = this->history_fbo[this->history_index]->color_textures[0];
+    else
+    {
+        marchVolumes();
+        volumes = this->volume_fbo->color_textures[0];
+        if (this->flag_volume_temporal || this->refining)
+            volumes = resolveTemporal();
+    }
+
+    // scene color and depth to the framebuffer, the wireframes and bounding boxes are still depth tested
+    Shader* shader = Shader::Get("res/shaders/quad.vs", "res/shaders/copy.fs");
+    glDepthFunc(GL_ALWAYS);
+    shader->enable();
+    shader->setUniform("u_texture", this->scene_fbo->color_textures[0], 0);
+    shader->setUniform("u_depth_texture", this->scene_fbo->depth_texture, 1);
+    quad->render(GL_TRIANGLES);
+    shader->disable();
+    glDepthFunc(GL_LESS);
+
+    // volumes over the scene
+    shader = Shader::Get("res/shaders/quad.vs", "res/shaders/upsample.fs");
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    shader->enable();
+    shader->setUniform("u_texture", volumes, 0);
+    shader->setUniform("u_low_depth", this->volume_fbo->depth_texture, 1);
+    shader->setUniform("u_depth_texture", this->scene_fbo->depth_texture, 2);
+    shader->setUniform("u_camera_nearfar", glm::vec2(this->camera->near_plane, this->camera->far_plane));
+    shader->setUniform("u_depth_aware", this->flag_volume_upsample);
+    quad->render(GL_TRIANGLES);
+    shader->disable();
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+}
+
+void Application::marchVolumes()
+{
+    SceneStore* store = SceneStore::Get();
+    Mesh* quad = Mesh::getQuad();
+
+    this->volume_fbo->bind();
+
+    // farthest scene depth of every low resolution pixel, the volume proxies are depth tested against it
+    Shader* shader = Shader::Get("res/shaders/quad.vs", "res/shaders/depth_downsample.fs");
+    glColorMask(false, false, false, false);
+    glDepthFunc(GL_ALWAYS);
+    shader->enable();
+    shader->setUniform("u_depth_texture", this->scene_fbo->depth_texture, 0);
+    shader->setUniform("u_ratio", this->volume_downsample);
+    quad->render(GL_TRIANGLES);
+    shader->disable();
+    glColorMask(true, true, true, true);
+    glDepthFunc(GL_LESS);
+
+    // volumes back to front, premultiplied so they can be blended over the scene later
+    glEnable(GL_CULL_FACE);
+    glClearColor(0.f, 0.f, 0.f, 0.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(false);
+    this->volume_pass = true;
+    for (const sRenderPacket& packet : this->render_packets)
+        if (store->materials[packet.material_id]->is_volume)
+            renderPacket(packet);
+    this->volume_pass = false;
+    glDepthMask(true);
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+
+    this->volume_fbo->unbind();
+    glClearColor(background_color.r, background_color.g, background_color.b, background_color.a);
+}
+
+Texture* Application::resolveTemporal()
+{
+    FBO* history = this->history_fbo[this->history_index];
+    FBO* target = this->history_fbo[1 - this->history_index];
+
+    // called from renderVolumes, face culling is already disabled
+    target->bind();
+    glDisable(GL_DEPTH_TEST);
+    Shader* shader = Shader::Get("res/shaders/quad.vs", "res/shaders/temporal.fs");
+    shader->enable();
+    shader->setUniform("u_texture", this->volume_fbo->color_textures[0], 0);
+    shader->setUniform("u_volume_depth", this->volume_fbo->color_textures[1], 1);
+    shader->setUniform("u_history", history->color_textures[0], 2);
+    shader->setUniform("u_inverse_viewprojection", glm::inverse(this->camera->viewprojection_matrix));
+    shader->setUniform("u_previous_viewprojection", this->previous_viewprojection);
+    shader->setUniform("u_camera_nearfar", glm::vec2(this->camera->near_plane, this->camera->far_plane));
+    shader->setUniform("u_blend", this->refining ? 1.f / (this->progressive_samples + 1) : this->temporal_blend);
+    shader->setUniform("u_history_valid", this->history_valid);
+    shader->setUniform("u_progressive", this->refining);
+    Mesh::getQuad()->render(GL_TRIANGLES);
+    shader->disable();
+    glEnable(GL_DEPTH_TEST);
+    target->unbind();
+
+    this->history_index = 1 - this->history_index;
+    this->previous_viewprojection = this->camera->viewprojection_matrix;
+    this->history_valid = true;
+    if (this->refining)
+        this->progressive_samples++;
+    return target->color_textures[0];
+}
+
+void Application::resizeRenderTargets(int width, int height)
+{
+    if (!this->scene_fbo)
+        this->scene_fbo = new FBO();
+    if (this->scene_fbo->width != width || this->scene_fbo->height != height)
+        this->scene_fbo->create(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, true);
+
+    // rounded up so the low resolution pixels cover the whole framebuffer
+    int volume_width = (width + this->volume_downsample - 1) / this->volume_downsample;
+    int volume_height = (height + this->volume_downsample - 1) / this->volume_downsample;
+    if (!this->volume_fbo)
+        this->volume_fbo = new FBO();
+    if (this->volume_fbo->width == volume_width && this->volume_fbo->height == volume_height)
+        return;
+
+    // second target with the depth of the volumes for the reprojection
+    this->volume_fbo->create(volume_width, volume_height, 2, GL_RGBA, GL_HALF_FLOAT, true, GL_RGBA16F);
+    if (!this->ray_bounds_fbo)
+        this->ray_bounds_fbo = new FBO();
+    this->ray_bounds_fbo->create(volume_width, volume_height, 1, GL_RGBA, GL_FLOAT, false, GL_RGBA32F);
+    for (int i = 0; i < 2; ++i)
+    {
+        if (!this->history_fbo[i])
+            this->history_fbo[i] = new FBO();
+        this->history_fbo[i]->create(volume_width, volume_height, 1, GL_RGBA, GL_FLOAT, false, GL_RGBA32F); // many samples are averaged
+    }
+    this->history_valid = false;
+    this->progressive_samples = 0;
 }
 
 void Application::renderGUI()
@@ -97,11 +427,37 @@ void Application::renderGUI()
             ImGui::TreePop();
         }
 
+        SceneStore* store = SceneStore::Get();
+        ImGui::Text("Scene: %d nodes, BVH height %d, %d visible", (int)store->size(), store->bvh.getHeight(), (int)this->visible_nodes.size());
+        ImGui::Checkbox("Occlusion culling", &this->flag_occlusion);
+        if (this->flag_occlusion)
+            ImGui::Text("Occluded %d / %d, raster %.2f ms (%d tris), test %.2f ms", this->occlusion_stats.num_occluded, this->occlusion_stats.num_tested, this->occlusion_stats.raster_time, this->occlusion_stats.num_triangles, this->occlusion_stats.test_time);
+
+        int volume_resolution = this->volume_downsample == 4 ? 2 : this->volume_downsample - 1;
+        if (ImGui::Combo("Volume resolution", &volume_resolution, "Full\0Half\0Quarter\0"))
+            this->volume_downsample = 1 << volume_resolution;
+        if (this->volume_downsample > 1)
+            ImGui::Checkbox("Depth aware upsample", &this->flag_volume_upsample);
+        ImGui::Checkbox("Clamp rays to opaque depth", &this->flag_volume_depth_clamp);
+        ImGui::Checkbox("Occupancy proxies", &this->flag_volume_proxy);
+        ImGui::Checkbox("Baked noise", &this->flag_baked_noise);
+        ImGui::SliderInt("Volume upload KB/frame", &this->volume_upload_budget, 16, 4096);
+        ImGui::Checkbox("Temporal accumulation", &this->flag_volume_temporal);
+        if (this->flag_volume_temporal)
+            ImGui::SliderFloat("Temporal blend", &this->temporal_blend, 0.02f, 1.f);
+        ImGui::Checkbox("Progressive refinement", &this->flag_progressive);
+        if (this->flag_progressive)
+        {
+            ImGui::Checkbox("Finer steps when refining", &this->flag_progressive_fine_steps);
+            ImGui::SliderInt("Sample budget", &this->progressive_budget, 1, 1024);
+            ImGui::Text("Samples %d / %d", this->progressive_samples, this->progressive_budget);
+        }
+
         unsigned int count = 0;
         std::stringstream ss;
         for (auto& node : this->node_list) {
             ss << count;
-            if (ImGui::TreeNode(node->name.c_str())) {
+            if (ImGui::TreeNodeEx(node->name.c_str(), node == this->selected_node ? ImGuiTreeNodeFlags_Selected : 0)) {
                 node->renderInMenu();
                 ImGui::TreePop();
             }
@@ -121,6 +477,7 @@ void Application::onKeyDown(int key, int scancode)
         break;
     case GLFW_KEY_R:
         Shader::ReloadAll();
+        this->static_frames = this->progressive_samples = 0;
         break;
     }
 }
@@ -149,6 +506,7 @@ void Application::onRightMouseUp()
 
 void Application::onLeftMouseDown()
 {
+    this->selected_node = pickNode(this->mousePosition);
     this->dragging = true;
     this->lastMousePosition = this->mousePosition;
 }
@@ -4,9 +4,14 @@
 #include "framework/camera.h"
 #include "framework/scenenode.h"
 #include "framework/light.h"
+#include "framework/scenebvh.h"
+#include "framework/scenestore.h"
+#include "framework/occlusion.h"
 
 #include <glm/vec2.hpp>
 
+class FBO;
+
 class Application
 {
 public:
@@ -18,6 +23,50 @@ public:
 	glm::vec4 background_color;
 	std::vector<Light*> light_list;
 
+	SceneBVH light_bvh; // influence bounds of the point and spot lights
+	std::vector<uint32_t> visible_nodes; // dense indices in the SceneStore
+	std::vector<sRenderPacket> render_packets;
+	std::vector<Light*> node_lights; // lights that affect the node being rendered
+	SceneNode* selected_node = nullptr;
+
+	SoftwareOcclusion occlusion;
+	sOcclusionStats occlusion_stats; // copied after the raster finished, for the GUI
+	bool flag_occlusion;
+
+	// volumes are ray marched offscreen at a fraction of the resolution and upsampled over the scene
+	FBO* scene_fbo = nullptr; // color and depth of the rest of the scene
+	FBO* volume_fbo = nullptr;
+	int volume_downsample; // 1 full resolution, 2 half, 4 quarter
+	bool flag_volume_upsample; // depth-aware upsample, bilinear when disabled
+	bool volume_pass = false; // the volume materials output premultiplied alpha
+	bool flag_volume_depth_clamp; // the rays stop at the opaque geometry, read from the depth of scene_fbo
+	FBO* ray_bounds_fbo = nullptr; // entry and exit of the occupancy hull of the volume being marched
+	bool flag_volume_proxy; // march the occupancy hull of the volumes instead of their box
+	bool flag_baked_noise; // the noise densities come from a baked 3D texture instead of the octaves in the shader
+	int volume_upload_budget; // KB of the VDB textures uploaded per frame while they load
+
+	// temporal accumulation of the jittered volumes, reprojected with the previous viewprojection
+	FBO* history_fbo[2] = { nullptr, nullptr };
+	int history_index = 0;
+	bool history_valid = false;
+	glm::mat4 previous_viewprojection;
+	bool flag_volume_temporal;
+	float temporal_blend; // weight of the new frame
+	float jitter_seed = 0.f;
+	unsigned int frame = 0;
+
+	// progressive refinement: while nothing changes the volumes keep averaging new jitter up to a budget
+	bool flag_progressive;
+	bool flag_progressive_fine_steps; // half the step length while refining
+	int progressive_delay; // static frames before refining
+	int progressive_budget; // samples
+	int progressive_samples = 0;
+	int static_frames = 0;
+	bool refining = false;
+	float volume_step_scale = 1.f;
+	glm::mat4 last_viewprojection;
+	unsigned int last_scene_version = 0;
+
 	int window_width;
 	int window_height;
 
@@ -35,6 +84,15 @@ public:
 	void renderGUI();
 	void shutdown();
 
+	void updateSceneBVH();
+	void gatherLights(const glm::vec3& box_min, const glm::vec3& box_max);
+	void renderPacket(const sRenderPacket& packet);
+	void renderVolumes();
+	void marchVolumes();
+	Texture* resolveTemporal();
+	void resizeRenderTargets(int width, int height);
+	SceneNode* pickNode(glm::vec2 mouse_position);
+
 	void onKeyDown(int key, int scancode);
 	void onKeyUp(int key, int scancode);
 	void onRightMouseDown();
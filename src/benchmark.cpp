@@ -0,0 +1,168 @@
+#include "benchmark.h"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+
+#include "graphics/mesh.h"
+#include "graphics/bvh.h"
+#include "framework/scenebvh.h"
+#include "framework/occlusion.h"
+#include "framework/scenestore.h"
+#include "graphics/volumegrid.h"
+#include "graphics/transferfunction.h"
+#include "graphics/noisevolume.h"
+#include "graphics/marchingcubes.h"
+#include "graphics/volumesequence.h"
+#include "graphics/volumeloader.h"
+#include "graphics/volumefile.h"
+#include "graphics/volumemarcher.h"
+
+static void benchmarkBVH()
+{
+	Mesh* sphere = Mesh::Get("res/meshes/sphere.obj");
+	if (sphere)
+		MeshBVH::benchmark(sphere);
+
+	//big procedural terrain, half a million triangles
+	Mesh* terrain = new Mesh();
+	terrain->name = "terrain";
+	terrain->createSubdividedPlane(10.f, 512, true);
+	for (glm::vec3& v : terrain->vertices)
+		v.y = sin(v.x * 3.f) * cos(v.z * 2.f) * 0.5f + sin(v.x * 17.f + v.z * 13.f) * 0.05f;
+	MeshBVH::benchmark(terrain);
+	delete terrain;
+}
+
+static void benchmarkSceneBVH()
+{
+	SceneBVH::benchmark(100000);
+}
+
+static void benchmarkOcclusion()
+{
+	SoftwareOcclusion::benchmark(10000);
+}
+
+static void benchmarkSceneStore()
+{
+	SceneStore::benchmark(100000);
+}
+
+static void benchmarkAdaptiveStep()
+{
+	VolumeGrid::benchmark("res/meshes/bunny_cloud.vdb");
+}
+
+static void benchmarkTransferFunction()
+{
+	TransferFunction::benchmark();
+}
+
+static void benchmarkNoiseVolume()
+{
+	NoiseVolume::benchmark();
+}
+
+static void benchmarkGradients()
+{
+	VolumeGrid::benchmarkGradients("res/meshes/bunny_cloud.vdb");
+}
+
+static void benchmarkIsosurface()
+{
+	VolumeGrid::benchmarkIsosurface("res/meshes/bunny_cloud.vdb");
+}
+
+static void benchmarkMarchingCubes()
+{
+	MarchingCubes::benchmark("res/meshes/bunny_cloud.vdb");
+}
+
+static void benchmarkMips()
+{
+	VolumeGrid::benchmarkMips("res/meshes/bunny_cloud.vdb");
+}
+
+static void benchmarkChannels()
+{
+	VolumeGrid::benchmarkChannels("res/meshes/bunny_cloud.vdb");
+}
+
+static void benchmarkQuantization()
+{
+	VolumeGrid::benchmarkQuantization("res/meshes/bunny_cloud.vdb");
+}
+
+static void benchmarkSequence()
+{
+	VolumeSequence::benchmark("res/meshes/cloud_0001.vdb");
+}
+
+static void benchmarkProgressive()
+{
+	VolumeLoader::benchmark("res/meshes/bunny_cloud.vdb");
+}
+
+static void benchmarkVDBScan()
+{
+	VolumeFile::benchmark("res/meshes/bunny_cloud.vdb");
+}
+
+static void benchmarkMarcher()
+{
+	VolumeMarcher::benchmark("res/meshes/bunny_cloud.vdb");
+}
+
+struct sBenchmark
+{
+	const char* name;
+	const char* description;
+	void (*function)();
+};
+
+static sBenchmark benchmarks[] = {
+	{ "bvh", "mesh BVH build time and rays/sec", benchmarkBVH },
+	{ "scenebvh", "scene BVH with 100k nodes: frustum culling, picking and refit", benchmarkSceneBVH },
+	{ "occlusion", "software occlusion raster and HiZ test of 10k boxes", benchmarkOcclusion },
+	{ "scenestore", "SoA scene store with 100k moving nodes: bounds update, culling and packets", benchmarkSceneStore },
+	{ "adaptivestep", "volume march with fixed and adaptive steps: samples, time and error, writes adaptive_step.csv", benchmarkAdaptiveStep },
+	{ "transfer", "pre-integration table of the transfer function: serial and parallel build, opacity error of a segment", benchmarkTransferFunction },
+	{ "noise", "baked 3D noise: scalar, SIMD and threaded generation, cache and cost per sample against the procedural octaves", benchmarkNoiseVolume },
+	{ "gradients", "packed gradient volume for the isosurface normals: scalar, SIMD and threaded", benchmarkGradients },
+	{ "isosurface", "surface only march: samples per ray and hit error of coarse steps with bisections, brick skipping and sphere tracing the distance field", benchmarkIsosurface },
+	{ "marchingcubes", "isosurface mesh extraction: serial and parallel time, triangles/sec, open and non manifold edges", benchmarkMarchingCubes },
+	{ "mips", "density mip chain: box and max build time, far views marched at the level of the pixel footprint against full resolution", benchmarkMips },
+	{ "channels", "density and temperature packed in one RG8 texture: packing time and quantization error of every channel", benchmarkChannels },
+	{ "quantization", "density storage in 8 and 16 bits over [0, 1] and over brick ranges: scalar and SIMD quantization time, bytes and PSNR against the floats", benchmarkQuantization },
+	{ "sequence", "VDB sequence playback with the prefetch ring: frames shown and dropped, load latency, time in the render thread", benchmarkSequence },
+	{ "progressive", "coarse to fine VDB load: serial and parallel voxelization, time to the first preview against the whole load", benchmarkProgressive },
+	{ "vdbscan", "VDB header scan against parsing the whole file, voxelizing the density grid against every grid", benchmarkVDBScan },
+	{ "marcher", "CPU reference of the scattering march for every density source: serial and tiled threaded time, samples/sec, writes marcher_*.tga", benchmarkMarcher },
+};
+
+void printBenchmarks()
+{
+	std::cout << "Available benchmarks:" << std::endl;
+	for (const sBenchmark& b : benchmarks)
+		std::cout << "\t" << b.name << ": " << b.description << std::endl;
+}
+
+bool runBenchmark(const char* name)
+{
+	//no context to upload the meshes
+	Mesh::auto_upload_to_vram = false;
+
+	for (const sBenchmark& b : benchmarks)
+	{
+		if (strcmp(b.name, name) != 0)
+			continue;
+		std::cout << "[BENCHMARK] " << b.name << std::endl;
+		b.function();
+		return true;
+	}
+
+	std::cerr << "[Error] Unknown benchmark: " << name << std::endl;
+	printBenchmarks();
+	return false;
+}
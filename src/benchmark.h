@@ -0,0 +1,11 @@
+/*  Headless benchmarks, launched with: ACG --benchmark <name>
+	They run without window or OpenGL context and print the results to the console.
+*/
+
+#pragma once
+
+//returns false if the benchmark does not exist
+bool runBenchmark(const char* name);
+
+//lists the available benchmarks
+void printBenchmarks();
@@ -34,6 +34,19 @@ glm::vec3 Camera::projectVector(glm::vec3 pos, bool& negZ)
 		return glm::vec3(result.x, result.y, result.z) / result.w;
 }
 
+glm::vec3 Camera::getRayDirection(float mouse_x, float mouse_y, float window_width, float window_height)
+{
+	// Mouse to normalized device coordinates (y goes up)
+	glm::vec2 ndc = glm::vec2(mouse_x / window_width, 1.f - mouse_y / window_height) * 2.f - 1.f;
+
+	glm::mat4 inverse_vp = glm::inverse(viewprojection_matrix);
+	glm::vec4 near_point = inverse_vp * glm::vec4(ndc, -1.f, 1.f);
+	glm::vec4 far_point = inverse_vp * glm::vec4(ndc, 1.f, 1.f);
+
+	glm::vec3 direction = glm::vec3(far_point) / far_point.w - glm::vec3(near_point) / near_point.w;
+	return glm::normalize(direction);
+}
+
 void Camera::rotate(float angle, const glm::vec3& axis)
 {
 	glm::vec3 front = center - eye;
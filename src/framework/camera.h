@@ -56,6 +56,9 @@ public:
 	// so it does not have to be rendered!
 	glm::vec3 projectVector(glm::vec3 pos, bool& negZ);
 
+	// Direction of the ray that goes from the eye through a pixel of the screen (for picking)
+	glm::vec3 getRayDirection(float mouse_x, float mouse_y, float window_width, float window_height);
+
 	// Set the info for each projection
 	void setPerspective(float fov, float aspect, float near_plane, float far_plane);
 	void setOrthographic(float left, float right, float top, float bottom, float near_plane, float far_plane);
@@ -0,0 +1,158 @@
+#include "jobs.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+class JobPool
+{
+public:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> queue; //parallelFor chunks, waiting threads can help with them
+	std::deque<std::function<void()>> background; //long running jobs, only workers pick them
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stop = false;
+
+	JobPool()
+	{
+		//at least one worker so background jobs run even on single core machines
+		unsigned int num_workers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+		for (unsigned int i = 0; i < num_workers; ++i)
+			workers.emplace_back([this]() { workerLoop(); });
+	}
+
+	~JobPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		condition.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	void push(const std::function<void()>& job, bool is_background = false)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (is_background)
+				background.push_back(job);
+			else
+				queue.push_back(job);
+		}
+		condition.notify_one();
+	}
+
+	//executes one pending job if there is any, used by threads waiting for other jobs
+	bool runPending()
+	{
+		std::function<void()> job;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (queue.empty())
+				return false;
+			job = std::move(queue.front());
+			queue.pop_front();
+		}
+		job();
+		return true;
+	}
+
+	void workerLoop()
+	{
+		while (true)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this]() { return stop || !queue.empty() || !background.empty(); });
+				if (stop && queue.empty() && background.empty())
+					return;
+				std::deque<std::function<void()>>& source = queue.empty() ? background : queue;
+				job = std::move(source.front());
+				source.pop_front();
+			}
+			job();
+		}
+	}
+};
+
+static JobPool& getPool()
+{
+	static JobPool pool;
+	return pool;
+}
+
+unsigned int getNumJobThreads()
+{
+	return (unsigned int)getPool().workers.size() + 1;
+}
+
+struct sParallelForState
+{
+	std::function<void(int, int)> fn;
+	int count;
+	int grain;
+	int num_chunks;
+	std::atomic<int> next_chunk{ 0 };
+	std::atomic<int> finished_chunks{ 0 };
+
+	void work()
+	{
+		int chunk;
+		while ((chunk = next_chunk.fetch_add(1)) < num_chunks)
+		{
+			int begin = chunk * grain;
+			fn(begin, std::min(begin + grain, count));
+			finished_chunks.fetch_add(1);
+		}
+	}
+};
+
+void parallelFor(int count, const std::function<void(int begin, int end)>& fn, int grain)
+{
+	if (count <= 0)
+		return;
+	grain = std::max(grain, 1);
+
+	int num_chunks = (count + grain - 1) / grain;
+	if (num_chunks == 1)
+	{
+		fn(0, count);
+		return;
+	}
+
+	JobPool& pool = getPool();
+
+	auto state = std::make_shared<sParallelForState>();
+	state->fn = fn;
+	state->count = count;
+	state->grain = grain;
+	state->num_chunks = num_chunks;
+
+	//helpers that start late find no chunks left and return, the state is kept alive by the shared_ptr
+	int num_helpers = std::min((int)pool.workers.size(), num_chunks - 1);
+	for (int i = 0; i < num_helpers; ++i)
+		pool.push([state]() { state->work(); });
+
+	state->work();
+
+	//chunks claimed by other threads may still be running
+	while (state->finished_chunks.load() < num_chunks)
+	{
+		if (!pool.runPending())
+			std::this_thread::yield();
+	}
+}
+
+void runJob(const std::function<void()>& job)
+{
+	getPool().push(job, true);
+}
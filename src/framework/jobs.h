@@ -0,0 +1,18 @@
+/*  Minimal job system: a pool of worker threads shared by all the CPU side
+	computations of the framework (BVH builds, voxelization, baking, ...).
+*/
+
+#pragma once
+
+#include <functional>
+
+//number of threads that take part in a parallelFor (workers + calling thread)
+unsigned int getNumJobThreads();
+
+//splits [0, count) in chunks of grain elements and calls fn(begin, end) for every chunk.
+//chunks are claimed dynamically so threads that finish early steal the remaining work.
+//it can be called from inside another job, the waiting thread keeps executing pending jobs
+void parallelFor(int count, const std::function<void(int begin, int end)>& fn, int grain = 1);
+
+//runs a job in a worker thread and returns immediately
+void runJob(const std::function<void()>& job);
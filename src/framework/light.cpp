@@ -8,7 +8,7 @@ Light::Light(glm::vec3 position, eLightType type, float intensity, glm::vec4 col
 	this->light_type = type;
 
 	this->name = std::string("Light" + std::to_string(this->lastNameId));
-	this->model = glm::translate(this->model, position);
+	this->setModel(glm::translate(this->getModel(), position));
 	
 	this->color = color;
 	this->intensity = intensity;
@@ -17,15 +17,16 @@ Light::Light(glm::vec3 position, eLightType type, float intensity, glm::vec4 col
 	this->cast_shadows;
 
 	// create a debug sphere mesh
-	this->mesh = Mesh::Get("res/meshes/sphere.obj");
-	this->model = glm::scale(this->model, glm::vec3(0.1f));
-	this->material = new FlatMaterial();
+	this->setMesh(Mesh::Get("res/meshes/sphere.obj"));
+	this->setModel(glm::scale(this->getModel(), glm::vec3(0.1f)));
+	this->setMaterial(new FlatMaterial());
 }
 
 void Light::setUniforms(Shader* shader, const glm::mat4& model)
 {
-	glm::vec3 position = glm::vec3(this->model[3][0], this->model[3][1], this->model[3][2]);
-	glm::vec3 front = glm::vec3(this->model[2][0], this->model[2][1], this->model[2][2]);
+	const glm::mat4& light_model = this->getModel();
+	glm::vec3 position = glm::vec3(light_model[3][0], light_model[3][1], light_model[3][2]);
+	glm::vec3 front = glm::vec3(light_model[2][0], light_model[2][1], light_model[2][2]);
 
 	// compute camera position in local coordinates
 	glm::mat4 inverseModel = glm::inverse(model);
@@ -42,8 +43,20 @@ void Light::setUniforms(Shader* shader, const glm::mat4& model)
 	shader->setUniform("u_local_light_position", local_pos);
 }
 
+bool Light::affects(const BoundingBox& world_box)
+{
+	if (this->light_type == LIGHT_DIRECTIONAL)
+		return true;
+
+	// distance from the light to the closest point of the box
+	glm::vec3 position = getPosition();
+	glm::vec3 d = position - glm::clamp(position, world_box.center - world_box.halfsize, world_box.center + world_box.halfsize);
+	return glm::dot(d, d) <= this->max_distance * this->max_distance;
+}
+
 void Light::renderInMenu()
 {
+	glm::mat4 model = this->getModel();
 	glm::vec3 front = glm::vec3(model[2][0], model[2][1], model[2][2]);
 
 	if (ImGui::Combo("Light Type", (int*)&this->light_type, "DIRECTIONAL\0POINT\0SPOT", 3))
@@ -52,9 +65,12 @@ void Light::renderInMenu()
 	}
 
 	float matrixTranslation[3], matrixRotation[3], matrixScale[3];
-	ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(this->model), matrixTranslation, matrixRotation, matrixScale);
-	ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
-	ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, glm::value_ptr(this->model));
+	ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(model), matrixTranslation, matrixRotation, matrixScale);
+	if (ImGui::DragFloat3("Position", matrixTranslation, 0.1f))
+	{
+		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, glm::value_ptr(model));
+		this->setModel(model);
+	}
 
 	ImGui::SliderFloat("Intensity", (float*)&this->intensity, 0.f, 50.f);
 	ImGui::SliderFloat("Shininess", (float*)&this->shininess, 0.f, 30.f);
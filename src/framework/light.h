@@ -15,8 +15,12 @@ public:
 	float max_distance = 100.f;
 	bool cast_shadows = false;
 
+	int light_bvh_proxy = -1; // influence bounds in the lights BVH, not used by directional lights
+
 	Light(glm::vec3 position = glm::vec3(0.f), eLightType type = LIGHT_DIRECTIONAL, float intensity = 1.f, glm::vec4 color = glm::vec4(1.f));
 
 	void setUniforms(Shader* shader, const glm::mat4& model);
+	glm::vec3 getPosition() { return glm::vec3(this->getModel()[3]); }
+	bool affects(const BoundingBox& world_box);
 	void renderInMenu();
 };
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include "occlusion.h"
+
+#include "jobs.h"
+#include "simd.h"
+#include "../graphics/mesh.h"
+#include "../graphics/bvh.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cassert>
+
+SoftwareOcclusion::SoftwareOcclusion(int width, int height)
+{
+	assert(width % 4 == 0);
+	this->width = width;
+	this->height = height;
+	depth.resize(width * height, 1.f);
+
+	//every level halves the previous one until 1x1
+	int w = width, h = height;
+	do
+	{
+		w = std::max(1, w / 2);
+		h = std::max(1, h / 2);
+		hiz.push_back(std::vector<float>(w * h, 1.f));
+	} while (w > 1 || h > 1);
+}
+
+SoftwareOcclusion::~SoftwareOcclusion()
+{
+	wait();
+}
+
+void SoftwareOcclusion::beginFrame(const glm::mat4& viewprojection, const std::vector<sOccluder>& occluders)
+{
+	wait();
+
+	//the collision models are shared with picking, create them here and not in the worker
+	for (const sOccluder& occluder : occluders)
+		occluder.mesh->createCollisionModel();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending = occluders;
+		busy = true;
+	}
+
+	runJob([this, viewprojection]() {
+		rasterize(viewprojection, pending);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy = false;
+		}
+		condition.notify_all();
+	});
+}
+
+void SoftwareOcclusion::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	condition.wait(lock, [this]() { return !busy; });
+}
+
+void SoftwareOcclusion::clear()
+{
+	std::fill(depth.begin(), depth.end(), 1.f);
+}
+
+void SoftwareOcclusion::rasterize(const glm::mat4& viewprojection, const std::vector<sOccluder>& occluders)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	this->viewprojection = viewprojection;
+	clear();
+	num_triangles = 0;
+
+	for (const sOccluder& occluder : occluders)
+	{
+		MeshBVH* bvh = (MeshBVH*)occluder.mesh->collision_model;
+		if (!bvh && occluder.mesh->createCollisionModel())
+			bvh = (MeshBVH*)occluder.mesh->collision_model;
+		if (!bvh)
+			continue;
+
+		glm::mat4 mvp = viewprojection * occluder.model;
+		for (const sBVHTriangle& tri : bvh->triangles)
+		{
+			glm::vec4 in[3] = {
+				mvp * glm::vec4(tri.v0, 1.f),
+				mvp * glm::vec4(tri.v0 + tri.e1, 1.f),
+				mvp * glm::vec4(tri.v0 + tri.e2, 1.f)
+			};
+
+			//clip against the near plane (z = -w), the result is a triangle or a quad
+			glm::vec4 clipped[4];
+			int num_clipped = 0;
+			for (int i = 0; i < 3; ++i)
+			{
+				const glm::vec4& a = in[i];
+				const glm::vec4& b = in[(i + 1) % 3];
+				float da = a.z + a.w;
+				float db = b.z + b.w;
+				if (da >= 0.f)
+					clipped[num_clipped++] = a;
+				if ((da >= 0.f) != (db >= 0.f))
+					clipped[num_clipped++] = a + (b - a) * (da / (da - db));
+			}
+			if (num_clipped < 3)
+				continue;
+
+			//to screen space, z/w remapped to [0,1]
+			glm::vec4 screen[4];
+			for (int i = 0; i < num_clipped; ++i)
+			{
+				glm::vec3 ndc = glm::vec3(clipped[i]) / std::max(clipped[i].w, 1e-6f);
+				screen[i] = glm::vec4((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, glm::clamp(ndc.z * 0.5f + 0.5f, 0.f, 1.f), 1.f);
+			}
+
+			rasterizeTriangle(screen[0], screen[1], screen[2]);
+			if (num_clipped == 4)
+				rasterizeTriangle(screen[0], screen[2], screen[3]);
+			num_triangles++;
+		}
+	}
+
+	buildHiZ();
+
+	raster_time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+}
+
+void SoftwareOcclusion::rasterizeTriangle(const glm::vec4& v0, const glm::vec4& in_v1, const glm::vec4& in_v2)
+{
+	glm::vec4 v1 = in_v1;
+	glm::vec4 v2 = in_v2;
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (std::abs(area) < 1e-8f)
+		return;
+	//occluders are not backface culled, flip to counter clockwise
+	if (area < 0.f)
+	{
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	int min_x = std::max(0, (int)std::floor(std::min(v0.x, std::min(v1.x, v2.x))));
+	int max_x = std::min(width - 1, (int)std::ceil(std::max(v0.x, std::max(v1.x, v2.x))));
+	int min_y = std::max(0, (int)std::floor(std::min(v0.y, std::min(v1.y, v2.y))));
+	int max_y = std::min(height - 1, (int)std::ceil(std::max(v0.y, std::max(v1.y, v2.y))));
+	if (min_x > max_x || min_y > max_y)
+		return;
+	min_x &= ~3;
+
+	//edge functions as A * x + B * y + C, w0 is the weight of v0 (edge v1-v2) and so on
+	const glm::vec4* a[3] = { &v1, &v2, &v0 };
+	const glm::vec4* b[3] = { &v2, &v0, &v1 };
+	float A[3], B[3], C[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		A[i] = -(b[i]->y - a[i]->y);
+		B[i] = b[i]->x - a[i]->x;
+		C[i] = -A[i] * a[i]->x - B[i] * a[i]->y;
+	}
+
+	//depth is linear in screen space: z = w0 * z0 + w1 * z1 + w2 * z2 (normalized weights)
+	float inv_area = 1.f / area;
+	float z0 = v0.z * inv_area, z1 = v1.z * inv_area, z2 = v2.z * inv_area;
+
+#ifdef USE_SSE
+	__m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	__m128 zero = _mm_setzero_ps();
+	__m128 a0 = _mm_set1_ps(A[0]), a1 = _mm_set1_ps(A[1]), a2 = _mm_set1_ps(A[2]);
+	__m128 vz0 = _mm_set1_ps(z0), vz1 = _mm_set1_ps(z1), vz2 = _mm_set1_ps(z2);
+
+	for (int y = min_y; y <= max_y; ++y)
+	{
+		float py = y + 0.5f;
+		__m128 row0 = _mm_set1_ps(B[0] * py + C[0]);
+		__m128 row1 = _mm_set1_ps(B[1] * py + C[1]);
+		__m128 row2 = _mm_set1_ps(B[2] * py + C[2]);
+		float* row = &depth[y * width];
+
+		for (int x = min_x; x <= max_x; x += 4)
+		{
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+			__m128 w0 = _mm_add_ps(_mm_mul_ps(a0, px), row0);
+			__m128 w1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+			__m128 w2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)), _mm_cmpge_ps(w2, zero));
+			if (!_mm_movemask_ps(inside))
+				continue;
+
+			__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, vz0), _mm_mul_ps(w1, vz1)), _mm_mul_ps(w2, vz2));
+			__m128 old_z = _mm_loadu_ps(row + x);
+			__m128 new_z = _mm_min_ps(old_z, z);
+			//keep the old value where the pixel is outside
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_z), _mm_andnot_ps(inside, old_z)));
+		}
+	}
+#else
+	for (int y = min_y; y <= max_y; ++y)
+	{
+		float py = y + 0.5f;
+		float* row = &depth[y * width];
+		for (int x = min_x; x <= max_x; ++x)
+		{
+			float px = x + 0.5f;
+			float w0 = A[0] * px + B[0] * py + C[0];
+			float w1 = A[1] * px + B[1] * py + C[1];
+			float w2 = A[2] * px + B[2] * py + C[2];
+			if (w0 < 0.f || w1 < 0.f || w2 < 0.f)
+				continue;
+			float z = w0 * z0 + w1 * z1 + w2 * z2;
+			if (z < row[x])
+				row[x] = z;
+		}
+	}
+#endif
+}
+
+void SoftwareOcclusion::buildHiZ()
+{
+	const float* source = depth.data();
+	int source_width = width, source_height = height;
+
+	for (std::vector<float>& level : hiz)
+	{
+		int w = std::max(1, source_width / 2);
+		int h = std::max(1, source_height / 2);
+		for (int y = 0; y < h; ++y)
+			for (int x = 0; x < w; ++x)
+			{
+				//clamped reads for levels with odd or 1 pixel sizes
+				int x0 = std::min(x * 2, source_width - 1), x1 = std::min(x * 2 + 1, source_width - 1);
+				int y0 = std::min(y * 2, source_height - 1), y1 = std::min(y * 2 + 1, source_height - 1);
+				level[y * w + x] = std::max(std::max(source[y0 * source_width + x0], source[y0 * source_width + x1]),
+					std::max(source[y1 * source_width + x0], source[y1 * source_width + x1]));
+			}
+		source = level.data();
+		source_width = w;
+		source_height = h;
+	}
+}
+
+bool SoftwareOcclusion::isOccluded(const BoundingBox& world_box)
+{
+	return isOccluded(world_box.center - world_box.halfsize, world_box.center + world_box.halfsize);
+}
+
+bool SoftwareOcclusion::isOccluded(const glm::vec3& box_min, const glm::vec3& box_max)
+{
+	num_tested++;
+
+	//screen rect and nearest depth of the box
+	glm::vec2 rect_min(1e10f), rect_max(-1e10f);
+	float min_depth = 1.f;
+	for (int i = 0; i < 8; ++i)
+	{
+		glm::vec3 corner(i & 1 ? box_max.x : box_min.x, i & 2 ? box_max.y : box_min.y, i & 4 ? box_max.z : box_min.z);
+		glm::vec4 clip = viewprojection * glm::vec4(corner, 1.f);
+		//crosses the near plane, can't be hidden
+		if (clip.z < -clip.w || clip.w <= 1e-6f)
+			return false;
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		glm::vec2 screen((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height);
+		rect_min = glm::min(rect_min, screen);
+		rect_max = glm::max(rect_max, screen);
+		min_depth = std::min(min_depth, ndc.z * 0.5f + 0.5f);
+	}
+
+	int x0 = std::max(0, (int)rect_min.x), x1 = std::min(width - 1, (int)rect_max.x);
+	int y0 = std::max(0, (int)rect_min.y), y1 = std::min(height - 1, (int)rect_max.y);
+	if (x0 > x1 || y0 > y1)
+		return false; //outside the screen, frustum culling takes care of it
+
+	//smallest level where the rect covers 2x2 texels at most
+	int level = 0;
+	while (level < (int)hiz.size() - 1 && ((x1 >> (level + 1)) - (x0 >> (level + 1)) > 1 || (y1 >> (level + 1)) - (y0 >> (level + 1)) > 1))
+		level++;
+
+	int level_width = std::max(1, width >> (level + 1));
+	int level_height = std::max(1, height >> (level + 1));
+	const std::vector<float>& texels = hiz[level];
+	for (int y = std::min(y0 >> (level + 1), level_height - 1); y <= std::min(y1 >> (level + 1), level_height - 1); ++y)
+		for (int x = std::min(x0 >> (level + 1), level_width - 1); x <= std::min(x1 >> (level + 1), level_width - 1); ++x)
+			if (texels[y * level_width + x] >= min_depth)
+				return false;
+
+	num_occluded++;
+	return true;
+}
+
+void SoftwareOcclusion::benchmark(int num_boxes)
+{
+	typedef std::chrono::high_resolution_clock clock;
+
+	//a wall in front of the camera hiding part of a field of boxes
+	Mesh* wall = new Mesh();
+	wall->name = "wall";
+	wall->createSubdividedPlane(8.f, 16, true);
+	glm::mat4 wall_model = glm::translate(glm::vec3(-4.f, -4.f, 0.f)) * glm::rotate(glm::radians(-90.f), glm::vec3(1.f, 0.f, 0.f));
+
+	Mesh* sphere = Mesh::Get("res/meshes/sphere.obj");
+
+	std::vector<sOccluder> occluders = { { wall, wall_model } };
+	if (sphere)
+		occluders.push_back({ sphere, glm::translate(glm::vec3(6.f, 0.f, 2.f)) * glm::scale(glm::vec3(2.f)) });
+
+	glm::mat4 projection = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 500.f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.f, 0.f, 10.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+	glm::mat4 vp = projection * view;
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+	std::vector<glm::vec3> mins(num_boxes), maxs(num_boxes);
+	for (int i = 0; i < num_boxes; ++i)
+	{
+		glm::vec3 center = glm::vec3(dist(rng) * 20.f - 10.f, dist(rng) * 12.f - 6.f, -dist(rng) * 30.f - 1.f);
+		glm::vec3 half = glm::vec3(dist(rng), dist(rng), dist(rng)) * 0.4f + 0.1f;
+		mins[i] = center - half;
+		maxs[i] = center + half;
+	}
+
+	SoftwareOcclusion occlusion;
+	const int num_frames = 100;
+	float raster_time = 0.f;
+	float test_time = 0.f;
+	for (int frame = 0; frame < num_frames; ++frame)
+	{
+		occlusion.beginFrame(vp, occluders);
+		occlusion.wait();
+		raster_time += occlusion.raster_time;
+
+		occlusion.num_tested = occlusion.num_occluded = 0;
+		auto start = clock::now();
+		for (int i = 0; i < num_boxes; ++i)
+			occlusion.isOccluded(mins[i], maxs[i]);
+		test_time += std::chrono::duration<float>(clock::now() - start).count() * 1000.f;
+	}
+
+	std::cout << " + Software occlusion " << occlusion.width << "x" << occlusion.height << ": " << occlusion.num_triangles << " occluder tris, raster "
+		<< raster_time / num_frames << " ms" << std::endl;
+	std::cout << "   " << occlusion.num_occluded << " / " << occlusion.num_tested << " boxes occluded, test " << test_time / num_frames << " ms per frame" << std::endl;
+
+	delete wall;
+}
@@ -0,0 +1,80 @@
+/*  Software occlusion culling: a few big occluder meshes are rasterized on the CPU into a low
+	resolution depth buffer (in a worker thread), then the screen bounds of the nodes are tested
+	against a max depth pyramid (HiZ) before submitting them to the GPU.
+*/
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include <glm/vec3.hpp>
+#include <glm/matrix.hpp>
+
+#define OCCLUSION_WIDTH 256 //must be multiple of 4, rows are rasterized 4 pixels at a time
+#define OCCLUSION_HEIGHT 128
+
+class Mesh;
+class BoundingBox;
+
+struct sOcclusionStats
+{
+	float raster_time = 0.f;
+	float test_time = 0.f;
+	int num_triangles = 0;
+	int num_tested = 0;
+	int num_occluded = 0;
+};
+
+class SoftwareOcclusion
+{
+public:
+	struct sOccluder
+	{
+		Mesh* mesh;
+		glm::mat4 model;
+	};
+
+	int width;
+	int height;
+	std::vector<float> depth; //z/w in [0,1], 1 is the far plane
+	std::vector<std::vector<float>> hiz; //max depth pyramid, level 0 is 2x2 pixels of the depth
+
+	glm::mat4 viewprojection;
+
+	//stats of the last frame, in ms. The worker writes the ones of the raster, read them after wait
+	float raster_time = 0.f;
+	float test_time = 0.f;
+	int num_triangles = 0;
+	int num_tested = 0;
+	int num_occluded = 0;
+
+	SoftwareOcclusion(int width = OCCLUSION_WIDTH, int height = OCCLUSION_HEIGHT);
+	~SoftwareOcclusion();
+
+	//starts rasterizing the occluders in a worker thread, call wait before testing
+	void beginFrame(const glm::mat4& viewprojection, const std::vector<sOccluder>& occluders);
+	void wait();
+	//copy of the stats, after wait
+	sOcclusionStats getStats() const { return { raster_time, test_time, num_triangles, num_tested, num_occluded }; }
+
+	//same but in the calling thread
+	void rasterize(const glm::mat4& viewprojection, const std::vector<sOccluder>& occluders);
+
+	//true if the box is completely hidden behind the occluders
+	bool isOccluded(const glm::vec3& box_min, const glm::vec3& box_max);
+	bool isOccluded(const BoundingBox& world_box);
+
+	static void benchmark(int num_boxes = 10000);
+
+private:
+	std::vector<sOccluder> pending;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool busy = false;
+
+	void clear();
+	void rasterizeTriangle(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2);
+	void buildHiZ();
+};
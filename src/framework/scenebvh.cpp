@@ -0,0 +1,642 @@
+#include "scenebvh.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <random>
+#include <cmath>
+
+#include <glm/gtx/transform.hpp>
+
+#define SCENEBVH_STACK_SIZE 256
+
+static float surfaceArea(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 e = max - min;
+	return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+static bool contains(const sSceneBVHNode& node, const glm::vec3& min, const glm::vec3& max)
+{
+	return node.min.x <= min.x && node.min.y <= min.y && node.min.z <= min.z &&
+		node.max.x >= max.x && node.max.y >= max.y && node.max.z >= max.z;
+}
+
+static bool overlaps(const sSceneBVHNode& node, const glm::vec3& min, const glm::vec3& max)
+{
+	return node.min.x <= max.x && node.min.y <= max.y && node.min.z <= max.z &&
+		node.max.x >= min.x && node.max.y >= min.y && node.max.z >= min.z;
+}
+
+SceneBVH::SceneBVH()
+{
+	nodes.reserve(64);
+}
+
+int SceneBVH::allocateNode()
+{
+	if (free_list == SCENEBVH_NULL_NODE)
+	{
+		nodes.push_back(sSceneBVHNode());
+		free_list = (int)nodes.size() - 1;
+		nodes[free_list].parent = SCENEBVH_NULL_NODE;
+	}
+
+	int node_id = free_list;
+	free_list = nodes[node_id].parent;
+	nodes[node_id] = sSceneBVHNode();
+	nodes[node_id].height = 0;
+	return node_id;
+}
+
+void SceneBVH::freeNode(int node_id)
+{
+	nodes[node_id].parent = free_list;
+	nodes[node_id].height = -1;
+	nodes[node_id].user_data = nullptr;
+	free_list = node_id;
+}
+
+int SceneBVH::createProxy(const glm::vec3& min, const glm::vec3& max, void* user_data)
+{
+	int proxy_id = allocateNode();
+	sSceneBVHNode& node = nodes[proxy_id];
+	node.min = min - glm::vec3(SCENEBVH_MARGIN);
+	node.max = max + glm::vec3(SCENEBVH_MARGIN);
+	node.user_data = user_data;
+
+	insertLeaf(proxy_id);
+	num_proxies++;
+	return proxy_id;
+}
+
+void SceneBVH::destroyProxy(int proxy_id)
+{
+	assert(proxy_id >= 0 && proxy_id < (int)nodes.size() && nodes[proxy_id].isLeaf());
+	removeLeaf(proxy_id);
+	freeNode(proxy_id);
+	num_proxies--;
+}
+
+bool SceneBVH::moveProxy(int proxy_id, const glm::vec3& min, const glm::vec3& max)
+{
+	assert(proxy_id >= 0 && proxy_id < (int)nodes.size() && nodes[proxy_id].isLeaf());
+
+	//still inside the fat box, and the box has not shrunk a lot
+	sSceneBVHNode& node = nodes[proxy_id];
+	glm::vec3 big_margin = glm::vec3(SCENEBVH_MARGIN * 4.f);
+	if (contains(node, min, max) && !contains(node, min - big_margin, max + big_margin))
+		return false;
+
+	removeLeaf(proxy_id);
+	nodes[proxy_id].min = min - glm::vec3(SCENEBVH_MARGIN);
+	nodes[proxy_id].max = max + glm::vec3(SCENEBVH_MARGIN);
+	insertLeaf(proxy_id);
+	return true;
+}
+
+void SceneBVH::insertLeaf(int leaf)
+{
+	if (root == SCENEBVH_NULL_NODE)
+	{
+		root = leaf;
+		nodes[root].parent = SCENEBVH_NULL_NODE;
+		return;
+	}
+
+	//find the best sibling going down the tree with the surface area heuristic
+	glm::vec3 leaf_min = nodes[leaf].min;
+	glm::vec3 leaf_max = nodes[leaf].max;
+	int index = root;
+	while (!nodes[index].isLeaf())
+	{
+		const sSceneBVHNode& node = nodes[index];
+		float area = surfaceArea(node.min, node.max);
+		float combined_area = surfaceArea(glm::min(node.min, leaf_min), glm::max(node.max, leaf_max));
+
+		//cost of creating a new parent for this node and the new leaf
+		float cost = 2.f * combined_area;
+		//minimum cost of pushing the leaf further down the tree
+		float inheritance_cost = 2.f * (combined_area - area);
+
+		float child_cost[2];
+		int children[2] = { node.child1, node.child2 };
+		for (int i = 0; i < 2; ++i)
+		{
+			const sSceneBVHNode& child = nodes[children[i]];
+			float new_area = surfaceArea(glm::min(child.min, leaf_min), glm::max(child.max, leaf_max));
+			if (child.isLeaf())
+				child_cost[i] = new_area + inheritance_cost;
+			else
+				child_cost[i] = (new_area - surfaceArea(child.min, child.max)) + inheritance_cost;
+		}
+
+		if (cost < child_cost[0] && cost < child_cost[1])
+			break;
+
+		index = child_cost[0] < child_cost[1] ? children[0] : children[1];
+	}
+
+	int sibling = index;
+
+	//allocateNode can grow the vector, no references before this point are kept
+	int old_parent = nodes[sibling].parent;
+	int new_parent = allocateNode();
+	sSceneBVHNode& parent = nodes[new_parent];
+	parent.parent = old_parent;
+	parent.min = glm::min(leaf_min, nodes[sibling].min);
+	parent.max = glm::max(leaf_max, nodes[sibling].max);
+	parent.height = nodes[sibling].height + 1;
+	parent.child1 = sibling;
+	parent.child2 = leaf;
+	nodes[sibling].parent = new_parent;
+	nodes[leaf].parent = new_parent;
+
+	if (old_parent != SCENEBVH_NULL_NODE)
+	{
+		if (nodes[old_parent].child1 == sibling)
+			nodes[old_parent].child1 = new_parent;
+		else
+			nodes[old_parent].child2 = new_parent;
+	}
+	else
+		root = new_parent;
+
+	fixUpwards(nodes[leaf].parent);
+}
+
+void SceneBVH::removeLeaf(int leaf)
+{
+	if (leaf == root)
+	{
+		root = SCENEBVH_NULL_NODE;
+		return;
+	}
+
+	int parent = nodes[leaf].parent;
+	int grand_parent = nodes[parent].parent;
+	int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+	if (grand_parent != SCENEBVH_NULL_NODE)
+	{
+		//the sibling takes the place of the parent
+		if (nodes[grand_parent].child1 == parent)
+			nodes[grand_parent].child1 = sibling;
+		else
+			nodes[grand_parent].child2 = sibling;
+		nodes[sibling].parent = grand_parent;
+		freeNode(parent);
+		fixUpwards(grand_parent);
+	}
+	else
+	{
+		root = sibling;
+		nodes[sibling].parent = SCENEBVH_NULL_NODE;
+		freeNode(parent);
+	}
+}
+
+//walks up to the root refitting the boxes and rebalancing
+void SceneBVH::fixUpwards(int index)
+{
+	while (index != SCENEBVH_NULL_NODE)
+	{
+		index = balance(index);
+
+		sSceneBVHNode& node = nodes[index];
+		const sSceneBVHNode& child1 = nodes[node.child1];
+		const sSceneBVHNode& child2 = nodes[node.child2];
+		node.height = 1 + std::max(child1.height, child2.height);
+		node.min = glm::min(child1.min, child2.min);
+		node.max = glm::max(child1.max, child2.max);
+
+		index = node.parent;
+	}
+}
+
+//performs a left or right rotation if node A is imbalanced, returns the new root of the subtree
+int SceneBVH::balance(int iA)
+{
+	sSceneBVHNode& A = nodes[iA];
+	if (A.isLeaf() || A.height < 2)
+		return iA;
+
+	int iB = A.child1;
+	int iC = A.child2;
+	sSceneBVHNode& B = nodes[iB];
+	sSceneBVHNode& C = nodes[iC];
+
+	int balance = C.height - B.height;
+
+	//rotate C up
+	if (balance > 1)
+	{
+		int iF = C.child1;
+		int iG = C.child2;
+		sSceneBVHNode& F = nodes[iF];
+		sSceneBVHNode& G = nodes[iG];
+
+		C.child1 = iA;
+		C.parent = A.parent;
+		A.parent = iC;
+
+		if (C.parent != SCENEBVH_NULL_NODE)
+		{
+			if (nodes[C.parent].child1 == iA)
+				nodes[C.parent].child1 = iC;
+			else
+				nodes[C.parent].child2 = iC;
+		}
+		else
+			root = iC;
+
+		if (F.height > G.height)
+		{
+			C.child2 = iF;
+			A.child2 = iG;
+			G.parent = iA;
+			A.min = glm::min(B.min, G.min); A.max = glm::max(B.max, G.max);
+			C.min = glm::min(A.min, F.min); C.max = glm::max(A.max, F.max);
+			A.height = 1 + std::max(B.height, G.height);
+			C.height = 1 + std::max(A.height, F.height);
+		}
+		else
+		{
+			C.child2 = iG;
+			A.child2 = iF;
+			F.parent = iA;
+			A.min = glm::min(B.min, F.min); A.max = glm::max(B.max, F.max);
+			C.min = glm::min(A.min, G.min); C.max = glm::max(A.max, G.max);
+			A.height = 1 + std::max(B.height, F.height);
+			C.height = 1 + std::max(A.height, G.height);
+		}
+		return iC;
+	}
+
+	//rotate B up
+	if (balance < -1)
+	{
+		int iD = B.child1;
+		int iE = B.child2;
+		sSceneBVHNode& D = nodes[iD];
+		sSceneBVHNode& E = nodes[iE];
+
+		B.child1 = iA;
+		B.parent = A.parent;
+		A.parent = iB;
+
+		if (B.parent != SCENEBVH_NULL_NODE)
+		{
+			if (nodes[B.parent].child1 == iA)
+				nodes[B.parent].child1 = iB;
+			else
+				nodes[B.parent].child2 = iB;
+		}
+		else
+			root = iB;
+
+		if (D.height > E.height)
+		{
+			B.child2 = iD;
+			A.child1 = iE;
+			E.parent = iA;
+			A.min = glm::min(C.min, E.min); A.max = glm::max(C.max, E.max);
+			B.min = glm::min(A.min, D.min); B.max = glm::max(A.max, D.max);
+			A.height = 1 + std::max(C.height, E.height);
+			B.height = 1 + std::max(A.height, D.height);
+		}
+		else
+		{
+			B.child2 = iE;
+			A.child1 = iD;
+			D.parent = iA;
+			A.min = glm::min(C.min, D.min); A.max = glm::max(C.max, D.max);
+			B.min = glm::min(A.min, E.min); B.max = glm::max(A.max, E.max);
+			A.height = 1 + std::max(C.height, D.height);
+			B.height = 1 + std::max(A.height, E.height);
+		}
+		return iB;
+	}
+
+	return iA;
+}
+
+void SceneBVH::collectLeaves(int node_id, std::vector<void*>& result) const
+{
+	int stack[SCENEBVH_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = node_id;
+
+	while (stack_size)
+	{
+		const sSceneBVHNode& node = nodes[stack[--stack_size]];
+		if (node.isLeaf())
+		{
+			result.push_back(node.user_data);
+			continue;
+		}
+		assert(stack_size + 2 <= SCENEBVH_STACK_SIZE);
+		stack[stack_size++] = node.child1;
+		stack[stack_size++] = node.child2;
+	}
+}
+
+void SceneBVH::queryAABB(const glm::vec3& min, const glm::vec3& max, std::vector<void*>& result) const
+{
+	if (root == SCENEBVH_NULL_NODE)
+		return;
+
+	int stack[SCENEBVH_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = root;
+
+	while (stack_size)
+	{
+		const sSceneBVHNode& node = nodes[stack[--stack_size]];
+		if (!overlaps(node, min, max))
+			continue;
+		if (node.isLeaf())
+		{
+			result.push_back(node.user_data);
+			continue;
+		}
+		assert(stack_size + 2 <= SCENEBVH_STACK_SIZE);
+		stack[stack_size++] = node.child1;
+		stack[stack_size++] = node.child2;
+	}
+}
+
+void SceneBVH::querySphere(const glm::vec3& center, float radius, std::vector<void*>& result) const
+{
+	if (root == SCENEBVH_NULL_NODE)
+		return;
+
+	int stack[SCENEBVH_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = root;
+	float radius2 = radius * radius;
+
+	while (stack_size)
+	{
+		const sSceneBVHNode& node = nodes[stack[--stack_size]];
+		glm::vec3 d = center - glm::clamp(center, node.min, node.max);
+		if (glm::dot(d, d) > radius2)
+			continue;
+		if (node.isLeaf())
+		{
+			result.push_back(node.user_data);
+			continue;
+		}
+		assert(stack_size + 2 <= SCENEBVH_STACK_SIZE);
+		stack[stack_size++] = node.child1;
+		stack[stack_size++] = node.child2;
+	}
+}
+
+void SceneBVH::queryFrustum(const glm::mat4& vp, std::vector<void*>& result) const
+{
+	if (root == SCENEBVH_NULL_NODE)
+		return;
+
+	//planes from the viewprojection rows (Gribb & Hartmann), pointing inside
+	glm::vec4 row0(vp[0][0], vp[1][0], vp[2][0], vp[3][0]);
+	glm::vec4 row1(vp[0][1], vp[1][1], vp[2][1], vp[3][1]);
+	glm::vec4 row2(vp[0][2], vp[1][2], vp[2][2], vp[3][2]);
+	glm::vec4 row3(vp[0][3], vp[1][3], vp[2][3], vp[3][3]);
+	glm::vec4 planes[6] = { row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2 };
+
+	//every entry keeps the mask of the planes the parent was not fully inside of
+	struct sEntry { int node; int mask; };
+	sEntry stack[SCENEBVH_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { root, 63 };
+
+	while (stack_size)
+	{
+		sEntry entry = stack[--stack_size];
+		const sSceneBVHNode& node = nodes[entry.node];
+
+		int mask = entry.mask;
+		bool outside = false;
+		for (int i = 0; i < 6; ++i)
+		{
+			if (!(mask & (1 << i)))
+				continue;
+			const glm::vec4& p = planes[i];
+			//farthest corner along the plane normal, and the closest one
+			glm::vec3 positive(p.x > 0.f ? node.max.x : node.min.x, p.y > 0.f ? node.max.y : node.min.y, p.z > 0.f ? node.max.z : node.min.z);
+			glm::vec3 negative(p.x > 0.f ? node.min.x : node.max.x, p.y > 0.f ? node.min.y : node.max.y, p.z > 0.f ? node.min.z : node.max.z);
+			if (glm::dot(glm::vec3(p), positive) + p.w < 0.f)
+			{
+				outside = true;
+				break;
+			}
+			if (glm::dot(glm::vec3(p), negative) + p.w >= 0.f)
+				mask &= ~(1 << i);
+		}
+		if (outside)
+			continue;
+
+		//fully inside, no more tests needed for the subtree
+		if (!mask || node.isLeaf())
+		{
+			if (node.isLeaf())
+				result.push_back(node.user_data);
+			else
+				collectLeaves(entry.node, result);
+			continue;
+		}
+
+		assert(stack_size + 2 <= SCENEBVH_STACK_SIZE);
+		stack[stack_size++] = { node.child1, mask };
+		stack[stack_size++] = { node.child2, mask };
+	}
+}
+
+static inline float rayBoxDistance(const sSceneBVHNode& node, const glm::vec3& origin, const glm::vec3& inv_direction, float max_dist)
+{
+	glm::vec3 t0 = (node.min - origin) * inv_direction;
+	glm::vec3 t1 = (node.max - origin) * inv_direction;
+	glm::vec3 tmin = glm::min(t0, t1);
+	glm::vec3 tmax = glm::max(t0, t1);
+	float tnear = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.f));
+	float tfar = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, max_dist));
+	return tnear <= tfar ? tnear : -1.f;
+}
+
+void SceneBVH::raycast(const glm::vec3& origin, const glm::vec3& direction, float max_dist, const std::function<float(void* user_data, float max_dist)>& callback) const
+{
+	if (root == SCENEBVH_NULL_NODE)
+		return;
+
+	glm::vec3 inv_direction;
+	for (int i = 0; i < 3; ++i)
+		inv_direction[i] = 1.f / (std::abs(direction[i]) > 1e-20f ? direction[i] : (direction[i] < 0.f ? -1e-20f : 1e-20f));
+
+	struct sEntry { int node; float tnear; };
+	sEntry stack[SCENEBVH_STACK_SIZE];
+	int stack_size = 0;
+
+	float t = rayBoxDistance(nodes[root], origin, inv_direction, max_dist);
+	if (t < 0.f)
+		return;
+	stack[stack_size++] = { root, t };
+
+	while (stack_size)
+	{
+		sEntry entry = stack[--stack_size];
+		if (entry.tnear > max_dist)
+			continue;
+
+		const sSceneBVHNode& node = nodes[entry.node];
+		if (node.isLeaf())
+		{
+			max_dist = std::min(max_dist, callback(node.user_data, max_dist));
+			continue;
+		}
+
+		//push the far child first so the near one is visited before
+		float t1 = rayBoxDistance(nodes[node.child1], origin, inv_direction, max_dist);
+		float t2 = rayBoxDistance(nodes[node.child2], origin, inv_direction, max_dist);
+		sEntry e1 = { node.child1, t1 };
+		sEntry e2 = { node.child2, t2 };
+		if (t1 < t2)
+			std::swap(e1, e2);
+		assert(stack_size + 2 <= SCENEBVH_STACK_SIZE);
+		if (e1.tnear >= 0.f)
+			stack[stack_size++] = e1;
+		if (e2.tnear >= 0.f)
+			stack[stack_size++] = e2;
+	}
+}
+
+void SceneBVH::benchmark(int num_proxies)
+{
+	typedef std::chrono::high_resolution_clock clock;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+
+	//boxes of 0.5 to 2 units spread in a 500 units cube
+	std::vector<glm::vec3> mins(num_proxies), maxs(num_proxies);
+	for (int i = 0; i < num_proxies; ++i)
+	{
+		glm::vec3 center = glm::vec3(dist(rng), dist(rng), dist(rng)) * 500.f - 250.f;
+		glm::vec3 half = glm::vec3(dist(rng), dist(rng), dist(rng)) * 0.75f + 0.25f;
+		mins[i] = center - half;
+		maxs[i] = center + half;
+	}
+
+	SceneBVH bvh;
+	std::vector<int> proxies(num_proxies);
+	auto start = clock::now();
+	for (int i = 0; i < num_proxies; ++i)
+		proxies[i] = bvh.createProxy(mins[i], maxs[i], (void*)(size_t)i);
+	float insert_time = std::chrono::duration<float>(clock::now() - start).count();
+	std::cout << " + Scene BVH: " << num_proxies << " proxies, height " << bvh.getHeight() << ", insert " << insert_time * 1000.f << " ms" << std::endl;
+
+	//frustum culling against a linear test of every box
+	glm::mat4 projection = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 500.f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.f, 0.f, 300.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+	glm::mat4 vp = projection * view;
+	std::vector<void*> result;
+	result.reserve(num_proxies);
+
+	const int num_frustums = 100;
+	start = clock::now();
+	for (int i = 0; i < num_frustums; ++i)
+	{
+		result.clear();
+		bvh.queryFrustum(glm::rotate(vp, i * 0.05f, glm::vec3(0.f, 1.f, 0.f)), result);
+	}
+	float frustum_time = std::chrono::duration<float>(clock::now() - start).count() / num_frustums;
+
+	size_t num_visible = 0;
+	start = clock::now();
+	for (int i = 0; i < num_frustums; ++i)
+	{
+		glm::mat4 rvp = glm::rotate(vp, i * 0.05f, glm::vec3(0.f, 1.f, 0.f));
+		//same plane test as the tree, without hierarchy
+		glm::vec4 r0(rvp[0][0], rvp[1][0], rvp[2][0], rvp[3][0]), r1(rvp[0][1], rvp[1][1], rvp[2][1], rvp[3][1]);
+		glm::vec4 r2(rvp[0][2], rvp[1][2], rvp[2][2], rvp[3][2]), r3(rvp[0][3], rvp[1][3], rvp[2][3], rvp[3][3]);
+		glm::vec4 planes[6] = { r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2 };
+		num_visible = 0;
+		for (int j = 0; j < num_proxies; ++j)
+		{
+			bool inside = true;
+			for (int k = 0; k < 6 && inside; ++k)
+			{
+				const glm::vec4& p = planes[k];
+				glm::vec3 positive(p.x > 0.f ? maxs[j].x : mins[j].x, p.y > 0.f ? maxs[j].y : mins[j].y, p.z > 0.f ? maxs[j].z : mins[j].z);
+				inside = glm::dot(glm::vec3(p), positive) + p.w >= 0.f;
+			}
+			num_visible += inside;
+		}
+	}
+	float linear_time = std::chrono::duration<float>(clock::now() - start).count() / num_frustums;
+	std::cout << "   frustum: " << result.size() << " visible, " << frustum_time * 1000.f << " ms (tree) " << linear_time * 1000.f << " ms (linear, " << num_visible << " visible)" << std::endl;
+
+	//picking rays from the camera position
+	const int num_rays = 100000;
+	int hits = 0;
+	start = clock::now();
+	for (int i = 0; i < num_rays; ++i)
+	{
+		glm::vec3 target = glm::vec3(dist(rng), dist(rng), dist(rng)) * 500.f - 250.f;
+		glm::vec3 origin(0.f, 0.f, 300.f);
+		float nearest = 1e10f;
+		bvh.raycast(origin, glm::normalize(target - origin), 1e10f, [&](void* data, float max_dist) {
+			//exact box test against the unfattened box
+			size_t j = (size_t)data;
+			sSceneBVHNode box;
+			box.min = mins[j];
+			box.max = maxs[j];
+			glm::vec3 dir = glm::normalize(target - origin);
+			float t = rayBoxDistance(box, origin, 1.f / dir, max_dist);
+			if (t < 0.f)
+				return max_dist;
+			nearest = t;
+			return t;
+		});
+		hits += nearest < 1e10f;
+	}
+	float ray_time = std::chrono::duration<float>(clock::now() - start).count();
+
+	//linear test of every box for a tenth of the rays
+	int linear_hits = 0;
+	start = clock::now();
+	for (int i = 0; i < num_rays / 10; ++i)
+	{
+		glm::vec3 target = glm::vec3(dist(rng), dist(rng), dist(rng)) * 500.f - 250.f;
+		glm::vec3 origin(0.f, 0.f, 300.f);
+		glm::vec3 inv_dir = 1.f / glm::normalize(target - origin);
+		float nearest = 1e10f;
+		for (int j = 0; j < num_proxies; ++j)
+		{
+			sSceneBVHNode box;
+			box.min = mins[j];
+			box.max = maxs[j];
+			float t = rayBoxDistance(box, origin, inv_dir, nearest);
+			if (t >= 0.f)
+				nearest = t;
+		}
+		linear_hits += nearest < 1e10f;
+	}
+	float linear_ray_time = std::chrono::duration<float>(clock::now() - start).count() * 10.f;
+	std::cout << "   raycast: " << num_rays / ray_time << " rays/s (tree, " << hits << " hits) " << num_rays / linear_ray_time << " rays/s (linear, " << linear_hits * 10 << " hits)" << std::endl;
+
+	//move 10% of the proxies per frame
+	const int num_moves = num_proxies / 10;
+	int reinserted = 0;
+	start = clock::now();
+	for (int i = 0; i < num_moves; ++i)
+	{
+		int j = (int)(dist(rng) * (num_proxies - 1));
+		glm::vec3 offset = glm::vec3(dist(rng), dist(rng), dist(rng)) - 0.5f;
+		mins[j] += offset;
+		maxs[j] += offset;
+		reinserted += bvh.moveProxy(proxies[j], mins[j], maxs[j]);
+	}
+	float move_time = std::chrono::duration<float>(clock::now() - start).count();
+	std::cout << "   move: " << num_moves << " proxies (" << reinserted << " reinserted) " << move_time * 1000.f << " ms, height " << bvh.getHeight() << std::endl;
+}
@@ -0,0 +1,69 @@
+/*  Dynamic AABB tree over world space bounds (same idea as Box2D's b2DynamicTree, in 3D).
+	Leaves store a slightly enlarged box so small movements don't touch the tree, and
+	the tree is kept balanced with rotations so queries stay logarithmic.
+*/
+
+#pragma once
+
+#include <vector>
+#include <functional>
+
+#include <glm/vec3.hpp>
+#include <glm/matrix.hpp>
+
+#define SCENEBVH_NULL_NODE -1
+#define SCENEBVH_MARGIN 0.1f //fattening of the leaf boxes, in world units
+
+struct sSceneBVHNode
+{
+	glm::vec3 min;
+	glm::vec3 max;
+	void* user_data = nullptr;
+
+	int parent = SCENEBVH_NULL_NODE; //next free node when not in use
+	int child1 = SCENEBVH_NULL_NODE;
+	int child2 = SCENEBVH_NULL_NODE;
+	int height = -1; //0 for leaves, -1 when free
+
+	bool isLeaf() const { return child1 == SCENEBVH_NULL_NODE; }
+};
+
+class SceneBVH
+{
+public:
+	std::vector<sSceneBVHNode> nodes;
+	int root = SCENEBVH_NULL_NODE;
+	int free_list = SCENEBVH_NULL_NODE;
+	int num_proxies = 0;
+
+	SceneBVH();
+
+	//returns the proxy id, used to move or destroy it later
+	int createProxy(const glm::vec3& min, const glm::vec3& max, void* user_data);
+	void destroyProxy(int proxy_id);
+	//returns true if the tree had to be updated (the new box is out of the fat box)
+	bool moveProxy(int proxy_id, const glm::vec3& min, const glm::vec3& max);
+
+	void* getUserData(int proxy_id) const { return nodes[proxy_id].user_data; }
+	int getHeight() const { return root == SCENEBVH_NULL_NODE ? 0 : nodes[root].height; }
+
+	//queries, the result is appended to the vector
+	void queryAABB(const glm::vec3& min, const glm::vec3& max, std::vector<void*>& result) const;
+	void querySphere(const glm::vec3& center, float radius, std::vector<void*>& result) const;
+	void queryFrustum(const glm::mat4& viewprojection, std::vector<void*>& result) const;
+
+	//visits the leaves hit by the ray from near to far. The callback does the precise test and returns
+	//the new max distance (the hit distance or the same max_dist if there was no hit)
+	void raycast(const glm::vec3& origin, const glm::vec3& direction, float max_dist, const std::function<float(void* user_data, float max_dist)>& callback) const;
+
+	static void benchmark(int num_proxies = 100000);
+
+private:
+	int allocateNode();
+	void freeNode(int node_id);
+	void insertLeaf(int leaf);
+	void removeLeaf(int leaf);
+	int balance(int node_id);
+	void fixUpwards(int node_id);
+	void collectLeaves(int node_id, std::vector<void*>& result) const;
+};
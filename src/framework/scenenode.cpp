@@ -14,28 +14,40 @@ unsigned int mesh_selected = 0;
 
 SceneNode::SceneNode()
 {
+	this->handle = SceneStore::Get()->create(NULL, NULL, glm::mat4(1.f), this);
 	this->type = NODE_BASE;
 	this->name = std::string("Node" + std::to_string(this->lastNameId++));
 }
 
 SceneNode::SceneNode(const char* name)
 {
+	this->handle = SceneStore::Get()->create(NULL, NULL, glm::mat4(1.f), this);
 	this->type = NODE_BASE;
 	this->name = name;
 }
 
-SceneNode::~SceneNode() { }
+SceneNode::~SceneNode()
+{
+	SceneStore::Get()->destroy(this->handle);
+}
 
 void SceneNode::render(Camera* camera)
 {
-	if (this->material && this->visible)
-		this->material->render(this->mesh, this->model, camera);
+	Material* material = this->getMaterial();
+	if (material && this->isVisible())
+		material->render(this->getMesh(), this->getModel(), camera);
 }
 
 void SceneNode::renderWireframe(Camera* camera)
 {
 	WireframeMaterial mat = WireframeMaterial();
-	mat.render(this->mesh, this->model, camera);
+	mat.render(this->getMesh(), this->getModel(), camera);
+}
+
+BoundingBox SceneNode::getWorldBoundingBox()
+{
+	assert(this->getMesh());
+	return transformBoundingBox(this->getModel(), this->getMesh()->box);
 }
 
 void SceneNode::renderInMenu()
@@ -43,18 +55,28 @@ void SceneNode::renderInMenu()
 	// Model edit
 	if (ImGui::TreeNode("Model")) 
 	{
+		glm::mat4 model = this->getModel();
 		float matrixTranslation[3], matrixRotation[3], matrixScale[3];
-		ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(this->model), matrixTranslation, matrixRotation, matrixScale);
-		ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
-		ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
-		ImGui::DragFloat3("Scale", matrixScale, 0.1f);
-		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, glm::value_ptr(this->model));
+		ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(model), matrixTranslation, matrixRotation, matrixScale);
+		bool changed = ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
+		changed |= ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
+		changed |= ImGui::DragFloat3("Scale", matrixScale, 0.1f);
+		if (changed)
+		{
+			ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, glm::value_ptr(model));
+			this->setModel(model);
+		}
 		
 		ImGui::TreePop();
 	}
 
+	bool occluder = this->isOccluder();
+	if (ImGui::Checkbox("Occluder", &occluder))
+		this->setOccluder(occluder);
+
 	// Material
-	if (this->material && ImGui::TreeNode("Material"))
+	Material* material = this->getMaterial();
+	if (material && ImGui::TreeNode("Material"))
 	{
 		material->renderInMenu();
 		ImGui::TreePop();
@@ -75,14 +97,15 @@ VolumeNode::VolumeNode(const char* name)
 
 void VolumeNode::render(Camera* camera)
 {
-	if (this->material && this->visible)
-		this->material->render(this->mesh, this->model, camera);
+	Material* material = this->getMaterial();
+	if (material && this->isVisible())
+		material->render(this->getMesh(), this->getModel(), camera);
 }
 
 void VolumeNode::renderWireframe(Camera* camera)
 {
 	WireframeMaterial mat = WireframeMaterial();
-	mat.render(this->mesh, this->model, camera);
+	mat.render(this->getMesh(), this->getModel(), camera);
 }
 
 void VolumeNode::renderInMenu()
@@ -90,18 +113,24 @@ void VolumeNode::renderInMenu()
 	// Model edit
 	if (ImGui::TreeNode("Model"))
 	{
+		glm::mat4 model = this->getModel();
 		float matrixTranslation[3], matrixRotation[3], matrixScale[3];
-		ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(this->model), matrixTranslation, matrixRotation, matrixScale);
-		ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
-		ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
-		ImGui::DragFloat3("Scale", matrixScale, 0.1f);
-		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, glm::value_ptr(this->model));
+		ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(model), matrixTranslation, matrixRotation, matrixScale);
+		bool changed = ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
+		changed |= ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
+		changed |= ImGui::DragFloat3("Scale", matrixScale, 0.1f);
+		if (changed)
+		{
+			ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, glm::value_ptr(model));
+			this->setModel(model);
+		}
 
 		ImGui::TreePop();
 	}
 
 	// Material
-	if (this->material && ImGui::TreeNode("Material"))
+	Material* material = this->getMaterial();
+	if (material && ImGui::TreeNode("Material"))
 	{
 		material->renderInMenu();
 		ImGui::TreePop();
@@ -7,6 +7,7 @@
 #include "../graphics/mesh.h"
 #include "../graphics/material.h"
 #include "framework/utils.h"
+#include "scenestore.h"
 
 class Light;
 enum eType { NODE_BASE, NODE_VOLUME, NODE_LIGHT };
@@ -18,19 +19,34 @@ public:
 	static unsigned int lastNameId;
 	std::string name;
 
-	glm::mat4 model = glm::mat4(1.f);
-	Mesh* mesh = NULL;
-	Material* material = NULL;
-
-	bool visible = true;
+	// Model, mesh, material and flags live in the SceneStore
+	SceneHandle handle = SCENE_INVALID_HANDLE;
 
 	SceneNode();
 	SceneNode(const char* name);
-	~SceneNode();
+	virtual ~SceneNode();
+
+	const glm::mat4& getModel() const { return SceneStore::Get()->getModel(this->handle); }
+	void setModel(const glm::mat4& model) { SceneStore::Get()->setModel(this->handle, model); }
+	Mesh* getMesh() const { return SceneStore::Get()->getMesh(this->handle); }
+	void setMesh(Mesh* mesh) { SceneStore::Get()->setMesh(this->handle, mesh); }
+	Material* getMaterial() const { return SceneStore::Get()->getMaterial(this->handle); }
+	void setMaterial(Material* material) { SceneStore::Get()->setMaterial(this->handle, material); }
+	bool isVisible() const { return SceneStore::Get()->getFlag(this->handle, SCENE_VISIBLE); }
+	void setVisible(bool visible) { SceneStore::Get()->setFlag(this->handle, SCENE_VISIBLE, visible); }
+	bool isOccluder() const { return SceneStore::Get()->getFlag(this->handle, SCENE_OCCLUDER); } // rasterized in the software occlusion buffer
+	void setOccluder(bool occluder) { SceneStore::Get()->setFlag(this->handle, SCENE_OCCLUDER, occluder); }
 
 	virtual void render(Camera* camera);
 	virtual void renderWireframe(Camera* camera);
 	virtual void renderInMenu();
+
+	BoundingBox getWorldBoundingBox();
+
+private:
+	// the handle is released once, by the node that owns it
+	SceneNode(const SceneNode&) = delete;
+	SceneNode& operator=(const SceneNode&) = delete;
 };
 class VolumeNode : public SceneNode {
 public:
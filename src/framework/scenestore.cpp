@@ -0,0 +1,464 @@
+#include "scenestore.h"
+
+#include "jobs.h"
+#include "simd.h"
+#include "../graphics/mesh.h"
+#include "../graphics/material.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <random>
+#include <limits>
+#include <string>
+
+#include <glm/gtx/transform.hpp>
+
+#define SCENESTORE_GRAIN 4096 //nodes per job in the parallel scans
+
+SceneStore* SceneStore::Get()
+{
+	static SceneStore store;
+	return &store;
+}
+
+SceneHandle SceneStore::create(Mesh* mesh, Material* material, const glm::mat4& model, SceneNode* owner)
+{
+	version++;
+	uint32_t slot;
+	if (free_slots.size())
+	{
+		slot = free_slots.back();
+		free_slots.pop_back();
+	}
+	else
+	{
+		slot = (uint32_t)slot_to_dense.size();
+		assert(slot < (1 << 24));
+		slot_to_dense.push_back(0);
+		slot_generations.push_back(0);
+	}
+
+	uint32_t index = (uint32_t)size();
+	slot_to_dense[slot] = index;
+	dense_to_slot.push_back(slot);
+
+	models.push_back(model);
+	min_x.push_back(0.f); min_y.push_back(0.f); min_z.push_back(0.f);
+	max_x.push_back(0.f); max_y.push_back(0.f); max_z.push_back(0.f);
+	local_centers.push_back(mesh ? mesh->box.center : glm::vec3(0.f));
+	local_halfsizes.push_back(mesh ? mesh->box.halfsize : glm::vec3(0.f));
+	mesh_ids.push_back(registerMesh(mesh));
+	material_ids.push_back(registerMaterial(material));
+	flags.push_back(SCENE_VISIBLE | SCENE_DIRTY);
+	bvh_proxies.push_back(-1);
+	owners.push_back(owner);
+
+	return slot | ((uint32_t)slot_generations[slot] << 24);
+}
+
+void SceneStore::destroy(SceneHandle handle)
+{
+	version++;
+	uint32_t index = getIndex(handle);
+	uint32_t slot = handle & 0xFFFFFF;
+
+	if (bvh_proxies[index] != -1)
+		bvh.destroyProxy(bvh_proxies[index]);
+
+	//the last node takes the place of the removed one so the arrays stay packed
+	uint32_t last = (uint32_t)size() - 1;
+	if (index != last)
+	{
+		models[index] = models[last];
+		min_x[index] = min_x[last]; min_y[index] = min_y[last]; min_z[index] = min_z[last];
+		max_x[index] = max_x[last]; max_y[index] = max_y[last]; max_z[index] = max_z[last];
+		local_centers[index] = local_centers[last];
+		local_halfsizes[index] = local_halfsizes[last];
+		mesh_ids[index] = mesh_ids[last];
+		material_ids[index] = material_ids[last];
+		flags[index] = flags[last];
+		bvh_proxies[index] = bvh_proxies[last];
+		owners[index] = owners[last];
+		dense_to_slot[index] = dense_to_slot[last];
+		slot_to_dense[dense_to_slot[index]] = index;
+	}
+
+	models.pop_back();
+	min_x.pop_back(); min_y.pop_back(); min_z.pop_back();
+	max_x.pop_back(); max_y.pop_back(); max_z.pop_back();
+	local_centers.pop_back();
+	local_halfsizes.pop_back();
+	mesh_ids.pop_back();
+	material_ids.pop_back();
+	flags.pop_back();
+	bvh_proxies.pop_back();
+	owners.pop_back();
+	dense_to_slot.pop_back();
+
+	slot_generations[slot]++;
+	free_slots.push_back(slot);
+}
+
+bool SceneStore::isValid(SceneHandle handle) const
+{
+	if (handle == SCENE_INVALID_HANDLE)
+		return false;
+	uint32_t slot = handle & 0xFFFFFF;
+	return slot < slot_to_dense.size() && slot_generations[slot] == (uint8_t)(handle >> 24) && slot_to_dense[slot] < size() && dense_to_slot[slot_to_dense[slot]] == slot;
+}
+
+uint32_t SceneStore::getIndex(SceneHandle handle) const
+{
+	assert(isValid(handle));
+	return slot_to_dense[handle & 0xFFFFFF];
+}
+
+SceneHandle SceneStore::getHandle(uint32_t index) const
+{
+	uint32_t slot = dense_to_slot[index];
+	return slot | ((uint32_t)slot_generations[slot] << 24);
+}
+
+void SceneStore::setModel(SceneHandle handle, const glm::mat4& model)
+{
+	version++;
+	uint32_t index = getIndex(handle);
+	models[index] = model;
+	flags[index] |= SCENE_DIRTY;
+}
+
+Mesh* SceneStore::getMesh(SceneHandle handle) const
+{
+	uint32_t id = mesh_ids[getIndex(handle)];
+	return id == SCENE_INVALID_ID ? nullptr : meshes[id];
+}
+
+void SceneStore::setMesh(SceneHandle handle, Mesh* mesh)
+{
+	version++;
+	uint32_t index = getIndex(handle);
+	mesh_ids[index] = registerMesh(mesh);
+	local_centers[index] = mesh ? mesh->box.center : glm::vec3(0.f);
+	local_halfsizes[index] = mesh ? mesh->box.halfsize : glm::vec3(0.f);
+	flags[index] |= SCENE_DIRTY;
+}
+
+Material* SceneStore::getMaterial(SceneHandle handle) const
+{
+	uint32_t id = material_ids[getIndex(handle)];
+	return id == SCENE_INVALID_ID ? nullptr : materials[id];
+}
+
+void SceneStore::setMaterial(SceneHandle handle, Material* material)
+{
+	version++;
+	material_ids[getIndex(handle)] = registerMaterial(material);
+}
+
+void SceneStore::setFlag(SceneHandle handle, eSceneFlags flag, bool value)
+{
+	version++;
+	uint32_t index = getIndex(handle);
+	if (value)
+		flags[index] |= flag;
+	else
+		flags[index] &= ~flag;
+}
+
+void SceneStore::getWorldBounds(uint32_t index, glm::vec3& min, glm::vec3& max) const
+{
+	min = glm::vec3(min_x[index], min_y[index], min_z[index]);
+	max = glm::vec3(max_x[index], max_y[index], max_z[index]);
+}
+
+uint32_t SceneStore::registerMesh(Mesh* mesh)
+{
+	if (!mesh)
+		return SCENE_INVALID_ID;
+	//there are few different meshes compared to nodes
+	auto it = std::find(meshes.begin(), meshes.end(), mesh);
+	if (it != meshes.end())
+		return (uint32_t)(it - meshes.begin());
+	meshes.push_back(mesh);
+	return (uint32_t)meshes.size() - 1;
+}
+
+uint32_t SceneStore::registerMaterial(Material* material)
+{
+	if (!material)
+		return SCENE_INVALID_ID;
+	auto it = std::find(materials.begin(), materials.end(), material);
+	if (it != materials.end())
+		return (uint32_t)(it - materials.begin());
+	materials.push_back(material);
+	return (uint32_t)materials.size() - 1;
+}
+
+void SceneStore::updateBounds()
+{
+	int count = (int)size();
+
+	//world box of the transformed local box: center transformed, halfsize by the absolute matrix (Arvo)
+	parallelFor(count, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			if (!(flags[i] & SCENE_DIRTY))
+				continue;
+
+			if (mesh_ids[i] == SCENE_INVALID_ID)
+			{
+				//empty bounds, never visible
+				min_x[i] = min_y[i] = min_z[i] = std::numeric_limits<float>::max();
+				max_x[i] = max_y[i] = max_z[i] = -std::numeric_limits<float>::max();
+				continue;
+			}
+
+			const glm::mat4& m = models[i];
+			const glm::vec3& h = local_halfsizes[i];
+			glm::vec3 center = glm::vec3(m * glm::vec4(local_centers[i], 1.f));
+			glm::vec3 halfsize = glm::abs(glm::vec3(m[0])) * h.x + glm::abs(glm::vec3(m[1])) * h.y + glm::abs(glm::vec3(m[2])) * h.z;
+			min_x[i] = center.x - halfsize.x; min_y[i] = center.y - halfsize.y; min_z[i] = center.z - halfsize.z;
+			max_x[i] = center.x + halfsize.x; max_y[i] = center.y + halfsize.y; max_z[i] = center.z + halfsize.z;
+		}
+	}, SCENESTORE_GRAIN);
+}
+
+void SceneStore::updateBVH()
+{
+	//the tree is not thread safe, refit the moved nodes serially
+	int count = (int)size();
+	for (int i = 0; i < count; ++i)
+	{
+		if (!(flags[i] & SCENE_DIRTY))
+			continue;
+		flags[i] &= ~SCENE_DIRTY;
+
+		if (mesh_ids[i] == SCENE_INVALID_ID)
+		{
+			if (bvh_proxies[i] != -1)
+				bvh.destroyProxy(bvh_proxies[i]);
+			bvh_proxies[i] = -1;
+			continue;
+		}
+
+		glm::vec3 min, max;
+		getWorldBounds(i, min, max);
+		if (bvh_proxies[i] == -1)
+			bvh_proxies[i] = bvh.createProxy(min, max, (void*)(uintptr_t)getHandle(i));
+		else
+			bvh.moveProxy(bvh_proxies[i], min, max);
+	}
+}
+
+void SceneStore::cull(const glm::mat4& vp, std::vector<uint32_t>& visible) const
+{
+	visible.clear();
+	int count = (int)size();
+	if (!count)
+		return;
+
+	//planes from the viewprojection rows (Gribb & Hartmann), pointing inside
+	glm::vec4 row0(vp[0][0], vp[1][0], vp[2][0], vp[3][0]);
+	glm::vec4 row1(vp[0][1], vp[1][1], vp[2][1], vp[3][1]);
+	glm::vec4 row2(vp[0][2], vp[1][2], vp[2][2], vp[3][2]);
+	glm::vec4 row3(vp[0][3], vp[1][3], vp[2][3], vp[3][3]);
+	glm::vec4 planes[6] = { row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2 };
+
+	//every job writes its own list, they are joined in order after
+	int num_chunks = (count + SCENESTORE_GRAIN - 1) / SCENESTORE_GRAIN;
+	std::vector<std::vector<uint32_t>> chunk_visible(num_chunks);
+
+	parallelFor(count, [&](int begin, int end) {
+		std::vector<uint32_t>& out = chunk_visible[begin / SCENESTORE_GRAIN];
+		int i = begin;
+
+#ifdef USE_SSE
+		//4 nodes at a time, the box corner tested against each plane is the same for all of them
+		__m128 zero = _mm_setzero_ps();
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 inside = _mm_cmpeq_ps(zero, zero);
+			for (int p = 0; p < 6; ++p)
+			{
+				const glm::vec4& plane = planes[p];
+				__m128 x = _mm_loadu_ps(plane.x > 0.f ? &max_x[i] : &min_x[i]);
+				__m128 y = _mm_loadu_ps(plane.y > 0.f ? &max_y[i] : &min_y[i]);
+				__m128 z = _mm_loadu_ps(plane.z > 0.f ? &max_z[i] : &min_z[i]);
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, zero));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			for (int k = 0; mask && k < 4; ++k)
+				if ((mask & (1 << k)) && (flags[i + k] & SCENE_VISIBLE))
+					out.push_back(i + k);
+		}
+#endif
+
+		for (; i < end; ++i)
+		{
+			if (!(flags[i] & SCENE_VISIBLE))
+				continue;
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; ++p)
+			{
+				const glm::vec4& plane = planes[p];
+				float x = plane.x > 0.f ? max_x[i] : min_x[i];
+				float y = plane.y > 0.f ? max_y[i] : min_y[i];
+				float z = plane.z > 0.f ? max_z[i] : min_z[i];
+				inside = x * plane.x + y * plane.y + z * plane.z + plane.w >= 0.f;
+			}
+			if (inside)
+				out.push_back(i);
+		}
+	}, SCENESTORE_GRAIN);
+
+	for (const std::vector<uint32_t>& chunk : chunk_visible)
+		visible.insert(visible.end(), chunk.begin(), chunk.end());
+}
+
+void SceneStore::buildPackets(const std::vector<uint32_t>& visible, const glm::vec3& eye, std::vector<sRenderPacket>& packets) const
+{
+	packets.clear();
+	packets.reserve(visible.size());
+	for (uint32_t i : visible)
+	{
+		if (mesh_ids[i] == SCENE_INVALID_ID || material_ids[i] == SCENE_INVALID_ID)
+			continue;
+		glm::vec3 d = glm::vec3(min_x[i] + max_x[i], min_y[i] + max_y[i], min_z[i] + max_z[i]) * 0.5f - eye;
+		packets.push_back({ glm::dot(d, d), i, mesh_ids[i], material_ids[i] });
+	}
+
+	//back to front so the volumes blend in order
+	std::sort(packets.begin(), packets.end(), [](const sRenderPacket& a, const sRenderPacket& b) {
+		return a.distance > b.distance;
+	});
+}
+
+//node as it was stored before the SceneStore, one heap allocation per node
+struct sLegacyNode
+{
+	std::string name;
+	glm::mat4 model;
+	Mesh* mesh;
+	Material* material;
+	bool visible;
+	BoundingBox world_box;
+
+	virtual ~sLegacyNode() {}
+	virtual void update() { world_box = transformBoundingBox(model, mesh->box); }
+};
+
+class BenchmarkMaterial : public Material
+{
+public:
+	void setUniforms(Camera* camera, glm::mat4 model) {}
+	void render(Mesh* mesh, glm::mat4 model, Camera* camera) {}
+	void renderInMenu() {}
+};
+
+void SceneStore::benchmark(int num_nodes)
+{
+	typedef std::chrono::high_resolution_clock clock;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+
+	Mesh* mesh = new Mesh();
+	mesh->box = BoundingBox(glm::vec3(0.f), glm::vec3(1.f));
+	BenchmarkMaterial material;
+
+	SceneStore store;
+	std::vector<sLegacyNode*> legacy;
+	for (int i = 0; i < num_nodes; ++i)
+	{
+		glm::mat4 model = glm::translate(glm::vec3(dist(rng), dist(rng), dist(rng)) * 500.f - 250.f);
+		store.create(mesh, &material, model);
+
+		sLegacyNode* node = new sLegacyNode();
+		node->name = "node" + std::to_string(i);
+		node->model = model;
+		node->mesh = mesh;
+		node->material = &material;
+		node->visible = true;
+		legacy.push_back(node);
+	}
+
+	glm::mat4 projection = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 500.f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.f, 0.f, 300.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+	glm::mat4 vp = projection * view;
+
+	//every node moves every frame, the worst case
+	const int num_frames = 20;
+	float store_update = 0.f, store_refit = 0.f, store_cull = 0.f, store_packets = 0.f;
+	float legacy_update = 0.f, legacy_cull = 0.f;
+	std::vector<uint32_t> visible;
+	std::vector<sRenderPacket> packets;
+	std::vector<sLegacyNode*> legacy_visible;
+	glm::mat4 offset = glm::translate(glm::vec3(0.01f, 0.f, 0.f));
+
+	for (int frame = 0; frame < num_frames; ++frame)
+	{
+		auto start = clock::now();
+		for (size_t i = 0; i < store.size(); ++i)
+		{
+			store.models[i] = offset * store.models[i];
+			store.flags[i] |= SCENE_DIRTY;
+		}
+		store.updateBounds();
+		store_update += std::chrono::duration<float>(clock::now() - start).count();
+
+		start = clock::now();
+		store.updateBVH();
+		store_refit += std::chrono::duration<float>(clock::now() - start).count();
+
+		start = clock::now();
+		store.cull(vp, visible);
+		store_cull += std::chrono::duration<float>(clock::now() - start).count();
+
+		start = clock::now();
+		store.buildPackets(visible, glm::vec3(0.f, 0.f, 300.f), packets);
+		store_packets += std::chrono::duration<float>(clock::now() - start).count();
+
+		start = clock::now();
+		for (sLegacyNode* node : legacy)
+		{
+			node->model = offset * node->model;
+			node->update();
+		}
+		legacy_update += std::chrono::duration<float>(clock::now() - start).count();
+
+		start = clock::now();
+		legacy_visible.clear();
+		glm::vec4 row0(vp[0][0], vp[1][0], vp[2][0], vp[3][0]), row1(vp[0][1], vp[1][1], vp[2][1], vp[3][1]);
+		glm::vec4 row2(vp[0][2], vp[1][2], vp[2][2], vp[3][2]), row3(vp[0][3], vp[1][3], vp[2][3], vp[3][3]);
+		glm::vec4 planes[6] = { row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2 };
+		for (sLegacyNode* node : legacy)
+		{
+			glm::vec3 min = node->world_box.center - node->world_box.halfsize;
+			glm::vec3 max = node->world_box.center + node->world_box.halfsize;
+			bool inside = node->visible;
+			for (int p = 0; p < 6 && inside; ++p)
+			{
+				glm::vec3 corner(planes[p].x > 0.f ? max.x : min.x, planes[p].y > 0.f ? max.y : min.y, planes[p].z > 0.f ? max.z : min.z);
+				inside = glm::dot(glm::vec3(planes[p]), corner) + planes[p].w >= 0.f;
+			}
+			if (inside)
+				legacy_visible.push_back(node);
+		}
+		legacy_cull += std::chrono::duration<float>(clock::now() - start).count();
+	}
+
+	float ms = 1000.f / num_frames;
+	std::cout << " + Scene store: " << num_nodes << " nodes, " << visible.size() << " visible (" << legacy_visible.size() << " legacy), " << getNumJobThreads() << " threads" << std::endl;
+	std::cout << "   bounds " << store_update * ms << " ms (legacy " << legacy_update * ms << " ms)" << std::endl;
+	std::cout << "   BVH refit " << store_refit * ms << " ms" << std::endl;
+	std::cout << "   cull " << store_cull * ms << " ms (legacy " << legacy_cull * ms << " ms)" << std::endl;
+	std::cout << "   packets " << store_packets * ms << " ms" << std::endl;
+
+	for (sLegacyNode* node : legacy)
+		delete node;
+	delete mesh;
+}
@@ -0,0 +1,108 @@
+/*  Data oriented storage of the scene: the per frame data of every node lives in contiguous
+	SoA arrays so update, culling and packet build are linear scans that vectorize and run in
+	parallel. Nodes are referenced with handles that stay valid when other nodes are removed.
+	SceneNode is a facade that keeps a handle to its data in the store.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/vec3.hpp>
+#include <glm/matrix.hpp>
+
+#include "scenebvh.h"
+
+class Mesh;
+class Material;
+class SceneNode;
+
+//slot index in the low 24 bits, generation in the high 8 bits to detect stale handles
+typedef uint32_t SceneHandle;
+#define SCENE_INVALID_HANDLE 0xFFFFFFFF
+#define SCENE_INVALID_ID 0xFFFFFFFF
+
+enum eSceneFlags : uint8_t {
+	SCENE_VISIBLE = 1,
+	SCENE_OCCLUDER = 2,
+	SCENE_DIRTY = 4 //model changed, bounds and BVH proxy pending update
+};
+
+struct sRenderPacket
+{
+	float distance; //to the camera, packets are sorted back to front
+	uint32_t node; //dense index
+	uint32_t mesh_id;
+	uint32_t material_id;
+};
+
+class SceneStore
+{
+public:
+	//hot data, indexed by the dense index [0, size)
+	std::vector<glm::mat4> models;
+	std::vector<float> min_x, min_y, min_z; //world bounds
+	std::vector<float> max_x, max_y, max_z;
+	std::vector<glm::vec3> local_centers; //mesh bounds
+	std::vector<glm::vec3> local_halfsizes;
+	std::vector<uint32_t> mesh_ids;
+	std::vector<uint32_t> material_ids;
+	std::vector<uint8_t> flags;
+
+	//cold data
+	std::vector<int> bvh_proxies;
+	std::vector<SceneNode*> owners; //facade of the node, can be null
+	std::vector<uint32_t> dense_to_slot;
+
+	//handle indirection
+	std::vector<uint32_t> slot_to_dense;
+	std::vector<uint8_t> slot_generations;
+	std::vector<uint32_t> free_slots;
+
+	//resources referenced by id
+	std::vector<Mesh*> meshes;
+	std::vector<Material*> materials;
+
+	//world bounds of the nodes, for picking and spatial queries. The user data is the handle
+	SceneBVH bvh;
+
+	//incremented by every change to the nodes, to detect that the scene is static
+	unsigned int version = 0;
+
+	SceneStore() {};
+
+	//store used by the SceneNode facades
+	static SceneStore* Get();
+
+	SceneHandle create(Mesh* mesh, Material* material, const glm::mat4& model, SceneNode* owner = nullptr);
+	void destroy(SceneHandle handle);
+	bool isValid(SceneHandle handle) const;
+	uint32_t getIndex(SceneHandle handle) const; //dense index, changes when other nodes are destroyed
+	SceneHandle getHandle(uint32_t index) const;
+	size_t size() const { return models.size(); }
+
+	const glm::mat4& getModel(SceneHandle handle) const { return models[getIndex(handle)]; }
+	void setModel(SceneHandle handle, const glm::mat4& model);
+	Mesh* getMesh(SceneHandle handle) const;
+	void setMesh(SceneHandle handle, Mesh* mesh);
+	Material* getMaterial(SceneHandle handle) const;
+	void setMaterial(SceneHandle handle, Material* material);
+	bool getFlag(SceneHandle handle, eSceneFlags flag) const { return (flags[getIndex(handle)] & flag) != 0; }
+	void setFlag(SceneHandle handle, eSceneFlags flag, bool value);
+	void getWorldBounds(uint32_t index, glm::vec3& min, glm::vec3& max) const;
+
+	uint32_t registerMesh(Mesh* mesh);
+	uint32_t registerMaterial(Material* material);
+
+	//recomputes the world bounds of the dirty nodes and refits their BVH proxies
+	void update() { updateBounds(); updateBVH(); }
+	void updateBounds();
+	void updateBVH(); //clears the dirty flags
+	//indices of the visible nodes inside the frustum
+	void cull(const glm::mat4& viewprojection, std::vector<uint32_t>& visible) const;
+	//draw packets of the visible nodes with material, sorted back to front
+	void buildPackets(const std::vector<uint32_t>& visible, const glm::vec3& eye, std::vector<sRenderPacket>& packets) const;
+
+	static void benchmark(int num_nodes = 100000);
+};
@@ -0,0 +1,10 @@
+/*  SIMD helpers: SSE2 is available on every x86-64 compiler we target,
+	other architectures (Apple Silicon) fall back to the scalar paths.
+*/
+
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define USE_SSE
+	#include <emmintrin.h>
+#endif
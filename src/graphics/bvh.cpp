@@ -0,0 +1,660 @@
+#include "bvh.h"
+
+#include "mesh.h"
+#include "../framework/jobs.h"
+#include "../framework/simd.h"
+
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#define BVH_STACK_SIZE 64
+//a node of a level pops one entry and pushes up to four, so the stack of the queries holds 1 + 3 * levels entries
+#define BVH_MAX_DEPTH (BVH_STACK_SIZE - 1)
+
+struct sBuildNode
+{
+	glm::vec3 min;
+	glm::vec3 max;
+	int left = -1; //right child is always left + 1
+	int first = 0;
+	int count = 0; //0 for inner nodes
+};
+
+struct sBuildContext
+{
+	std::vector<glm::vec3> tri_min;
+	std::vector<glm::vec3> tri_max;
+	std::vector<glm::vec3> centroids;
+	std::vector<unsigned int> indices;
+	std::vector<sBuildNode> nodes;
+	std::atomic<int> nodes_used{ 0 };
+	bool parallel = true;
+};
+
+static float surfaceArea(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 e = max - min;
+	if (e.x < 0.f || e.y < 0.f || e.z < 0.f)
+		return 0.f;
+	return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+struct sBin
+{
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+	int count = 0;
+};
+
+static void buildNode(sBuildContext& ctx, int node_id, int first, int count, int depth)
+{
+	sBuildNode& node = ctx.nodes[node_id];
+	node.first = first;
+	node.count = count;
+
+	//bounds of the triangles and of their centroids
+	glm::vec3 cmin = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 cmax = glm::vec3(-std::numeric_limits<float>::max());
+	node.min = cmin;
+	node.max = cmax;
+	for (int i = first; i < first + count; ++i)
+	{
+		unsigned int tri = ctx.indices[i];
+		node.min = glm::min(node.min, ctx.tri_min[tri]);
+		node.max = glm::max(node.max, ctx.tri_max[tri]);
+		cmin = glm::min(cmin, ctx.centroids[tri]);
+		cmax = glm::max(cmax, ctx.centroids[tri]);
+	}
+
+	//clustered or degenerate triangles can split one at a time, past the depth the stack can hold they stay in a bigger leaf
+	if (count <= BVH_MAX_LEAF_TRIANGLES || depth >= BVH_MAX_DEPTH)
+		return;
+
+	//binned SAH, evaluates BVH_NUM_BINS - 1 split planes per axis
+	float best_cost = std::numeric_limits<float>::max();
+	int best_axis = -1;
+	int best_split = 0;
+	glm::vec3 extent = cmax - cmin;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		//a denormal extent would give an infinite scale and bins out of range
+		if (extent[axis] <= 0.f || !std::isfinite(BVH_NUM_BINS / extent[axis]))
+			continue;
+
+		sBin bins[BVH_NUM_BINS];
+		float scale = BVH_NUM_BINS / extent[axis];
+		for (int i = first; i < first + count; ++i)
+		{
+			unsigned int tri = ctx.indices[i];
+			int b = std::min(BVH_NUM_BINS - 1, (int)((ctx.centroids[tri][axis] - cmin[axis]) * scale));
+			bins[b].count++;
+			bins[b].min = glm::min(bins[b].min, ctx.tri_min[tri]);
+			bins[b].max = glm::max(bins[b].max, ctx.tri_max[tri]);
+		}
+
+		//sweep from both sides
+		float left_area[BVH_NUM_BINS - 1], right_area[BVH_NUM_BINS - 1];
+		int left_count[BVH_NUM_BINS - 1], right_count[BVH_NUM_BINS - 1];
+		sBin left, right;
+		for (int i = 0; i < BVH_NUM_BINS - 1; ++i)
+		{
+			left.count += bins[i].count;
+			left.min = glm::min(left.min, bins[i].min);
+			left.max = glm::max(left.max, bins[i].max);
+			left_count[i] = left.count;
+			left_area[i] = surfaceArea(left.min, left.max);
+
+			int j = BVH_NUM_BINS - 1 - i;
+			right.count += bins[j].count;
+			right.min = glm::min(right.min, bins[j].min);
+			right.max = glm::max(right.max, bins[j].max);
+			right_count[j - 1] = right.count;
+			right_area[j - 1] = surfaceArea(right.min, right.max);
+		}
+
+		for (int i = 0; i < BVH_NUM_BINS - 1; ++i)
+		{
+			if (!left_count[i] || !right_count[i])
+				continue;
+			float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_split = i;
+			}
+		}
+	}
+
+	//all centroids in the same spot, nothing to split
+	if (best_axis == -1)
+		return;
+
+	//only keep a leaf if splitting is more expensive than intersecting every triangle (traversal cost = 1)
+	float leaf_cost = count * surfaceArea(node.min, node.max);
+	if (best_cost + surfaceArea(node.min, node.max) >= leaf_cost && count <= BVH_MAX_LEAF_TRIANGLES * 4)
+		return;
+
+	//partition the indices in place
+	float scale = BVH_NUM_BINS / extent[best_axis];
+	auto middle = std::partition(ctx.indices.begin() + first, ctx.indices.begin() + first + count, [&](unsigned int tri) {
+		int b = std::min(BVH_NUM_BINS - 1, (int)((ctx.centroids[tri][best_axis] - cmin[best_axis]) * scale));
+		return b <= best_split;
+	});
+	int left_count = (int)(middle - ctx.indices.begin()) - first;
+	if (left_count == 0 || left_count == count)
+		return;
+
+	int left_id = ctx.nodes_used.fetch_add(2);
+	node.left = left_id;
+	node.count = 0;
+
+	//the ranges of both children are disjoint so they can be built concurrently
+	if (ctx.parallel && count > BVH_PARALLEL_THRESHOLD)
+	{
+		parallelFor(2, [&](int begin, int end) {
+			for (int i = begin; i < end; ++i)
+			{
+				if (i == 0)
+					buildNode(ctx, left_id, first, left_count, depth + 1);
+				else
+					buildNode(ctx, left_id + 1, first + left_count, count - left_count, depth + 1);
+			}
+		});
+	}
+	else
+	{
+		buildNode(ctx, left_id, first, left_count, depth + 1);
+		buildNode(ctx, left_id + 1, first + left_count, count - left_count, depth + 1);
+	}
+}
+
+static void setEmptySlot(sBVH4Node& node, int slot)
+{
+	node.min_x[slot] = node.min_y[slot] = node.min_z[slot] = std::numeric_limits<float>::max();
+	node.max_x[slot] = node.max_y[slot] = node.max_z[slot] = -std::numeric_limits<float>::max();
+	node.child[slot] = 0;
+	node.count[slot] = -1;
+}
+
+//pulls grandchildren up until every node has 4 children (or only leaves are left)
+static int collapseNode(const sBuildContext& ctx, std::vector<sBVH4Node>& nodes, int binary_id)
+{
+	const sBuildNode& binary = ctx.nodes[binary_id];
+
+	int children[4];
+	int num_children = 0;
+	if (binary.count)
+		children[num_children++] = binary_id; //root is a leaf
+	else
+	{
+		children[num_children++] = binary.left;
+		children[num_children++] = binary.left + 1;
+	}
+
+	while (num_children < 4)
+	{
+		int best = -1;
+		float best_area = -1.f;
+		for (int i = 0; i < num_children; ++i)
+		{
+			const sBuildNode& child = ctx.nodes[children[i]];
+			float area = surfaceArea(child.min, child.max);
+			if (!child.count && area > best_area)
+			{
+				best = i;
+				best_area = area;
+			}
+		}
+		if (best == -1)
+			break;
+		int left = ctx.nodes[children[best]].left;
+		children[best] = left;
+		children[num_children++] = left + 1;
+	}
+
+	int node_id = (int)nodes.size();
+	nodes.push_back(sBVH4Node());
+
+	for (int slot = 0; slot < 4; ++slot)
+	{
+		if (slot >= num_children)
+		{
+			setEmptySlot(nodes[node_id], slot);
+			continue;
+		}
+
+		const sBuildNode& child = ctx.nodes[children[slot]];
+		int child_index = child.count ? child.first : collapseNode(ctx, nodes, children[slot]);
+
+		//the vector may have grown, do not keep references across the recursion
+		sBVH4Node& node = nodes[node_id];
+		node.min_x[slot] = child.min.x; node.min_y[slot] = child.min.y; node.min_z[slot] = child.min.z;
+		node.max_x[slot] = child.max.x; node.max_y[slot] = child.max.y; node.max_z[slot] = child.max.z;
+		node.child[slot] = child_index;
+		node.count[slot] = child.count;
+	}
+
+	return node_id;
+}
+
+bool MeshBVH::build(Mesh* mesh, bool parallel)
+{
+	std::vector<glm::vec3> positions;
+
+	bool is_interleaved = mesh->interleaved.size() != 0;
+	size_t num_vertices = is_interleaved ? mesh->interleaved.size() : mesh->vertices.size();
+
+	if (mesh->indices.size())
+	{
+		positions.reserve(mesh->indices.size() * 3);
+		for (const glm::vec3& tri : mesh->indices)
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int index = (unsigned int)tri[k];
+				assert(index < num_vertices);
+				positions.push_back(is_interleaved ? mesh->interleaved[index].vertex : mesh->vertices[index]);
+			}
+	}
+	else if (is_interleaved)
+	{
+		positions.resize(num_vertices);
+		for (size_t i = 0; i < num_vertices; ++i)
+			positions[i] = mesh->interleaved[i].vertex;
+	}
+	else
+		positions = mesh->vertices;
+
+	return build(positions, parallel);
+}
+
+bool MeshBVH::build(const std::vector<glm::vec3>& positions, bool parallel)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	int num_triangles = (int)(positions.size() / 3);
+	nodes.clear();
+	triangles.clear();
+	triangle_ids.clear();
+	if (!num_triangles)
+		return false;
+
+	sBuildContext ctx;
+	ctx.parallel = parallel;
+	ctx.tri_min.resize(num_triangles);
+	ctx.tri_max.resize(num_triangles);
+	ctx.centroids.resize(num_triangles);
+	ctx.indices.resize(num_triangles);
+	ctx.nodes.resize(num_triangles * 2);
+	ctx.nodes_used = 1;
+
+	parallelFor(num_triangles, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			const glm::vec3& a = positions[i * 3];
+			const glm::vec3& b = positions[i * 3 + 1];
+			const glm::vec3& c = positions[i * 3 + 2];
+			ctx.tri_min[i] = glm::min(a, glm::min(b, c));
+			ctx.tri_max[i] = glm::max(a, glm::max(b, c));
+			ctx.centroids[i] = (ctx.tri_min[i] + ctx.tri_max[i]) * 0.5f;
+			ctx.indices[i] = i;
+		}
+	}, 4096);
+
+	buildNode(ctx, 0, 0, num_triangles, 0);
+
+	aabb_min = ctx.nodes[0].min;
+	aabb_max = ctx.nodes[0].max;
+
+	//flatten into the 4-wide layout, children are emitted depth first so siblings stay close in memory
+	nodes.reserve(ctx.nodes_used / 2 + 1);
+	collapseNode(ctx, nodes, 0);
+
+	triangles.resize(num_triangles);
+	triangle_ids = ctx.indices;
+	parallelFor(num_triangles, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			unsigned int tri = ctx.indices[i];
+			sBVHTriangle& t = triangles[i];
+			t.v0 = positions[tri * 3];
+			t.e1 = positions[tri * 3 + 1] - t.v0;
+			t.e2 = positions[tri * 3 + 2] - t.v0;
+		}
+	}, 4096);
+
+	build_time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+	return true;
+}
+
+struct sRay
+{
+	glm::vec3 origin;
+	glm::vec3 direction;
+	glm::vec3 inv_direction;
+};
+
+static sRay makeRay(const glm::vec3& origin, const glm::vec3& direction)
+{
+	sRay ray;
+	ray.origin = origin;
+	ray.direction = direction;
+	//avoid 0 * inf = NaN in the slab test
+	for (int i = 0; i < 3; ++i)
+	{
+		float d = direction[i];
+		if (std::abs(d) < 1e-20f)
+			d = d < 0.f ? -1e-20f : 1e-20f;
+		ray.inv_direction[i] = 1.f / d;
+	}
+	return ray;
+}
+
+//returns a mask with the children hit and their entry distance
+static inline int intersectChildren(const sBVH4Node& node, const sRay& ray, float max_t, float* tnear)
+{
+#ifdef USE_SSE
+	__m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+	__m128 ix = _mm_set1_ps(ray.inv_direction.x), iy = _mm_set1_ps(ray.inv_direction.y), iz = _mm_set1_ps(ray.inv_direction.z);
+
+	__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_x), ox), ix);
+	__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_x), ox), ix);
+	__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_y), oy), iy);
+	__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_y), oy), iy);
+	__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_z), oz), iz);
+	__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_z), oz), iz);
+
+	__m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+	__m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(max_t)));
+
+	__m128i valid = _mm_cmpgt_epi32(_mm_load_si128((const __m128i*)node.count), _mm_set1_epi32(-1));
+	__m128 hit = _mm_and_ps(_mm_cmple_ps(tmin, tmax), _mm_castsi128_ps(valid));
+	_mm_storeu_ps(tnear, tmin);
+	return _mm_movemask_ps(hit);
+#else
+	int mask = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (node.count[i] < 0)
+			continue;
+		float t0x = (node.min_x[i] - ray.origin.x) * ray.inv_direction.x, t1x = (node.max_x[i] - ray.origin.x) * ray.inv_direction.x;
+		float t0y = (node.min_y[i] - ray.origin.y) * ray.inv_direction.y, t1y = (node.max_y[i] - ray.origin.y) * ray.inv_direction.y;
+		float t0z = (node.min_z[i] - ray.origin.z) * ray.inv_direction.z, t1z = (node.max_z[i] - ray.origin.z) * ray.inv_direction.z;
+		float tmin = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), 0.f));
+		float tmax = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), max_t));
+		tnear[i] = tmin;
+		if (tmin <= tmax)
+			mask |= 1 << i;
+	}
+	return mask;
+#endif
+}
+
+//Moller-Trumbore
+static inline bool intersectTriangle(const sBVHTriangle& tri, const sRay& ray, float& t, float& u, float& v)
+{
+	glm::vec3 p = glm::cross(ray.direction, tri.e2);
+	float det = glm::dot(tri.e1, p);
+	if (std::abs(det) < 1e-12f)
+		return false;
+	float inv_det = 1.f / det;
+	glm::vec3 s = ray.origin - tri.v0;
+	u = glm::dot(s, p) * inv_det;
+	if (u < 0.f || u > 1.f)
+		return false;
+	glm::vec3 q = glm::cross(s, tri.e1);
+	v = glm::dot(ray.direction, q) * inv_det;
+	if (v < 0.f || u + v > 1.f)
+		return false;
+	t = glm::dot(tri.e2, q) * inv_det;
+	return t > 0.f;
+}
+
+struct sStackEntry
+{
+	int child;
+	int count;
+	float tnear;
+};
+
+template<bool any_hit>
+static bool traverse(const MeshBVH& bvh, const sRay& ray, float max_dist, sRayHit* hit)
+{
+	if (bvh.nodes.empty())
+		return false;
+
+	sStackEntry stack[BVH_STACK_SIZE * 3];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0, 0.f };
+
+	float best_t = max_dist;
+	int best_tri = -1;
+	float best_u = 0.f, best_v = 0.f;
+
+	while (stack_size)
+	{
+		sStackEntry entry = stack[--stack_size];
+		if (entry.tnear > best_t)
+			continue;
+
+		if (entry.count > 0)
+		{
+			for (int i = entry.child; i < entry.child + entry.count; ++i)
+			{
+				float t, u, v;
+				if (intersectTriangle(bvh.triangles[i], ray, t, u, v) && t < best_t)
+				{
+					if (any_hit)
+						return true;
+					best_t = t;
+					best_tri = i;
+					best_u = u;
+					best_v = v;
+				}
+			}
+			continue;
+		}
+
+		const sBVH4Node& node = bvh.nodes[entry.child];
+		float tnear[4];
+		int mask = intersectChildren(node, ray, best_t, tnear);
+		if (!mask)
+			continue;
+
+		//push the hit children sorted far to near so the nearest is popped first
+		sStackEntry hits[4];
+		int num_hits = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(mask & (1 << i)))
+				continue;
+			sStackEntry e = { node.child[i], node.count[i], tnear[i] };
+			int j = num_hits++;
+			while (j > 0 && hits[j - 1].tnear < e.tnear)
+			{
+				hits[j] = hits[j - 1];
+				j--;
+			}
+			hits[j] = e;
+		}
+		assert(stack_size + num_hits <= BVH_STACK_SIZE * 3);
+		for (int i = 0; i < num_hits; ++i)
+			stack[stack_size++] = hits[i];
+	}
+
+	if (best_tri == -1)
+		return false;
+
+	if (hit)
+	{
+		const sBVHTriangle& tri = bvh.triangles[best_tri];
+		hit->t = best_t;
+		hit->triangle = bvh.triangle_ids[best_tri];
+		hit->u = best_u;
+		hit->v = best_v;
+		hit->normal = glm::cross(tri.e1, tri.e2);
+	}
+	return true;
+}
+
+bool MeshBVH::testRay(const glm::vec3& origin, const glm::vec3& direction, sRayHit& hit, float max_dist) const
+{
+	return traverse<false>(*this, makeRay(origin, direction), max_dist, &hit);
+}
+
+bool MeshBVH::testAnyHit(const glm::vec3& origin, const glm::vec3& direction, float max_dist) const
+{
+	return traverse<true>(*this, makeRay(origin, direction), max_dist, NULL);
+}
+
+//from Real-Time Collision Detection (Ericson), 5.1.5
+static glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if (d1 <= 0.f && d2 <= 0.f) return a;
+
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if (d3 >= 0.f && d4 <= d3) return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+		return a + ab * (d1 / (d1 - d3));
+
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if (d6 >= 0.f && d5 <= d6) return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+		return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+bool MeshBVH::testSphere(const glm::vec3& center, float radius, glm::vec3& collision, glm::vec3& normal) const
+{
+	if (nodes.empty())
+		return false;
+
+	sStackEntry stack[BVH_STACK_SIZE * 3];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0, 0.f };
+
+	float best_dist2 = radius * radius;
+	int best_tri = -1;
+
+	while (stack_size)
+	{
+		sStackEntry entry = stack[--stack_size];
+
+		if (entry.count > 0)
+		{
+			for (int i = entry.child; i < entry.child + entry.count; ++i)
+			{
+				const sBVHTriangle& tri = triangles[i];
+				glm::vec3 p = closestPointOnTriangle(center, tri.v0, tri.v0 + tri.e1, tri.v0 + tri.e2);
+				glm::vec3 d = center - p;
+				float dist2 = glm::dot(d, d);
+				if (dist2 <= best_dist2)
+				{
+					best_dist2 = dist2;
+					best_tri = i;
+					collision = p;
+				}
+			}
+			continue;
+		}
+
+		//box-sphere overlap with the current best distance
+		const sBVH4Node& node = nodes[entry.child];
+		for (int i = 0; i < 4; ++i)
+		{
+			if (node.count[i] < 0)
+				continue;
+			glm::vec3 bmin(node.min_x[i], node.min_y[i], node.min_z[i]);
+			glm::vec3 bmax(node.max_x[i], node.max_y[i], node.max_z[i]);
+			glm::vec3 d = center - glm::clamp(center, bmin, bmax);
+			if (glm::dot(d, d) <= best_dist2)
+			{
+				assert(stack_size < BVH_STACK_SIZE * 3);
+				stack[stack_size++] = { node.child[i], node.count[i], 0.f };
+			}
+		}
+	}
+
+	if (best_tri == -1)
+		return false;
+
+	glm::vec3 d = center - collision;
+	if (glm::dot(d, d) > 1e-12f)
+		normal = glm::normalize(d);
+	else
+		normal = glm::normalize(glm::cross(triangles[best_tri].e1, triangles[best_tri].e2));
+	return true;
+}
+
+void MeshBVH::benchmark(Mesh* mesh, int num_rays)
+{
+	MeshBVH bvh;
+	bvh.build(mesh, false);
+	float serial_time = bvh.build_time;
+	bvh.build(mesh, true);
+
+	std::cout << " + BVH " << mesh->name << ": " << bvh.triangles.size() << " tris, " << bvh.nodes.size() << " nodes, "
+		<< bvh.getMemorySize() / 1024 << " KB, build " << serial_time * 1000.f << " ms (1 thread) "
+		<< bvh.build_time * 1000.f << " ms (" << getNumJobThreads() << " threads)" << std::endl;
+
+	//rays from a sphere around the mesh towards random points inside its box
+	std::vector<glm::vec3> origins(num_rays);
+	std::vector<glm::vec3> directions(num_rays);
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+	glm::vec3 center = (bvh.aabb_min + bvh.aabb_max) * 0.5f;
+	glm::vec3 size = bvh.aabb_max - bvh.aabb_min;
+	float radius = glm::length(size);
+	for (int i = 0; i < num_rays; ++i)
+	{
+		glm::vec3 dir = glm::normalize(glm::vec3(dist(rng) - 0.5f, dist(rng) - 0.5f, dist(rng) - 0.5f) + glm::vec3(1e-4f));
+		origins[i] = center + dir * radius;
+		glm::vec3 target = bvh.aabb_min + size * glm::vec3(dist(rng), dist(rng), dist(rng));
+		directions[i] = glm::normalize(target - origins[i]);
+	}
+
+	std::atomic<int> hits{ 0 };
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < num_rays; ++i)
+	{
+		sRayHit hit;
+		if (bvh.testRay(origins[i], directions[i], hit))
+			hits++;
+	}
+	float single_time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	parallelFor(num_rays, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			sRayHit hit;
+			bvh.testRay(origins[i], directions[i], hit);
+		}
+	}, 1024);
+	float multi_time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "   " << num_rays << " rays, " << hits.load() << " hits: "
+		<< num_rays / single_time * 1e-6f << " Mrays/s (1 thread) "
+		<< num_rays / multi_time * 1e-6f << " Mrays/s (" << getNumJobThreads() << " threads)" << std::endl;
+}
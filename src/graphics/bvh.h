@@ -0,0 +1,70 @@
+/*  Bounding volume hierarchy over the triangles of a mesh, used for ray casting and picking.
+	It is built as a binary tree using binned SAH and collapsed into a 4-wide tree so
+	the four children boxes of a node can be tested at once with SSE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/vec3.hpp>
+
+#define BVH_NUM_BINS 16
+#define BVH_MAX_LEAF_TRIANGLES 4
+#define BVH_PARALLEL_THRESHOLD 4096 //subtrees bigger than this are built in parallel
+
+class Mesh;
+
+struct sRayHit
+{
+	float t;
+	unsigned int triangle; //index in the original mesh order
+	float u, v; //barycentrics
+	glm::vec3 normal; //geometric normal, not normalized
+};
+
+//4 children boxes stored SoA so they can be loaded directly in SSE registers (128 bytes, two cache lines)
+struct alignas(16) sBVH4Node
+{
+	float min_x[4], min_y[4], min_z[4];
+	float max_x[4], max_y[4], max_z[4];
+	int32_t child[4]; //node index or first triangle when leaf
+	int32_t count[4]; //0: inner node, > 0: num triangles in leaf, -1: empty slot
+};
+
+//triangles are stored in leaf order with the edges precomputed for Moller-Trumbore
+struct sBVHTriangle
+{
+	glm::vec3 v0;
+	glm::vec3 e1;
+	glm::vec3 e2;
+};
+
+class MeshBVH
+{
+public:
+	std::vector<sBVH4Node> nodes;
+	std::vector<sBVHTriangle> triangles;
+	std::vector<unsigned int> triangle_ids; //leaf order -> mesh triangle
+	glm::vec3 aabb_min;
+	glm::vec3 aabb_max;
+
+	float build_time = 0.f; //in seconds
+
+	MeshBVH() {};
+
+	//reads the triangles from the mesh (interleaved, vertices or indexed)
+	bool build(Mesh* mesh, bool parallel = true);
+	bool build(const std::vector<glm::vec3>& positions, bool parallel = true);
+
+	//queries in object space
+	bool testRay(const glm::vec3& origin, const glm::vec3& direction, sRayHit& hit, float max_dist = 3.4e+38F) const;
+	bool testAnyHit(const glm::vec3& origin, const glm::vec3& direction, float max_dist = 3.4e+38F) const;
+	bool testSphere(const glm::vec3& center, float radius, glm::vec3& collision, glm::vec3& normal) const;
+
+	size_t getMemorySize() const { return nodes.size() * sizeof(sBVH4Node) + triangles.size() * sizeof(sBVHTriangle) + triangle_ids.size() * sizeof(unsigned int); }
+
+	//prints build time and rays/sec for the given mesh
+	static void benchmark(Mesh* mesh, int num_rays = 1000000);
+};
@@ -0,0 +1,180 @@
+#include "distancefield.h"
+
+#include "texture.h"
+#include "volumegrid.h"
+#include "../framework/jobs.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define EDT_INFINITY 1e20f
+
+DistanceField::~DistanceField()
+{
+	if (texture)
+		delete texture;
+}
+
+//squared distance of every sample to the nearest site, f is 0 at the sites and EDT_INFINITY elsewhere in the first
+//pass, then the squared distances of the previous axis. v and z hold the parabolas of the lower envelope
+static void distanceTransform1D(const float* f, float* d, int n, int* v, float* z)
+{
+	int k = -1;
+	for (int q = 0; q < n; ++q)
+	{
+		if (f[q] >= EDT_INFINITY)
+			continue;
+		float s = -EDT_INFINITY;
+		while (k >= 0)
+		{
+			s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.f * (q - v[k]));
+			if (s > z[k])
+				break;
+			--k;
+		}
+		++k;
+		v[k] = q;
+		z[k] = k ? s : -EDT_INFINITY;
+	}
+
+	if (k < 0)
+	{
+		std::fill(d, d + n, EDT_INFINITY);
+		return;
+	}
+	z[k + 1] = EDT_INFINITY;
+	for (int q = 0, j = 0; q < n; ++q)
+	{
+		while (z[j + 1] < q)
+			++j;
+		d[q] = (q - v[j]) * (q - v[j]) + f[v[j]];
+	}
+}
+
+void DistanceField::build(const VolumeGrid& grid, float isovalue, bool parallel)
+{
+	const int res = grid.resolution;
+	const size_t count = grid.data.size();
+	this->resolution = res;
+	this->isovalue = isovalue;
+	if (texture)
+		delete texture;
+	texture = nullptr;
+
+	//distance to the nearest inside voxel and to the nearest outside one
+	std::vector<float> outside(count), inside(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		bool in = std::min(grid.data[i], 1.f) >= isovalue;
+		outside[i] = in ? 0.f : EDT_INFINITY;
+		inside[i] = in ? EDT_INFINITY : 0.f;
+	}
+
+	//one pass per axis over the res^2 lines along it
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		int stride = axis == 0 ? 1 : (axis == 1 ? res : res * res);
+		auto lines = [&](int begin, int end) {
+			std::vector<float> f(res), d(res), z(res + 1);
+			std::vector<int> v(res);
+			for (int l = begin; l < end; ++l)
+			{
+				size_t base = axis == 0 ? (size_t)l * res : (axis == 1 ? (l % res) + (size_t)(l / res) * res * res : l);
+				for (std::vector<float>* field : { &outside, &inside })
+				{
+					float* values = &(*field)[base];
+					for (int i = 0; i < res; ++i)
+						f[i] = values[i * stride];
+					distanceTransform1D(&f[0], &d[0], res, &v[0], &z[0]);
+					for (int i = 0; i < res; ++i)
+						values[i * stride] = d[i];
+				}
+			}
+		};
+		if (parallel)
+			parallelFor(res * res, lines, 64);
+		else
+			lines(0, res * res);
+	}
+
+	//the surface is between the centers of an inside and an outside voxel, far values are clamped for the half floats
+	float far_distance = res * 2.f;
+	data.resize(count);
+	for (size_t i = 0; i < count; ++i)
+		data[i] = outside[i] > 0.f ? std::min(sqrtf(outside[i]) - 0.5f, far_distance) : -std::min(sqrtf(inside[i]) - 0.5f, far_distance);
+}
+
+float DistanceField::sample(const glm::vec3& uvw) const
+{
+	//texel centers like GL_LINEAR with GL_CLAMP_TO_EDGE
+	glm::vec3 p = glm::clamp(uvw * (float)resolution - 0.5f, glm::vec3(0.f), glm::vec3((float)(resolution - 1)));
+	glm::ivec3 a = glm::min(glm::ivec3(p), glm::ivec3(resolution - 2));
+	glm::vec3 f = p - glm::vec3(a);
+	auto voxel = [&](int x, int y, int z) {
+		return data[(a.x + x) + ((a.y + y) + (a.z + z) * resolution) * resolution];
+	};
+	float c00 = voxel(0, 0, 0) * (1.f - f.x) + voxel(1, 0, 0) * f.x;
+	float c10 = voxel(0, 1, 0) * (1.f - f.x) + voxel(1, 1, 0) * f.x;
+	float c01 = voxel(0, 0, 1) * (1.f - f.x) + voxel(1, 0, 1) * f.x;
+	float c11 = voxel(0, 1, 1) * (1.f - f.x) + voxel(1, 1, 1) * f.x;
+	float c0 = c00 * (1.f - f.y) + c10 * f.y;
+	float c1 = c01 * (1.f - f.y) + c11 * f.y;
+	return c0 * (1.f - f.z) + c1 * f.z;
+}
+
+bool DistanceField::trace(const VolumeGrid& grid, const glm::vec3& origin, const glm::vec3& dir, float ta, float tb, int refine_steps, float& t_hit, int& samples) const
+{
+	auto texcoord = [&](float t) {
+		return (origin + dir * t + 1.f) * 0.5f;
+	};
+	//the field may be a bit long near the surface, the density decides and the step never gets too short
+	float voxel = 2.f / resolution;
+	float t = ta, t_prev = ta;
+	while (t < tb)
+	{
+		float distance = sample(texcoord(t)) * voxel;
+		samples++;
+		if (distance <= 0.f)
+		{
+			float back = grid.sample(texcoord(t));
+			samples++;
+			if (back >= isovalue)
+			{
+				float t0 = t_prev, t1 = t;
+				float front = grid.sample(texcoord(t0));
+				samples++;
+				for (int i = 0; i < refine_steps && t0 < t1; ++i)
+				{
+					float tm = 0.5f * (t0 + t1);
+					float dm = grid.sample(texcoord(tm));
+					samples++;
+					if (dm >= isovalue)
+					{
+						t1 = tm;
+						back = dm;
+					}
+					else
+					{
+						t0 = tm;
+						front = dm;
+					}
+				}
+				t_hit = t0 + (t1 - t0) * std::min(std::max((isovalue - front) / std::max(back - front, 1e-6f), 0.f), 1.f);
+				return true;
+			}
+		}
+		t_prev = t;
+		t += std::max(distance, voxel * 0.5f);
+	}
+	return false;
+}
+
+Texture* DistanceField::getTexture()
+{
+	if (texture || data.empty())
+		return texture;
+
+	texture = new Texture();
+	texture->create3D(resolution, resolution, resolution, GL_RED, GL_FLOAT, false, &data[0], GL_R16F);
+	return texture;
+}
@@ -0,0 +1,42 @@
+/*  Signed distance to the isosurface of a density grid, for sphere tracing. The voxels are split
+	in inside and outside at the isovalue and the exact euclidean distance transform of both sets
+	is taken, separable in three passes of lower envelopes of parabolas (Felzenszwalb 2012).
+	The distance is in voxels, negative inside, to the midpoint between the voxel centers.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+class Texture;
+class VolumeGrid;
+
+class DistanceField
+{
+public:
+	int resolution = 0;
+	float isovalue = -1.f; //of the density clamped to [0, 1] like the texture
+	std::vector<float> data; //x fastest, in voxels
+
+	DistanceField() {};
+	~DistanceField();
+
+	void build(const VolumeGrid& grid, float isovalue, bool parallel = true);
+	//texture space, clamped and trilinear like the texture
+	float sample(const glm::vec3& uvw) const;
+
+	//CPU reference of the sphere tracing of isosurface.fs through the box [-1, 1]: steps of the distance,
+	//the density confirms the hit where the field is negative and the last step is bisected
+	bool trace(const VolumeGrid& grid, const glm::vec3& origin, const glm::vec3& dir, float ta, float tb, int refine_steps, float& t_hit, int& samples) const;
+
+	//R16F texture, rebuilt after every build
+	Texture* getTexture();
+
+private:
+	Texture* texture = nullptr;
+
+	DistanceField(const DistanceField&) = delete;
+	DistanceField& operator=(const DistanceField&) = delete;
+};
@@ -0,0 +1,102 @@
+#include "fbo.h"
+
+#include "texture.h"
+#include "../framework/utils.h"
+
+#include <iostream>
+#include <cassert>
+
+FBO::FBO()
+{
+	fbo_id = 0;
+	for (int i = 0; i < FBO_MAX_COLOR_TEXTURES; ++i)
+	{
+		color_textures[i] = NULL;
+		bufs[i] = GL_COLOR_ATTACHMENT0 + i;
+	}
+	depth_texture = NULL;
+	num_color_textures = 0;
+	width = height = 0;
+	owns_textures = false;
+	previous_fbo = 0;
+}
+
+FBO::~FBO()
+{
+	if (owns_textures)
+		freeTextures();
+	if (fbo_id)
+		glDeleteFramebuffers(1, &fbo_id);
+}
+
+void FBO::freeTextures()
+{
+	for (int i = 0; i < FBO_MAX_COLOR_TEXTURES; ++i)
+	{
+		if (color_textures[i])
+			delete color_textures[i];
+		color_textures[i] = NULL;
+	}
+	if (depth_texture)
+		delete depth_texture;
+	depth_texture = NULL;
+	num_color_textures = 0;
+}
+
+bool FBO::create(int width, int height, int num_textures, int format, int type, bool use_depth_texture, int internal_format)
+{
+	assert(width && height && num_textures > 0 && num_textures <= FBO_MAX_COLOR_TEXTURES);
+
+	if (owns_textures)
+		freeTextures();
+	if (!fbo_id)
+		glGenFramebuffers(1, &fbo_id);
+
+	this->width = width;
+	this->height = height;
+	this->num_color_textures = num_textures;
+	this->owns_textures = true;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+
+	for (int i = 0; i < num_textures; ++i)
+	{
+		color_textures[i] = new Texture(width, height, format, type, false, NULL, internal_format);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, color_textures[i]->texture_id, 0);
+	}
+
+	if (use_depth_texture)
+	{
+		depth_texture = new Texture(width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, false, NULL, GL_DEPTH_COMPONENT24);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture->texture_id, 0);
+	}
+
+	glDrawBuffers(num_textures, bufs);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "[ERROR] FBO not complete, status: " << status << std::endl;
+		return false;
+	}
+
+	assert(checkGLErrors() && "Error creating FBO");
+	return true;
+}
+
+void FBO::bind()
+{
+	assert(fbo_id && "FBO not created");
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_fbo);
+	glGetIntegerv(GL_VIEWPORT, previous_viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	glViewport(0, 0, width, height);
+}
+
+void FBO::unbind()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, previous_fbo);
+	glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2], previous_viewport[3]);
+}
@@ -0,0 +1,41 @@
+/*  FrameBufferObject: helps rendering the scene inside textures, used by the passes that render
+	at a different resolution than the window or that need to read the depth buffer.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#define FBO_MAX_COLOR_TEXTURES 4
+
+class Texture;
+
+class FBO
+{
+public:
+	GLuint fbo_id;
+	Texture* color_textures[FBO_MAX_COLOR_TEXTURES];
+	Texture* depth_texture;
+	int num_color_textures;
+	GLenum bufs[FBO_MAX_COLOR_TEXTURES];
+	int width;
+	int height;
+	bool owns_textures;
+
+	FBO();
+	~FBO();
+
+	//creates the textures, internal_format allows float targets (GL_RGBA16F)
+	bool create(int width, int height, int num_textures = 1, int format = GL_RGBA, int type = GL_UNSIGNED_BYTE, bool use_depth_texture = true, int internal_format = 0);
+
+	//renders inside the textures, the viewport is set to the size of the FBO
+	void bind();
+	//restores the framebuffer and viewport that were active when binding
+	void unbind();
+
+	void freeTextures();
+
+private:
+	GLint previous_fbo;
+	GLint previous_viewport[4];
+};
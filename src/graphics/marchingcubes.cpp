@@ -0,0 +1,426 @@
+#include "marchingcubes.h"
+
+#include "mesh.h"
+#include "volumegrid.h"
+#include "volumefile.h"
+#include "../framework/jobs.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+
+#define MC_MAX_CASE_EDGES 31 //10 triangles at most and the end mark
+
+//corners of the cube are bit 0 for x, 1 for y and 2 for z
+static const int cube_edges[12][2] = {
+	{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 }, //along x
+	{ 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 }, //along y
+	{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }  //along z
+};
+
+struct sCaseTable
+{
+	int8_t edges[256][MC_MAX_CASE_EDGES]; //three per triangle, -1 after the last one
+};
+
+static glm::vec3 cornerPosition(int corner)
+{
+	return glm::vec3((float)(corner & 1), (float)((corner >> 1) & 1), (float)((corner >> 2) & 1));
+}
+
+static int findEdge(int a, int b)
+{
+	for (int e = 0; e < 12; ++e)
+		if ((cube_edges[e][0] == a && cube_edges[e][1] == b) || (cube_edges[e][0] == b && cube_edges[e][1] == a))
+			return e;
+	assert(0 && "corners not in an edge");
+	return -1;
+}
+
+//two edges in the same face of the cube, all their corners agree in one axis
+static bool sameFace(int e1, int e2)
+{
+	int a = cube_edges[e1][0];
+	int same = ~(a ^ cube_edges[e1][1]) & ~(a ^ cube_edges[e2][0]) & ~(a ^ cube_edges[e2][1]) & 7;
+	return same != 0;
+}
+
+//every face of the cube links the crossed edges with segments that leave its inside corners on their left seen
+//from outside. Each crossed edge is in two faces, so the segments close loops that are fanned in triangles
+static sCaseTable buildCaseTable()
+{
+	sCaseTable table;
+	for (int mask = 0; mask < 256; ++mask)
+	{
+		int next[12];
+		std::fill(next, next + 12, -1);
+		auto inside = [&](int corner) { return ((mask >> corner) & 1) != 0; };
+
+		for (int axis = 0; axis < 3; ++axis)
+			for (int side = 0; side < 2; ++side)
+			{
+				int u = (axis + 1) % 3, v = (axis + 2) % 3;
+				int base = side << axis;
+				int corners[4] = { base, base | (1 << u), base | (1 << u) | (1 << v), base | (1 << v) };
+				glm::vec3 normal(0.f);
+				normal[axis] = side ? 1.f : -1.f;
+
+				auto addSegment = [&](int e1, int e2, int inside_corner) {
+					glm::vec3 p1 = (cornerPosition(cube_edges[e1][0]) + cornerPosition(cube_edges[e1][1])) * 0.5f;
+					glm::vec3 p2 = (cornerPosition(cube_edges[e2][0]) + cornerPosition(cube_edges[e2][1])) * 0.5f;
+					if (glm::dot(glm::cross(p2 - p1, cornerPosition(inside_corner) - p1), normal) < 0.f)
+						std::swap(e1, e2);
+					assert(next[e1] == -1);
+					next[e1] = e2;
+				};
+
+				int crossed[4], num_crossed = 0, inside_corner = -1;
+				for (int i = 0; i < 4; ++i)
+				{
+					if (inside(corners[i]))
+						inside_corner = corners[i];
+					if (inside(corners[i]) != inside(corners[(i + 1) % 4]))
+						crossed[num_crossed++] = findEdge(corners[i], corners[(i + 1) % 4]);
+				}
+
+				if (num_crossed == 2)
+					addSegment(crossed[0], crossed[1], inside_corner);
+				else if (num_crossed == 4)
+				{
+					//ambiguous, the inside corners are cut off on their own
+					for (int i = 0; i < 4; ++i)
+						if (inside(corners[i]))
+							addSegment(findEdge(corners[(i + 3) % 4], corners[i]), findEdge(corners[i], corners[(i + 1) % 4]), corners[i]);
+				}
+			}
+
+		//reversed fans, the loops go clockwise seen from outside
+		bool visited[12] = {};
+		int count = 0;
+		for (int e = 0; e < 12; ++e)
+		{
+			if (next[e] == -1 || visited[e])
+				continue;
+			int loop[12], length = 0;
+			for (int current = e; !visited[current]; current = next[current])
+			{
+				assert(next[current] != -1 && "open loop");
+				visited[current] = true;
+				loop[length++] = current;
+			}
+			//the fan starts where none of its diagonals lies on a face, the cube next to it could have the same one
+			int start = 0;
+			for (int s = 0; s < length; ++s)
+			{
+				bool on_face = false;
+				for (int i = 2; i + 1 < length; ++i)
+					on_face |= sameFace(loop[s], loop[(s + i) % length]);
+				if (!on_face)
+				{
+					start = s;
+					break;
+				}
+			}
+			for (int i = 1; i + 1 < length; ++i)
+			{
+				table.edges[mask][count++] = (int8_t)loop[start];
+				table.edges[mask][count++] = (int8_t)loop[(start + i + 1) % length];
+				table.edges[mask][count++] = (int8_t)loop[(start + i) % length];
+			}
+		}
+		assert(count < MC_MAX_CASE_EDGES);
+		table.edges[mask][count] = -1;
+	}
+	return table;
+}
+
+void MarchingCubes::extract(const VolumeGrid& grid, float isovalue, bool parallel)
+{
+	static const sCaseTable cases = buildCaseTable();
+
+	const int res = grid.resolution;
+	vertices.clear();
+	normals.clear();
+	triangles.clear();
+	if (res < 2)
+		return;
+
+	auto index = [&](int x, int y, int z) {
+		return (size_t)x + ((size_t)y + (size_t)z * res) * res;
+	};
+	auto density = [&](int x, int y, int z) {
+		return std::min(grid.data[index(x, y, z)], 1.f);
+	};
+	//central differences with the edges clamped, like the gradient texture
+	auto gradient = [&](int x, int y, int z) {
+		return glm::vec3(density(std::min(x + 1, res - 1), y, z) - density(std::max(x - 1, 0), y, z),
+			density(x, std::min(y + 1, res - 1), z) - density(x, std::max(y - 1, 0), z),
+			density(x, y, std::min(z + 1, res - 1)) - density(x, y, std::max(z - 1, 0)));
+	};
+
+	//one vertex per crossed edge of the grid, numbered inside its slice until the offsets of the slices are known
+	std::vector<uint32_t> edge_vertex((size_t)res * res * res * 3);
+	std::vector<std::vector<glm::vec3>> slice_vertices(res), slice_normals(res);
+	auto vertexSlices = [&](int begin, int end) {
+		for (int z = begin; z < end; ++z)
+			for (int y = 0; y < res; ++y)
+				for (int x = 0; x < res; ++x)
+				{
+					float d0 = density(x, y, z);
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						glm::ivec3 n(x, y, z);
+						n[axis]++;
+						if (n[axis] >= res)
+							continue;
+						float d1 = density(n.x, n.y, n.z);
+						if ((d0 >= isovalue) == (d1 >= isovalue))
+							continue;
+
+						float t = (isovalue - d0) / (d1 - d0);
+						glm::vec3 p(x, y, z);
+						p[axis] += t;
+						glm::vec3 g = gradient(x, y, z) * (1.f - t) + gradient(n.x, n.y, n.z) * t;
+						glm::vec3 normal(0.f);
+						normal[axis] = d0 >= isovalue ? 1.f : -1.f;
+						if (glm::dot(g, g) > 1e-12f)
+							normal = -glm::normalize(g);
+
+						edge_vertex[index(x, y, z) * 3 + axis] = (uint32_t)slice_vertices[z].size();
+						slice_vertices[z].push_back((p + 0.5f) / (float)res);
+						slice_normals[z].push_back(normal);
+					}
+				}
+	};
+
+	std::vector<std::vector<glm::uvec3>> slice_triangles(res);
+	std::vector<uint32_t> offsets(res + 1, 0);
+	auto triangleSlices = [&](int begin, int end) {
+		for (int z = begin; z < end; ++z)
+			for (int y = 0; y < res - 1; ++y)
+				for (int x = 0; x < res - 1; ++x)
+				{
+					int mask = 0;
+					for (int c = 0; c < 8; ++c)
+						if (density(x + (c & 1), y + ((c >> 1) & 1), z + ((c >> 2) & 1)) >= isovalue)
+							mask |= 1 << c;
+					if (mask == 0 || mask == 255)
+						continue;
+
+					for (const int8_t* e = cases.edges[mask]; *e >= 0; e += 3)
+					{
+						glm::uvec3 triangle;
+						for (int k = 0; k < 3; ++k)
+						{
+							int corner = cube_edges[e[k]][0];
+							int vz = z + ((corner >> 2) & 1);
+							size_t edge = index(x + (corner & 1), y + ((corner >> 1) & 1), vz) * 3 + e[k] / 4;
+							triangle[k] = offsets[vz] + edge_vertex[edge];
+						}
+						slice_triangles[z].push_back(triangle);
+					}
+				}
+	};
+
+	if (parallel)
+		parallelFor(res, vertexSlices);
+	else
+		vertexSlices(0, res);
+
+	for (int z = 0; z < res; ++z)
+		offsets[z + 1] = offsets[z] + (uint32_t)slice_vertices[z].size();
+	vertices.reserve(offsets[res]);
+	normals.reserve(offsets[res]);
+	for (int z = 0; z < res; ++z)
+	{
+		vertices.insert(vertices.end(), slice_vertices[z].begin(), slice_vertices[z].end());
+		normals.insert(normals.end(), slice_normals[z].begin(), slice_normals[z].end());
+	}
+
+	if (parallel)
+		parallelFor(res - 1, triangleSlices);
+	else
+		triangleSlices(0, res - 1);
+
+	for (int z = 0; z < res - 1; ++z)
+		triangles.insert(triangles.end(), slice_triangles[z].begin(), slice_triangles[z].end());
+}
+
+Mesh* MarchingCubes::createMesh(const glm::vec3& box_min, const glm::vec3& box_max) const
+{
+	Mesh* mesh = new Mesh();
+	glm::vec3 size = box_max - box_min;
+	mesh->vertices.resize(vertices.size());
+	mesh->normals.resize(normals.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		mesh->vertices[i] = box_min + vertices[i] * size;
+		mesh->normals[i] = glm::normalize(normals[i] / size);
+	}
+
+	//the indices are stored as floats, like the loaders fill them
+	mesh->indices.resize(triangles.size());
+	for (size_t i = 0; i < triangles.size(); ++i)
+		mesh->indices[i] = glm::vec3(triangles[i]);
+
+	if (vertices.size())
+		mesh->updateBoundingBox();
+	mesh->radius = glm::length(mesh->box.halfsize);
+	return mesh;
+}
+
+std::string MarchingCubes::getCacheName(const char* vdb_filename, const std::string& grid_name, int resolution, float isovalue,
+	const glm::vec3& box_min, const glm::vec3& box_max)
+{
+	std::string name = vdb_filename;
+	size_t dot = name.find_last_of(".");
+	if (dot != std::string::npos)
+		name = name.substr(0, dot);
+
+	//the names of the grids can have any character, only the ones safe in a file name are kept
+	if (!grid_name.empty())
+	{
+		name += "_";
+		for (char c : grid_name)
+			name += isalnum((unsigned char)c) || c == '-' ? c : '_';
+	}
+	char suffix[160];
+	snprintf(suffix, sizeof(suffix), "_iso%03d_r%d_box%g_%g_%g_%g_%g_%g.mbin", (int)roundf(isovalue * 1000.f), resolution,
+		box_min.x, box_min.y, box_min.z, box_max.x, box_max.y, box_max.z);
+	return name + suffix;
+}
+
+Mesh* MarchingCubes::Get(const char* vdb_filename, const std::string& grid_name, const VolumeGrid& grid, float isovalue,
+	const glm::vec3& box_min, const glm::vec3& box_max)
+{
+	isovalue = roundf(isovalue * 1000.f) / 1000.f;
+	std::string name = getCacheName(vdb_filename, grid_name, grid.resolution, isovalue, box_min, box_max);
+	auto it = Mesh::sMeshesLoaded.find(name);
+	if (it != Mesh::sMeshesLoaded.end())
+		return it->second;
+
+	std::ifstream file(name);
+	if (Mesh::use_binary && file.good())
+	{
+		file.close();
+		return Mesh::Get(name.c_str());
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	MarchingCubes mc;
+	mc.extract(grid, isovalue);
+	Mesh* mesh = mc.createMesh(box_min, box_max);
+	float ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	std::cout << " + Isosurface mesh: " << name << " " << mc.triangles.size() << " triangles, " << mc.vertices.size() << " vertices in " << ms << " ms" << std::endl;
+
+	if (Mesh::use_binary && mc.triangles.size())
+		mesh->writeBin(name.substr(0, name.size() - 5).c_str());
+	if (Mesh::auto_upload_to_vram)
+		mesh->uploadToVRAM();
+	mesh->registerMesh(name);
+	return mesh;
+}
+
+void MarchingCubes::Release(Mesh* mesh)
+{
+	if (!mesh)
+		return;
+	auto it = Mesh::sMeshesLoaded.find(mesh->name);
+	if (it != Mesh::sMeshesLoaded.end() && it->second == mesh)
+		Mesh::sMeshesLoaded.erase(it);
+	delete mesh;
+}
+
+bool MarchingCubes::extractFile(const char* vdb_filename, float isovalue, int resolution)
+{
+	//the density grid that VolumeGrid::load takes, its name goes in the cache like the materials do
+	VolumeFile file;
+	std::string grid_name;
+	if (file.scan(vdb_filename) && file.findDensity() != -1)
+		grid_name = file.grids[file.findDensity()].name;
+
+	VolumeGrid grid;
+	if (!grid.load(vdb_filename, resolution, 2.f, grid_name))
+	{
+		std::cout << "[ERROR] cannot read VDB: " << vdb_filename << std::endl;
+		return false;
+	}
+
+	isovalue = roundf(isovalue * 1000.f) / 1000.f;
+	auto start = std::chrono::high_resolution_clock::now();
+	MarchingCubes mc;
+	mc.extract(grid, isovalue);
+	float ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	if (!mc.triangles.size())
+	{
+		std::cout << "[WARN] the isovalue " << isovalue << " is not crossed in " << vdb_filename << std::endl;
+		return false;
+	}
+
+	Mesh* mesh = mc.createMesh();
+	std::string name = getCacheName(vdb_filename, grid_name, resolution, isovalue);
+	bool written = mesh->writeBin(name.substr(0, name.size() - 5).c_str());
+	std::cout << " + " << name << ": " << mc.triangles.size() << " triangles, " << mc.vertices.size() << " vertices in " << ms << " ms" << std::endl;
+	delete mesh;
+	return written;
+}
+
+void MarchingCubes::benchmark(const char* filename)
+{
+	VolumeGrid grid;
+	grid.loadBenchmark(filename);
+
+	for (float isovalue : { 0.25f, 0.5f, 0.75f })
+	{
+		MarchingCubes mc;
+		auto start = std::chrono::high_resolution_clock::now();
+		mc.extract(grid, isovalue, false);
+		float serial = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		start = std::chrono::high_resolution_clock::now();
+		mc.extract(grid, isovalue, true);
+		float parallel = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+
+		//every edge inside the grid is shared by two triangles, the surface is only open where it is cut by the grid
+		std::vector<uint64_t> edges;
+		edges.reserve(mc.triangles.size() * 3);
+		int flipped = 0;
+		for (const glm::uvec3& t : mc.triangles)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				uint64_t a = t[k], b = t[(k + 1) % 3];
+				edges.push_back(std::min(a, b) << 32 | std::max(a, b));
+			}
+			glm::vec3 face = glm::cross(mc.vertices[t.y] - mc.vertices[t.x], mc.vertices[t.z] - mc.vertices[t.x]);
+			flipped += glm::dot(face, mc.normals[t.x] + mc.normals[t.y] + mc.normals[t.z]) < 0.f;
+		}
+		std::sort(edges.begin(), edges.end());
+		float border = 0.5f / grid.resolution, limit = 1.f - border;
+		auto onBorder = [&](uint32_t v) {
+			const glm::vec3& p = mc.vertices[v];
+			return std::min(std::min(p.x, p.y), p.z) <= border + 1e-6f || std::max(std::max(p.x, p.y), p.z) >= limit - 1e-6f;
+		};
+		int open = 0, non_manifold = 0;
+		for (size_t i = 0; i < edges.size();)
+		{
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i])
+				++j;
+			if (j - i == 1 && !(onBorder((uint32_t)(edges[i] >> 32)) && onBorder((uint32_t)edges[i])))
+				open++;
+			else if (j - i > 2)
+				non_manifold++;
+			i = j;
+		}
+
+		std::cout << "   isovalue " << isovalue << ": " << mc.triangles.size() << " triangles, " << mc.vertices.size() << " vertices, " << serial << " ms serial, "
+			<< parallel << " ms with " << getNumJobThreads() << " threads (" << mc.triangles.size() / (parallel * 1000.f) << " M triangles/s). "
+			<< open << " open and " << non_manifold << " non manifold edges, " << flipped << " triangles against their normals" << std::endl;
+	}
+}
@@ -0,0 +1,43 @@
+/*  Triangle mesh of the isosurface of a density grid, to rasterize static iso views instead of
+	ray marching them every frame. The vertices sit on the edges of the grid and are shared by
+	all the cubes around the edge, the normals come from the gradient of the density.
+	The table of the cases is traced from the faces of the cube instead of written by hand: the
+	ambiguous faces always separate the inside corners, so neighbor cubes agree and the surface
+	has no cracks.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <glm/vec3.hpp>
+
+class Mesh;
+class VolumeGrid;
+
+class MarchingCubes
+{
+public:
+	std::vector<glm::vec3> vertices; //texture space of the grid
+	std::vector<glm::vec3> normals; //texture space, outwards
+	std::vector<glm::uvec3> triangles; //counter clockwise seen from outside
+
+	//slices of the grid in parallel, the edge vertices are welded through a map of the edges of the grid
+	void extract(const VolumeGrid& grid, float isovalue, bool parallel = true);
+	//indexed mesh with the vertices mapped to the box of the volume
+	Mesh* createMesh(const glm::vec3& box_min = glm::vec3(-1.f), const glm::vec3& box_max = glm::vec3(1.f)) const;
+
+	//name of the .mbin cache next to the VDB: the grid, the isovalue rounded to 3 decimals, the resolution and the box
+	//the vertices are mapped to. The grid is left out when its name is empty
+	static std::string getCacheName(const char* vdb_filename, const std::string& grid_name, int resolution, float isovalue,
+		const glm::vec3& box_min = glm::vec3(-1.f), const glm::vec3& box_max = glm::vec3(1.f));
+	//extracted once and cached as .mbin, uses the grid only when there is no cache
+	static Mesh* Get(const char* vdb_filename, const std::string& grid_name, const VolumeGrid& grid, float isovalue,
+		const glm::vec3& box_min = glm::vec3(-1.f), const glm::vec3& box_max = glm::vec3(1.f));
+	//removes a mesh of Get from the loaded meshes and deletes it, the .mbin stays
+	static void Release(Mesh* mesh);
+	//headless tool, writes the .mbin of the density grid of the VDB
+	static bool extractFile(const char* vdb_filename, float isovalue, int resolution = 128);
+	static void benchmark(const char* filename);
+};
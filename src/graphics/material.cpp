@@ -1,10 +1,15 @@
 #include "material.h"
 
 #include "application.h"
+#include "fbo.h"
+#include "volumegrid.h"
+#include "noisevolume.h"
+#include "../framework/jobs.h"
 
 #include <istream>
 #include <fstream>
 #include <algorithm>
+#include <cmath>
 
 enum ShaderType {
 	ABSORPTION_SHADER,
@@ -29,6 +34,248 @@ ShaderType currentShaderType = SCATTERING_SHADER;
 VolumeType currentVolumeType = HOMOGENEOUS;
 DensityType currentDensityType = CONSTANT;
 
+Material::~Material()
+{
+	// the loader waits for its job, the texture it is still uploading is its own
+	if (this->loader)
+		delete this->loader;
+	releaseVolume();
+	if (this->transfer)
+		delete this->transfer;
+}
+
+void Material::setDepthClampUniforms(Shader* shader, Camera* camera)
+{
+	Application* app = Application::instance;
+	bool clamp = app->volume_pass && app->flag_volume_depth_clamp && app->scene_fbo;
+	shader->setUniform("u_depth_clamp", clamp);
+	if (!clamp)
+	{
+		shader->setUniform("u_opaque_depth", 2); //its own slot, samplers of different types can't share the one of the density
+		return;
+	}
+
+	//the volume pass renders at a fraction of the resolution of the scene depth
+	shader->setUniform("u_opaque_depth", app->scene_fbo->depth_texture, 2);
+	shader->setUniform("u_depth_ratio", app->volume_downsample);
+	shader->setUniform("u_inverse_viewprojection", glm::inverse(camera->viewprojection_matrix));
+}
+
+Mesh* Material::prepareProxy(Mesh* mesh, const glm::mat4& model, Camera* camera, bool enabled)
+{
+	Application* app = Application::instance;
+	this->proxy_active = false;
+	if (!enabled || !this->proxy || !this->proxy->num_occupied || !app->volume_pass || !app->flag_volume_proxy || !app->ray_bounds_fbo)
+		return mesh;
+
+	//the box is marched when the camera is inside, or close enough for the near plane to clip the hull
+	glm::vec3 eye = glm::inverse(model) * glm::vec4(camera->eye, 1.f);
+	glm::vec3 margin = (mesh->aabb_max - mesh->aabb_min) * this->proxy->brick_extent + camera->near_plane;
+	glm::vec3 lo = mesh->aabb_min - margin;
+	glm::vec3 hi = mesh->aabb_max + margin;
+	if (eye.x > lo.x && eye.y > lo.y && eye.z > lo.z && eye.x < hi.x && eye.y < hi.y && eye.z < hi.z)
+		return mesh;
+
+	Mesh* hull = this->proxy->getMesh(mesh->aabb_min, mesh->aabb_max);
+
+	//all the faces without depth test, blended with max (see ray_bounds.fs)
+	Shader* shader = Shader::Get("res/shaders/basic.vs", "res/shaders/ray_bounds.fs");
+	app->ray_bounds_fbo->bind();
+	glClearColor(0.f, 0.f, 0.f, 0.f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glBlendEquation(GL_MAX);
+	shader->enable();
+	shader->setUniform("u_model", model);
+	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	hull->render(GL_TRIANGLES);
+	shader->disable();
+	glBlendEquation(GL_FUNC_ADD);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_CULL_FACE);
+	glEnable(GL_DEPTH_TEST);
+	app->ray_bounds_fbo->unbind();
+
+	this->proxy_active = true;
+	return hull;
+}
+
+void Material::setProxyUniforms(Shader* shader)
+{
+	shader->setUniform("u_use_proxy", this->proxy_active);
+	if (this->proxy_active)
+		shader->setUniform("u_ray_bounds", Application::instance->ray_bounds_fbo->color_textures[0], 3);
+	else
+		shader->setUniform("u_ray_bounds", 3);
+}
+
+void Material::setAdaptiveStepUniforms(Shader* shader)
+{
+	bool adaptive = this->adaptive_step && this->proxy;
+	shader->setUniform("u_adaptive_step", adaptive);
+	if (!adaptive)
+	{
+		shader->setUniform("u_brick_texture", 4);
+		return;
+	}
+
+	shader->setUniform("u_brick_texture", this->proxy->getBrickTexture(), 4);
+	shader->setUniform("u_brick_extent", this->proxy->brick_extent);
+	shader->setUniform("u_max_step_scale", this->max_step_scale);
+	shader->setUniform("u_step_distance_scale", this->step_distance_scale);
+	shader->setUniform("u_step_tau", VOLUME_ADAPTIVE_TAU);
+}
+
+int Material::scanVDB(const std::string& file_path)
+{
+	this->vdb_grid = -1;
+	if (this->vdb_file.scan(file_path.c_str())) {
+		this->vdb_grid = this->vdb_file.findGrid(this->density_grid);
+		if (this->vdb_grid == -1)
+			this->vdb_grid = this->vdb_file.findDensity();
+	}
+	return this->vdb_grid;
+}
+
+void Material::releaseVolume()
+{
+	if (this->owns_texture) {
+		delete this->texture;
+		if (this->range_texture)
+			delete this->range_texture;
+	}
+	if (this->owns_proxy)
+		delete this->proxy;
+	this->texture = NULL;
+	this->range_texture = NULL;
+	this->proxy = NULL;
+	this->owns_texture = false;
+	this->owns_proxy = false;
+}
+
+void Material::startLoader(const std::string& file_path)
+{
+	if (this->loader)
+		delete this->loader;
+	this->loader = new VolumeLoader();
+	// only the chosen grid is voxelized, the loader takes the density one if the header couldn't be read
+	scanVDB(file_path);
+	this->loader->start(file_path, 128, 2.f, this->vdb_grid == -1 ? "" : this->vdb_file.grids[this->vdb_grid].name, this->pack_temperature,
+		this->density_bits, this->brick_ranges);
+
+	// the bricks of the previous volume would clip the new one
+	releaseVolume();
+	this->texture = VolumeLoader::getPlaceholderTexture();
+	this->channels = sVolumeChannels();
+}
+
+bool Material::updateLoader(VolumeGrid** grid)
+{
+	if (!this->loader)
+		return false;
+
+	if (this->loader->isFailed()) {
+		std::cout << "[ERROR] " << this->loader->getFilename() << " could not be loaded" << std::endl;
+		delete this->loader;
+		this->loader = NULL;
+		this->texture = NULL;
+		return false;
+	}
+
+	// every finer level changes the volume, the progressive refinement starts again
+	this->loader->upload_budget = (size_t)Application::instance->volume_upload_budget * 1024;
+	if (this->loader->update())
+		SceneStore::Get()->version++;
+	// the placeholder is a plain R8 texture
+	this->texture = this->loader->getTexture();
+	this->channels = this->texture != VolumeLoader::getPlaceholderTexture() ? this->loader->getChannels() : sVolumeChannels();
+	this->range_texture = this->loader->getRangeTexture();
+	if (!this->proxy) {
+		this->proxy = this->loader->takeProxy();
+		this->owns_proxy = this->proxy != NULL;
+	}
+	if (!this->loader->isComplete())
+		return false;
+
+	this->texture = this->loader->takeTexture();
+	this->range_texture = this->loader->takeRangeTexture();
+	this->owns_texture = true;
+	if (grid) {
+		if (*grid)
+			delete *grid;
+		*grid = this->loader->takeGrid();
+	}
+	delete this->loader;
+	this->loader = NULL;
+	return true;
+}
+
+bool Material::renderGridsInMenu()
+{
+	if (this->vdb_file.grids.size() < 2)
+		return false;
+
+	bool changed = false;
+	if (ImGui::TreeNode("VDB Grids")) {
+		for (int i = 0; i < (int)this->vdb_file.grids.size(); ++i) {
+			const VolumeFile::sGridInfo& grid = this->vdb_file.grids[i];
+			glm::ivec3 size = grid.has_bbox ? grid.bbox_max - grid.bbox_min + 1 : glm::ivec3(0);
+			ImGui::PushID(i);
+			if (ImGui::RadioButton(grid.name.c_str(), this->vdb_grid == i) && this->vdb_grid != i) {
+				this->density_grid = grid.name;
+				changed = true;
+			}
+			ImGui::SameLine();
+			ImGui::Text("%s, %dx%dx%d, %lld voxels", grid.value_type.c_str(), size.x, size.y, size.z, (long long)grid.voxel_count);
+			ImGui::PopID();
+		}
+		ImGui::TreePop();
+	}
+	return changed;
+}
+
+void Material::setLodUniforms(Shader* shader, Camera* camera, const glm::mat4& model)
+{
+	bool lod = this->density_lod && this->texture && this->texture->mipmaps && camera->type == Camera::PERSPECTIVE;
+	shader->setUniform("u_density_lod", lod);
+	if (!lod)
+		return;
+
+	//the pixels of the volume pass are larger, the local units scale with the model (uniformly, the length of its x axis)
+	Application* app = Application::instance;
+	int height = app->volume_pass && app->volume_fbo ? app->volume_fbo->height : app->window_height;
+	float scale = std::max(glm::length(glm::vec3(model[0])), 1e-6f);
+	shader->setUniform("u_pixel_footprint", 2.f * tanf(glm::radians(camera->fov) * 0.5f) / std::max(height, 1) / scale);
+	shader->setUniform("u_lod_bias", this->lod_bias);
+	shader->setUniform("u_light_lod", this->light_lod);
+}
+
+void Material::setTransferUniforms(Shader* shader, float step_length, float extinction_scale, float scattering_scale)
+{
+	//the samplers keep their own units even when unused, samplers of different types can't share one
+	if (!this->transfer)
+	{
+		shader->setUniform("u_use_transfer", false);
+		shader->setUniform("u_preintegrated", false);
+		shader->setUniform("u_transfer_texture", 5);
+		shader->setUniform("u_preintegration_table", 6);
+		shader->setUniform("u_preintegration_emission", 7);
+		return;
+	}
+
+	//the table is integrated for the step of the material, the shader rescales it to the length of every segment
+	this->transfer->update(extinction_scale, scattering_scale, step_length);
+	shader->setUniform("u_use_transfer", true);
+	shader->setUniform("u_transfer_texture", this->transfer->texture, 5);
+	shader->setUniform("u_transfer_size", (float)TF_TABLE_SIZE);
+	shader->setUniform("u_preintegrated", this->preintegrate);
+	shader->setUniform("u_preintegration_table", this->transfer->scattering_table, 6);
+	shader->setUniform("u_preintegration_emission", this->transfer->emission_table, 7);
+	shader->setUniform("u_preintegration_step", this->transfer->step_length);
+}
+
 FlatMaterial::FlatMaterial(glm::vec4 color)
 {
 	this->color = color;
@@ -130,7 +377,7 @@ void StandardMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 		this->shader->enable();
 
 		// Multi pass render
-		int num_lights = Application::instance->light_list.size();
+		int num_lights = Application::instance->node_lights.size();
 		for (int nlight = -1; nlight < num_lights; nlight++)
 		{
 			if (nlight == -1) { nlight++; } // hotfix
@@ -146,7 +393,7 @@ void StandardMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 			this->shader->setUniform("u_ambient_light", Application::instance->ambient_light * (float)first_pass);
 
 			if (num_lights > 0) {
-				Light* light = Application::instance->light_list[nlight];
+				Light* light = Application::instance->node_lights[nlight];
 				light->setUniforms(this->shader, model);
 			}
 			else {
@@ -183,6 +430,7 @@ void StandardMaterial::renderInMenu()
 
 VolumeMaterial::VolumeMaterial(double absorption_coefficient, glm::vec4 color, float noise_scale, int noise_detail, float step_length, float emission_coefficient, float density_scale, float scattering_coefficient, float isotropy_parameter)
 {
+	this->is_volume = true;
 	this->color = color;
 	this->absorption_coefficient = absorption_coefficient;
 	this->noise_scale = noise_scale;
@@ -195,12 +443,22 @@ VolumeMaterial::VolumeMaterial(double absorption_coefficient, glm::vec4 color, f
 	this->absorption_shader = Shader::Get("res/shaders/basic.vs", "res/shaders/absorption.fs");
 	this->normal_shader = Shader::Get("res/shaders/basic.vs", "res/shaders/normal.fs");
 	this->emission_absorption = Shader::Get("res/shaders/basic.vs", "res/shaders/emission-absorption.fs");
-	this->scattering_shader = Shader::Get("res/shaders/basic.vs", "res/shaders/scattering.fs");
+	this->scattering_macros = this->channels.getMacros();
+	this->scattering_shader = Shader::Get("res/shaders/basic.vs", "res/shaders/scattering.fs", this->scattering_macros.c_str());
 	this->shader = this->scattering_shader;
+	this->pack_temperature = true;
 	this->scattering_coefficient = scattering_coefficient;
 	this->isotropy_parameter = isotropy_parameter;
 	this->jittering_offset = false;
+	this->transfer = new TransferFunction();
+
+}
 
+VolumeMaterial::~VolumeMaterial()
+{
+	// the texture and the proxy of the frame on screen go with the sequence, the material doesn't own them
+	if (this->sequence)
+		delete this->sequence;
 }
 
 void VolumeMaterial::setUniforms(Camera* camera, glm::mat4 model, Mesh* mesh) {
@@ -231,11 +489,22 @@ void VolumeMaterial::setUniforms(Camera* camera, glm::mat4 model, Mesh* mesh) {
 
 	int volumeTypeInt = static_cast<int>(currentVolumeType);
 	this->shader->setUniform("u_volume_type", volumeTypeInt);
-	this->shader->setUniform("u_step_length", this->step_length);
+	this->shader->setUniform("u_step_length", this->step_length * Application::instance->volume_step_scale);
 	this->shader->setUniform("u_noise_scale", this->noise_scale);
 	this->shader->setUniform("u_noise_detail", this->noise_detail);
 	this->shader->setUniform("u_max_light_steps", this->max_light_steps);
 
+	// the shaders that use the noise fetch it from the baked volume instead of evaluating every octave
+	bool baked_noise = Application::instance->flag_baked_noise && ((currentShaderType == SCATTERING_SHADER && currentDensityType == NOISE) ||
+		((currentShaderType == ABSORPTION_SHADER || currentShaderType == EMISSION_ABSORPTION) && currentVolumeType == HETEROGENEOUS));
+	this->shader->setUniform("u_baked_noise", baked_noise);
+	if (baked_noise) {
+		this->shader->setUniform("u_noise_texture", NoiseVolume::Get(this->noise_detail), 8);
+		this->shader->setUniform("u_noise_period", (float)NOISE_VOLUME_PERIOD);
+	}
+	else
+		this->shader->setUniform("u_noise_texture", 8);
+
 	// VDB-related uniforms
 	if (this->texture) {
 		this->shader->setUniform("u_density_texture", this->texture,0);
@@ -244,8 +513,24 @@ void VolumeMaterial::setUniforms(Camera* camera, glm::mat4 model, Mesh* mesh) {
 	this->shader->setUniform("u_density_scale", this->density_scale);
 	this->shader->setUniform("u_constant_density", 1.f);
 	this->shader->setUniform("u_isotropy_parameter", this->isotropy_parameter);
+	this->shader->setUniform("u_channel_scale", this->channels.scale);
+	this->shader->setUniform("u_channel_offset", this->channels.offset);
+	this->shader->setUniform("u_temperature_range", this->temperature_range);
+	this->shader->setUniform("u_temperature_emission", this->temperature_emission);
+	if (this->channels.brick_ranges && this->range_texture) {
+		this->shader->setUniform("u_range_texture", this->range_texture, 11);
+		this->shader->setUniform("u_range_extent", this->channels.range_extent);
+	}
 
 	this->shader->setUniform("u_jittering", this->jittering_offset);
+	this->shader->setUniform("u_premultiplied", Application::instance->volume_pass);
+	this->shader->setUniform("u_jitter_seed", Application::instance->jitter_seed);
+	this->shader->setUniform("u_blue_noise", Texture::getBlueNoiseTexture(), 1);
+	setDepthClampUniforms(this->shader, camera);
+	setProxyUniforms(this->shader);
+	setAdaptiveStepUniforms(this->shader);
+	setLodUniforms(this->shader, camera, model);
+	setTransferUniforms(this->shader, this->step_length, this->density_scale * (this->absorption_coefficient + this->scattering_coefficient) * this->absorption_coefficient, this->scattering_coefficient * this->density_scale);
 
 	// Light uniforms
 	//this->shader->setUniform("u_light_intensity");
@@ -258,11 +543,14 @@ void VolumeMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera) {
 	bool first_pass = true;
 	if (mesh && this->shader)
 	{
+		// the hull only bounds the density of the VDB
+		Mesh* march_mesh = prepareProxy(mesh, model, camera, currentShaderType == SCATTERING_SHADER && currentDensityType == TEXTURE);
+
 		// enable shader
 		this->shader->enable();
 
 		// Multi pass render
-		int num_lights = Application::instance->light_list.size();
+		int num_lights = Application::instance->node_lights.size();
 		for (int nlight = -1; nlight < num_lights; nlight++)
 		{
 			if (nlight == -1) { nlight++; } // hotfix
@@ -272,14 +560,21 @@ void VolumeMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera) {
 
 			// upload light uniforms
 			if (!first_pass) {
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+				if (Application::instance->volume_pass) {
+					// the extra lights only add radiance, the opacity was written by the first pass
+					glBlendFunc(GL_ONE, GL_ONE);
+					glColorMask(true, true, true, false);
+					glColorMaski(1, false, false, false, false);
+				}
+				else
+					glBlendFunc(GL_SRC_ALPHA, GL_ONE);
 				glDepthFunc(GL_LEQUAL);
 			}
 			//this->shader->setUniform("u_ambient_light", Application::instance->ambient_light * (float)first_pass);
 			//this->shader->setUniform("u_background_color", Application::instance->background_color);
 
 			if (num_lights > 0) {
-				Light* light = Application::instance->light_list[nlight];
+				Light* light = Application::instance->node_lights[nlight];
 				light->setUniforms(this->shader, model);
 			}
 			else {
@@ -290,22 +585,84 @@ void VolumeMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera) {
 			}
 
 			// do the draw call
-			mesh->render(GL_TRIANGLES);
+			march_mesh->render(GL_TRIANGLES);
 
 			first_pass = false;
 		}
 
+		if (Application::instance->volume_pass) {
+			glColorMask(true, true, true, true);
+			glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+		}
+
 		// disable shader
 		this->shader->disable();
 	}
 }
 
+void VolumeMaterial::update(float dt)
+{
+	// the ramp starts with the range of the grid, the previews have no temperature
+	if (updateLoader() && this->channels.temperature != -1)
+		this->temperature_range = glm::vec2(this->channels.offset[this->channels.temperature], this->channels.offset[this->channels.temperature] + this->channels.scale[this->channels.temperature]);
+
+	// the scattering shader reads the channels the texture has
+	std::string macros = this->channels.getMacros();
+	if (macros != this->scattering_macros) {
+		this->scattering_macros = macros;
+		this->scattering_shader = Shader::Get("res/shaders/basic.vs", "res/shaders/scattering.fs", macros.c_str());
+		setShader();
+	}
+
+	if (!this->sequence || !this->sequence->update(dt))
+		return;
+
+	this->texture = this->sequence->getTexture();
+	this->proxy = this->sequence->getProxy();
+	// the volume changed, the progressive refinement starts again
+	SceneStore::Get()->version++;
+}
+
 void VolumeMaterial::renderInMenu() {
+	if (this->sequence)
+		this->sequence->renderInMenu();
+	if (this->loader)
+		ImGui::Text(this->loader->isUploading() ? "Uploading %.0f%%" : "Loading VDB...", this->loader->getProgress() * 100.f);
+	// the frames of a sequence always use their density grid
+	if (!this->sequence && renderGridsInMenu())
+		loadVDB(this->vdb_file.filename);
+	if (!this->sequence && this->vdb_file.findTemperature() != -1 && ImGui::Checkbox("Pack Temperature", &this->pack_temperature))
+		loadVDB(this->vdb_file.filename);
+	if (this->channels.temperature != -1) {
+		ImGui::SliderFloat("Temperature Emission", &this->temperature_emission, 0.0f, 10.0f);
+		ImGui::DragFloatRange2("Temperature Range", &this->temperature_range.x, &this->temperature_range.y, 10.0f);
+	}
+	// 16 bits already resolve the thin densities, the ranges of the bricks pay off with 8
+	const char* storageNames[] = { "8 bit", "8 bit, brick ranges", "16 bit" };
+	int storageIndex = this->density_bits == 16 ? 2 : this->brick_ranges ? 1 : 0;
+	if (!this->sequence && ImGui::Combo("Density Storage", &storageIndex, storageNames, IM_ARRAYSIZE(storageNames))) {
+		this->density_bits = storageIndex == 2 ? 16 : 8;
+		this->brick_ranges = storageIndex == 1;
+		if (!this->vdb_file.filename.empty())
+			loadVDB(this->vdb_file.filename);
+	}
 	ImGui::Checkbox("Jittering Offset", &this->jittering_offset);
 	ImGui::ColorEdit3("Color", (float*)&this->color);
 	ImGui::SliderFloat("Absorption Coefficient", &this->absorption_coefficient, 0.0f, 2.0f); // Absorption control
 	ImGui::SliderFloat("Scattering Coefficient", &this->scattering_coefficient, 0.0f, 2.0f); // Absorption control
 	ImGui::SliderFloat("Step Length", &this->step_length, 0.01f, 3.0f); // Absorption control
+	ImGui::Checkbox("Adaptive Step", &this->adaptive_step);
+	if (this->adaptive_step) {
+		ImGui::SliderFloat("Max Step Scale", &this->max_step_scale, 1.0f, 16.0f);
+		ImGui::SliderFloat("Step Distance Scale", &this->step_distance_scale, 0.0f, 0.5f);
+	}
+	ImGui::Checkbox("Density Mipmaps", &this->density_lod);
+	if (this->density_lod) {
+		ImGui::SliderFloat("LOD Bias", &this->lod_bias, -2.0f, 2.0f);
+		ImGui::SliderFloat("Light LOD", &this->light_lod, 0.0f, 3.0f);
+	}
+	ImGui::Checkbox("Pre-integrated Transfer Function", &this->preintegrate);
+	this->transfer->renderInMenu();
 	ImGui::SliderInt("Light Step Length", &this->max_light_steps, 1, 100);
 	ImGui::SliderFloat("G parameter Value", &this->isotropy_parameter, -1.f, 1.0f);
 
@@ -354,16 +711,50 @@ void VolumeMaterial::setShader() {
 	case EMISSION_ABSORPTION:
 		this->shader = this->emission_absorption;
 		break;
+	case SCATTERING_SHADER:
+		this->shader = this->scattering_shader;
+		break;
 	}
 }
 
-void VolumeMaterial::loadVDB(std::string file_path)
+void VolumeMaterial::loadVDB(std::string file_path, bool async)
 {
+	// the frames of a sequence are loaded by the jobs, nothing is shown until the first one is ready
+	std::string pattern;
+	int first, last;
+	if (VolumeSequence::findFrames(file_path, pattern, first, last)) {
+		if (!this->sequence)
+			this->sequence = new VolumeSequence();
+		this->sequence->open(pattern, first, last);
+		if (this->loader) {
+			delete this->loader;
+			this->loader = NULL;
+		}
+		releaseVolume();
+		this->channels = sVolumeChannels();
+		std::cout << " + VDB sequence: " << pattern << " frames " << first << " to " << last << std::endl;
+		return;
+	}
+
+	// the texture and the proxy were the ones of the sequence, they are deleted with it
+	if (this->sequence) {
+		delete this->sequence;
+		this->sequence = NULL;
+		releaseVolume();
+	}
+
+	if (async) {
+		startLoader(file_path);
+		return;
+	}
+
+	scanVDB(file_path);
 	easyVDB::OpenVDBReader* vdbReader = new easyVDB::OpenVDBReader();
 	vdbReader->read(file_path);
 
 	// now, read the grid from the vdbReader and store the data in a 3D texture
 	estimate3DTexture(vdbReader);
+	delete vdbReader;
 }
 
 void VolumeMaterial::estimate3DTexture(easyVDB::OpenVDBReader* vdbReader)
@@ -371,118 +762,45 @@ void VolumeMaterial::estimate3DTexture(easyVDB::OpenVDBReader* vdbReader)
 	int resolution = 128;
 	float radius = 2.0;
 
-	int convertedGrids = 0;
-	int convertedVoxels = 0;
-
-	int totalGrids = vdbReader->gridsSize;
-	int totalVoxels = totalGrids * pow(resolution, 3);
-
-	float resolutionInv = 1.0f / resolution;
-	int resolutionPow2 = pow(resolution, 2);
-	int resolutionPow3 = pow(resolution, 3);
-
-	// read all grids data and convert to texture
-	for (unsigned int i = 0; i < totalGrids; i++) {
-		easyVDB::Grid& grid = vdbReader->grids[i];
-		float* data = new float[resolutionPow3];
-		memset(data, 0, sizeof(float) * resolutionPow3);
-
-		// Bbox
-		easyVDB::Bbox bbox = easyVDB::Bbox();
-		bbox = grid.getPreciseWorldBbox();
-		glm::vec3 target = bbox.getCenter();
-		glm::vec3 size = bbox.getSize();
-		glm::vec3 step = size * resolutionInv;
-
-		grid.transform->applyInverseTransformMap(step);
-		target = target - (size * 0.5f);
-		grid.transform->applyInverseTransformMap(target);
-		target = target + (step * 0.5f);
-
-		int x = 0;
-		int y = 0;
-		int z = 0;
-
-		for (unsigned int j = 0; j < resolutionPow3; j++) {
-			int baseX = x;
-			int baseY = y;
-			int baseZ = z;
-			int baseIndex = baseX + baseY * resolution + baseZ * resolutionPow2;
-
-			if (target.x >= 40 && target.y >= 40.33 && target.z >= 10.36) {
-				int a = 0;
-			}
-
-			float value = grid.getValue(target);
-
-			int cellBleed = radius;
-
-			if (cellBleed) {
-				for (int sx = -cellBleed; sx < cellBleed; sx++) {
-					for (int sy = -cellBleed; sy < cellBleed; sy++) {
-						for (int sz = -cellBleed; sz < cellBleed; sz++) {
-							if (x + sx < 0.0 || x + sx >= resolution ||
-								y + sy < 0.0 || y + sy >= resolution ||
-								z + sz < 0.0 || z + sz >= resolution) {
-								continue;
-							}
-
-							int targetIndex = baseIndex + sx + sy * resolution + sz * resolutionPow2;
-
-							float offset = std::max(0.0, std::min(1.0, 1.0 - std::hypot(sx, sy, sz) / (radius / 2.0)));
-							float dataValue = offset * value * 255.f;
-
-							data[targetIndex] += dataValue;
-							data[targetIndex] = std::min((float)data[targetIndex], 255.f);
-						}
-					}
-				}
-			}
-			else {
-				float dataValue = value * 255.f;
-
-				data[baseIndex] += dataValue;
-				data[baseIndex] = std::min((float)data[baseIndex], 255.f);
-			}
-
-			convertedVoxels++;
-
-			if (z >= resolution) {
-				break;
-			}
-
-			x++;
-			target.x += step.x;
-
-			if (x >= resolution) {
-				x = 0;
-				target.x -= step.x * resolution;
-
-				y++;
-				target.y += step.y;
-			}
-
-			if (y >= resolution) {
-				y = 0;
-				target.y -= step.y * resolution;
-
-				z++;
-				target.z += step.z;
-			}
-
-			// yield
-		}
-
-		// now we create the texture with the data
-		// use this: https://www.khronos.org/opengl/wiki/OpenGL_Type
-		// and this: https://registry.khronos.org/OpenGL-Refpages/gl4/html/glTexImage3D.xhtml
-		this->texture = new Texture();
-		this->texture->create3D(resolution, resolution, resolution, GL_RED, GL_FLOAT, false, data, GL_R8);
+	// only the grid chosen as the density, the first one if the header couldn't be read
+	unsigned int i = std::max(this->vdb_grid, 0);
+	if (i >= vdbReader->gridsSize)
+		return;
+	VolumeGrid grid, temperature;
+	grid.voxelize(vdbReader->grids[i], resolution, radius);
+	std::vector<const VolumeGrid*> grids = { &grid };
+	int heat = this->pack_temperature ? this->vdb_file.findTemperature() : -1;
+	if (heat != -1 && heat < (int)vdbReader->gridsSize) {
+		// over the bbox of the density, the temperature is packed in the same texels
+		easyVDB::Bbox bbox = vdbReader->grids[i].getPreciseWorldBbox();
+		temperature.voxelize(vdbReader->grids[heat], resolution, radius, true, true, &bbox);
+		grids.push_back(&temperature);
 	}
+
+	// now we create the texture with the data and its mip chain, the mean density keeps the extinction of a far cloud
+	// use this: https://www.khronos.org/opengl/wiki/OpenGL_Type
+	// and this: https://registry.khronos.org/OpenGL-Refpages/gl4/html/glTexImage3D.xhtml
+	this->channels = sVolumeChannels();
+	this->channels.temperature = grids.size() > 1 ? 1 : -1;
+	this->channels.bits = this->density_bits;
+	this->channels.brick_ranges = this->brick_ranges;
+	VolumeProxy* proxy = this->owns_proxy ? this->proxy : NULL;
+	this->owns_proxy = false;
+	releaseVolume();
+	this->texture = VolumeGrid::createTexture(grids, this->channels, &this->range_texture);
+	this->owns_texture = true;
+	if (this->channels.temperature != -1)
+		this->temperature_range = glm::vec2(this->channels.offset.y, this->channels.offset.y + this->channels.scale.y);
+
+	// bricks with density, their hull is rasterized instead of the box in the volume pass
+	this->proxy = proxy ? proxy : new VolumeProxy();
+	this->owns_proxy = true;
+	this->proxy->build(&grid.data[0], resolution);
 }
 
 IsoMaterial::IsoMaterial(double absorption_coefficient, glm::vec4 color, float noise_scale, int noise_detail, float step_length, float emission_coefficient, float density_scale, float scattering_coefficient, float isotropy_parameter)
 {
+	this->is_volume = true;
 	this->color = color;
 	this->absorption_coefficient = absorption_coefficient;
 	this->noise_scale = noise_scale;
@@ -495,7 +813,21 @@ IsoMaterial::IsoMaterial(double absorption_coefficient, glm::vec4 color, float n
 	this->scattering_coefficient = scattering_coefficient;
 	this->isotropy_parameter = isotropy_parameter;
 	this->jittering_offset = false;
+	this->transfer = new TransferFunction();
+
+}
 
+IsoMaterial::~IsoMaterial()
+{
+	// the job of the distance field writes to the material and reads the grid
+	clearDistanceField();
+	if (this->time_query)
+		glDeleteQueries(1, &this->time_query);
+	MarchingCubes::Release(this->surface_mesh);
+	if (this->surface_material)
+		delete this->surface_material;
+	if (this->grid)
+		delete this->grid;
 }
 
 void IsoMaterial::setUniforms(Camera* camera, glm::mat4 model, Mesh* mesh)
@@ -527,7 +859,7 @@ void IsoMaterial::setUniforms(Camera* camera, glm::mat4 model, Mesh* mesh)
 
 	int volumeTypeInt = static_cast<int>(currentVolumeType);
 	this->shader->setUniform("u_volume_type", volumeTypeInt);
-	this->shader->setUniform("u_step_length", this->step_length);
+	this->shader->setUniform("u_step_length", this->step_length * Application::instance->volume_step_scale);
 	this->shader->setUniform("u_noise_scale", this->noise_scale);
 	this->shader->setUniform("u_noise_detail", this->noise_detail);
 	this->shader->setUniform("u_max_light_steps", this->max_light_steps);
@@ -541,18 +873,82 @@ void IsoMaterial::setUniforms(Camera* camera, glm::mat4 model, Mesh* mesh)
 	this->shader->setUniform("u_isotropy_parameter", this->isotropy_parameter);
 
 	this->shader->setUniform("u_jittering", this->jittering_offset);
+	this->shader->setUniform("u_premultiplied", Application::instance->volume_pass);
+	this->shader->setUniform("u_jitter_seed", Application::instance->jitter_seed);
+	this->shader->setUniform("u_blue_noise", Texture::getBlueNoiseTexture(), 1);
+	setDepthClampUniforms(this->shader, camera);
+	setProxyUniforms(this->shader);
+	setAdaptiveStepUniforms(this->shader);
+	setLodUniforms(this->shader, camera, model);
+	setTransferUniforms(this->shader, this->step_length, this->density_scale * (this->absorption_coefficient + this->scattering_coefficient) * this->absorption_coefficient, this->scattering_coefficient * this->density_scale);
+
+	this->shader->setUniform("u_isosurface", this->show_surface);
+	this->shader->setUniform("u_isovalue", this->isovalue);
+	this->shader->setUniform("u_surface_color", this->surface_color);
+	this->shader->setUniform("u_surface_only", this->surface_only);
+	this->shader->setUniform("u_iso_step_scale", this->iso_step_scale);
+	this->shader->setUniform("u_refine_steps", this->refine_steps);
+	this->shader->setUniform("u_debug_steps", this->debug_steps);
+	this->shader->setUniform("u_debug_max_steps", this->debug_max_steps);
+	bool gradient_normals = this->show_surface && this->precomputed_normals && this->grid;
+	this->shader->setUniform("u_gradient_normals", gradient_normals);
+	if (gradient_normals)
+		this->shader->setUniform("u_gradient_texture", this->grid->getGradientTexture(), 9);
+	else
+		this->shader->setUniform("u_gradient_texture", 9);
+
+	// while the field of a new isovalue is built the surface is marched with coarse steps, the old field could step past it
+	bool sphere_tracing = this->show_surface && this->surface_only && this->sphere_tracing && this->grid && updateDistanceField();
+	this->shader->setUniform("u_sphere_tracing", sphere_tracing);
+	if (sphere_tracing)
+		this->shader->setUniform("u_distance_texture", this->distance_field->getTexture(), 10);
+	else
+		this->shader->setUniform("u_distance_texture", 10);
 }
 
 void IsoMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 {
+	// the result of the previous query is read once it is available, a new one starts only then so it never stalls
+	bool timing = !this->time_pending;
+	if (this->time_pending) {
+		GLint available = 0;
+		glGetQueryObjectiv(this->time_query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(this->time_query, GL_QUERY_RESULT, &elapsed);
+			this->gpu_ms = elapsed * 1e-6f;
+			timing = true;
+		}
+	}
+	if (!this->time_query)
+		glGenQueries(1, &this->time_query);
+	if (timing)
+		glBeginQuery(GL_TIME_ELAPSED, this->time_query);
+
+	if (this->rasterize && this->extract_requested && this->grid && mesh) {
+		std::string grid_name = this->vdb_grid != -1 ? this->vdb_file.grids[this->vdb_grid].name : "";
+		this->surface_mesh = MarchingCubes::Get(this->vdb_path.c_str(), grid_name, *this->grid, this->isovalue, mesh->aabb_min, mesh->aabb_max);
+		this->surface_mesh_isovalue = this->isovalue;
+		this->extract_requested = false;
+		if (!this->surface_material)
+			this->surface_material = new StandardMaterial();
+	}
+
 	bool first_pass = true;
-	if (mesh && this->shader)
+	if (this->rasterize && this->surface_mesh)
 	{
+		this->surface_material->color = this->surface_color;
+		this->surface_material->render(this->surface_mesh, model, camera);
+	}
+	else if (mesh && this->shader)
+	{
+		Mesh* march_mesh = prepareProxy(mesh, model, camera);
+
 		// enable shader
 		this->shader->enable();
 
 		// Multi pass render
-		int num_lights = Application::instance->light_list.size();
+		int num_lights = Application::instance->node_lights.size();
 		for (int nlight = -1; nlight < num_lights; nlight++)
 		{
 			if (nlight == -1) { nlight++; } // hotfix
@@ -562,14 +958,22 @@ void IsoMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 
 			// upload light uniforms
 			if (!first_pass) {
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+				if (Application::instance->volume_pass) {
+					// the extra lights only add radiance, the opacity was written by the first pass
+					glBlendFunc(GL_ONE, GL_ONE);
+					glColorMask(true, true, true, false);
+					glColorMaski(1, false, false, false, false);
+				}
+				else
+					glBlendFunc(GL_SRC_ALPHA, GL_ONE);
 				glDepthFunc(GL_LEQUAL);
 			}
-			//this->shader->setUniform("u_ambient_light", Application::instance->ambient_light * (float)first_pass);
+			// the ambient of the surface is added once
+			this->shader->setUniform("u_ambient_light", Application::instance->ambient_light * (float)first_pass);
 			//this->shader->setUniform("u_background_color", Application::instance->background_color);
 
 			if (num_lights > 0) {
-				Light* light = Application::instance->light_list[nlight];
+				Light* light = Application::instance->node_lights[nlight];
 				light->setUniforms(this->shader, model);
 			}
 			else {
@@ -580,23 +984,80 @@ void IsoMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 			}
 
 			// do the draw call
-			mesh->render(GL_TRIANGLES);
+			march_mesh->render(GL_TRIANGLES);
 
 			first_pass = false;
+
+			// the step count is the same for every light, the extra passes would only add to it
+			if (this->debug_steps)
+				break;
+		}
+
+		if (Application::instance->volume_pass) {
+			glColorMask(true, true, true, true);
+			glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 		}
 
 		// disable shader
 		this->shader->disable();
 	}
+
+	if (timing) {
+		glEndQuery(GL_TIME_ELAPSED);
+		this->time_pending = true;
+	}
 }
 
 void IsoMaterial::renderInMenu()
 {
+	if (this->loader)
+		ImGui::Text(this->loader->isUploading() ? "Uploading %.0f%%" : "Loading VDB...", this->loader->getProgress() * 100.f);
+	if (renderGridsInMenu())
+		loadVDB(this->vdb_file.filename);
 	ImGui::Checkbox("Jittering Offset", &this->jittering_offset);
 	ImGui::ColorEdit3("Color", (float*)&this->color);
+	ImGui::Checkbox("Isosurface", &this->show_surface);
+	if (this->show_surface) {
+		ImGui::SliderFloat("Isovalue", &this->isovalue, 0.01f, 1.0f);
+		ImGui::ColorEdit3("Surface Color", (float*)&this->surface_color);
+		ImGui::Checkbox("Precomputed Normals", &this->precomputed_normals);
+		ImGui::Checkbox("Surface Only", &this->surface_only);
+		if (this->surface_only) {
+			ImGui::Checkbox("Sphere Tracing", &this->sphere_tracing);
+			if (!this->sphere_tracing)
+				ImGui::SliderFloat("Coarse Step Scale", &this->iso_step_scale, 1.0f, 8.0f);
+		}
+		ImGui::SliderInt("Bisection Steps", &this->refine_steps, 0, 8);
+	}
+	if (ImGui::Checkbox("Rasterize Mesh", &this->rasterize)) {
+		// the mesh is opaque, it is drawn with the scene instead of in the volume pass
+		this->is_volume = !this->rasterize;
+		if (this->rasterize && !this->surface_mesh)
+			this->extract_requested = true;
+	}
+	if (this->rasterize) {
+		if (ImGui::Button("Extract at Isovalue"))
+			this->extract_requested = true;
+		if (this->surface_mesh)
+			ImGui::Text("%d triangles at isovalue %.3f", (int)this->surface_mesh->indices.size(), this->surface_mesh_isovalue);
+	}
+	ImGui::Text("GPU time %.3f ms", this->gpu_ms);
+	ImGui::Checkbox("Debug Step Count", &this->debug_steps);
+	if (this->debug_steps)
+		ImGui::SliderInt("Max Steps", &this->debug_max_steps, 8, 512);
 	ImGui::SliderFloat("Absorption Coefficient", &this->absorption_coefficient, 0.0f, 2.0f); // Absorption control
 	ImGui::SliderFloat("Scattering Coefficient", &this->scattering_coefficient, 0.0f, 2.0f); // Absorption control
 	ImGui::SliderFloat("Step Length", &this->step_length, 0.01f, 3.0f); // Absorption control
+	ImGui::Checkbox("Adaptive Step", &this->adaptive_step);
+	if (this->adaptive_step) {
+		ImGui::SliderFloat("Max Step Scale", &this->max_step_scale, 1.0f, 16.0f);
+		ImGui::SliderFloat("Step Distance Scale", &this->step_distance_scale, 0.0f, 0.5f);
+	}
+	ImGui::Checkbox("Light Mipmaps", &this->density_lod);
+	if (this->density_lod)
+		ImGui::SliderFloat("Light LOD", &this->light_lod, 0.0f, 3.0f);
+	ImGui::Checkbox("Pre-integrated Transfer Function", &this->preintegrate);
+	this->transfer->renderInMenu();
 	//ImGui::SliderInt("Light Step Length", &this->max_light_steps, 1, 100);
 	ImGui::SliderFloat("G parameter Value", &this->isotropy_parameter, -1.f, 1.0f);
 
@@ -608,126 +1069,111 @@ void IsoMaterial::setShader()
 {
 }
 
-void IsoMaterial::loadVDB(std::string file_path)
+void IsoMaterial::loadVDB(std::string file_path, bool async)
 {
+	this->vdb_path = file_path;
+	if (async) {
+		startLoader(file_path);
+		return;
+	}
+
+	scanVDB(file_path);
 	easyVDB::OpenVDBReader* vdbReader = new easyVDB::OpenVDBReader();
 	vdbReader->read(file_path);
 
 	// now, read the grid from the vdbReader and store the data in a 3D texture
 	estimate3DTexture(vdbReader);
+	delete vdbReader;
 }
 
-void IsoMaterial::estimate3DTexture(easyVDB::OpenVDBReader* vdbReader)
+bool IsoMaterial::updateDistanceField()
 {
-	int resolution = 128;
-	float radius = 2.0;
-
-	int convertedGrids = 0;
-	int convertedVoxels = 0;
-
-	int totalGrids = vdbReader->gridsSize;
-	int totalVoxels = totalGrids * pow(resolution, 3);
-
-	float resolutionInv = 1.0f / resolution;
-	int resolutionPow2 = pow(resolution, 2);
-	int resolutionPow3 = pow(resolution, 3);
-
-	// read all grids data and convert to texture
-	for (unsigned int i = 0; i < totalGrids; i++) {
-		easyVDB::Grid& grid = vdbReader->grids[i];
-		float* data = new float[resolutionPow3];
-		memset(data, 0, sizeof(float) * resolutionPow3);
-
-		// Bbox
-		easyVDB::Bbox bbox = easyVDB::Bbox();
-		bbox = grid.getPreciseWorldBbox();
-		glm::vec3 target = bbox.getCenter();
-		glm::vec3 size = bbox.getSize();
-		glm::vec3 step = size * resolutionInv;
-
-		grid.transform->applyInverseTransformMap(step);
-		target = target - (size * 0.5f);
-		grid.transform->applyInverseTransformMap(target);
-		target = target + (step * 0.5f);
-
-		int x = 0;
-		int y = 0;
-		int z = 0;
-
-		for (unsigned int j = 0; j < resolutionPow3; j++) {
-			int baseX = x;
-			int baseY = y;
-			int baseZ = z;
-			int baseIndex = baseX + baseY * resolution + baseZ * resolutionPow2;
-
-			if (target.x >= 40 && target.y >= 40.33 && target.z >= 10.36) {
-				int a = 0;
-			}
-
-			float value = grid.getValue(target);
-
-			int cellBleed = radius;
-
-			if (cellBleed) {
-				for (int sx = -cellBleed; sx < cellBleed; sx++) {
-					for (int sy = -cellBleed; sy < cellBleed; sy++) {
-						for (int sz = -cellBleed; sz < cellBleed; sz++) {
-							if (x + sx < 0.0 || x + sx >= resolution ||
-								y + sy < 0.0 || y + sy >= resolution ||
-								z + sz < 0.0 || z + sz >= resolution) {
-								continue;
-							}
-
-							int targetIndex = baseIndex + sx + sy * resolution + sz * resolutionPow2;
-
-							float offset = std::max(0.0, std::min(1.0, 1.0 - std::hypot(sx, sy, sz) / (radius / 2.0)));
-							float dataValue = offset * value * 255.f;
-
-							data[targetIndex] += dataValue;
-							data[targetIndex] = std::min((float)data[targetIndex], 255.f);
-						}
-					}
-				}
-			}
-			else {
-				float dataValue = value * 255.f;
-
-				data[baseIndex] += dataValue;
-				data[baseIndex] = std::min((float)data[baseIndex], 255.f);
-			}
-
-			convertedVoxels++;
-
-			if (z >= resolution) {
-				break;
-			}
-
-			x++;
-			target.x += step.x;
-
-			if (x >= resolution) {
-				x = 0;
-				target.x -= step.x * resolution;
+	{
+		std::lock_guard<std::mutex> lock(this->distance_field_mutex);
+		if (this->next_distance_field && !this->distance_field_busy) {
+			delete this->distance_field;
+			this->distance_field = this->next_distance_field;
+			this->next_distance_field = NULL;
+		}
+	}
 
-				y++;
-				target.y += step.y;
-			}
+	// one build at a time, while the slider is dragged the field follows it every build
+	if (!this->next_distance_field && (!this->distance_field || this->distance_field->isovalue != this->isovalue)) {
+		DistanceField* field = new DistanceField();
+		const VolumeGrid* grid = this->grid;
+		float isovalue = this->isovalue;
+		this->next_distance_field = field;
+		this->distance_field_busy = true;
+		runJob([this, field, grid, isovalue]() {
+			field->build(*grid, isovalue);
+			// notified with the lock held, the fields may be deleted as soon as the wait returns
+			std::lock_guard<std::mutex> lock(this->distance_field_mutex);
+			this->distance_field_busy = false;
+			this->distance_field_condition.notify_all();
+		});
+	}
+	return this->distance_field && this->distance_field->isovalue == this->isovalue;
+}
 
-			if (y >= resolution) {
-				y = 0;
-				target.y -= step.y * resolution;
+void IsoMaterial::clearDistanceField()
+{
+	{
+		std::unique_lock<std::mutex> lock(this->distance_field_mutex);
+		this->distance_field_condition.wait(lock, [this]() { return !this->distance_field_busy; });
+	}
+	delete this->distance_field;
+	delete this->next_distance_field;
+	this->distance_field = NULL;
+	this->next_distance_field = NULL;
+}
 
-				z++;
-				target.z += step.z;
-			}
+void IsoMaterial::update(float dt)
+{
+	// the job of the distance field reads the grid, it is replaced once the job is done
+	VolumeGrid* grid = NULL;
+	if (!updateLoader(&grid))
+		return;
+
+	// the gradients and the distance field come from the new grid, the mesh of the old one is dropped from the cache
+	clearDistanceField();
+	if (this->grid)
+		delete this->grid;
+	this->grid = grid;
+	MarchingCubes::Release(this->surface_mesh);
+	this->surface_mesh = NULL;
+	this->extract_requested = this->rasterize;
+}
 
-			// yield
-		}
+void IsoMaterial::estimate3DTexture(easyVDB::OpenVDBReader* vdbReader)
+{
+	int resolution = 128;
+	float radius = 2.0;
 
-		// now we create the texture with the data
-		// use this: https://www.khronos.org/opengl/wiki/OpenGL_Type
-		// and this: https://registry.khronos.org/OpenGL-Refpages/gl4/html/glTexImage3D.xhtml
-		this->texture = new Texture();
-		this->texture->create3D(resolution, resolution, resolution, GL_RED, GL_FLOAT, false, data, GL_R8);
-	}
+	// only the grid chosen as the density, the first one if the header couldn't be read
+	unsigned int i = std::max(this->vdb_grid, 0);
+	if (i >= vdbReader->gridsSize)
+		return;
+
+	// the gradients are computed from it the first time the surface is shaded with them
+	if (!this->grid)
+		this->grid = new VolumeGrid();
+	clearDistanceField();
+	this->grid->voxelize(vdbReader->grids[i], resolution, radius);
+	MarchingCubes::Release(this->surface_mesh);
+	this->surface_mesh = NULL;
+	this->extract_requested = this->rasterize;
+
+	// now we create the texture with the data and its mip chain, only the light march samples the coarse levels
+	// use this: https://www.khronos.org/opengl/wiki/OpenGL_Type
+	// and this: https://registry.khronos.org/OpenGL-Refpages/gl4/html/glTexImage3D.xhtml
+	VolumeProxy* proxy = this->owns_proxy ? this->proxy : NULL;
+	this->owns_proxy = false;
+	releaseVolume();
+	this->texture = this->grid->createTexture();
+	this->owns_texture = true;
+
+	// bricks with density, their hull is rasterized instead of the box in the volume pass
+	this->proxy = proxy ? proxy : new VolumeProxy();
+	this->owns_proxy = true;
+	this->proxy->build(&this->grid->data[0], resolution);
 }
\ No newline at end of file
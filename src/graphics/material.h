@@ -8,6 +8,14 @@
 #include "mesh.h"
 #include "texture.h"
 #include "shader.h"
+#include "volumeproxy.h"
+#include "volumegrid.h"
+#include "distancefield.h"
+#include "marchingcubes.h"
+#include "volumesequence.h"
+#include "volumeloader.h"
+#include "volumefile.h"
+#include "transferfunction.h"
 #include "openvdbReader.h"
 #include "bbox.h"
 
@@ -17,10 +25,60 @@ public:
 	Shader* shader = NULL;
 	Texture* texture = NULL;
 	glm::vec4 color;
+	bool is_volume = false; // ray marched, rendered in the offscreen volume pass
+	VolumeProxy* proxy = NULL; // occupancy hull of the volume, marched instead of the box when available
+	bool proxy_active = false; // the ray bounds of the hull were rendered for the current draw
+	bool adaptive_step = true; // longer steps in thin or empty bricks and far from the camera, needs the proxy
+	float max_step_scale = 4.f;
+	float step_distance_scale = 0.05f; // per unit of distance to the camera
+	TransferFunction* transfer = NULL; // density to extinction, albedo and emission of the volume
+	bool preintegrate = true; // segments between two samples from the pre-integrated table instead of one sample per step
+	bool density_lod = true; // density from the level of its mip chain covered by a pixel, longer steps through the coarse ones
+	float lod_bias = 0.f;
+	float light_lod = 1.f; // levels coarser than the view sample for the light march
+	VolumeLoader* loader = NULL; // VDB loading in the background, the texture is its placeholder or the levels it has uploaded
+	VolumeFile vdb_file; // header of the last VDB, its grids are listed in the menu
+	std::string density_grid; // chosen in the menu, the density grid of the file when empty or missing
+	int vdb_grid = -1; // index in vdb_file of the grid loaded as the density, -1 if the header couldn't be read
+	sVolumeChannels channels; // grids packed in the texture and their ranges, only the density unless pack_temperature
+	bool pack_temperature = false; // the temperature grid of the VDB goes in the second channel of the texture
+	int density_bits = 8; // texels of the next VDB load, 8 or 16 bits per channel
+	bool brick_ranges = false; // the next VDB load quantizes the density over the range of its bricks
+	Texture* range_texture = NULL; // offset and scale of the density bricks when the channels use them
+	bool owns_texture = false; // texture and range_texture were created for the material, not the placeholder, the loader's or the sequence's
+	bool owns_proxy = false;
+
+	//waits for the loader and deletes it, the owned texture and proxy and the transfer function
+	virtual ~Material();
 
 	virtual void setUniforms(Camera* camera, glm::mat4 model) = 0;
 	virtual void render(Mesh* mesh, glm::mat4 model, Camera* camera) = 0;
 	virtual void renderInMenu() = 0;
+	//once per frame before the render, dt in seconds
+	virtual void update(float dt) {};
+
+	//depth of the opaque scene for the ray marchers, the rays are clamped only in the offscreen volume pass
+	//takes the shader since IsoMaterial declares its own
+	void setDepthClampUniforms(Shader* shader, Camera* camera);
+	//offscreen volume pass: rasterizes the entry and exit of the hull and returns it to be marched instead of the box
+	Mesh* prepareProxy(Mesh* mesh, const glm::mat4& model, Camera* camera, bool enabled = true);
+	void setProxyUniforms(Shader* shader);
+	void setAdaptiveStepUniforms(Shader* shader);
+	//rebuilds the tables of the transfer function when the coefficients changed, step_length is the unscaled one of the material
+	void setTransferUniforms(Shader* shader, float step_length, float extinction_scale, float scattering_scale);
+	//reads the header of the VDB and finds the grid to load as the density
+	int scanVDB(const std::string& file_path);
+	//deletes the texture, range texture and proxy the material owns and clears them, the ones of the loader and the sequence are left
+	void releaseVolume();
+	//starts the background load of a VDB, the texture and the proxy are replaced as it arrives
+	void startLoader(const std::string& file_path);
+	//grids of the VDB, true when another one was chosen as the density and the file has to be loaded again
+	bool renderGridsInMenu();
+	//once per frame: uploads the next slices within the budget of the application and takes the channels of the texture.
+	//True the frame the load completes, then the loader is deleted and its grid is handed over if grid is given
+	bool updateLoader(VolumeGrid** grid = NULL);
+	//footprint of a pixel of the current target for the level of the density, only with a perspective camera
+	void setLodUniforms(Shader* shader, Camera* camera, const glm::mat4& model);
 };
 
 class FlatMaterial : public Material {
@@ -73,15 +131,20 @@ public:
 	float isotropy_parameter;
 	glm::vec4 color;
 	bool jittering_offset;
+	float temperature_emission = 1.f; // radiance of the hottest voxels, only with a temperature channel
+	glm::vec2 temperature_range = glm::vec2(0.f, 1.f); // cold and hot ends of the fire ramp, the range of the grid when it loads
 
 	Shader* basic_shader = NULL;
 	Shader* absorption_shader = NULL;
 	Shader* emission_absorption = NULL;
 	Shader* normal_shader = NULL;
-	Shader* scattering_shader = NULL;
+	Shader* scattering_shader = NULL; // compiled with the macros of the channels
+	std::string scattering_macros;
+	VolumeSequence* sequence = NULL; // numbered VDB files played back, the texture and the proxy are the ones of its frame on screen
 
 	VolumeMaterial(double absorption_coefficient = 1.0, glm::vec4 color = glm::vec4(0.f),
 		float noise_scale = 1.558f, int noise_detail = 5.f, float step_length = 0.045f, float emission_coefficient = 1.0f, float density_scale = 1.0f, float scattering_coefficient = 1.0f, float isotropy_parameter = 0.f);
+	~VolumeMaterial();
 
 	void setUniforms(Camera* camera, glm::mat4 model) override {
 		setUniforms(camera, model, nullptr);
@@ -89,8 +152,11 @@ public:
 	void setUniforms(Camera* camera, glm::mat4 model, Mesh* mesh);
 	void render(Mesh* mesh, glm::mat4 model, Camera* camera) override;
 	void renderInMenu() override;
+	void update(float dt) override;
 	void setShader();
-	void loadVDB(std::string file_path);
+	//a file numbered like cloud_0001.vdb is played back with the others next to it, a single one is loaded in the
+	//background unless async is false
+	void loadVDB(std::string file_path, bool async = true);
 	void estimate3DTexture(easyVDB::OpenVDBReader* vdbReader);
 
 };
@@ -108,11 +174,37 @@ public:
 	float isotropy_parameter;
 	glm::vec4 color;
 	bool jittering_offset;
+	bool show_surface = true; // opaque surface at the isovalue, shaded with the lights
+	float isovalue = 0.5f;
+	glm::vec4 surface_color = glm::vec4(0.9f, 0.85f, 0.8f, 1.f);
+	bool precomputed_normals = true; // normals from the gradient volume of the grid instead of six more density fetches per hit
+	bool surface_only = true; // coarse steps to the surface and nothing else, the volume in front is not marched
+	float iso_step_scale = 1.f;
+	bool sphere_tracing = true; // surface only: steps of the distance field of the grid at the isovalue
+	int refine_steps = 4; // bisections of the step with the crossing
+	bool debug_steps = false; // heat map of the density samples per pixel
+	int debug_max_steps = 128;
+	bool rasterize = false; // draws the marching cubes mesh of the surface as an opaque node instead of marching it
+	Mesh* surface_mesh = NULL; // extracted at surface_mesh_isovalue, cached as .mbin next to the VDB
+	float surface_mesh_isovalue = -1.f;
+	bool extract_requested = false; // extracted in the next render, which knows the box of the volume
+	StandardMaterial* surface_material = NULL;
+	std::string vdb_path;
+	unsigned int time_query = 0; // GPU time of the render, to compare marching and rasterizing
+	float gpu_ms = 0.f;
+	bool time_pending = false;
 
 	Shader* shader = NULL;
+	VolumeGrid* grid = NULL; // density of the loaded VDB, kept for its gradients and distance field
+	DistanceField* distance_field = NULL; // of the isovalue it was built with, sphere traced only while it is the current one
+	DistanceField* next_distance_field = NULL; // built by a job for a newer isovalue, replaces distance_field when done
+	bool distance_field_busy = false;
+	std::mutex distance_field_mutex;
+	std::condition_variable distance_field_condition;
 
 	IsoMaterial(double absorption_coefficient = 1.0, glm::vec4 color = glm::vec4(0.f),
 		float noise_scale = 1.558f, int noise_detail = 5.f, float step_length = 0.045f, float emission_coefficient = 1.0f, float density_scale = 1.0f, float scattering_coefficient = 1.0f, float isotropy_parameter = 0.f);
+	~IsoMaterial();
 
 	void setUniforms(Camera* camera, glm::mat4 model) override {
 		setUniforms(camera, model, nullptr);
@@ -120,8 +212,15 @@ public:
 	void setUniforms(Camera* camera, glm::mat4 model, Mesh* mesh);
 	void render(Mesh* mesh, glm::mat4 model, Camera* camera) override;
 	void renderInMenu() override;
+	void update(float dt) override;
 	void setShader();
-	void loadVDB(std::string file_path);
+	//in the background unless async is false
+	void loadVDB(std::string file_path, bool async = true);
 	void estimate3DTexture(easyVDB::OpenVDBReader* vdbReader);
+	//swaps in the field the job finished and starts another one when the isovalue changed. True when the field is the one
+	//of the current isovalue, the render thread never waits for the build
+	bool updateDistanceField();
+	//waits for the job, which reads the grid, and deletes the fields before the grid changes
+	void clearDistanceField();
 
 };
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 #include "shader.h"
 #include "texture.h"
+#include "bvh.h"
 #include "../framework/includes.h"
 #include "../framework/utils.h"
 #include "../framework/camera.h"
@@ -44,9 +45,9 @@ BoundingBox transformBoundingBox(const glm::mat4 m, const BoundingBox& box)
 		if (corner.z < box_min.z) box_min.z = corner.z;
 
 		//box_max.setMax(corner);
-		if (corner.x > box_min.x) box_min.x = corner.x;
-		if (corner.y > box_min.y) box_min.y = corner.y;
-		if (corner.z > box_min.z) box_min.z = corner.z;
+		if (corner.x > box_max.x) box_max.x = corner.x;
+		if (corner.y > box_max.y) box_max.y = corner.y;
+		if (corner.z > box_max.z) box_max.z = corner.z;
 	}
 
 	glm::vec3 halfsize = (box_max - box_min) * 0.5f;
@@ -101,6 +102,11 @@ void Mesh::clear()
 	bones.clear();
 	weights.clear();
 	uvs1.clear();
+
+	//collision model is built from the geometry
+	if (collision_model)
+		delete (MeshBVH*)collision_model;
+	collision_model = NULL;
 }
 
 int vertex_location = -1;
@@ -603,7 +609,11 @@ void Mesh::uploadToVRAM()
 		if (indices_vbo_id == 0)
 			glGenBuffers(1, &indices_vbo_id);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(glm::uvec3), &indices[0], GL_STATIC_DRAW);
+		//stored as floats like the loaders and the BVH read them, the GPU needs them as unsigned ints
+		std::vector<glm::uvec3> gpu_indices(indices.size());
+		for (size_t i = 0; i < indices.size(); ++i)
+			gpu_indices[i] = glm::uvec3(indices[i]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, gpu_indices.size() * sizeof(glm::uvec3), &gpu_indices[0], GL_STATIC_DRAW);
 	}
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
@@ -1517,6 +1527,66 @@ void Mesh::renderBounding(const glm::mat4& model, bool world_bounding)
 }
 
 
+bool Mesh::createCollisionModel(bool parallel)
+{
+	if (collision_model)
+		return true;
+
+	MeshBVH* bvh = new MeshBVH();
+	if (!bvh->build(this, parallel))
+	{
+		std::cerr << "Mesh has no triangles to create a collision model: " << name << std::endl;
+		delete bvh;
+		return false;
+	}
+
+	collision_model = bvh;
+	return true;
+}
+
+bool Mesh::testRayCollision(glm::mat4 model, glm::vec3 ray_origin, glm::vec3 ray_direction, glm::vec3& collision, glm::vec3& normal, float max_ray_dist, bool in_object_space)
+{
+	if (!collision_model && !createCollisionModel())
+		return false;
+	MeshBVH* bvh = (MeshBVH*)collision_model;
+
+	//the direction is not normalized after the transform so the distances along the ray are still in world units
+	glm::mat4 inv = glm::inverse(model);
+	glm::vec3 local_origin = glm::vec3(inv * glm::vec4(ray_origin, 1.f));
+	glm::vec3 local_direction = glm::vec3(inv * glm::vec4(ray_direction, 0.f));
+
+	sRayHit hit;
+	if (!bvh->testRay(local_origin, local_direction, hit, max_ray_dist))
+		return false;
+
+	collision = local_origin + local_direction * hit.t;
+	normal = glm::normalize(hit.normal);
+	if (!in_object_space)
+	{
+		collision = glm::vec3(model * glm::vec4(collision, 1.f));
+		normal = glm::normalize(glm::transpose(glm::mat3(inv)) * normal);
+	}
+	return true;
+}
+
+bool Mesh::testSphereCollision(glm::mat4 model, glm::vec3 center, float radius, glm::vec3& collision, glm::vec3& normal)
+{
+	if (!collision_model && !createCollisionModel())
+		return false;
+	MeshBVH* bvh = (MeshBVH*)collision_model;
+
+	//non uniform scales use the smallest axis, the test is conservative
+	glm::mat4 inv = glm::inverse(model);
+	glm::vec3 local_center = glm::vec3(inv * glm::vec4(center, 1.f));
+	float scale = glm::min(glm::length(glm::vec3(model[0])), glm::min(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+
+	if (!bvh->testSphere(local_center, radius / scale, collision, normal))
+		return false;
+
+	collision = glm::vec3(model * glm::vec4(collision, 1.f));
+	normal = glm::normalize(glm::transpose(glm::mat3(inv)) * normal);
+	return true;
+}
 
 Mesh* Mesh::getQuad()
 {
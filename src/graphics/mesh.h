@@ -137,11 +137,11 @@ public:
 	unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
 
 	//collision testing
-	void* collision_model;
-	//bool createCollisionModel(bool is_static = false); //is_static sets if the inv matrix should be computed after setTransform (true) or before rayCollision (false)
-	////help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
-	//bool testRayCollision(Matrix44 model, Vector3 ray_origin, Vector3 ray_direction, Vector3& collision, Vector3& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false);
-	//bool testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal);
+	void* collision_model; //MeshBVH, created on the first query if not created before
+	bool createCollisionModel(bool parallel = true);
+	//help: model is the transform of the mesh, ray origin and direction, a vec3 where to store the collision if found, a vec3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
+	bool testRayCollision(glm::mat4 model, glm::vec3 ray_origin, glm::vec3 ray_direction, glm::vec3& collision, glm::vec3& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false);
+	bool testSphereCollision(glm::mat4 model, glm::vec3 center, float radius, glm::vec3& collision, glm::vec3& normal);
 
 	//loader
 	static Mesh* Get(const char* filename);
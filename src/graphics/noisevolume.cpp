@@ -0,0 +1,374 @@
+#include "noisevolume.h"
+
+#include "texture.h"
+#include "../framework/jobs.h"
+#include "../framework/simd.h"
+
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <functional>
+
+std::map<uint64_t, Texture*> NoiseVolume::sTexturesGenerated;
+
+//edges of the cube, the first four repeated so the hash can be masked (improved noise, Perlin 2002)
+static const float gradients[16][3] = {
+	{ 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+	{ 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+	{ 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 },
+	{ 1, 1, 0 }, { 0, -1, 1 }, { -1, 1, 0 }, { 0, -1, -1 }
+};
+
+static inline float fade(float t)
+{
+	return t * t * t * (t * (t * 6.f - 15.f) + 10.f);
+}
+
+static inline float lerp(float a, float b, float t)
+{
+	return a + (b - a) * t;
+}
+
+static inline float dotGradient(int hash, float x, float y, float z)
+{
+	const float* g = gradients[hash & 15];
+	return g[0] * x + g[1] * y + g[2] * z;
+}
+
+//gradient noise that wraps every period cells. The hash goes z, y, x so a row along x shares the first two lookups
+static float gradientNoise(const int* perm, float x, float y, float z, int period)
+{
+	int mask = period - 1;
+	int xi = (int)floorf(x), yi = (int)floorf(y), zi = (int)floorf(z);
+	float xf = x - xi, yf = y - yi, zf = z - zi;
+	int x0 = xi & mask, x1 = (xi + 1) & mask;
+	int y0 = yi & mask, y1 = (yi + 1) & mask;
+	int z0 = zi & mask, z1 = (zi + 1) & mask;
+
+	int b00 = perm[perm[z0] + y0], b10 = perm[perm[z0] + y1];
+	int b01 = perm[perm[z1] + y0], b11 = perm[perm[z1] + y1];
+
+	float u = fade(xf), v = fade(yf), w = fade(zf);
+	float x00 = lerp(dotGradient(perm[b00 + x0], xf, yf, zf), dotGradient(perm[b00 + x1], xf - 1.f, yf, zf), u);
+	float x10 = lerp(dotGradient(perm[b10 + x0], xf, yf - 1.f, zf), dotGradient(perm[b10 + x1], xf - 1.f, yf - 1.f, zf), u);
+	float x01 = lerp(dotGradient(perm[b01 + x0], xf, yf, zf - 1.f), dotGradient(perm[b01 + x1], xf - 1.f, yf, zf - 1.f), u);
+	float x11 = lerp(dotGradient(perm[b11 + x0], xf, yf - 1.f, zf - 1.f), dotGradient(perm[b11 + x1], xf - 1.f, yf - 1.f, zf - 1.f), u);
+	return lerp(lerp(x00, x10, v), lerp(x01, x11, v), w);
+}
+
+int NoiseVolume::getMaxDetail(int resolution, int period)
+{
+	int detail = 1;
+	while ((period << detail) * 2 <= resolution)
+		++detail;
+	return detail;
+}
+
+void NoiseVolume::setSeed(unsigned int seed)
+{
+	this->seed = seed;
+	for (int i = 0; i < 256; ++i)
+		perm[i] = i;
+	std::mt19937 rng(seed);
+	std::shuffle(perm, perm + 256, rng);
+	for (int i = 0; i < 256; ++i)
+		perm[i + 256] = perm[i];
+}
+
+float NoiseVolume::evaluate(float x, float y, float z) const
+{
+	float value = 0.f;
+	float amplitude = 0.5f;
+	float frequency = 1.f;
+	for (int i = 0; i < detail; ++i)
+	{
+		value += amplitude * gradientNoise(perm, x * frequency, y * frequency, z * frequency, period << i);
+		frequency *= 2.f;
+		amplitude *= 0.5f;
+	}
+	return value;
+}
+
+void NoiseVolume::generate(int resolution, int period, int detail, unsigned int seed, bool use_simd, bool parallel)
+{
+	assert(period > 0 && (period & (period - 1)) == 0 && "the period must be a power of two");
+	assert((period << (detail - 1)) <= 256 && "the lattice of the last octave must fit the permutation");
+	this->resolution = resolution;
+	this->period = period;
+	this->detail = detail;
+	setSeed(seed);
+	data.resize((size_t)resolution * resolution * resolution);
+
+	if (parallel)
+		parallelFor(resolution, [&](int begin, int end) { generateSlices(begin, end, use_simd); });
+	else
+		generateSlices(0, resolution, use_simd);
+}
+
+void NoiseVolume::generateSlices(int begin, int end, bool use_simd)
+{
+	std::vector<float> row(resolution);
+#ifdef USE_SSE
+	std::vector<float> lattice_x(4 * 256), lattice_yz(4 * 256); //per row: x of the gradients and y, z part of the dot product
+#endif
+	for (int z = begin; z < end; ++z)
+		for (int y = 0; y < resolution; ++y)
+		{
+			std::fill(row.begin(), row.end(), 0.f);
+			float amplitude = 0.5f;
+			for (int octave = 0; octave < detail; ++octave, amplitude *= 0.5f)
+			{
+				//texel centers in lattice units of the octave
+				int octave_period = period << octave;
+				float scale = octave_period / (float)resolution;
+				float py = (y + 0.5f) * scale, pz = (z + 0.5f) * scale;
+				int x = 0;
+
+#ifdef USE_SSE
+				if (use_simd)
+				{
+					//4 texels of the row at a time, y and z are the same for all of them
+					int mask = octave_period - 1;
+					int yi = (int)py, zi = (int)pz;
+					float yf = py - yi, zf = pz - zi;
+					int y0 = yi & mask, y1 = (yi + 1) & mask;
+					int z0 = zi & mask, z1 = (zi + 1) & mask;
+					const int rows[4] = { perm[perm[z0] + y0], perm[perm[z0] + y1], perm[perm[z1] + y0], perm[perm[z1] + y1] };
+					const float dy[4] = { yf, yf - 1.f, yf, yf - 1.f };
+					const float dz[4] = { zf, zf, zf - 1.f, zf - 1.f };
+					float v = fade(yf), w = fade(zf);
+
+					//the gradients of the row only depend on the lattice x, so the hash and the y, z part of the
+					//dot product are done once per cell instead of once per texel
+					for (int c = 0; c < 4; ++c)
+						for (int i = 0; i < octave_period; ++i)
+						{
+							const float* g = gradients[perm[rows[c] + i] & 15];
+							lattice_x[c * 256 + i] = g[0];
+							lattice_yz[c * 256 + i] = g[1] * dy[c] + g[2] * dz[c];
+						}
+
+					__m128 one = _mm_set1_ps(1.f);
+					__m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+					__m128 vamplitude = _mm_set1_ps(amplitude);
+					for (; x + 4 <= resolution; x += 4)
+					{
+						__m128 px = _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), lanes), _mm_set1_ps(scale));
+						__m128i pxi = _mm_cvttps_epi32(px); //positive, truncation is floor
+						__m128 xf = _mm_sub_ps(px, _mm_cvtepi32_ps(pxi));
+						alignas(16) int xi[4];
+						_mm_store_si128((__m128i*)xi, pxi);
+						int i0[4], i1[4];
+						for (int k = 0; k < 4; ++k)
+						{
+							i0[k] = xi[k] & mask;
+							i1[k] = (xi[k] + 1) & mask;
+						}
+
+						//fade of x
+						__m128 u = _mm_mul_ps(_mm_mul_ps(xf, _mm_mul_ps(xf, xf)),
+							_mm_add_ps(_mm_mul_ps(xf, _mm_sub_ps(_mm_mul_ps(xf, _mm_set1_ps(6.f)), _mm_set1_ps(15.f))), _mm_set1_ps(10.f)));
+
+						__m128 edges[4];
+						for (int c = 0; c < 4; ++c)
+						{
+							const float* gx = &lattice_x[c * 256];
+							const float* gyz = &lattice_yz[c * 256];
+							__m128 n0 = _mm_add_ps(_mm_mul_ps(_mm_setr_ps(gx[i0[0]], gx[i0[1]], gx[i0[2]], gx[i0[3]]), xf),
+								_mm_setr_ps(gyz[i0[0]], gyz[i0[1]], gyz[i0[2]], gyz[i0[3]]));
+							__m128 n1 = _mm_add_ps(_mm_mul_ps(_mm_setr_ps(gx[i1[0]], gx[i1[1]], gx[i1[2]], gx[i1[3]]), _mm_sub_ps(xf, one)),
+								_mm_setr_ps(gyz[i1[0]], gyz[i1[1]], gyz[i1[2]], gyz[i1[3]]));
+							edges[c] = _mm_add_ps(n0, _mm_mul_ps(_mm_sub_ps(n1, n0), u));
+						}
+						__m128 vv = _mm_set1_ps(v);
+						__m128 front = _mm_add_ps(edges[0], _mm_mul_ps(_mm_sub_ps(edges[1], edges[0]), vv));
+						__m128 back = _mm_add_ps(edges[2], _mm_mul_ps(_mm_sub_ps(edges[3], edges[2]), vv));
+						__m128 n = _mm_add_ps(front, _mm_mul_ps(_mm_sub_ps(back, front), _mm_set1_ps(w)));
+						_mm_storeu_ps(&row[x], _mm_add_ps(_mm_loadu_ps(&row[x]), _mm_mul_ps(n, vamplitude)));
+					}
+				}
+#endif
+
+				for (; x < resolution; ++x)
+					row[x] += amplitude * gradientNoise(perm, (x + 0.5f) * scale, py, pz, octave_period);
+			}
+
+			uint16_t* out = &data[((size_t)z * resolution + y) * resolution];
+			for (int x = 0; x < resolution; ++x)
+				out[x] = (uint16_t)(std::min(std::max(row[x] * 0.5f + 0.5f, 0.f), 1.f) * 65535.f + 0.5f);
+		}
+}
+
+struct sNoiseVolumeInfo
+{
+	int version = 0;
+	int header_bytes = 0;
+	int resolution = 0;
+	int period = 0;
+	int detail = 0;
+	unsigned int seed = 0;
+};
+
+bool NoiseVolume::readBin(const char* filename)
+{
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+		return false;
+
+	char watermark[4];
+	sNoiseVolumeInfo info;
+	bool valid = fread(watermark, 1, 4, f) == 4 && memcmp(watermark, "NBIN", 4) == 0 &&
+		fread(&info, sizeof(sNoiseVolumeInfo), 1, f) == 1 &&
+		info.version == NOISE_VOLUME_BIN_VERSION && info.header_bytes == sizeof(sNoiseVolumeInfo);
+	if (!valid)
+	{
+		std::cout << "[WARN] loading noise BIN: old version or invalid content: " << filename << std::endl;
+		fclose(f);
+		return false;
+	}
+
+	data.resize((size_t)info.resolution * info.resolution * info.resolution);
+	valid = fread(&data[0], sizeof(uint16_t), data.size(), f) == data.size();
+	fclose(f);
+	if (!valid)
+		return false;
+
+	resolution = info.resolution;
+	period = info.period;
+	detail = info.detail;
+	setSeed(info.seed);
+	return true;
+}
+
+bool NoiseVolume::writeBin(const char* filename)
+{
+	assert(data.size());
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write noise BIN: " << filename << std::endl;
+		return false;
+	}
+
+	//watermark
+	fwrite("NBIN", sizeof(char), 4, f);
+
+	sNoiseVolumeInfo info;
+	info.version = NOISE_VOLUME_BIN_VERSION;
+	info.header_bytes = sizeof(sNoiseVolumeInfo);
+	info.resolution = resolution;
+	info.period = period;
+	info.detail = detail;
+	info.seed = seed;
+	fwrite(&info, sizeof(sNoiseVolumeInfo), 1, f);
+	fwrite(&data[0], sizeof(uint16_t), data.size(), f);
+	fclose(f);
+	return true;
+}
+
+Texture* NoiseVolume::createTexture()
+{
+	//16 bits so the integral of the shallow parts doesn't band, repeated and mipmapped for the far volumes
+	std::vector<float> texels(data.size());
+	for (size_t i = 0; i < data.size(); ++i)
+		texels[i] = data[i] / 65535.f;
+	Texture* texture = new Texture();
+	texture->create3D(resolution, resolution, resolution, GL_RED, GL_FLOAT, true, &texels[0], GL_R16);
+	texture->upload3D(&texels[0], GL_LINEAR, GL_LINEAR_MIPMAP_LINEAR, GL_REPEAT);
+	return texture;
+}
+
+Texture* NoiseVolume::Get(int detail, unsigned int seed)
+{
+	detail = std::min(std::max(detail, 1), getMaxDetail());
+	uint64_t key = ((uint64_t)seed << 8) | (uint64_t)detail;
+	auto it = sTexturesGenerated.find(key);
+	if (it != sTexturesGenerated.end())
+		return it->second;
+
+	//the generation takes a moment, reuse it from disk
+	std::string filename = "res/noise" + std::to_string(NOISE_VOLUME_RESOLUTION) + "_p" + std::to_string(NOISE_VOLUME_PERIOD) +
+		"_d" + std::to_string(detail) + "_s" + std::to_string(seed) + ".nbin";
+	NoiseVolume noise;
+	if (!noise.readBin(filename.c_str()) || noise.resolution != NOISE_VOLUME_RESOLUTION || noise.period != NOISE_VOLUME_PERIOD || noise.detail != detail)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		noise.generate(NOISE_VOLUME_RESOLUTION, NOISE_VOLUME_PERIOD, detail, seed);
+		float ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		std::cout << " + Noise volume: " << NOISE_VOLUME_RESOLUTION << "^3, " << detail << " octaves in " << ms << " ms" << std::endl;
+		if (!noise.writeBin(filename.c_str()))
+			std::cout << "[WARN] Noise volume could not be cached in " << filename << std::endl;
+	}
+
+	Texture* texture = noise.createTexture();
+	sTexturesGenerated[key] = texture;
+	return texture;
+}
+
+void NoiseVolume::benchmark()
+{
+	int detail = getMaxDetail();
+	auto time = [](const std::function<void()>& fn) {
+		auto start = std::chrono::high_resolution_clock::now();
+		fn();
+		return std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	};
+
+	NoiseVolume scalar, simd, threaded;
+	float scalar_ms = time([&]() { scalar.generate(NOISE_VOLUME_RESOLUTION, NOISE_VOLUME_PERIOD, detail, NOISE_VOLUME_SEED, false, false); });
+	float simd_ms = time([&]() { simd.generate(NOISE_VOLUME_RESOLUTION, NOISE_VOLUME_PERIOD, detail, NOISE_VOLUME_SEED, true, false); });
+	float threaded_ms = time([&]() { threaded.generate(NOISE_VOLUME_RESOLUTION, NOISE_VOLUME_PERIOD, detail, NOISE_VOLUME_SEED, true, true); });
+	int max_difference = 0;
+	for (size_t i = 0; i < scalar.data.size(); ++i)
+		max_difference = std::max(max_difference, std::abs((int)scalar.data[i] - (int)threaded.data[i]));
+	std::cout << "   " << NOISE_VOLUME_RESOLUTION << "^3 voxels, " << detail << " octaves: scalar " << scalar_ms << " ms, SIMD " << simd_ms << " ms, SIMD with "
+		<< getNumJobThreads() << " threads " << threaded_ms << " ms (max difference " << max_difference << "/65535)" << std::endl;
+
+	const char* filename = "noise_benchmark.nbin";
+	float write_ms = time([&]() { threaded.writeBin(filename); });
+	NoiseVolume cached;
+	float read_ms = time([&]() { cached.readBin(filename); });
+	remove(filename);
+	std::cout << "   cache: write " << write_ms << " ms, read " << read_ms << " ms" << std::endl;
+
+	//cost of a density sample on the CPU: every octave of the procedural noise against a trilinear fetch of the baked one
+	const int num_samples = 1 << 20;
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> random(0.f, (float)NOISE_VOLUME_PERIOD);
+	std::vector<float> points(num_samples * 3);
+	for (float& p : points)
+		p = random(rng);
+
+	volatile float sink = 0.f;
+	float procedural_ms = time([&]() {
+		float sum = 0.f;
+		for (int i = 0; i < num_samples; ++i)
+			sum += threaded.evaluate(points[i * 3], points[i * 3 + 1], points[i * 3 + 2]);
+		sink = sum;
+	});
+	const int res = threaded.resolution;
+	float baked_ms = time([&]() {
+		float sum = 0.f;
+		for (int i = 0; i < num_samples; ++i)
+		{
+			//texel centers with GL_REPEAT
+			float fx = points[i * 3] * res / NOISE_VOLUME_PERIOD - 0.5f, fy = points[i * 3 + 1] * res / NOISE_VOLUME_PERIOD - 0.5f, fz = points[i * 3 + 2] * res / NOISE_VOLUME_PERIOD - 0.5f;
+			int x = (int)floorf(fx), y = (int)floorf(fy), z = (int)floorf(fz);
+			float tx = fx - x, ty = fy - y, tz = fz - z;
+			auto voxel = [&](int dx, int dy, int dz) {
+				return threaded.data[(((z + dz) & (res - 1)) * res + ((y + dy) & (res - 1))) * res + ((x + dx) & (res - 1))] / 65535.f;
+			};
+			float c0 = lerp(lerp(voxel(0, 0, 0), voxel(1, 0, 0), tx), lerp(voxel(0, 1, 0), voxel(1, 1, 0), tx), ty);
+			float c1 = lerp(lerp(voxel(0, 0, 1), voxel(1, 0, 1), tx), lerp(voxel(0, 1, 1), voxel(1, 1, 1), tx), ty);
+			sum += lerp(c0, c1, tz);
+		}
+		sink = sum;
+	});
+	std::cout << "   per sample on the CPU: procedural " << procedural_ms * 1e6f / num_samples << " ns, baked " << baked_ms * 1e6f / num_samples << " ns" << std::endl;
+}
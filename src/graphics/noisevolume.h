@@ -0,0 +1,50 @@
+/*  Tileable fBm of gradient noise baked in a 3D texture, so the volume shaders fetch the noise
+	density once per sample instead of evaluating every octave. The lattice wraps every period
+	cells, the texture repeats and the shaders scale it like the procedural noise.
+*/
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <cstdint>
+
+#define NOISE_VOLUME_RESOLUTION 128
+#define NOISE_VOLUME_PERIOD 4 //lattice cells of the first octave across the texture, power of two
+#define NOISE_VOLUME_SEED 1234
+#define NOISE_VOLUME_BIN_VERSION 1
+
+class Texture;
+
+class NoiseVolume
+{
+public:
+	int resolution = 0;
+	int period = 0;
+	int detail = 0;
+	unsigned int seed = 0;
+	std::vector<uint16_t> data; //x fastest, fBm remapped from [-1, 1] to [0, 1]
+
+	//octaves past this one would have less than two texels per cell
+	static int getMaxDetail(int resolution = NOISE_VOLUME_RESOLUTION, int period = NOISE_VOLUME_PERIOD);
+
+	void generate(int resolution, int period, int detail, unsigned int seed, bool use_simd = true, bool parallel = true);
+	//value at a lattice position, scalar reference of generate
+	float evaluate(float x, float y, float z) const;
+
+	bool readBin(const char* filename);
+	bool writeBin(const char* filename);
+
+	Texture* createTexture();
+
+	//generated once per detail and seed, cached in res/ since it takes a moment
+	static Texture* Get(int detail, unsigned int seed = NOISE_VOLUME_SEED);
+	static void benchmark();
+
+private:
+	int perm[512]; //permutation of the lattice, doubled to skip the wrap
+	static std::map<uint64_t, Texture*> sTexturesGenerated;
+
+	void setSeed(unsigned int seed);
+	void generateSlices(int begin, int end, bool use_simd);
+};
@@ -97,8 +97,15 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	//printf("Fragment shader from memory:\n%s\n", psm.c_str());
 	if (macros)
 	{
-		vsm = macros + vsm;
-		psm = macros + psm;
+		//GLSL wants the #version first, the macros go right after it
+		auto insert = [macros](std::string& code) {
+			size_t at = code.find("#version");
+			if (at != std::string::npos)
+				at = code.find('\n', at);
+			code.insert(at == std::string::npos ? 0 : at + 1, macros);
+		};
+		insert(vsm);
+		insert(psm);
 		this->macros = macros;
 	}
 
@@ -564,9 +571,10 @@ int Shader::getUniformLocation(const char* varname)
 
 void Shader::setTexture(const char* varname, Texture* tex, int slot)
 {
-	glBindTexture(tex->texture_type, tex->texture_id);
 	glActiveTexture(GL_TEXTURE0 + slot);
+	glBindTexture(tex->texture_type, tex->texture_id);
 	setUniform1(varname, slot);
+	glActiveTexture(GL_TEXTURE0);
 }
 
 /*
@@ -5,6 +5,8 @@
 #include <iostream> //to output
 #include <cmath>
 #include <algorithm>
+#include <random>
+#include <vector>
 
 #include "mesh.h"
 #include "shader.h"
@@ -181,6 +183,75 @@ void Texture::upload3D(float* data, unsigned int mag_filter, unsigned int min_fi
 	assert(checkGLErrors() && "Error uploading texture");
 }
 
+void Texture::create3DMipmaps(unsigned int width, unsigned int height, unsigned int depth, unsigned int format, unsigned int type, uint8_t** levels, int num_levels, unsigned int internal_format)
+{
+	assert(width && height && depth && "texture must have a size");
+	assert(num_levels > 0 && "texture must have a level");
+
+	this->width = (float)width;
+	this->height = (float)height;
+	this->depth = (float)depth;
+	this->format = format;
+	this->internal_format = internal_format;
+	this->type = type;
+	this->mipmaps = num_levels > 1;
+
+	//Delete previous texture and ensure that previous bounded texture_id is not of another texture type
+	if (this->texture_id != 0)
+		clear();
+
+	this->texture_type = GL_TEXTURE_3D;
+
+	if (this->texture_id == 0)
+		glGenTextures(1, &this->texture_id); //we need to create an unique ID for the texture
+
+	glBindTexture(this->texture_type, this->texture_id);
+
+	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(this->texture_type, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+
+	//the rows of the small levels are not aligned to 4 bytes
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int level = 0; level < num_levels; ++level)
+		glTexImage3D(this->texture_type, level, internal_format ? internal_format : format, std::max(width >> level, 1u), std::max(height >> level, 1u), std::max(depth >> level, 1u), 0, format, type, levels ? levels[level] : NULL);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	glBindTexture(this->texture_type, 0);
+	assert(checkGLErrors() && "Error uploading texture");
+}
+
+void Texture::update3DMipmaps(uint8_t** levels, int num_levels)
+{
+	assert(this->texture_id && this->texture_type == GL_TEXTURE_3D && "Must create the 3D texture before updating it.");
+
+	glBindTexture(this->texture_type, this->texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	unsigned int width = (unsigned int)this->width, height = (unsigned int)this->height, depth = (unsigned int)this->depth;
+	for (int level = 0; level < num_levels; ++level)
+		glTexSubImage3D(this->texture_type, level, 0, 0, 0, std::max(width >> level, 1u), std::max(height >> level, 1u), std::max(depth >> level, 1u), this->format, this->type, levels[level]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	glBindTexture(this->texture_type, 0);
+	assert(checkGLErrors() && "Error updating texture");
+}
+
+void Texture::update3DSlices(int level, int z, int slices, const void* data)
+{
+	assert(this->texture_id && this->texture_type == GL_TEXTURE_3D && "Must create the 3D texture before updating it.");
+
+	glBindTexture(this->texture_type, this->texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	unsigned int width = (unsigned int)this->width, height = (unsigned int)this->height;
+	glTexSubImage3D(this->texture_type, level, 0, 0, z, std::max(width >> level, 1u), std::max(height >> level, 1u), slices, this->format, this->type, data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(this->texture_type, 0);
+}
+
 void Texture::createCubemap(unsigned int width, unsigned int height, uint8_t** data, unsigned int format, unsigned int type, bool mipmaps, unsigned int internal_format)
 {
 	assert(width && height && "texture must have a size");
@@ -479,6 +550,26 @@ Texture* Texture::getWhiteTexture()
 	return white;
 }
 
+Texture* Texture::getBlueNoiseTexture()
+{
+	static Texture* blue_noise = NULL;
+	if (blue_noise)
+		return blue_noise;
+
+	//the generation takes a moment, reuse it from disk
+	std::string filename = "res/bluenoise" + std::to_string(BLUE_NOISE_SIZE) + ".tga";
+	Image image;
+	if (!image.loadTGA(filename.c_str()) || image.width != BLUE_NOISE_SIZE || image.height != BLUE_NOISE_SIZE)
+	{
+		image.createBlueNoise(BLUE_NOISE_SIZE);
+		if (!image.saveTGA(filename.c_str()))
+			std::cout << "[WARN] Blue noise could not be cached in " << filename << std::endl;
+	}
+
+	blue_noise = new Texture(BLUE_NOISE_SIZE, BLUE_NOISE_SIZE, image.bytes_per_pixel == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, false, image.data);
+	return blue_noise;
+}
+
 void Image::fromScreen(int width, int height)
 {
 	if (data && (width != this->width || height != this->height))
@@ -628,6 +719,101 @@ bool Image::loadPNG(const char* filename, bool flip_y)
 	return true;
 }
 
+//void and cluster (Ulichney 93): points are ranked by where they best fill the largest voids,
+//energies wrap around so the result tiles
+void Image::createBlueNoise(int size, unsigned int seed)
+{
+	int num_pixels = size * size;
+	const float sigma = 1.5f;
+
+	//energy that a point adds at every offset
+	std::vector<float> kernel(num_pixels);
+	for (int y = 0; y < size; ++y)
+		for (int x = 0; x < size; ++x)
+		{
+			int dx = std::min(x, size - x);
+			int dy = std::min(y, size - y);
+			kernel[y * size + x] = exp(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+		}
+
+	auto toggle = [&](std::vector<uint8_t>& points, std::vector<float>& energy, int index, bool value) {
+		points[index] = value;
+		float sign = value ? 1.f : -1.f;
+		int px = index % size;
+		int py = index / size;
+		for (int y = 0; y < size; ++y)
+		{
+			const float* row = &kernel[((y - py + size) % size) * size];
+			for (int x = 0; x < size; ++x)
+				energy[y * size + x] += sign * row[(x - px + size) % size];
+		}
+	};
+	auto tightestCluster = [&](const std::vector<uint8_t>& points, const std::vector<float>& energy) {
+		int best = -1;
+		for (int i = 0; i < num_pixels; ++i)
+			if (points[i] && (best == -1 || energy[i] > energy[best]))
+				best = i;
+		return best;
+	};
+	auto largestVoid = [&](const std::vector<uint8_t>& points, const std::vector<float>& energy) {
+		int best = -1;
+		for (int i = 0; i < num_pixels; ++i)
+			if (!points[i] && (best == -1 || energy[i] < energy[best]))
+				best = i;
+		return best;
+	};
+
+	//initial pattern: random points relaxed moving the tightest cluster to the largest void
+	std::vector<uint8_t> points(num_pixels, 0);
+	std::vector<float> energy(num_pixels, 0.f);
+	int num_initial = std::max(1, num_pixels / 10);
+	std::mt19937 rng(seed);
+	for (int count = 0; count < num_initial; )
+	{
+		int index = rng() % num_pixels;
+		if (points[index])
+			continue;
+		toggle(points, energy, index, true);
+		count++;
+	}
+	while (true)
+	{
+		int cluster = tightestCluster(points, energy);
+		toggle(points, energy, cluster, false);
+		int hole = largestVoid(points, energy);
+		toggle(points, energy, hole, true);
+		if (hole == cluster)
+			break;
+	}
+
+	std::vector<int> ranks(num_pixels);
+
+	//initial points: removing the tightest clusters gives the lowest ranks to the best spread ones
+	std::vector<uint8_t> initial_points = points;
+	std::vector<float> initial_energy = energy;
+	for (int rank = num_initial - 1; rank >= 0; --rank)
+	{
+		int cluster = tightestCluster(initial_points, initial_energy);
+		toggle(initial_points, initial_energy, cluster, false);
+		ranks[cluster] = rank;
+	}
+
+	//the rest fill the largest void left each time
+	for (int rank = num_initial; rank < num_pixels; ++rank)
+	{
+		int hole = largestVoid(points, energy);
+		toggle(points, energy, hole, true);
+		ranks[hole] = rank;
+	}
+
+	resize(size, size, 4);
+	for (int i = 0; i < num_pixels; ++i)
+	{
+		uint8_t value = (uint8_t)((ranks[i] * 256) / num_pixels);
+		data[i * 4] = data[i * 4 + 1] = data[i * 4 + 2] = data[i * 4 + 3] = value;
+	}
+}
+
 // Saves the image to a TGA file
 bool Image::saveTGA(const char* filename, bool flip_y)
 {
@@ -11,6 +11,8 @@
 
 #include <glm/vec4.hpp>
 
+#define BLUE_NOISE_SIZE 64
+
 class Shader;
 class FBO;
 class Texture;
@@ -53,6 +55,9 @@ public:
 	bool loadTGA(const char* filename);
 	bool loadPNG(const char* filename, bool flip_y = false);
 	bool saveTGA(const char* filename, bool flip_y = true);
+
+	//tileable blue noise (void and cluster), the rank of every pixel in all the channels
+	void createBlueNoise(int size, unsigned int seed = 1234);
 };
 
 
@@ -97,6 +102,12 @@ public:
 	void create(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, uint8_t* data = NULL, unsigned int internal_format = 0);
 	void create3D(unsigned int width, unsigned int height, unsigned int depth, unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, uint8_t* data = NULL, unsigned int internal_format = 0);
 	void create3D(unsigned int width, unsigned int height, unsigned int depth, unsigned int format = GL_RED, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, float* data = NULL, unsigned int internal_format = 0);
+	//every level given by the CPU, level i is (size >> i) clamped to 1. Without levels the storage is only allocated
+	void create3DMipmaps(unsigned int width, unsigned int height, unsigned int depth, unsigned int format, unsigned int type, uint8_t** levels, int num_levels, unsigned int internal_format = 0);
+	//replaces the levels of a texture made by create3DMipmaps, same sizes
+	void update3DMipmaps(uint8_t** levels, int num_levels);
+	//z-slices [z, z + slices) of a level, data is an offset in the pixel unpack buffer when one is bound
+	void update3DSlices(int level, int z, int slices, const void* data);
 	void createCubemap(unsigned int width, unsigned int height, uint8_t** data = NULL, unsigned int format = GL_RGBA, unsigned int type = GL_FLOAT, bool mipmaps = true, unsigned int internal_format = GL_RGBA32F);
 
 	void upload(Image* img);
@@ -127,6 +138,7 @@ public:
 
 	static Texture* getBlackTexture();
 	static Texture* getWhiteTexture();
+	static Texture* getBlueNoiseTexture(); //generated once and cached in res/
 };
 
 bool isPowerOfTwo(int n);
\ No newline at end of file
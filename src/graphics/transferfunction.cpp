@@ -0,0 +1,162 @@
+#include "transferfunction.h"
+
+#include "texture.h"
+#include "../framework/jobs.h"
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+TransferFunction::~TransferFunction()
+{
+	if (texture)
+		delete texture;
+	if (scattering_table)
+		delete scattering_table;
+	if (emission_table)
+		delete emission_table;
+}
+
+void TransferFunction::evaluate(float density, float& extinction, glm::vec3& albedo, glm::vec3& emission) const
+{
+	float window = std::max(density_high - density_low, 1e-4f);
+	extinction = std::min(std::max((density - density_low) / window, 0.f), 1.f);
+	albedo = this->albedo;
+	emission = this->emission * extinction;
+}
+
+void TransferFunction::integrate(float extinction_scale, float scattering_scale, float step_length, bool parallel)
+{
+	const int N = TF_TABLE_SIZE;
+	function_texels.resize(N * 2);
+	for (int i = 0; i < N; ++i)
+	{
+		float extinction;
+		glm::vec3 albedo, emission;
+		evaluate(i / (float)(N - 1), extinction, albedo, emission);
+		function_texels[i] = glm::vec4(albedo, extinction);
+		function_texels[i + N] = glm::vec4(emission, 0.f);
+	}
+
+	//a segment of step_length from the density of the front (x) to the one of the back (y). The density
+	//is linear along it, the substeps integrate the scattering and the emission seen through the segment
+	scattering_texels.resize(N * N);
+	emission_texels.resize(N * N);
+	const int M = TF_INTEGRATION_STEPS;
+	float h = step_length / M;
+	auto integrateRows = [&](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+			for (int x = 0; x < N; ++x)
+			{
+				float front = x / (float)(N - 1);
+				float back = y / (float)(N - 1);
+				glm::vec3 scattering(0.f), emitted(0.f);
+				float transmittance = 1.f;
+				for (int k = 0; k < M; ++k)
+				{
+					float density = front + (back - front) * (k + 0.5f) / M;
+					float extinction;
+					glm::vec3 albedo, emission;
+					evaluate(density, extinction, albedo, emission);
+					float kt = extinction_scale * extinction;
+					//exact for the constant extinction of the substep
+					float alpha = 1.f - std::exp(-kt * h);
+					float weight = kt > 0.f ? alpha / kt : h;
+					scattering += transmittance * scattering_scale * extinction * albedo * weight;
+					emitted += transmittance * emission * weight;
+					transmittance *= 1.f - alpha;
+				}
+				scattering_texels[x + y * N] = glm::vec4(scattering, 1.f - transmittance);
+				emission_texels[x + y * N] = glm::vec4(emitted, 0.f);
+			}
+	};
+	if (parallel)
+		parallelFor(N, integrateRows, 8);
+	else
+		integrateRows(0, N);
+
+	this->extinction_scale = extinction_scale;
+	this->scattering_scale = scattering_scale;
+	this->step_length = step_length;
+}
+
+void TransferFunction::update(float extinction_scale, float scattering_scale, float step_length)
+{
+	if (!dirty && texture && this->extinction_scale == extinction_scale && this->scattering_scale == scattering_scale && this->step_length == step_length)
+		return;
+	dirty = false;
+
+	integrate(extinction_scale, scattering_scale, step_length);
+
+	//float textures so the small opacities of the thin segments are not lost, linear and clamped
+	if (!texture)
+	{
+		texture = new Texture(TF_TABLE_SIZE, 2, GL_RGBA, GL_FLOAT, false, (uint8_t*)&function_texels[0], GL_RGBA32F);
+		scattering_table = new Texture(TF_TABLE_SIZE, TF_TABLE_SIZE, GL_RGBA, GL_FLOAT, false, (uint8_t*)&scattering_texels[0], GL_RGBA32F);
+		emission_table = new Texture(TF_TABLE_SIZE, TF_TABLE_SIZE, GL_RGBA, GL_FLOAT, false, (uint8_t*)&emission_texels[0], GL_RGBA32F);
+		return;
+	}
+	texture->upload(GL_RGBA, GL_FLOAT, false, (uint8_t*)&function_texels[0], GL_RGBA32F);
+	scattering_table->upload(GL_RGBA, GL_FLOAT, false, (uint8_t*)&scattering_texels[0], GL_RGBA32F);
+	emission_table->upload(GL_RGBA, GL_FLOAT, false, (uint8_t*)&emission_texels[0], GL_RGBA32F);
+}
+
+bool TransferFunction::renderInMenu()
+{
+	bool changed = false;
+	if (ImGui::TreeNode("Transfer Function"))
+	{
+		changed |= ImGui::DragFloatRange2("Density Window", &this->density_low, &this->density_high, 0.005f, 0.0f, 1.0f);
+		changed |= ImGui::ColorEdit3("Albedo", (float*)&this->albedo);
+		changed |= ImGui::ColorEdit3("Emission", (float*)&this->emission, ImGuiColorEditFlags_HDR | ImGuiColorEditFlags_Float);
+		ImGui::TreePop();
+	}
+	dirty |= changed;
+	return changed;
+}
+
+void TransferFunction::benchmark()
+{
+	//coefficients of the default materials, a window that makes the function non linear
+	TransferFunction tf;
+	tf.density_low = 0.1f;
+	tf.density_high = 0.6f;
+	tf.emission = glm::vec3(0.5f, 0.2f, 0.1f);
+	float extinction_scale = 2.f, scattering_scale = 1.f;
+
+	for (float step : { 0.045f, 0.18f })
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		tf.integrate(extinction_scale, scattering_scale, step, false);
+		float serial = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		start = std::chrono::high_resolution_clock::now();
+		tf.integrate(extinction_scale, scattering_scale, step, true);
+		float parallel = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		std::cout << "   " << TF_TABLE_SIZE << "^2 table, step " << step << ": " << serial << " ms serial, " << parallel << " ms with " << getNumJobThreads() << " threads" << std::endl;
+
+		//a density ramp across a long segment: one sample at the middle against the table
+		const int N = TF_TABLE_SIZE;
+		float worst_sampled = 0.f, worst_table = 0.f;
+		for (int y = 0; y < N; y += 15)
+			for (int x = 0; x < N; x += 15)
+			{
+				float front = x / (float)(N - 1), back = y / (float)(N - 1);
+				float tau = 0.f;
+				for (int k = 0; k < 1024; ++k)
+				{
+					float extinction;
+					glm::vec3 albedo, emission;
+					tf.evaluate(front + (back - front) * (k + 0.5f) / 1024.f, extinction, albedo, emission);
+					tau += extinction_scale * extinction * step / 1024.f;
+				}
+				float expected = 1.f - std::exp(-tau);
+				float extinction;
+				glm::vec3 albedo, emission;
+				tf.evaluate((front + back) * 0.5f, extinction, albedo, emission);
+				worst_sampled = std::max(worst_sampled, std::fabs(1.f - std::exp(-extinction_scale * extinction * step) - expected));
+				worst_table = std::max(worst_table, std::fabs(tf.scattering_texels[x + y * N].a - expected));
+			}
+		std::cout << "   max opacity error of a segment: " << worst_sampled << " sampled once, " << worst_table << " pre-integrated" << std::endl;
+	}
+}
@@ -0,0 +1,58 @@
+/*  Transfer function of the volumes: maps the density of the VDB to extinction, albedo and emission.
+	It is baked in a small texture for the march, and pre-integrated in a 2D table indexed by the
+	densities at the front and back of a segment of the ray, so the march can take long steps
+	without the slicing artifacts of sampling the function once per step.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#define TF_TABLE_SIZE 256 //entries per density, of the function and of both axes of the pre-integration
+#define TF_INTEGRATION_STEPS 32 //substeps of a segment when pre-integrating
+
+class Texture;
+
+class TransferFunction
+{
+public:
+	//the extinction ramps from 0 to 1 in the density window, the default is the linear mapping
+	float density_low = 0.f;
+	float density_high = 1.f;
+	glm::vec3 albedo = glm::vec3(1.f);
+	glm::vec3 emission = glm::vec3(0.f); //radiance per unit length at full extinction
+
+	//coefficients of the material the tables were integrated with
+	float extinction_scale = -1.f;
+	float scattering_scale = -1.f;
+	float step_length = -1.f;
+
+	//albedo and extinction in the first row, emission in the second
+	Texture* texture = nullptr;
+	//of a segment of step_length: scattering weight in rgb and opacity in a, emitted radiance in the other
+	Texture* scattering_table = nullptr;
+	Texture* emission_table = nullptr;
+
+	std::vector<glm::vec4> function_texels;
+	std::vector<glm::vec4> scattering_texels;
+	std::vector<glm::vec4> emission_texels;
+
+	TransferFunction() {};
+	~TransferFunction();
+
+	void evaluate(float density, float& extinction, glm::vec3& albedo, glm::vec3& emission) const;
+	//integrates the tables in parallel and uploads them when the function or the coefficients changed
+	void update(float extinction_scale, float scattering_scale, float step_length);
+	//CPU side of update, extinction_scale and scattering_scale multiply the extinction of the function
+	void integrate(float extinction_scale, float scattering_scale, float step_length, bool parallel = true);
+	//returns true when the function changed
+	bool renderInMenu();
+
+	static void benchmark();
+
+private:
+	bool dirty = true;
+};
@@ -0,0 +1,246 @@
+#include "volumefile.h"
+
+#include "volumegrid.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+
+//versions of the format that changed the header, see openvdb/version.h
+#define VDB_MAGIC 0x56444220
+#define VDB_FILE_VERSION_GRID_OFFSETS 212
+#define VDB_FILE_VERSION_GRID_INSTANCING 216
+#define VDB_FILE_VERSION_BOOST_UUID 218
+#define VDB_FILE_VERSION_SELECTIVE_COMPRESSION 220
+#define VDB_FILE_VERSION_NODE_MASK_COMPRESSION 222
+
+template <typename T>
+static bool readValue(std::istream& stream, T& value)
+{
+	stream.read((char*)&value, sizeof(T));
+	return stream.good();
+}
+
+//a uint32 length and the characters, the names and types are short so anything long is a broken file
+static bool readString(std::istream& stream, std::string& value)
+{
+	uint32_t size;
+	if (!readValue(stream, size) || size > 4096)
+		return false;
+	value.resize(size);
+	stream.read(&value[0], size);
+	return stream.good();
+}
+
+//every entry is a name, a type, a uint32 size and the value. Only the stats of the grids are kept
+static bool readMetadata(std::istream& stream, VolumeFile::sGridInfo* grid)
+{
+	int32_t count;
+	if (!readValue(stream, count) || count < 0 || count > 4096)
+		return false;
+	for (int32_t i = 0; i < count; ++i)
+	{
+		std::string name, type;
+		uint32_t size;
+		if (!readString(stream, name) || !readString(stream, type) || !readValue(stream, size))
+			return false;
+
+		if (grid && type == "vec3i" && size == sizeof(glm::ivec3) && (name == "file_bbox_min" || name == "file_bbox_max"))
+		{
+			glm::ivec3& corner = name == "file_bbox_min" ? grid->bbox_min : grid->bbox_max;
+			readValue(stream, corner);
+			grid->has_bbox = true;
+		}
+		else if (grid && type == "int64" && size == sizeof(int64_t) && name == "file_voxel_count")
+			readValue(stream, grid->voxel_count);
+		else if (grid && type == "string" && name == "class" && size <= 4096)
+		{
+			grid->grid_class.resize(size);
+			stream.read(&grid->grid_class[0], size);
+		}
+		else
+			stream.seekg(size, std::ios::cur);
+		if (!stream.good())
+			return false;
+	}
+	return true;
+}
+
+bool VolumeFile::scan(const char* filename)
+{
+	this->filename = filename;
+	version = 0;
+	grids.clear();
+
+	std::ifstream stream(filename, std::ios::binary);
+	if (!stream.good())
+		return false;
+
+	int64_t magic;
+	if (!readValue(stream, magic) || magic != VDB_MAGIC || !readValue(stream, version) || version < VDB_FILE_VERSION_GRID_OFFSETS)
+		return false;
+
+	//library version, grid offsets, compression of the old files and the uuid of the file. The old files flag it in one byte,
+	//the newer ones with a mask per grid
+	uint32_t library[2];
+	char has_offsets = 0;
+	char is_compressed = 0;
+	uint32_t compression;
+	stream.read((char*)library, sizeof(library));
+	readValue(stream, has_offsets);
+	if (version >= VDB_FILE_VERSION_SELECTIVE_COMPRESSION && version < VDB_FILE_VERSION_NODE_MASK_COMPRESSION)
+		readValue(stream, is_compressed);
+	stream.seekg(version >= VDB_FILE_VERSION_BOOST_UUID ? 36 : 16, std::ios::cur);
+	if (!stream.good() || !has_offsets || !readMetadata(stream, nullptr))
+		return false;
+
+	int32_t count;
+	if (!readValue(stream, count) || count < 0)
+		return false;
+	for (int32_t i = 0; i < count; ++i)
+	{
+		//the descriptor: unique name, tree type, parent of an instance and where the grid is
+		sGridInfo grid;
+		std::string type, parent;
+		int64_t grid_pos, block_pos, end_pos;
+		if (!readString(stream, grid.name) || !readString(stream, type))
+			return false;
+		if (version >= VDB_FILE_VERSION_GRID_INSTANCING && !readString(stream, parent))
+			return false;
+		if (!readValue(stream, grid_pos) || !readValue(stream, block_pos) || !readValue(stream, end_pos))
+			return false;
+
+		//grids with the same name get a suffix after a record separator
+		grid.name = grid.name.substr(0, grid.name.find('\x1e'));
+		const std::string half_suffix = "_HalfFloat";
+		if (type.size() > half_suffix.size() && type.compare(type.size() - half_suffix.size(), half_suffix.size(), half_suffix) == 0)
+		{
+			grid.half_float = true;
+			type.erase(type.size() - half_suffix.size());
+		}
+		//Tree_float_5_4_3 -> float
+		if (type.compare(0, 5, "Tree_") == 0)
+			type.erase(0, 5);
+		while (type.find_last_of('_') != std::string::npos && type.find_first_not_of("0123456789", type.find_last_of('_') + 1) == std::string::npos)
+			type.erase(type.find_last_of('_'));
+		grid.value_type = type;
+		grid.bytes = end_pos - grid_pos;
+
+		//the metadata goes first in the grid, the transform and the tree are skipped
+		stream.seekg(grid_pos);
+		if (version >= VDB_FILE_VERSION_NODE_MASK_COMPRESSION)
+			readValue(stream, compression);
+		if (!readMetadata(stream, &grid))
+			return false;
+		grids.push_back(grid);
+		stream.seekg(end_pos);
+	}
+	return true;
+}
+
+int VolumeFile::findGrid(const std::string& name) const
+{
+	for (size_t i = 0; i < grids.size(); ++i)
+		if (grids[i].name == name)
+			return (int)i;
+	return -1;
+}
+
+int VolumeFile::findDensity() const
+{
+	int density = findGrid("density");
+	if (density != -1)
+		return density;
+	for (size_t i = 0; i < grids.size(); ++i)
+		if (grids[i].value_type == "float" || grids[i].value_type == "double")
+			return (int)i;
+	return grids.empty() ? -1 : 0;
+}
+
+int VolumeFile::findTemperature() const
+{
+	for (const char* name : { "temperature", "heat", "flame" })
+	{
+		int index = findGrid(name);
+		if (index != -1 && (grids[index].value_type == "float" || grids[index].value_type == "double"))
+			return index;
+	}
+	return -1;
+}
+
+bool VolumeFile::voxelize(const std::vector<std::string>& names, std::vector<VolumeGrid*>& result, int resolution, float radius) const
+{
+	result.assign(names.size(), nullptr);
+	std::ifstream file(filename);
+	if (!file.good())
+		return false;
+	file.close();
+
+	easyVDB::OpenVDBReader reader;
+	reader.read(filename);
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		int index = findGrid(names[i]);
+		if (index == -1 || index >= (int)reader.gridsSize)
+		{
+			std::cout << "[WARN] " << filename << " has no grid " << names[i] << std::endl;
+			continue;
+		}
+		result[i] = new VolumeGrid();
+		result[i]->voxelize(reader.grids[index], resolution, radius);
+	}
+	return reader.gridsSize > 0;
+}
+
+void VolumeFile::print() const
+{
+	std::cout << " + " << filename << ": " << grids.size() << " grids (format " << version << ")" << std::endl;
+	for (const sGridInfo& grid : grids)
+	{
+		glm::ivec3 size = grid.has_bbox ? grid.bbox_max - grid.bbox_min + 1 : glm::ivec3(0);
+		std::cout << "   " << grid.name << ": " << grid.value_type << (grid.half_float ? " (half)" : "") << (grid.grid_class.empty() ? "" : ", " + grid.grid_class)
+			<< ", " << size.x << "x" << size.y << "x" << size.z << ", " << grid.voxel_count << " voxels, " << grid.bytes / 1024 << " KB" << std::endl;
+	}
+}
+
+void VolumeFile::benchmark(const char* filename)
+{
+	VolumeFile file;
+	auto start = std::chrono::high_resolution_clock::now();
+	if (!file.scan(filename))
+	{
+		std::cout << "   " << filename << " not found or without grid offsets" << std::endl;
+		return;
+	}
+	float scan_ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	file.print();
+	if (file.grids.empty())
+		return;
+
+	start = std::chrono::high_resolution_clock::now();
+	easyVDB::OpenVDBReader reader;
+	reader.read(filename);
+	float read_ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	std::cout << "   scan " << scan_ms << " ms, parsing every grid " << read_ms << " ms" << std::endl;
+
+	//the voxelization is the part that grows with the grids, the parse is the same for both
+	std::vector<std::string> all, density = { file.grids[std::max(file.findDensity(), 0)].name };
+	for (const sGridInfo& grid : file.grids)
+		all.push_back(grid.name);
+	for (const std::vector<std::string>* names : { &density, &all })
+	{
+		std::vector<VolumeGrid*> result;
+		start = std::chrono::high_resolution_clock::now();
+		file.voxelize(*names, result);
+		float ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		size_t bytes = 0;
+		for (VolumeGrid* grid : result)
+			if (grid)
+			{
+				bytes += grid->data.size() * sizeof(float);
+				delete grid;
+			}
+		std::cout << "   " << names->size() << " of " << file.grids.size() << " grids voxelized at 128^3: " << ms << " ms, " << bytes / (1024 * 1024) << " MB" << std::endl;
+	}
+}
@@ -0,0 +1,53 @@
+/*  Header of a VDB file read without its trees: the descriptor of every grid and the stats OpenVDB
+	writes in its metadata, seeking from one grid to the next with the offsets of the descriptors. A
+	few KB are read whatever the size of the file, so the grids can be listed and chosen before the
+	reader parses them, and only the chosen ones are voxelized.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include <glm/vec3.hpp>
+
+class VolumeGrid;
+
+class VolumeFile
+{
+public:
+	struct sGridInfo
+	{
+		std::string name;
+		std::string value_type; //float, double, vec3s... from the type of the tree
+		std::string grid_class; //fog volume, level set, empty if the file doesn't say
+		bool half_float = false; //stored as 16 bits
+		bool has_bbox = false;
+		glm::ivec3 bbox_min = glm::ivec3(0); //active voxels in index space, inclusive
+		glm::ivec3 bbox_max = glm::ivec3(-1);
+		int64_t voxel_count = -1; //active voxels, -1 when the file has no stats
+		int64_t bytes = 0; //of the grid in the file
+	};
+
+	std::string filename;
+	uint32_t version = 0;
+	std::vector<sGridInfo> grids; //in the order of the file, the same as the grids of easyVDB::OpenVDBReader
+
+	//reads the header and the metadata of the grids. False if the file can't be read or has no grid offsets (before OpenVDB 2)
+	bool scan(const char* filename);
+	//index of the grid, -1 if there is none with the name
+	int findGrid(const std::string& name) const;
+	//the grid named density, else the first scalar one, else the first one. -1 without grids
+	int findDensity() const;
+	//scalar grid named temperature, heat or flame, the names the simulators use. -1 without one
+	int findTemperature() const;
+	//parses the file once and voxelizes the named grids, each one into its own grid owned by the caller.
+	//Null for the names that aren't in the file
+	bool voxelize(const std::vector<std::string>& names, std::vector<VolumeGrid*>& result, int resolution = 128, float radius = 2.f) const;
+	//name, type, bbox and voxels of every grid
+	void print() const;
+
+	//time of the scan against parsing the whole file, and voxelizing the density grid against all of them
+	static void benchmark(const char* filename);
+};
@@ -0,0 +1,1130 @@
+#include "volumegrid.h"
+
+#include "volumeproxy.h"
+#include "volumefile.h"
+#include "distancefield.h"
+#include "texture.h"
+#include "../framework/jobs.h"
+#include "../framework/simd.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+
+VolumeGrid::~VolumeGrid()
+{
+	if (gradient_texture)
+		delete gradient_texture;
+}
+
+void VolumeGrid::voxelize(easyVDB::Grid& grid, int resolution, float radius, bool parallel, bool raw, const easyVDB::Bbox* world_bbox)
+{
+	//the density changes, the gradients are computed again when requested
+	if (gradient_texture)
+		delete gradient_texture;
+	gradient_texture = nullptr;
+
+	this->resolution = resolution;
+	int resolutionPow2 = resolution * resolution;
+	data.assign(resolutionPow2 * resolution, 0.f);
+
+	// Bbox, the one of the grid unless another is given
+	easyVDB::Bbox bbox = world_bbox ? *world_bbox : grid.getPreciseWorldBbox();
+	glm::vec3 target = bbox.getCenter();
+	glm::vec3 size = bbox.getSize();
+	glm::vec3 step = size * (1.0f / resolution);
+
+	grid.transform->applyInverseTransformMap(step);
+	target = target - (size * 0.5f);
+	grid.transform->applyInverseTransformMap(target);
+	target = target + (step * 0.5f);
+
+	//the bleed is gathered from the samples around every voxel instead of scattered to them, so the slices can be written
+	//in parallel. The values only add up, clamping the sum once is the same as clamping after every addition
+	int cellBleed = (int)radius;
+	struct sBleed { int x, y, z; float weight; };
+	std::vector<float> samples;
+	std::vector<sBleed> kernel;
+	if (cellBleed)
+	{
+		samples.resize(data.size());
+		for (int sz = -cellBleed; sz < cellBleed; sz++)
+			for (int sy = -cellBleed; sy < cellBleed; sy++)
+				for (int sx = -cellBleed; sx < cellBleed; sx++)
+				{
+					float offset = (float)std::max(0.0, std::min(1.0, 1.0 - std::hypot(sx, sy, sz) / (radius / 2.0)));
+					if (offset > 0.f)
+						kernel.push_back({ sx, sy, sz, offset });
+				}
+	}
+	float* values = cellBleed ? &samples[0] : &data[0];
+	float scale = raw ? 1.f : 255.f;
+	float limit = raw ? FLT_MAX : 255.f;
+
+	auto sampleSlices = [&](int begin, int end) {
+		for (int z = begin; z < end; z++)
+			for (int y = 0; y < resolution; y++)
+				for (int x = 0; x < resolution; x++)
+				{
+					float value = grid.getValue(target + step * glm::vec3((float)x, (float)y, (float)z));
+					values[x + y * resolution + z * resolutionPow2] = cellBleed ? value : std::min(value * scale, limit);
+				}
+	};
+
+	auto bleedSlices = [&](int begin, int end) {
+		for (int z = begin; z < end; z++)
+			for (int y = 0; y < resolution; y++)
+				for (int x = 0; x < resolution; x++)
+				{
+					float sum = 0.f;
+					for (const sBleed& k : kernel)
+					{
+						//the voxel the offset came from
+						int ox = x - k.x, oy = y - k.y, oz = z - k.z;
+						if (ox < 0 || ox >= resolution || oy < 0 || oy >= resolution || oz < 0 || oz >= resolution)
+							continue;
+						sum += k.weight * samples[ox + oy * resolution + oz * resolutionPow2] * scale;
+					}
+					data[x + y * resolution + z * resolutionPow2] = std::min(sum, limit);
+				}
+	};
+
+	if (parallel)
+		parallelFor(resolution, sampleSlices);
+	else
+		sampleSlices(0, resolution);
+	if (!cellBleed)
+		return;
+	if (parallel)
+		parallelFor(resolution, bleedSlices);
+	else
+		bleedSlices(0, resolution);
+}
+
+float VolumeGrid::sample(const glm::vec3& uvw) const
+{
+	//texel centers like GL_LINEAR with GL_CLAMP_TO_EDGE
+	glm::vec3 p = glm::clamp(uvw * (float)resolution - 0.5f, glm::vec3(0.f), glm::vec3((float)(resolution - 1)));
+	glm::ivec3 a = glm::min(glm::ivec3(p), glm::ivec3(resolution - 2));
+	glm::vec3 f = p - glm::vec3(a);
+	auto voxel = [&](int x, int y, int z) {
+		return std::min(data[(a.x + x) + ((a.y + y) + (a.z + z) * resolution) * resolution], 1.f);
+	};
+	float c00 = voxel(0, 0, 0) * (1.f - f.x) + voxel(1, 0, 0) * f.x;
+	float c10 = voxel(0, 1, 0) * (1.f - f.x) + voxel(1, 1, 0) * f.x;
+	float c01 = voxel(0, 0, 1) * (1.f - f.x) + voxel(1, 0, 1) * f.x;
+	float c11 = voxel(0, 1, 1) * (1.f - f.x) + voxel(1, 1, 1) * f.x;
+	float c0 = c00 * (1.f - f.y) + c10 * f.y;
+	float c1 = c01 * (1.f - f.y) + c11 * f.y;
+	return c0 * (1.f - f.z) + c1 * f.z;
+}
+
+static inline uint32_t packGradient(float gx, float gy, float gz)
+{
+	float length2 = gx * gx + gy * gy + gz * gz;
+	if (length2 < 1e-8f)
+		return (512u) | (512u << 10) | (512u << 20);
+	float inverse = 1.f / sqrtf(length2);
+	uint32_t r = (uint32_t)((gx * inverse * 0.5f + 0.5f) * 1023.f + 0.5f);
+	uint32_t g = (uint32_t)((gy * inverse * 0.5f + 0.5f) * 1023.f + 0.5f);
+	uint32_t b = (uint32_t)((gz * inverse * 0.5f + 0.5f) * 1023.f + 0.5f);
+	return r | (g << 10) | (b << 20) | (3u << 30);
+}
+
+void VolumeGrid::computeGradients(std::vector<uint32_t>& packed, bool use_simd, bool parallel) const
+{
+	const int res = resolution;
+	packed.resize(data.size());
+	auto density = [&](int x, int y, int z) {
+		return std::min(data[x + (y + z * res) * res], 1.f);
+	};
+
+	//edges clamped like the texture
+	auto slices = [&](int begin, int end) {
+		for (int z = begin; z < end; ++z)
+			for (int y = 0; y < res; ++y)
+			{
+				int ym = std::max(y - 1, 0), yp = std::min(y + 1, res - 1);
+				int zm = std::max(z - 1, 0), zp = std::min(z + 1, res - 1);
+				const float* row = &data[(y + z * res) * res];
+				const float* row_ym = &data[(ym + z * res) * res];
+				const float* row_yp = &data[(yp + z * res) * res];
+				const float* row_zm = &data[(y + zm * res) * res];
+				const float* row_zp = &data[(y + zp * res) * res];
+				uint32_t* out = &packed[(y + z * res) * res];
+
+				auto scalar = [&](int x) {
+					int xm = std::max(x - 1, 0), xp = std::min(x + 1, res - 1);
+					out[x] = packGradient(density(xp, y, z) - density(xm, y, z), density(x, yp, z) - density(x, ym, z), density(x, y, zp) - density(x, y, zm));
+				};
+
+				int x = 0;
+#ifdef USE_SSE
+				if (use_simd && res > 2)
+				{
+					//4 voxels of the row at a time, the first and last one clamp x so they go scalar
+					scalar(x++);
+					__m128 one = _mm_set1_ps(1.f);
+					__m128 half = _mm_set1_ps(0.5f);
+					__m128 scale = _mm_set1_ps(1023.f);
+					__m128 flat = _mm_set1_ps(1e-8f);
+					__m128i alpha = _mm_set1_epi32((int)(3u << 30));
+					for (; x + 4 <= res - 1; x += 4)
+					{
+						__m128 gx = _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(row + x + 1), one), _mm_min_ps(_mm_loadu_ps(row + x - 1), one));
+						__m128 gy = _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(row_yp + x), one), _mm_min_ps(_mm_loadu_ps(row_ym + x), one));
+						__m128 gz = _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(row_zp + x), one), _mm_min_ps(_mm_loadu_ps(row_zm + x), one));
+						__m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), _mm_mul_ps(gz, gz));
+						__m128 valid = _mm_cmpge_ps(length2, flat);
+						//the flat voxels get a zero direction, 0.5 once encoded
+						__m128 inverse = _mm_and_ps(_mm_div_ps(one, _mm_sqrt_ps(length2)), valid);
+						__m128i r = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(gx, inverse), half), half), scale), half));
+						__m128i g = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(gy, inverse), half), half), scale), half));
+						__m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(gz, inverse), half), half), scale), half));
+						__m128i result = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 10)), _mm_or_si128(_mm_slli_epi32(b, 20), _mm_and_si128(_mm_castps_si128(valid), alpha)));
+						_mm_storeu_si128((__m128i*)(out + x), result);
+					}
+				}
+#endif
+
+				for (; x < res; ++x)
+					scalar(x);
+			}
+	};
+
+	if (parallel)
+		parallelFor(res, slices);
+	else
+		slices(0, res);
+}
+
+Texture* VolumeGrid::getGradientTexture()
+{
+	if (gradient_texture)
+		return gradient_texture;
+
+	std::vector<uint32_t> packed;
+	computeGradients(packed);
+	gradient_texture = new Texture();
+	gradient_texture->create3D(resolution, resolution, resolution, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, false, (uint8_t*)&packed[0], GL_RGB10_A2);
+	return gradient_texture;
+}
+
+void VolumeGrid::buildMips(std::vector<std::vector<uint8_t>>& levels, bool max_filter, bool parallel) const
+{
+	//the levels are filtered from floats and rounded once, like the R8 upload of the full resolution
+	std::vector<std::vector<float>> filtered;
+	filterMips(filtered, max_filter, parallel);
+	levels.resize(filtered.size());
+	for (size_t l = 0; l < filtered.size(); ++l)
+	{
+		levels[l].resize(filtered[l].size());
+		for (size_t i = 0; i < filtered[l].size(); ++i)
+			levels[l][i] = (uint8_t)(std::max(filtered[l][i], 0.f) * 255.f + 0.5f);
+	}
+}
+
+void VolumeGrid::filterMips(std::vector<std::vector<float>>& levels, bool max_filter, bool parallel) const
+{
+	levels.assign(1, std::vector<float>(data.size()));
+	for (size_t i = 0; i < data.size(); ++i)
+		levels[0][i] = std::min(data[i], 1.f);
+
+	for (int size = resolution; size > 1; size = std::max(size >> 1, 1))
+	{
+		//odd sizes drop their last voxel like the levels of GL
+		int half = std::max(size >> 1, 1);
+		const std::vector<float>& current = levels.back();
+		std::vector<float> next((size_t)half * half * half);
+		auto slices = [&](int begin, int end) {
+			for (int z = begin; z < end; ++z)
+				for (int y = 0; y < half; ++y)
+					for (int x = 0; x < half; ++x)
+					{
+						float sum = 0.f, maximum = 0.f;
+						for (int c = 0; c < 8; ++c)
+						{
+							int cx = std::min(x * 2 + (c & 1), size - 1);
+							int cy = std::min(y * 2 + ((c >> 1) & 1), size - 1);
+							int cz = std::min(z * 2 + (c >> 2), size - 1);
+							float v = current[cx + ((size_t)cy + (size_t)cz * size) * size];
+							sum += v;
+							maximum = std::max(maximum, v);
+						}
+						next[x + ((size_t)y + (size_t)z * half) * half] = max_filter ? maximum : sum * 0.125f;
+					}
+		};
+		if (parallel)
+			parallelFor(half, slices, 4);
+		else
+			slices(0, half);
+		levels.push_back(std::move(next));
+	}
+}
+
+void VolumeGrid::computeRanges(std::vector<glm::vec2>& ranges, int& bricks, int brick_size, bool parallel) const
+{
+	bricks = (resolution + brick_size - 1) / brick_size;
+	size_t count = (size_t)bricks * bricks * bricks;
+	std::vector<float> minimum(count, 1.f), maximum(count, 0.f);
+
+	//a slice of bricks per task, each brick is written by one of them
+	auto brickSlices = [&](int begin, int end) {
+		for (int bz = begin; bz < end; ++bz)
+			for (int z = bz * brick_size; z < std::min((bz + 1) * brick_size, resolution); ++z)
+				for (int y = 0; y < resolution; ++y)
+					for (int x = 0; x < resolution; ++x)
+					{
+						size_t brick = x / brick_size + ((size_t)(y / brick_size) + (size_t)bz * bricks) * bricks;
+						float v = glm::clamp(data[x + ((size_t)y + (size_t)z * resolution) * resolution], 0.f, 1.f);
+						minimum[brick] = std::min(minimum[brick], v);
+						maximum[brick] = std::max(maximum[brick], v);
+					}
+	};
+	if (parallel)
+		parallelFor(bricks, brickSlices);
+	else
+		brickSlices(0, bricks);
+
+	//the voxels around a brick center are interpolated with the ranges of the bricks next to theirs, each range covers them
+	ranges.resize(count);
+	for (int bz = 0; bz < bricks; ++bz)
+		for (int by = 0; by < bricks; ++by)
+			for (int bx = 0; bx < bricks; ++bx)
+			{
+				float low = 1.f, high = 0.f;
+				for (int z = std::max(bz - 1, 0); z <= std::min(bz + 1, bricks - 1); ++z)
+					for (int y = std::max(by - 1, 0); y <= std::min(by + 1, bricks - 1); ++y)
+						for (int x = std::max(bx - 1, 0); x <= std::min(bx + 1, bricks - 1); ++x)
+						{
+							size_t brick = x + ((size_t)y + (size_t)z * bricks) * bricks;
+							low = std::min(low, minimum[brick]);
+							high = std::max(high, maximum[brick]);
+						}
+				low = std::min(low, high);
+				ranges[bx + ((size_t)by + (size_t)bz * bricks) * bricks] = glm::vec2(low, std::max(high - low, 1e-6f));
+			}
+}
+
+Texture* VolumeGrid::createTexture(bool mipmaps, bool max_filter) const
+{
+	std::vector<std::vector<uint8_t>> levels;
+	buildMips(levels, max_filter);
+	std::vector<uint8_t*> pointers;
+	for (size_t i = 0; i < (mipmaps ? levels.size() : 1); ++i)
+		pointers.push_back(&levels[i][0]);
+
+	Texture* texture = new Texture();
+	texture->create3DMipmaps(resolution, resolution, resolution, GL_RED, GL_UNSIGNED_BYTE, &pointers[0], (int)pointers.size(), GL_R8);
+	return texture;
+}
+
+int VolumeGrid::getNumPreviews(int resolution)
+{
+	int previews = 0;
+	while ((resolution >> (previews + 1)) >= VOLUME_PREVIEW_RESOLUTION)
+		previews++;
+	return previews;
+}
+
+unsigned int sVolumeChannels::getFormat() const
+{
+	return count == 1 ? GL_RED : count == 2 ? GL_RG : GL_RGBA;
+}
+
+unsigned int sVolumeChannels::getInternalFormat() const
+{
+	if (bits == 16)
+		return count == 1 ? GL_R16 : count == 2 ? GL_RG16 : GL_RGBA16;
+	return count == 1 ? GL_R8 : count == 2 ? GL_RG8 : GL_RGBA8;
+}
+
+unsigned int sVolumeChannels::getType() const
+{
+	return bits == 16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+}
+
+int sVolumeChannels::getTexelSize() const
+{
+	return (count == 3 ? 4 : count) * bits / 8;
+}
+
+std::string sVolumeChannels::getMacros() const
+{
+	std::string macros = "#define VOLUME_CHANNELS " + std::to_string(count) + "\n";
+	if (temperature != -1)
+		macros += "#define VOLUME_TEMPERATURE_CHANNEL " + std::to_string(temperature) + "\n";
+	if (brick_ranges)
+		macros += "#define VOLUME_BRICK_RANGES\n";
+	return macros;
+}
+
+//the ranges interpolated like GL_LINEAR at the voxel centers of a row of a level of the given size: the offset and
+//the inverse of the scale of every voxel. row holds the ranges along the row of bricks
+static void interpolateRanges(const std::vector<glm::vec2>& ranges, int bricks, float to_brick, int size, int y, int z, std::vector<glm::vec2>& row, float* offsets, float* inverses)
+{
+	//texel of the range texture before the voxel center and the weight of the next one, clamped to the edge
+	auto texel = [&](int i, int& a, int& b, float& f) {
+		float t = glm::clamp((i + 0.5f) * to_brick - 0.5f, 0.f, (float)(bricks - 1));
+		a = (int)t;
+		b = std::min(a + 1, bricks - 1);
+		f = t - a;
+	};
+	int y0, y1, z0, z1;
+	float fy, fz;
+	texel(y, y0, y1, fy);
+	texel(z, z0, z1, fz);
+	row.resize(bricks);
+	for (int bx = 0; bx < bricks; ++bx)
+	{
+		auto range = [&](int by, int bz) { return ranges[bx + ((size_t)by + (size_t)bz * bricks) * bricks]; };
+		row[bx] = glm::mix(glm::mix(range(y0, z0), range(y1, z0), fy), glm::mix(range(y0, z1), range(y1, z1), fy), fz);
+	}
+	for (int x = 0; x < size; ++x)
+	{
+		int x0, x1;
+		float fx;
+		texel(x, x0, x1, fx);
+		glm::vec2 range = glm::mix(row[x0], row[x1], fx);
+		offsets[x] = range.x;
+		inverses[x] = 1.f / range.y;
+	}
+}
+
+//values to texels of the given bits over [offset, offset + scale] of every voxel, stride bytes apart. 4 voxels at a time with SSE
+static void quantizeRow(const float* values, const float* offsets, const float* inverses, int count, int bits, uint8_t* out, int stride, bool use_simd)
+{
+	float maximum = (float)((1 << bits) - 1);
+	auto scalar = [&](int x) {
+		float q = std::min(std::max((values[x] - offsets[x]) * inverses[x], 0.f), 1.f) * maximum + 0.5f;
+		if (bits == 8)
+			out[x * stride] = (uint8_t)q;
+		else
+		{
+			uint16_t texel = (uint16_t)q;
+			memcpy(out + x * stride, &texel, sizeof(texel));
+		}
+	};
+
+	int x = 0;
+#ifdef USE_SSE
+	if (use_simd)
+	{
+		__m128 zero = _mm_setzero_ps();
+		__m128 one = _mm_set1_ps(1.f);
+		__m128 half = _mm_set1_ps(0.5f);
+		__m128 scale = _mm_set1_ps(maximum);
+		__m128i bias = _mm_set1_epi32(32768);
+		__m128i flip = _mm_set1_epi16((short)0x8000);
+		for (; x + 4 <= count; x += 4)
+		{
+			__m128 v = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(values + x), _mm_loadu_ps(offsets + x)), _mm_loadu_ps(inverses + x));
+			__m128i q = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(v, zero), one), scale), half));
+			if (bits == 8)
+			{
+				//32 to 16 to 8 bits, the values fit so nothing saturates
+				__m128i words = _mm_packs_epi32(q, q);
+				uint32_t bytes = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+				if (stride == 1)
+					memcpy(out + x, &bytes, sizeof(bytes));
+				else
+					for (int k = 0; k < 4; ++k)
+						out[(x + k) * stride] = (uint8_t)(bytes >> (k * 8));
+			}
+			else
+			{
+				//SSE2 only packs to signed 16 bits: biased to them and flipped back
+				__m128i biased = _mm_sub_epi32(q, bias);
+				__m128i words = _mm_xor_si128(_mm_packs_epi32(biased, biased), flip);
+				uint16_t texels[8];
+				_mm_storeu_si128((__m128i*)texels, words);
+				if (stride == 2)
+					memcpy(out + x * 2, texels, 4 * sizeof(uint16_t));
+				else
+					for (int k = 0; k < 4; ++k)
+						memcpy(out + (x + k) * stride, &texels[k], sizeof(uint16_t));
+			}
+		}
+	}
+#endif
+
+	for (; x < count; ++x)
+		scalar(x);
+}
+
+void VolumeGrid::packChannels(const std::vector<const VolumeGrid*>& grids, sVolumeChannels& channels, std::vector<std::vector<uint8_t>>& levels,
+	std::vector<glm::vec2>* ranges, bool use_simd, bool parallel)
+{
+	channels.count = std::min((int)grids.size(), VOLUME_MAX_CHANNELS);
+	channels.bits = channels.bits == 16 ? 16 : 8;
+	channels.brick_ranges = channels.brick_ranges && ranges;
+	channels.range_extent = 1.f;
+	channels.scale = glm::vec4(1.f);
+	channels.offset = glm::vec4(0.f);
+	int texel = channels.getTexelSize();
+	int bytes = channels.bits / 8;
+	int resolution = grids[0]->resolution;
+
+	//the other channels are normalized to [0, 1] and filtered like the density, the last texel is the max of the grid
+	std::vector<std::vector<std::vector<float>>> chains(channels.count);
+	grids[0]->filterMips(chains[0], false, parallel);
+	for (int c = 1; c < channels.count; ++c)
+	{
+		const VolumeGrid* grid = grids[c];
+		if (!grid || grid->resolution != resolution)
+			continue;
+		auto range = std::minmax_element(grid->data.begin(), grid->data.end());
+		channels.offset[c] = *range.first;
+		channels.scale[c] = std::max(*range.second - *range.first, 1e-6f);
+		VolumeGrid normalized;
+		normalized.resolution = resolution;
+		normalized.data.resize(grid->data.size());
+		for (size_t i = 0; i < grid->data.size(); ++i)
+			normalized.data[i] = (grid->data[i] - channels.offset[c]) / channels.scale[c];
+		normalized.filterMips(chains[c], false, parallel);
+	}
+
+	//one field of ranges for every level, the coarse voxels are averages of the fine ones so they mostly fit in it too
+	int bricks = 1;
+	if (channels.brick_ranges)
+	{
+		grids[0]->computeRanges(*ranges, bricks, VOLUME_RANGE_BRICK_SIZE, parallel);
+		channels.range_extent = bricks * VOLUME_RANGE_BRICK_SIZE / (float)resolution;
+	}
+
+	levels.resize(chains[0].size());
+	for (size_t l = 0; l < levels.size(); ++l)
+	{
+		int size = std::max(resolution >> l, 1);
+		levels[l].assign(chains[0][l].size() * texel, 0);
+		auto slices = [&](int begin, int end) {
+			std::vector<float> zeros(size, 0.f), ones(size, 1.f), offsets(size), inverses(size);
+			std::vector<glm::vec2> row;
+			for (int z = begin; z < end; ++z)
+				for (int y = 0; y < size; ++y)
+				{
+					size_t first = ((size_t)y + (size_t)z * size) * size;
+					if (channels.brick_ranges)
+						interpolateRanges(*ranges, bricks, resolution / (float)(size * VOLUME_RANGE_BRICK_SIZE), size, y, z, row, &offsets[0], &inverses[0]);
+					for (int c = 0; c < channels.count; ++c)
+						if (!chains[c].empty())
+						{
+							bool ranged = c == 0 && channels.brick_ranges;
+							quantizeRow(&chains[c][l][first], ranged ? &offsets[0] : &zeros[0], ranged ? &inverses[0] : &ones[0], size, channels.bits,
+								&levels[l][first * texel + c * bytes], texel, use_simd);
+						}
+				}
+		};
+		if (parallel)
+			parallelFor(size, slices, 4);
+		else
+			slices(0, size);
+	}
+}
+
+Texture* VolumeGrid::createTexture(const std::vector<const VolumeGrid*>& grids, sVolumeChannels& channels, Texture** range_texture)
+{
+	std::vector<std::vector<uint8_t>> levels;
+	std::vector<glm::vec2> ranges;
+	packChannels(grids, channels, levels, range_texture ? &ranges : nullptr);
+	std::vector<uint8_t*> pointers;
+	for (std::vector<uint8_t>& level : levels)
+		pointers.push_back(&level[0]);
+
+	int resolution = grids[0]->resolution;
+	Texture* texture = new Texture();
+	texture->create3DMipmaps(resolution, resolution, resolution, channels.getFormat(), channels.getType(), &pointers[0], (int)pointers.size(), channels.getInternalFormat());
+	if (range_texture)
+		*range_texture = channels.brick_ranges ? createRangeTexture(ranges) : nullptr;
+	return texture;
+}
+
+Texture* VolumeGrid::createRangeTexture(const std::vector<glm::vec2>& ranges)
+{
+	int bricks = (int)std::round(std::cbrt((double)ranges.size()));
+	Texture* texture = new Texture();
+	texture->create3D(bricks, bricks, bricks, GL_RG, GL_FLOAT, false, (float*)&ranges[0], GL_RG32F);
+	return texture;
+}
+
+bool VolumeGrid::load(const char* filename, int resolution, float radius, const std::string& grid_name)
+{
+	//the header tells which grid it is before the trees are parsed, the old files without grid offsets use the first one
+	VolumeFile file;
+	int index = 0;
+	if (file.scan(filename))
+		index = grid_name.empty() ? file.findDensity() : file.findGrid(grid_name);
+	else if (!std::ifstream(filename).good())
+		return false;
+	if (index == -1)
+		return false;
+
+	easyVDB::OpenVDBReader reader;
+	reader.read(filename);
+	if ((int)reader.gridsSize <= index)
+		return false;
+	voxelize(reader.grids[index], resolution, radius);
+	return true;
+}
+
+void VolumeGrid::loadBenchmark(const char* filename)
+{
+	if (load(filename))
+		return;
+
+	//soft blobs with holes, dense enough to be clamped in places like the loaded VDBs
+	std::cout << "   " << filename << " not found, using a procedural cloud" << std::endl;
+	resolution = 128;
+	data.resize(128 * 128 * 128);
+	for (int z = 0; z < 128; ++z)
+		for (int y = 0; y < 128; ++y)
+			for (int x = 0; x < 128; ++x)
+			{
+				glm::vec3 p = glm::vec3(x, y, z) / 127.f;
+				float d = std::max(0.f, 1.f - glm::length(p - glm::vec3(0.4f, 0.45f, 0.5f)) / 0.3f) + std::max(0.f, 0.6f - glm::length(p - glm::vec3(0.72f, 0.6f, 0.45f)) / 0.25f);
+				d *= 0.5f + 0.5f * sin(p.x * 23.f) * sin(p.y * 19.f) * sin(p.z * 29.f);
+				data[x + (y + z * 128) * 128] = d * 4.f;
+			}
+}
+
+//opacity along a ray through the box [-1, 1] like the texture loop of the volume shaders, adaptive when proxy is set
+static float marchOpacity(const VolumeGrid& grid, const VolumeProxy* proxy, const glm::vec3& origin, const glm::vec3& dir, float ta, float tb, const sAdaptiveStep& settings, int& samples)
+{
+	glm::vec3 box_min(-1.f), box_max(1.f);
+	float tau = 0.f;
+	float t = ta;
+	while (t < tb)
+	{
+		float dt = proxy ? proxy->getStep(origin + dir * t, dir, t, box_min, box_max, settings) : settings.step_length;
+		dt = std::min(dt, tb - t);
+		glm::vec3 P = origin + dir * (t + dt * 0.5f);
+		tau += grid.sample((P - box_min) / (box_max - box_min)) * settings.sigma * dt;
+		samples++;
+		if (exp(-tau) < 0.01f)
+			break;
+		t += dt;
+	}
+	return 1.f - exp(-tau);
+}
+
+struct sBenchmarkRay { glm::vec3 dir; float ta, tb; };
+
+//pinhole camera like the default one of the viewer, rays that hit the box [-1, 1]
+static std::vector<sBenchmarkRay> benchmarkRays(const glm::vec3& eye, int size)
+{
+	glm::vec3 front = glm::normalize(-eye);
+	glm::vec3 right = glm::normalize(glm::cross(front, glm::vec3(0.f, 1.f, 0.f)));
+	glm::vec3 up = glm::cross(right, front);
+	std::vector<sBenchmarkRay> rays;
+	for (int y = 0; y < size; ++y)
+		for (int x = 0; x < size; ++x)
+		{
+			glm::vec2 ndc = (glm::vec2(x, y) + 0.5f) / (float)size * 2.f - 1.f;
+			glm::vec3 dir = glm::normalize(front + (right * ndc.x + up * ndc.y) * 0.4f);
+			glm::vec3 t1 = (glm::vec3(-1.f) - eye) / dir;
+			glm::vec3 t2 = (glm::vec3(1.f) - eye) / dir;
+			glm::vec3 tmin = glm::min(t1, t2), tmax = glm::max(t1, t2);
+			float ta = std::max(std::max(tmin.x, tmin.y), tmin.z);
+			float tb = std::min(std::min(tmax.x, tmax.y), tmax.z);
+			if (ta < tb && tb > 0.f)
+				rays.push_back({ dir, std::max(ta, 0.f), tb });
+		}
+	return rays;
+}
+
+void VolumeGrid::benchmark(const char* filename)
+{
+	VolumeGrid grid;
+	grid.loadBenchmark(filename);
+
+	VolumeProxy proxy;
+	proxy.build(&grid.data[0], grid.resolution);
+	std::cout << "   " << grid.resolution << "^3 voxels, " << proxy.num_occupied << "/" << proxy.occupancy.size() << " bricks occupied" << std::endl;
+
+	glm::vec3 eye(1.f, 1.5f, 4.f);
+	std::vector<sBenchmarkRay> rays = benchmarkRays(eye, 192);
+
+	//density scale 1, absorption 1 and scattering 1 like the defaults of the materials
+	sAdaptiveStep reference;
+	reference.step_length = 0.002f;
+	reference.sigma = 2.f;
+	std::vector<float> expected(rays.size());
+	int reference_samples = 0;
+	for (size_t i = 0; i < rays.size(); ++i)
+		expected[i] = marchOpacity(grid, nullptr, eye, rays[i].dir, rays[i].ta, rays[i].tb, reference, reference_samples);
+
+	std::ofstream csv("adaptive_step.csv");
+	csv << "mode,step_length,max_step_scale,distance_scale,samples_per_ray,ms,rmse,max_error" << std::endl;
+	std::cout << "   " << rays.size() << " rays, reference step " << reference.step_length << std::endl;
+
+	auto run = [&](const char* mode, const VolumeProxy* adaptive, sAdaptiveStep settings) {
+		int samples = 0;
+		double error = 0.0, max_error = 0.0;
+		auto start = std::chrono::high_resolution_clock::now();
+		std::vector<float> opacity(rays.size());
+		for (size_t i = 0; i < rays.size(); ++i)
+			opacity[i] = marchOpacity(grid, adaptive, eye, rays[i].dir, rays[i].ta, rays[i].tb, settings, samples);
+		float ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			double e = fabs(opacity[i] - expected[i]);
+			error += e * e;
+			max_error = std::max(max_error, e);
+		}
+		float rmse = (float)sqrt(error / rays.size());
+		float samples_per_ray = samples / (float)rays.size();
+		std::cout << "   " << mode << " step " << settings.step_length;
+		if (adaptive)
+			std::cout << " x" << settings.max_step_scale << " dist " << settings.distance_scale;
+		std::cout << ": " << samples_per_ray << " samples/ray, " << ms << " ms, rmse " << rmse << ", max error " << max_error << std::endl;
+		csv << mode << "," << settings.step_length << "," << (adaptive ? settings.max_step_scale : 1.f) << "," << (adaptive ? settings.distance_scale : 0.f) << ","
+			<< samples_per_ray << "," << ms << "," << rmse << "," << max_error << std::endl;
+	};
+
+	sAdaptiveStep settings = reference;
+	for (float step : { 0.0225f, 0.045f, 0.09f, 0.18f, 0.36f })
+	{
+		settings.step_length = step;
+		run("fixed", nullptr, settings);
+	}
+	settings.step_length = 0.045f; //default of the materials
+	for (float scale : { 4.f, 8.f, 16.f })
+		for (float distance_scale : { 0.f, 0.05f })
+		{
+			settings.max_step_scale = scale;
+			settings.distance_scale = distance_scale;
+			run("adaptive", &proxy, settings);
+		}
+	std::cout << "   written adaptive_step.csv" << std::endl;
+}
+
+void VolumeGrid::benchmarkGradients(const char* filename)
+{
+	VolumeGrid grid;
+	grid.loadBenchmark(filename);
+
+	std::vector<uint32_t> scalar, simd, threaded;
+	auto time = [&](std::vector<uint32_t>& packed, bool use_simd, bool parallel) {
+		auto start = std::chrono::high_resolution_clock::now();
+		grid.computeGradients(packed, use_simd, parallel);
+		return std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	};
+	float scalar_ms = time(scalar, false, false);
+	float simd_ms = time(simd, true, false);
+	float threaded_ms = time(threaded, true, true);
+
+	//the rounding of the SIMD path can differ in the last bit of a channel
+	int max_difference = 0, surface = 0;
+	for (size_t i = 0; i < scalar.size(); ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+			max_difference = std::max(max_difference, std::abs((int)((scalar[i] >> (c * 10)) & 1023) - (int)((threaded[i] >> (c * 10)) & 1023)));
+		surface += (scalar[i] >> 30) != 0;
+	}
+	std::cout << "   " << grid.resolution << "^3 voxels, " << surface << " with gradient: scalar " << scalar_ms << " ms, SIMD " << simd_ms << " ms, SIMD with "
+		<< getNumJobThreads() << " threads " << threaded_ms << " ms (max difference " << max_difference << "/1023)" << std::endl;
+}
+
+//first crossing of the isovalue like the surface only march of isosurface.fs, the bricks under the isovalue are skipped when proxy is set
+static bool marchIsosurface(const VolumeGrid& grid, const VolumeProxy* proxy, const glm::vec3& origin, const glm::vec3& dir, float ta, float tb, float isovalue, float step_length, int refine_steps, float& t_hit, int& samples)
+{
+	auto density = [&](float t) {
+		samples++;
+		return grid.sample((origin + dir * t + 1.f) * 0.5f);
+	};
+
+	float t = ta;
+	float front = density(t);
+	while (t < tb)
+	{
+		float dt = step_length;
+		if (proxy)
+		{
+			glm::vec3 P = origin + dir * t;
+			glm::vec3 uvw = glm::clamp((P + 1.f) * 0.5f, glm::vec3(0.f), glm::vec3(1.f));
+			glm::ivec3 cell = glm::min(glm::ivec3(uvw / proxy->brick_extent), glm::ivec3(proxy->resolution - 1));
+			if (proxy->max_density[cell.x + (cell.y + cell.z * proxy->resolution) * proxy->resolution] < isovalue)
+			{
+				glm::vec3 lo = glm::vec3(cell) * proxy->brick_extent * 2.f - 1.f;
+				float to_exit = 3.4e+38F;
+				for (int i = 0; i < 3; ++i)
+					if (dir[i] != 0.f)
+						to_exit = std::min(to_exit, (lo[i] + (dir[i] > 0.f ? proxy->brick_extent * 2.f : 0.f) - P[i]) / dir[i]);
+				dt = to_exit + step_length * 0.01f;
+			}
+		}
+		dt = std::min(dt, tb - t);
+
+		float back = density(t + dt);
+		if (back >= isovalue)
+		{
+			float t0 = t, t1 = t + dt;
+			for (int i = 0; i < refine_steps; ++i)
+			{
+				float tm = 0.5f * (t0 + t1);
+				float dm = density(tm);
+				if (dm >= isovalue)
+				{
+					t1 = tm;
+					back = dm;
+				}
+				else
+				{
+					t0 = tm;
+					front = dm;
+				}
+			}
+			t_hit = t0 + (t1 - t0) * std::min(std::max((isovalue - front) / std::max(back - front, 1e-6f), 0.f), 1.f);
+			return true;
+		}
+		front = back;
+		t += dt;
+	}
+	return false;
+}
+
+void VolumeGrid::benchmarkIsosurface(const char* filename)
+{
+	VolumeGrid grid;
+	grid.loadBenchmark(filename);
+
+	VolumeProxy proxy;
+	proxy.build(&grid.data[0], grid.resolution);
+
+	glm::vec3 eye(1.f, 1.5f, 4.f);
+	std::vector<sBenchmarkRay> rays = benchmarkRays(eye, 192);
+	const float isovalue = 0.5f;
+	const float voxel = 2.f / grid.resolution;
+
+	//fine steps and many bisections as the reference
+	std::vector<float> expected(rays.size());
+	std::vector<bool> hit(rays.size());
+	int reference_samples = 0, hits = 0;
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		float t_hit = 0.f;
+		hit[i] = marchIsosurface(grid, nullptr, eye, rays[i].dir, rays[i].ta, rays[i].tb, isovalue, 0.002f, 12, t_hit, reference_samples);
+		expected[i] = t_hit;
+		hits += hit[i];
+	}
+	std::cout << "   " << rays.size() << " rays, " << hits << " hit the isovalue " << isovalue << ", voxel " << voxel << std::endl;
+
+	auto run = [&](const char* mode, const VolumeProxy* skip, float step, int refine_steps) {
+		int samples = 0, missed = 0;
+		double error = 0.0, max_error = 0.0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			float t_hit = 0.f;
+			bool found = marchIsosurface(grid, skip, eye, rays[i].dir, rays[i].ta, rays[i].tb, isovalue, step, refine_steps, t_hit, samples);
+			if (found != hit[i])
+			{
+				missed++;
+				continue;
+			}
+			if (!found)
+				continue;
+			double e = fabs(t_hit - expected[i]) / voxel;
+			error += e;
+			max_error = std::max(max_error, e);
+		}
+		float ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		std::cout << "   " << mode << " step " << step << ", " << refine_steps << " bisections: " << samples / (float)rays.size() << " samples/ray, " << ms << " ms, hit error "
+			<< error / std::max(hits - missed, 1) << " voxels (max " << max_error << "), " << missed << " rays differ" << std::endl;
+	};
+
+	for (float step : { 0.045f, 0.09f, 0.18f })
+		for (int refine_steps : { 0, 2, 4, 6 })
+			run("fixed", nullptr, step, refine_steps);
+	for (float step : { 0.045f, 0.09f })
+		run("bricks", &proxy, step, 4);
+
+	//the field is rebuilt every time the isovalue changes
+	DistanceField field;
+	auto start = std::chrono::high_resolution_clock::now();
+	field.build(grid, isovalue, false);
+	float serial = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	start = std::chrono::high_resolution_clock::now();
+	field.build(grid, isovalue, true);
+	float parallel = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	std::cout << "   distance field: " << serial << " ms serial, " << parallel << " ms with " << getNumJobThreads() << " threads" << std::endl;
+
+	int samples = 0, missed = 0, max_samples = 0;
+	double error = 0.0, max_error = 0.0;
+	start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		float t_hit = 0.f;
+		int ray_samples = 0;
+		bool found = field.trace(grid, eye, rays[i].dir, rays[i].ta, rays[i].tb, 4, t_hit, ray_samples);
+		samples += ray_samples;
+		max_samples = std::max(max_samples, ray_samples);
+		if (found != hit[i])
+		{
+			missed++;
+			continue;
+		}
+		if (!found)
+			continue;
+		double e = fabs(t_hit - expected[i]) / voxel;
+		error += e;
+		max_error = std::max(max_error, e);
+	}
+	float ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	std::cout << "   sphere tracing, 4 bisections: " << samples / (float)rays.size() << " samples/ray (max " << max_samples << "), " << ms << " ms, hit error "
+		<< error / std::max(hits - missed, 1) << " voxels (max " << max_error << "), " << missed << " rays differ" << std::endl;
+}
+
+//trilinear between the texels and the two nearest levels like textureLod with GL_LINEAR_MIPMAP_LINEAR
+static float sampleLevels(const std::vector<std::vector<uint8_t>>& levels, int resolution, const glm::vec3& uvw, float lod)
+{
+	auto sampleLevel = [&](int l) {
+		const std::vector<uint8_t>& level = levels[l];
+		int size = std::max(resolution >> l, 1);
+		glm::vec3 p = glm::clamp(uvw * (float)size - 0.5f, glm::vec3(0.f), glm::vec3((float)(size - 1)));
+		glm::ivec3 a = glm::ivec3(p);
+		glm::ivec3 b = glm::min(a + 1, glm::ivec3(size - 1));
+		glm::vec3 f = p - glm::vec3(a);
+		auto voxel = [&](int x, int y, int z) {
+			return level[x + ((size_t)y + (size_t)z * size) * size] / 255.f;
+		};
+		float c00 = voxel(a.x, a.y, a.z) * (1.f - f.x) + voxel(b.x, a.y, a.z) * f.x;
+		float c10 = voxel(a.x, b.y, a.z) * (1.f - f.x) + voxel(b.x, b.y, a.z) * f.x;
+		float c01 = voxel(a.x, a.y, b.z) * (1.f - f.x) + voxel(b.x, a.y, b.z) * f.x;
+		float c11 = voxel(a.x, b.y, b.z) * (1.f - f.x) + voxel(b.x, b.y, b.z) * f.x;
+		float c0 = c00 * (1.f - f.y) + c10 * f.y;
+		float c1 = c01 * (1.f - f.y) + c11 * f.y;
+		return c0 * (1.f - f.z) + c1 * f.z;
+	};
+	lod = std::min(std::max(lod, 0.f), (float)(levels.size() - 1));
+	int l0 = (int)lod;
+	float f = lod - l0;
+	if (f <= 0.f)
+		return sampleLevel(l0);
+	return sampleLevel(l0) * (1.f - f) + sampleLevel(l0 + 1) * f;
+}
+
+void VolumeGrid::benchmarkMips(const char* filename)
+{
+	VolumeGrid grid;
+	grid.loadBenchmark(filename);
+
+	std::vector<std::vector<uint8_t>> levels;
+	for (bool max_filter : { false, true })
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		grid.buildMips(levels, max_filter, false);
+		float serial = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		start = std::chrono::high_resolution_clock::now();
+		grid.buildMips(levels, max_filter, true);
+		float parallel = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		std::cout << "   " << (max_filter ? "max" : "box") << " chain of " << levels.size() << " levels: " << serial << " ms serial, " << parallel << " ms with "
+			<< getNumJobThreads() << " threads" << std::endl;
+	}
+	grid.buildMips(levels, false);
+
+	//the pixel of benchmarkRays covers 0.8 / size radians, the level is where a voxel covers a pixel like isosurface.fs and scattering.fs
+	const int size = 192;
+	const float voxel = 2.f / grid.resolution;
+	const float pixel_footprint = 0.8f / size;
+	const float step_length = 0.045f, sigma = 2.f;
+	for (float distance : { 1.f, 3.f, 6.f })
+	{
+		glm::vec3 eye = glm::vec3(1.f, 1.5f, 4.f) * distance;
+		std::vector<sBenchmarkRay> rays = benchmarkRays(eye, size);
+
+		auto march = [&](bool use_lod, std::vector<float>& opacity, int& samples, float& mean_lod) {
+			auto start = std::chrono::high_resolution_clock::now();
+			double lod_sum = 0.0;
+			opacity.resize(rays.size());
+			for (size_t i = 0; i < rays.size(); ++i)
+			{
+				float tau = 0.f;
+				for (float t = rays[i].ta; t < rays[i].tb; )
+				{
+					float lod = use_lod ? std::max(log2f(std::max(pixel_footprint * t / voxel, 1e-6f)), 0.f) : 0.f;
+					//the voxels of the level are larger, so are the steps
+					float dt = std::min(std::max(step_length, voxel * exp2f(lod) * 0.5f), rays[i].tb - t);
+					glm::vec3 P = eye + rays[i].dir * (t + dt * 0.5f);
+					tau += sampleLevels(levels, grid.resolution, (P + 1.f) * 0.5f, lod) * sigma * dt;
+					lod_sum += lod;
+					samples++;
+					if (exp(-tau) < 0.01f)
+						break;
+					t += dt;
+				}
+				opacity[i] = 1.f - exp(-tau);
+			}
+			mean_lod = (float)(lod_sum / std::max(samples, 1));
+			return std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		};
+
+		std::vector<float> full, filtered;
+		int full_samples = 0, lod_samples = 0;
+		float full_lod = 0.f, mean_lod = 0.f;
+		float full_ms = march(false, full, full_samples, full_lod);
+		float lod_ms = march(true, filtered, lod_samples, mean_lod);
+		double error = 0.0;
+		for (size_t i = 0; i < rays.size(); ++i)
+			error += (filtered[i] - full[i]) * (filtered[i] - full[i]);
+		std::cout << "   distance x" << distance << ", " << rays.size() << " rays: full resolution " << full_samples / (float)std::max(rays.size(), (size_t)1) << " samples/ray, " << full_ms
+			<< " ms; footprint level " << mean_lod << " on average, " << lod_samples / (float)std::max(rays.size(), (size_t)1) << " samples/ray, " << lod_ms << " ms, opacity rmse "
+			<< sqrt(error / std::max(rays.size(), (size_t)1)) << std::endl;
+	}
+}
+
+void VolumeGrid::benchmarkChannels(const char* filename)
+{
+	VolumeGrid density;
+	density.loadBenchmark(filename);
+
+	//a fire-like temperature in kelvin: hot where the density is high and near the center, ambient elsewhere
+	const int res = density.resolution;
+	VolumeGrid temperature;
+	temperature.resolution = res;
+	temperature.data.resize(density.data.size());
+	for (int z = 0; z < res; ++z)
+		for (int y = 0; y < res; ++y)
+			for (int x = 0; x < res; ++x)
+			{
+				size_t i = x + ((size_t)y + (size_t)z * res) * res;
+				float center = glm::length(glm::vec3(x, y, z) / (float)(res - 1) - 0.5f);
+				temperature.data[i] = 300.f + 1500.f * std::min(density.data[i], 1.f) * std::max(1.f - center * 2.f, 0.f);
+			}
+
+	std::vector<const VolumeGrid*> grids = { &density, &temperature };
+	sVolumeChannels channels;
+	std::vector<std::vector<uint8_t>> levels;
+	for (bool parallel : { false, true })
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		packChannels(grids, channels, levels, nullptr, true, parallel);
+		float ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		size_t bytes = 0;
+		for (const std::vector<uint8_t>& level : levels)
+			bytes += level.size();
+		std::cout << "   RG8 chain of " << levels.size() << " levels, " << bytes / 1024 << " KB: " << ms << " ms " << (parallel ? "with " + std::to_string(getNumJobThreads()) + " threads" : "serial")
+			<< ", 1 fetch per sample instead of 2" << std::endl;
+	}
+
+	//the density channel is the R8 texture as it was, the temperature against quantizing it from 0 with only a scale
+	float max_density_error = 0.f, max_error = 0.f, max_shared_error = 0.f;
+	float shared_scale = *std::max_element(temperature.data.begin(), temperature.data.end());
+	for (size_t i = 0; i < density.data.size(); ++i)
+	{
+		float d = levels[0][i * 2] / 255.f;
+		max_density_error = std::max(max_density_error, std::abs(d - std::min(density.data[i], 1.f)));
+		float t = levels[0][i * 2 + 1] / 255.f * channels.scale.y + channels.offset.y;
+		max_error = std::max(max_error, std::abs(t - temperature.data[i]));
+		float shared = std::round(temperature.data[i] / shared_scale * 255.f) / 255.f * shared_scale;
+		max_shared_error = std::max(max_shared_error, std::abs(shared - temperature.data[i]));
+	}
+	std::cout << "   density error " << max_density_error << ", temperature range " << channels.offset.y << " to " << channels.offset.y + channels.scale.y << " K: error "
+		<< max_error << " K with its own range, " << max_shared_error << " K from 0" << std::endl;
+}
+
+//range of the bricks at a point of texture space, trilinear and clamped like the RG32F texture
+static glm::vec2 sampleRanges(const std::vector<glm::vec2>& ranges, int bricks, float extent, const glm::vec3& uvw)
+{
+	glm::vec3 p = glm::clamp(uvw / extent * (float)bricks - 0.5f, glm::vec3(0.f), glm::vec3((float)(bricks - 1)));
+	glm::ivec3 a = glm::ivec3(p);
+	glm::ivec3 b = glm::min(a + 1, glm::ivec3(bricks - 1));
+	glm::vec3 f = p - glm::vec3(a);
+	auto range = [&](int x, int y, int z) { return ranges[x + ((size_t)y + (size_t)z * bricks) * bricks]; };
+	glm::vec2 c0 = glm::mix(glm::mix(range(a.x, a.y, a.z), range(b.x, a.y, a.z), f.x), glm::mix(range(a.x, b.y, a.z), range(b.x, b.y, a.z), f.x), f.y);
+	glm::vec2 c1 = glm::mix(glm::mix(range(a.x, a.y, b.z), range(b.x, a.y, b.z), f.x), glm::mix(range(a.x, b.y, b.z), range(b.x, b.y, b.z), f.x), f.y);
+	return glm::mix(c0, c1, f.z);
+}
+
+void VolumeGrid::benchmarkQuantization(const char* filename)
+{
+	VolumeGrid grid;
+	grid.loadBenchmark(filename);
+	const int res = grid.resolution;
+
+	//points spread over the volume, between the voxels the shaders filter the texels before dequantizing them
+	std::vector<glm::vec3> points(200000);
+	for (size_t i = 0; i < points.size(); ++i)
+		points[i] = glm::fract(glm::vec3(0.5f) + (float)i * glm::vec3(0.8191725f, 0.6710436f, 0.5497005f));
+
+	//the volume as loaded, and a thin fog of it that only uses the first codes of [0, 1]
+	for (float thinning : { 1.f, 0.05f })
+	{
+		if (thinning != 1.f)
+			for (float& value : grid.data)
+				value = std::min(value, 1.f) * thinning;
+		std::vector<std::vector<float>> reference;
+		grid.filterMips(reference);
+		size_t float_bytes = 0;
+		for (const std::vector<float>& level : reference)
+			float_bytes += level.size() * sizeof(float);
+		std::cout << "   " << (thinning != 1.f ? "thin fog" : "volume") << ", float chain " << float_bytes / 1024 << " KB for the GL_FLOAT upload the driver converts" << std::endl;
+
+		for (int bits : { 8, 16 })
+			for (bool brick_ranges : { false, true })
+			{
+				sVolumeChannels channels;
+				channels.bits = bits;
+				channels.brick_ranges = brick_ranges;
+				std::vector<std::vector<uint8_t>> levels;
+				std::vector<glm::vec2> ranges;
+				float ms[2];
+				for (int simd = 0; simd < 2; ++simd)
+				{
+					auto start = std::chrono::high_resolution_clock::now();
+					packChannels({ &grid }, channels, levels, &ranges, simd == 1);
+					ms[simd] = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+				}
+				size_t bytes = brick_ranges ? ranges.size() * sizeof(glm::vec2) : 0;
+				for (const std::vector<uint8_t>& level : levels)
+					bytes += level.size();
+
+				//the full resolution back to densities, the occupied voxels only so the empty space doesn't hide the error
+				int bricks = (int)std::round(std::cbrt((double)std::max(ranges.size(), (size_t)1)));
+				float maximum = (float)((1 << bits) - 1);
+				VolumeGrid texels;
+				texels.resolution = res;
+				texels.data.resize(grid.data.size());
+				for (size_t i = 0; i < texels.data.size(); ++i)
+				{
+					uint16_t texel = levels[0][i];
+					if (bits == 16)
+						memcpy(&texel, &levels[0][i * 2], sizeof(texel));
+					texels.data[i] = texel / maximum;
+				}
+				auto decode = [&](const glm::vec3& uvw) {
+					glm::vec2 range = brick_ranges ? sampleRanges(ranges, bricks, channels.range_extent, uvw) : glm::vec2(0.f, 1.f);
+					return range.x + texels.sample(uvw) * range.y;
+				};
+				double voxel_error = 0.0, point_error = 0.0;
+				size_t occupied = 0, occupied_points = 0;
+				for (int z = 0; z < res; ++z)
+					for (int y = 0; y < res; ++y)
+						for (int x = 0; x < res; ++x)
+						{
+							float value = reference[0][x + ((size_t)y + (size_t)z * res) * res];
+							if (value <= 0.f)
+								continue;
+							float e = decode((glm::vec3(x, y, z) + 0.5f) / (float)res) - value;
+							voxel_error += e * e;
+							occupied++;
+						}
+				for (const glm::vec3& p : points)
+				{
+					float value = grid.sample(p);
+					if (value <= 0.f)
+						continue;
+					float e = decode(p) - value;
+					point_error += e * e;
+					occupied_points++;
+				}
+				auto psnr = [](double error, size_t count) { return error > 0.0 ? 10.0 * log10(count / error) : INFINITY; };
+				std::cout << "   " << bits << " bit " << (brick_ranges ? "brick ranges" : "[0, 1]") << ": " << bytes / 1024 << " KB, " << ms[0] << " ms scalar, " << ms[1]
+					<< " ms SIMD, PSNR " << psnr(voxel_error, occupied) << " dB at the voxels, " << psnr(point_error, occupied_points) << " dB between them" << std::endl;
+			}
+	}
+}
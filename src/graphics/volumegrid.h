@@ -0,0 +1,114 @@
+/*  Dense density grid of a volume on the CPU, resampled from a VDB grid. The volume materials
+	upload it as their 3D texture and build the occupancy of the bricks from it. The isosurfaces
+	also get the gradient of the density packed in a texture for their normals.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "openvdbReader.h"
+
+#define VOLUME_PREVIEW_RESOLUTION 32 //the coarsest voxelization of a progressive load
+#define VOLUME_MAX_CHANNELS 4
+#define VOLUME_RANGE_BRICK_SIZE 8 //voxels per side of the bricks that share a quantization range
+
+class Texture;
+
+//grids of a VDB packed in the channels of one 8 or 16 bit texture, the density in the first one, so every step of the
+//march fetches all of them at once. Each channel is quantized over its own range: value = texel * scale + offset.
+//With brick ranges the density is quantized over the range of the bricks around every voxel instead of [0, 1], the
+//ranges go in a small linear texture and the shaders dequantize the filtered texel with the range at the sample
+struct sVolumeChannels
+{
+	int count = 1;
+	int temperature = -1; //channel of the temperature, -1 without it
+	int bits = 8; //per channel, 8 or 16
+	bool brick_ranges = false;
+	float range_extent = 1.f; //texture space covered by the bricks of the ranges, the last one can go past the volume
+	glm::vec4 scale = glm::vec4(1.f);
+	glm::vec4 offset = glm::vec4(0.f);
+
+	unsigned int getFormat() const; //GL_RED, GL_RG or GL_RGBA, three channels are padded to four
+	unsigned int getInternalFormat() const;
+	unsigned int getType() const; //GL_UNSIGNED_BYTE or GL_UNSIGNED_SHORT
+	int getTexelSize() const; //bytes
+	//#define VOLUME_CHANNELS, VOLUME_TEMPERATURE_CHANNEL and VOLUME_BRICK_RANGES for the shaders, before their code
+	std::string getMacros() const;
+};
+
+class VolumeGrid
+{
+public:
+	int resolution = 0;
+	std::vector<float> data; //x fastest, in [0, 255] like the loader always did, the R8 upload clamps it to [0, 1]
+
+	VolumeGrid() {};
+	~VolumeGrid();
+
+	//resamples the world bbox of the grid, every value bleeds to the voxels around it in a radius. Slices in parallel.
+	//raw keeps the values of the grid, the density is scaled to [0, 255] and clamped. The grids packed with the density
+	//pass its bbox, they are sampled over it through their own transform so their voxels line up
+	void voxelize(easyVDB::Grid& grid, int resolution = 128, float radius = 2.f, bool parallel = true, bool raw = false,
+		const easyVDB::Bbox* world_bbox = nullptr);
+	//grid of a VDB file, the density one of VolumeFile::findDensity without a name
+	bool load(const char* filename, int resolution = 128, float radius = 2.f, const std::string& grid_name = "");
+	//coarser voxelizations of a progressive load, resolution >> 1 down to resolution >> getNumPreviews
+	static int getNumPreviews(int resolution);
+	//the VDB for the benchmarks, or a procedural cloud when it can't be read
+	void loadBenchmark(const char* filename);
+	//texture space, clamped and trilinear like the 3D texture
+	float sample(const glm::vec3& uvw) const;
+
+	//central differences of the clamped density, normalized and packed like GL_UNSIGNED_INT_2_10_10_10_REV:
+	//direction * 0.5 + 0.5 in rgb, alpha 0 where the density is flat
+	void computeGradients(std::vector<uint32_t>& packed, bool use_simd = true, bool parallel = true) const;
+	//RGB10A2 texture of the gradients, built the first time it is requested
+	Texture* getGradientTexture();
+
+	//8 bit levels of the clamped density down to 1^3, each voxel the mean of its 8 children (the extinction of a far cloud
+	//is kept) or their max (a conservative bound, nothing is lost for the empty space tests). Slices in parallel
+	void buildMips(std::vector<std::vector<uint8_t>>& levels, bool max_filter = false, bool parallel = true) const;
+	//the same levels before they are rounded to 8 bits
+	void filterMips(std::vector<std::vector<float>>& levels, bool max_filter = false, bool parallel = true) const;
+	//offset and scale of the clamped density at the center of every brick, x fastest: the min and the max of the bricks around it,
+	//so the range interpolated at the center of any voxel contains it. bricks is set to the bricks per axis
+	void computeRanges(std::vector<glm::vec2>& ranges, int& bricks, int brick_size = VOLUME_RANGE_BRICK_SIZE, bool parallel = true) const;
+	//R8 density texture with the mip chain of the CPU, the caller owns it
+	Texture* createTexture(bool mipmaps = true, bool max_filter = false) const;
+
+	//interleaved mip chain of the density (the first grid, clamped like its R8 texture) and raw grids of the same resolution
+	//in the next channels, each one quantized over its range to the bits of the channels. Null grids give empty channels.
+	//The ranges of the density bricks are returned in ranges, the density is quantized over [0, 1] without them
+	static void packChannels(const std::vector<const VolumeGrid*>& grids, sVolumeChannels& channels, std::vector<std::vector<uint8_t>>& levels,
+		std::vector<glm::vec2>* ranges = nullptr, bool use_simd = true, bool parallel = true);
+	//the texture of the channels, and the one of the ranges when they are used and range_texture is given
+	static Texture* createTexture(const std::vector<const VolumeGrid*>& grids, sVolumeChannels& channels, Texture** range_texture = nullptr);
+	//RG32F, linear and clamped, so the ranges are interpolated between the brick centers like computeRanges assumes
+	static Texture* createRangeTexture(const std::vector<glm::vec2>& ranges);
+
+	//fixed steps against the adaptive step, writes adaptive_step.csv. Uses a procedural cloud if the file can't be read
+	static void benchmark(const char* filename);
+	//scalar, SIMD and threaded gradient stencil
+	static void benchmarkGradients(const char* filename);
+	//hit distance and samples of the surface march with coarse steps and bisections, and sphere tracing the distance field
+	static void benchmarkIsosurface(const char* filename);
+	//time of the mip chain and the opacity of far views marched at the level of the pixel footprint against the full resolution
+	static void benchmarkMips(const char* filename);
+	//density and a temperature grid packed in one texture: time, bytes and quantization error of every channel
+	static void benchmarkChannels(const char* filename);
+	//8 and 16 bits over [0, 1] and over the ranges of the bricks: scalar and SIMD quantization time, bytes and PSNR against the floats
+	static void benchmarkQuantization(const char* filename);
+
+private:
+	Texture* gradient_texture = nullptr;
+
+	VolumeGrid(const VolumeGrid&) = delete;
+	VolumeGrid& operator=(const VolumeGrid&) = delete;
+};
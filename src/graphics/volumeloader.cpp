@@ -0,0 +1,338 @@
+#include "volumeloader.h"
+
+#include "texture.h"
+#include "volumegrid.h"
+#include "volumeproxy.h"
+#include "volumefile.h"
+#include "../framework/jobs.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+VolumeLoader::~VolumeLoader()
+{
+	wait();
+	if (pbo)
+		glDeleteBuffers(1, &pbo);
+	if (texture)
+		delete texture;
+	if (range_texture)
+		delete range_texture;
+	if (proxy)
+		delete proxy;
+	if (grid)
+		delete grid;
+}
+
+static int getNumLevels(int resolution)
+{
+	int levels = 1;
+	for (int size = resolution; size > 1; size = std::max(size >> 1, 1))
+		levels++;
+	return levels;
+}
+
+void VolumeLoader::start(const std::string& filename, int resolution, float radius, const std::string& grid_name, bool temperature, int bits, bool brick_ranges)
+{
+	this->filename = filename;
+	this->resolution = resolution;
+	num_levels = getNumLevels(resolution);
+	base_level = num_levels;
+	stages.resize(brick_ranges ? 1 : VolumeGrid::getNumPreviews(resolution) + 1);
+	for (size_t i = 0; i < stages.size(); ++i)
+		stages[i].level = (int)(stages.size() - 1 - i);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		busy = true;
+	}
+
+	runJob([this, radius, grid_name, temperature, bits, brick_ranges]() {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		//the header tells which grids they are before the trees are parsed, the old files without grid offsets use the first one
+		VolumeFile file;
+		int density = 0, heat = -1;
+		if (file.scan(this->filename.c_str()))
+		{
+			density = grid_name.empty() ? file.findDensity() : file.findGrid(grid_name);
+			heat = temperature ? file.findTemperature() : -1;
+		}
+		//set before the first stage is ready, the render thread creates the texture with them
+		channels.count = heat == -1 ? 1 : 2;
+		channels.temperature = heat == -1 ? -1 : 1;
+		channels.bits = bits;
+		channels.brick_ranges = brick_ranges;
+
+		//the bytes of every stage, each one uploads its chain from its level down to 1^3
+		for (const sStage& stage : stages)
+			for (int l = stage.level; l < num_levels; ++l)
+			{
+				size_t size = (size_t)std::max(this->resolution >> l, 1);
+				total += size * size * size * channels.getTexelSize();
+			}
+
+		//the previews only have the density, the other channels arrive with the full resolution
+		int index = 0;
+		auto publish = [&](const VolumeGrid& voxels, const VolumeGrid* other) {
+			sStage& stage = stages[index];
+			stage.channels = channels;
+			std::vector<const VolumeGrid*> grids = { &voxels, other };
+			grids.resize(channels.count);
+			VolumeGrid::packChannels(grids, stage.channels, stage.levels, &stage.ranges);
+			if (!index)
+				preview_time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+			ready_stages.store(++index);
+		};
+
+		easyVDB::OpenVDBReader reader;
+		if (density != -1 && std::ifstream(this->filename).good())
+			reader.read(this->filename);
+		if (density != -1 && density < (int)reader.gridsSize)
+		{
+			//a few ms for the coarsest one, the last preview costs an eighth of the full resolution
+			for (int level = (int)stages.size() - 1; level > 0; --level)
+			{
+				VolumeGrid coarse;
+				coarse.voxelize(reader.grids[density], this->resolution >> level, radius);
+				publish(coarse, nullptr);
+			}
+			grid = new VolumeGrid();
+			grid->voxelize(reader.grids[density], this->resolution, radius);
+			//over the bbox of the density, the temperature is packed in the same texels
+			VolumeGrid hot;
+			easyVDB::Bbox bbox = reader.grids[density].getPreciseWorldBbox();
+			if (heat != -1)
+				hot.voxelize(reader.grids[heat], this->resolution, radius, true, true, &bbox);
+			publish(*grid, heat != -1 ? &hot : nullptr);
+			proxy = new VolumeProxy();
+			proxy->build(&grid->data[0], this->resolution);
+		}
+		else
+			failed = true;
+		load_time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		loaded.store(true);
+
+		//notified with the lock held, the loader may be destroyed as soon as wait returns
+		std::lock_guard<std::mutex> lock(mutex);
+		busy = false;
+		condition.notify_all();
+	});
+}
+
+void VolumeLoader::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	condition.wait(lock, [this]() { return !busy; });
+}
+
+//the pixel buffer is orphaned every time, so the copy never waits for the transfer of the previous slices
+void VolumeLoader::uploadSlices(int slices)
+{
+	int size = std::max(resolution >> level, 1);
+	size_t slice_bytes = (size_t)size * size * channels.getTexelSize();
+	size_t bytes = slice_bytes * slices;
+	const sStage& current = stages[stage];
+	const uint8_t* source = &current.levels[level - current.level][slice * slice_bytes];
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+	void* destination = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (destination)
+	{
+		memcpy(destination, source, bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		texture->update3DSlices(level, slice, slices, (const void*)0);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	//without the buffer the slices go from the CPU memory
+	if (!destination)
+		texture->update3DSlices(level, slice, slices, source);
+
+	slice += slices;
+	uploaded += bytes;
+}
+
+bool VolumeLoader::update()
+{
+	int ready = ready_stages.load();
+	if (!ready || complete)
+		return false;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	if (!texture)
+	{
+		//storage of every level, none is sampled until it is complete
+		texture = new Texture();
+		texture->create3DMipmaps(resolution, resolution, resolution, channels.getFormat(), channels.getType(), NULL, num_levels, channels.getInternalFormat());
+		//a single stage with brick ranges, they are ready with it
+		if (stages[0].channels.brick_ranges)
+			range_texture = VolumeGrid::createRangeTexture(stages[0].ranges);
+		glGenBuffers(1, &pbo);
+		level = num_levels - 1;
+		slice = 0;
+	}
+
+	//a finer stage rewrites the coarse levels as well, for a few frames the far mips mix both voxelizations
+	bool changed = false;
+	size_t sent = 0;
+	while (stage < ready)
+	{
+		int size = std::max(resolution >> level, 1);
+		size_t slice_bytes = (size_t)size * size * channels.getTexelSize();
+		int slices = std::min(size - slice, (int)((upload_budget - std::min(sent, upload_budget)) / slice_bytes));
+		if (!sent)
+			slices = std::max(slices, 1);
+		if (slices <= 0)
+			break;
+		uploadSlices(slices);
+		sent += slice_bytes * slices;
+		if (slice < size)
+			continue;
+
+		if (level < base_level)
+		{
+			base_level = level;
+			texture->bind();
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, level);
+			texture->unbind();
+		}
+		changed = true;
+		slice = 0;
+		if (level > stages[stage].level)
+		{
+			level--;
+			continue;
+		}
+
+		//the voxelization is on the GPU, the next one starts from 1^3 again
+		std::vector<std::vector<uint8_t>>().swap(stages[stage].levels);
+		stage++;
+		level = num_levels - 1;
+	}
+	//the job may still be building the bricks after the last stage, the proxy is taken with the texture
+	complete = stage == (int)stages.size() && loaded.load();
+
+	upload_time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	max_upload_time = std::max(max_upload_time, upload_time);
+	upload_frames++;
+	if (complete)
+		std::cout << " + VDB loaded: " << filename << ", preview in " << preview_time << " ms, loaded in " << load_time << " ms, uploaded in "
+			<< upload_frames << " frames (max " << max_upload_time << " ms)" << std::endl;
+	return changed;
+}
+
+float VolumeLoader::getProgress() const
+{
+	//the job counts the bytes before the first stage is ready
+	return ready_stages.load() && total ? uploaded / (float)total : 0.f;
+}
+
+Texture* VolumeLoader::getTexture() const
+{
+	//the coarsest level is completed in the first frame of the upload
+	if (texture && base_level < num_levels)
+		return texture;
+	return getPlaceholderTexture();
+}
+
+Texture* VolumeLoader::takeTexture()
+{
+	Texture* result = complete ? texture : nullptr;
+	if (result)
+		texture = nullptr;
+	return result;
+}
+
+Texture* VolumeLoader::takeRangeTexture()
+{
+	Texture* result = complete ? range_texture : nullptr;
+	if (result)
+		range_texture = nullptr;
+	return result;
+}
+
+VolumeProxy* VolumeLoader::takeProxy()
+{
+	if (!loaded.load())
+		return nullptr;
+	VolumeProxy* result = proxy;
+	proxy = nullptr;
+	return result;
+}
+
+VolumeGrid* VolumeLoader::takeGrid()
+{
+	if (!loaded.load() || failed)
+		return nullptr;
+	VolumeGrid* result = grid;
+	grid = nullptr;
+	return result;
+}
+
+Texture* VolumeLoader::getPlaceholderTexture()
+{
+	static Texture* placeholder = nullptr;
+	if (placeholder)
+		return placeholder;
+
+	uint8_t density = VOLUME_PLACEHOLDER_DENSITY;
+	uint8_t* levels[1] = { &density };
+	placeholder = new Texture();
+	placeholder->create3DMipmaps(1, 1, 1, GL_RED, GL_UNSIGNED_BYTE, levels, 1, GL_R8);
+	return placeholder;
+}
+
+void VolumeLoader::benchmark(const char* filename)
+{
+	std::ifstream file(filename);
+	if (!file.good())
+	{
+		std::cout << "   " << filename << " not found" << std::endl;
+		return;
+	}
+	file.close();
+
+	easyVDB::OpenVDBReader reader;
+	reader.read(filename);
+	if (!reader.gridsSize)
+	{
+		std::cout << "   " << filename << " has no grids" << std::endl;
+		return;
+	}
+
+	for (int resolution : { 32, 64, 128, 256 })
+	{
+		VolumeGrid serial, parallel;
+		auto start = std::chrono::high_resolution_clock::now();
+		serial.voxelize(reader.grids[0], resolution, 2.f, false);
+		float serial_ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		start = std::chrono::high_resolution_clock::now();
+		parallel.voxelize(reader.grids[0], resolution, 2.f, true);
+		float parallel_ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+		float difference = 0.f;
+		for (size_t i = 0; i < serial.data.size(); ++i)
+			difference = std::max(difference, std::abs(serial.data[i] - parallel.data[i]));
+		std::cout << "   voxelize " << resolution << "^3: " << serial_ms << " ms serial, " << parallel_ms << " ms with " << getNumJobThreads()
+			<< " threads (max difference " << difference << ")" << std::endl;
+	}
+
+	//the job parses the file again, like a load from the menu
+	for (int resolution : { 128, 256 })
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		VolumeGrid grid;
+		grid.load(filename, resolution);
+		float direct_ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+
+		VolumeLoader loader;
+		loader.start(filename, resolution);
+		loader.wait();
+		std::cout << "   load " << resolution << "^3: " << direct_ms << " ms at once, progressive " << loader.stages.size() << " stages: preview in "
+			<< loader.preview_time << " ms, full resolution in " << loader.load_time << " ms" << std::endl;
+	}
+}
@@ -0,0 +1,115 @@
+/*  Loads a VDB without blocking the render thread. A job parses the grid and voxelizes it coarse to
+	fine: at the sizes of the mip levels from VOLUME_PREVIEW_RESOLUTION up to the full resolution,
+	each one with its own mip chain, and builds the bricks of the last one. A temperature grid is
+	packed next to the density of the full resolution. The render thread uploads
+	every voxelization as soon as it is ready, a few z-slices per frame through a pixel buffer object,
+	the coarsest level first, without going over the byte budget of a frame. The texture is sampled
+	from the finest complete level, so the volume sharpens while it arrives. Until the first level is
+	there the materials show a placeholder of constant density.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "volumegrid.h"
+
+#define VOLUME_PLACEHOLDER_DENSITY 16 //of 255, a faint fog that fills the box
+
+class Texture;
+class VolumeProxy;
+
+class VolumeLoader
+{
+public:
+	size_t upload_budget = 256 * 1024; //bytes per frame, at least one slice is uploaded
+
+	//stats, in ms
+	float preview_time = 0.f; //until the coarsest voxelization is ready
+	float load_time = 0.f; //of the job
+	float upload_time = 0.f; //in the render thread, the last frame that uploaded
+	float max_upload_time = 0.f;
+	int upload_frames = 0;
+
+	VolumeLoader() {};
+	~VolumeLoader();
+
+	//the density grid of the file without a name. With temperature the one of VolumeFile::findTemperature is packed in the
+	//second channel when the file has it. The texels have the given bits, with brick ranges there are no previews: the levels
+	//of different stages are mixed while uploading and the ranges of one would not fit the others
+	void start(const std::string& filename, int resolution = 128, float radius = 2.f, const std::string& grid_name = "", bool temperature = false,
+		int bits = 8, bool brick_ranges = false);
+
+	//render thread, once per frame: uploads the next slices. True when a level was completed
+	bool update();
+	bool isLoaded() const { return loaded.load(); } //the job finished
+	bool isFailed() const { return loaded.load() && failed; }
+	bool isUploading() const { return ready_stages.load() > 0; } //a voxelization is ready, it may not be the last one
+	bool isComplete() const { return complete; } //every level is on the GPU
+	float getProgress() const; //of the bytes uploaded
+	const std::string& getFilename() const { return filename; }
+	//layout of the texture once uploading, the ranges of the channels are the ones of the full resolution once complete
+	const sVolumeChannels& getChannels() const { return complete ? stages.back().channels : channels; }
+
+	//the texture being uploaded once it has a level, the placeholder before
+	Texture* getTexture() const;
+	//ranges of the density bricks when the channels use them, null otherwise
+	Texture* getRangeTexture() const { return range_texture; }
+	//handed over to the material once loaded, null before or if taken
+	Texture* takeTexture();
+	Texture* takeRangeTexture();
+	VolumeProxy* takeProxy();
+	VolumeGrid* takeGrid();
+
+	static Texture* getPlaceholderTexture();
+
+	//serial and parallel voxelization at every size, and the time to the first preview against the whole load
+	static void benchmark(const char* filename);
+
+private:
+	struct sStage
+	{
+		int level = 0; //of the texture, the size of the voxelization is resolution >> level
+		std::vector<std::vector<uint8_t>> levels; //its mip chain, levels[i] goes to the level + i of the texture
+		sVolumeChannels channels; //ranges of its channels
+		std::vector<glm::vec2> ranges; //of the density bricks, only with brick ranges
+	};
+
+	std::string filename;
+	int resolution = 0;
+	sVolumeChannels channels; //count and roles, written by the job before the first stage is ready
+	VolumeGrid* grid = nullptr;
+	VolumeProxy* proxy = nullptr;
+	std::vector<sStage> stages; //coarsest first, the last one is the full resolution
+	std::atomic<int> ready_stages{ 0 }; //the job only touches the stages after these
+	bool failed = false;
+	std::atomic<bool> loaded{ false };
+
+	Texture* texture = nullptr;
+	Texture* range_texture = nullptr;
+	unsigned int pbo = 0;
+	int num_levels = 0;
+	int base_level = 0; //finest complete level, num_levels while there is none
+	int stage = 0; //being uploaded
+	int level = -1; //of the stage being uploaded, from the coarsest
+	int slice = 0;
+	size_t uploaded = 0;
+	size_t total = 0;
+	bool complete = false;
+
+	//the job is waited for before the loader goes away
+	bool busy = false;
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	void uploadSlices(int slices);
+	void wait();
+
+	VolumeLoader(const VolumeLoader&) = delete;
+	VolumeLoader& operator=(const VolumeLoader&) = delete;
+};
@@ -0,0 +1,454 @@
+#include "volumemarcher.h"
+
+#include "material.h"
+#include "volumegrid.h"
+#include "volumeproxy.h"
+#include "noisevolume.h"
+#include "transferfunction.h"
+#include "../framework/camera.h"
+#include "../framework/jobs.h"
+
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <cmath>
+
+void sVolumeMarchSettings::fromMaterial(const VolumeMaterial& material, float step_scale)
+{
+	setCoefficients(material.absorption_coefficient, material.scattering_coefficient, material.density_scale, material.step_length, step_scale);
+	noise_scale = material.noise_scale;
+	noise_detail = material.noise_detail;
+	max_light_steps = material.max_light_steps;
+	isotropy_parameter = material.isotropy_parameter;
+	jittering = material.jittering_offset;
+	adaptive_step = material.adaptive_step;
+	max_step_scale = material.max_step_scale;
+	step_distance_scale = material.step_distance_scale;
+	transfer = material.transfer;
+	preintegrate = material.preintegrate;
+}
+
+void sVolumeMarchSettings::setCoefficients(float absorption, float scattering, float density, float step, float step_scale)
+{
+	absorption_coefficient = absorption;
+	scattering_coefficient = scattering;
+	density_scale = density;
+	step_length = step * step_scale;
+}
+
+//the hash of the shader, the sin of the GPU is less precise so the values differ where the argument is large
+static float fractalPerlin(const glm::vec3& position, float scale, int detail)
+{
+	float value = 0.f;
+	float amplitude = 0.5f;
+	float frequency = 1.f;
+	for (int i = 0; i < detail; ++i)
+	{
+		float hash = std::sin(glm::dot(position * frequency * scale, glm::vec3(12.9898f, 78.233f, 45.164f))) * 43758.5453f;
+		value += amplitude * (hash - std::floor(hash));
+		frequency *= 2.f;
+		amplitude *= 0.5f;
+	}
+	return value;
+}
+
+static glm::vec2 intersectAABB(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& box_min, const glm::vec3& box_max)
+{
+	glm::vec3 t_min = (box_min - origin) / dir;
+	glm::vec3 t_max = (box_max - origin) / dir;
+	glm::vec3 t1 = glm::min(t_min, t_max);
+	glm::vec3 t2 = glm::max(t_min, t_max);
+	return glm::vec2(std::max(std::max(t1.x, t1.y), t1.z), std::min(std::min(t2.x, t2.y), t2.z));
+}
+
+static float phaseHG(const glm::vec3& light_dir, const glm::vec3& view_dir, float g)
+{
+	float cos_theta = glm::dot(light_dir, view_dir);
+	return (1.f - g * g) / std::pow(1.f + g * g - 2.f * g * cos_theta, 1.5f);
+}
+
+static bool insideBox(const glm::vec3& P, const glm::vec3& box_min, const glm::vec3& box_max)
+{
+	glm::vec3 uvw = (P - box_min) / (box_max - box_min);
+	return uvw.x >= 0.f && uvw.y >= 0.f && uvw.z >= 0.f && uvw.x <= 1.f && uvw.y <= 1.f && uvw.z <= 1.f;
+}
+
+//texel centers of a row of TF_TABLE_SIZE entries, linear between two of them like transferCoord
+static glm::vec4 lookupRow(const glm::vec4* row, float density)
+{
+	float x = std::min(std::max(density, 0.f), 1.f) * (TF_TABLE_SIZE - 1);
+	int i = std::min((int)x, TF_TABLE_SIZE - 2);
+	float f = x - i;
+	return row[i] * (1.f - f) + row[i + 1] * f;
+}
+
+//bilinear at the texel centers of a table of the densities at the front (x) and back (y)
+static glm::vec4 lookupTable(const std::vector<glm::vec4>& table, float front, float back)
+{
+	const int N = TF_TABLE_SIZE;
+	float y = std::min(std::max(back, 0.f), 1.f) * (N - 1);
+	int j = std::min((int)y, N - 2);
+	float f = y - j;
+	return lookupRow(&table[j * N], front) * (1.f - f) + lookupRow(&table[(j + 1) * N], front) * f;
+}
+
+float VolumeMarcher::rayOffset(int x, int y) const
+{
+	//texelFetch of the red channel, rotated by the seed
+	int bx = x % blue_noise.width;
+	int by = y % blue_noise.height;
+	float value = blue_noise.data[(bx + by * blue_noise.width) * blue_noise.bytes_per_pixel] / 255.f + settings.jitter_seed;
+	return value - std::floor(value);
+}
+
+//trilinear with repeat at the texel centers of the baked volume, like bakedNoise
+float VolumeMarcher::sampleNoise(const glm::vec3& P) const
+{
+	int size = noise->resolution;
+	glm::vec3 p = P * settings.noise_scale / (float)noise->period * (float)size - 0.5f;
+	glm::vec3 base = glm::floor(p);
+	glm::vec3 f = p - base;
+	auto wrap = [size](float v) { int i = (int)v % size; return i < 0 ? i + size : i; };
+	int x[2] = { wrap(base.x), wrap(base.x + 1.f) };
+	int y[2] = { wrap(base.y), wrap(base.y + 1.f) };
+	int z[2] = { wrap(base.z), wrap(base.z + 1.f) };
+	auto texel = [&](int i, int j, int k) {
+		return noise->data[x[i] + (y[j] + z[k] * size) * size] / 65535.f;
+	};
+	float c00 = texel(0, 0, 0) * (1.f - f.x) + texel(1, 0, 0) * f.x;
+	float c10 = texel(0, 1, 0) * (1.f - f.x) + texel(1, 1, 0) * f.x;
+	float c01 = texel(0, 0, 1) * (1.f - f.x) + texel(1, 0, 1) * f.x;
+	float c11 = texel(0, 1, 1) * (1.f - f.x) + texel(1, 1, 1) * f.x;
+	float c0 = c00 * (1.f - f.y) + c10 * f.y;
+	float c1 = c01 * (1.f - f.y) + c11 * f.y;
+	return c0 * (1.f - f.z) + c1 * f.z;
+}
+
+float VolumeMarcher::sampleDensity(const glm::vec3& P) const
+{
+	return grid->sample((P - settings.box_min) / (settings.box_max - settings.box_min));
+}
+
+glm::vec4 VolumeMarcher::transferFunction(float density) const
+{
+	if (!settings.transfer)
+		return glm::vec4(1.f, 1.f, 1.f, density);
+	return lookupRow(&settings.transfer->function_texels[0], density);
+}
+
+glm::vec3 VolumeMarcher::transferEmission(float density) const
+{
+	if (!settings.transfer)
+		return glm::vec3(0.f);
+	return glm::vec3(lookupRow(&settings.transfer->function_texels[TF_TABLE_SIZE], density));
+}
+
+float VolumeMarcher::lightTransmittance(const glm::vec3& P, const glm::vec3& light_dir, uint64_t& count) const
+{
+	float step = settings.step_length;
+	glm::vec3 position = P + light_dir * step * 0.5f;
+	float tau = 0.f;
+	for (int i = 0; i < settings.max_light_steps; ++i)
+	{
+		if (!insideBox(position, settings.box_min, settings.box_max))
+			break;
+		float density = transferFunction(sampleDensity(position)).a * settings.density_scale;
+		tau += density * settings.scattering_coefficient * step;
+		position += light_dir * step;
+		count++;
+	}
+	return std::exp(-tau);
+}
+
+glm::vec4 VolumeMarcher::marchConstant(const glm::vec3& origin, const glm::vec3& dir, float ta, float tb, float offset, uint64_t& count) const
+{
+	const sVolumeMarchSettings& s = settings;
+	float step = s.step_length;
+	float tau = 0.f;
+	glm::vec4 scattering(0.f);
+	for (float t = ta + step * 0.5f; t < tb; t += step)
+	{
+		glm::vec3 P = origin + dir * (t + offset * step);
+		glm::vec3 view_dir = glm::normalize(origin - P);
+
+		float density = s.constant_density;
+		tau += density * (s.absorption_coefficient + s.scattering_coefficient) * step;
+		float transmittance = std::exp(-tau);
+
+		glm::vec3 light_dir = glm::normalize(s.light_position - P);
+		glm::vec3 position = P + light_dir * step * 0.5f;
+		float light_tau = 0.f;
+		for (int i = 0; i < s.max_light_steps; ++i)
+		{
+			if (!insideBox(position, s.box_min, s.box_max))
+				break;
+			light_tau += s.constant_density * s.scattering_coefficient * step;
+			position += light_dir * step;
+			count++;
+		}
+		count++;
+
+		glm::vec4 Ls = s.light_color * std::exp(-light_tau) * phaseHG(light_dir, view_dir, s.isotropy_parameter);
+		scattering += s.scattering_coefficient * Ls * transmittance * density * step;
+	}
+
+	float transmittance = std::exp(-tau);
+	return s.premultiplied ? glm::vec4(glm::vec3(scattering), 1.f - transmittance) : s.background_color * transmittance + scattering;
+}
+
+//the noise branch has no jitter and its light march runs until a sample without density
+glm::vec4 VolumeMarcher::marchNoise(const glm::vec3& origin, const glm::vec3& dir, float ta, float tb, uint64_t& count) const
+{
+	const sVolumeMarchSettings& s = settings;
+	auto density = [&](const glm::vec3& P) {
+		count++;
+		return noise ? sampleNoise(P) : std::min(std::max(fractalPerlin(P, s.noise_scale, s.noise_detail), 0.f), 1.f);
+	};
+
+	float step = s.step_length;
+	float tau = 0.f;
+	glm::vec4 scattering(0.f);
+	for (float t = ta + step * 0.5f; t < tb; t += step)
+	{
+		glm::vec3 P = origin + dir * t;
+		glm::vec3 view_dir = glm::normalize(origin - P);
+
+		float value = density(P) * s.absorption_coefficient;
+		tau += value * (s.absorption_coefficient + s.scattering_coefficient) * step;
+		float transmittance = std::exp(-tau);
+
+		glm::vec3 light_dir = glm::normalize(s.light_position - P);
+		glm::vec3 position = P + light_dir * step * 0.5f;
+		float light_tau = 0.f;
+		for (int i = 0; i < s.max_light_steps; ++i)
+		{
+			float light_density = density(position);
+			light_tau += light_density * s.scattering_coefficient * step;
+			if (light_density == 0.f)
+				break;
+			position += light_dir * step;
+		}
+
+		glm::vec4 Ls = s.light_color * std::exp(-light_tau) * phaseHG(light_dir, view_dir, s.isotropy_parameter);
+		scattering += s.scattering_coefficient * Ls * transmittance * value * step;
+	}
+
+	float transmittance = std::exp(-tau);
+	return s.premultiplied ? glm::vec4(glm::vec3(scattering), 1.f - transmittance) : s.background_color * transmittance + scattering;
+}
+
+//at the full resolution, the levels of the mip chain and the temperature channel are left to the GPU
+glm::vec4 VolumeMarcher::marchTexture(const glm::vec3& origin, const glm::vec3& dir, float ta, float tb, float offset, uint64_t& count) const
+{
+	const sVolumeMarchSettings& s = settings;
+	sAdaptiveStep adaptive;
+	adaptive.step_length = s.step_length;
+	adaptive.sigma = s.density_scale * (s.absorption_coefficient + s.scattering_coefficient) * s.absorption_coefficient;
+	adaptive.max_step_scale = s.max_step_scale;
+	adaptive.distance_scale = s.step_distance_scale;
+	bool use_adaptive = s.adaptive_step && proxy;
+	bool preintegrated = s.transfer && s.preintegrate;
+
+	float tau = 0.f;
+	glm::vec4 scattering(0.f);
+	float t = ta;
+	float front = sampleDensity(origin + dir * t);
+	count++;
+	while (t < tb)
+	{
+		float dt = use_adaptive ? proxy->getStep(origin + dir * t, dir, t, s.box_min, s.box_max, adaptive) : s.step_length;
+		dt = std::min(dt, tb - t);
+		glm::vec3 P = origin + dir * (t + offset * dt);
+
+		glm::vec3 view_dir = glm::normalize(origin - P);
+		glm::vec3 light_dir = glm::normalize(s.light_position - P);
+		glm::vec4 Ls = s.light_color * lightTransmittance(P, light_dir, count) * phaseHG(light_dir, view_dir, s.isotropy_parameter);
+
+		if (preintegrated)
+		{
+			float back = sampleDensity(origin + dir * (t + dt));
+			glm::vec4 segment = lookupTable(s.transfer->scattering_texels, front, back);
+			glm::vec3 emission = glm::vec3(lookupTable(s.transfer->emission_texels, front, back));
+			float ratio = dt / s.transfer->step_length;
+			float opacity = 1.f - std::pow(1.f - segment.a, ratio);
+			float weight = segment.a > 1e-5f ? opacity / segment.a : ratio;
+
+			scattering += std::exp(-tau) * (glm::vec4(glm::vec3(segment), 1.f) * Ls + glm::vec4(emission, 0.f)) * weight;
+			tau -= std::log(std::max(1.f - opacity, 1e-6f));
+			front = back;
+		}
+		else
+		{
+			float raw_density = sampleDensity(P);
+			glm::vec4 transfer = transferFunction(raw_density);
+			float density = transfer.a * s.density_scale;
+			tau += density * (s.absorption_coefficient + s.scattering_coefficient) * s.absorption_coefficient * dt;
+			float transmittance = std::exp(-tau);
+
+			scattering += s.scattering_coefficient * Ls * glm::vec4(glm::vec3(transfer), 1.f) * transmittance * density * dt;
+			scattering += glm::vec4(transferEmission(raw_density) * transmittance * dt, 0.f);
+		}
+		count++;
+
+		if (std::exp(-tau) < 0.01f)
+			break;
+		t += dt;
+	}
+
+	float transmittance = std::exp(-tau);
+	return s.premultiplied ? glm::vec4(glm::vec3(scattering), 1.f - transmittance) : s.background_color * transmittance + scattering;
+}
+
+glm::vec4 VolumeMarcher::march(const glm::vec3& origin, const glm::vec3& dir, int x, int y, uint64_t& count) const
+{
+	glm::vec2 interval = intersectAABB(origin, dir, settings.box_min, settings.box_max);
+	float ta = interval.x;
+	float tb = interval.y;
+	if (ta > tb || tb < 0.f)
+		return settings.premultiplied ? glm::vec4(0.f) : settings.background_color;
+
+	float offset = settings.jittering ? rayOffset(x, y) : 0.f;
+	if (settings.density_source == 1)
+		return marchNoise(origin, dir, ta, tb, count);
+	if (settings.density_source == 2 && grid)
+		return marchTexture(origin, dir, ta, tb, settings.jittering ? offset : 0.5f, count);
+	return marchConstant(origin, dir, ta, tb, offset, count);
+}
+
+void VolumeMarcher::render(const Camera& camera, Image& image, bool parallel)
+{
+	int width = image.width;
+	int height = image.height;
+	if (width <= 0 || height <= 0)
+		return;
+	if (image.bytes_per_pixel != 4)
+		image.resize(width, height, 4);
+	pixels.resize((size_t)width * height);
+
+	//the same tables as the material, integrated here only when the coefficients changed
+	const sVolumeMarchSettings& s = settings;
+	if (s.transfer)
+	{
+		float extinction_scale = s.density_scale * (s.absorption_coefficient + s.scattering_coefficient) * s.absorption_coefficient;
+		float scattering_scale = s.scattering_coefficient * s.density_scale;
+		if (s.transfer->scattering_texels.empty() || s.transfer->extinction_scale != extinction_scale ||
+			s.transfer->scattering_scale != scattering_scale || s.transfer->step_length != s.step_length)
+			s.transfer->integrate(extinction_scale, scattering_scale, s.step_length, parallel);
+	}
+
+	if (s.jittering && !blue_noise.data)
+	{
+		//the file cached by the blue noise texture, generated if there is none
+		std::string filename = "res/bluenoise" + std::to_string(BLUE_NOISE_SIZE) + ".tga";
+		if (!blue_noise.loadTGA(filename.c_str()) || blue_noise.width != BLUE_NOISE_SIZE || blue_noise.height != BLUE_NOISE_SIZE)
+			blue_noise.createBlueNoise(BLUE_NOISE_SIZE);
+	}
+
+	//the rays go from the camera position through the far plane, like the ones to the faces of the box in the shader
+	glm::mat4 inverse_vp = glm::inverse(camera.viewprojection_matrix);
+	glm::vec3 origin = camera.eye;
+	int tiles_x = (width + VOLUME_MARCHER_TILE - 1) / VOLUME_MARCHER_TILE;
+	int tiles_y = (height + VOLUME_MARCHER_TILE - 1) / VOLUME_MARCHER_TILE;
+	num_tiles = tiles_x * tiles_y;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::atomic<uint64_t> total{ 0 };
+	auto renderTiles = [&](int begin, int end) {
+		uint64_t count = 0;
+		for (int tile = begin; tile < end; ++tile)
+		{
+			int x0 = (tile % tiles_x) * VOLUME_MARCHER_TILE;
+			int y0 = (tile / tiles_x) * VOLUME_MARCHER_TILE;
+			for (int y = y0; y < std::min(y0 + VOLUME_MARCHER_TILE, height); ++y)
+				for (int x = x0; x < std::min(x0 + VOLUME_MARCHER_TILE, width); ++x)
+				{
+					glm::vec2 ndc = (glm::vec2(x, y) + 0.5f) / glm::vec2(width, height) * 2.f - 1.f;
+					glm::vec4 far_point = inverse_vp * glm::vec4(ndc, 1.f, 1.f);
+					glm::vec3 dir = glm::normalize(glm::vec3(far_point) / far_point.w - origin);
+
+					glm::vec4 color = march(origin, dir, x, y, count);
+					pixels[x + (size_t)y * width] = color;
+					image.setPixel(x, y, glm::clamp(color, glm::vec4(0.f), glm::vec4(1.f)) * 255.f + 0.5f);
+				}
+		}
+		total += count;
+	};
+	//a tile per chunk, the threads that get the empty corners of the image take the tiles left over the volume
+	if (parallel)
+		parallelFor(num_tiles, renderTiles, 1);
+	else
+		renderTiles(0, num_tiles);
+
+	render_time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+	samples = total.load();
+}
+
+void VolumeMarcher::benchmark(const char* filename)
+{
+	VolumeGrid grid;
+	grid.loadBenchmark(filename);
+	VolumeProxy proxy;
+	proxy.build(&grid.data[0], grid.resolution);
+	NoiseVolume noise;
+	noise.generate(NOISE_VOLUME_RESOLUTION, NOISE_VOLUME_PERIOD, std::min(5, NoiseVolume::getMaxDetail()), NOISE_VOLUME_SEED);
+	TransferFunction transfer;
+	transfer.density_low = 0.05f;
+	transfer.emission = glm::vec3(0.4f, 0.15f, 0.05f);
+
+	Camera camera;
+	camera.lookAt(glm::vec3(1.f, 1.5f, 4.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+	camera.setPerspective(45.f, 1.f, 0.1f, 100.f);
+	Image image(192, 192, 4);
+
+	struct sCase
+	{
+		const char* name;
+		int density_source;
+		bool baked_noise;
+		bool adaptive_step;
+		bool transfer;
+	};
+	sCase cases[] = {
+		{ "constant", 0, false, false, false },
+		{ "noise", 1, false, false, false },
+		{ "baked_noise", 1, true, false, false },
+		{ "texture", 2, false, false, false },
+		{ "texture_adaptive", 2, false, true, false },
+		{ "texture_preintegrated", 2, false, true, true },
+	};
+
+	for (const sCase& c : cases)
+	{
+		VolumeMarcher marcher;
+		marcher.grid = &grid;
+		marcher.proxy = &proxy;
+		marcher.noise = c.baked_noise ? &noise : nullptr;
+		//the coefficients and the step of a default material, not refining
+		marcher.settings.setCoefficients(1.f, 1.f, 1.f, 0.045f, 1.f);
+		marcher.settings.density_source = c.density_source;
+		marcher.settings.jittering = true;
+		marcher.settings.adaptive_step = c.adaptive_step;
+		marcher.settings.transfer = c.transfer ? &transfer : nullptr;
+
+		marcher.render(camera, image, false);
+		float serial_ms = marcher.render_time;
+		double serial_rate = marcher.getSamplesPerSecond();
+		std::vector<glm::vec4> serial = marcher.pixels;
+		marcher.render(camera, image, true);
+
+		//every pixel is marched on its own, the threads can't change the result
+		float difference = 0.f;
+		for (size_t i = 0; i < serial.size(); ++i)
+		{
+			glm::vec4 d = glm::abs(serial[i] - marcher.pixels[i]);
+			difference = std::max(difference, std::max(std::max(d.x, d.y), std::max(d.z, d.w)));
+		}
+		std::string output = std::string("marcher_") + c.name + ".tga";
+		image.saveTGA(output.c_str());
+		std::cout << "   " << c.name << ": " << marcher.samples / (float)(image.width * image.height) << " samples/pixel, " << serial_ms << " ms serial ("
+			<< serial_rate * 1e-6 << " Msamples/s), " << marcher.render_time << " ms with " << getNumJobThreads() << " threads ("
+			<< marcher.getSamplesPerSecond() * 1e-6 << " Msamples/s, " << marcher.num_tiles << " tiles), max difference " << difference << ", " << output << std::endl;
+	}
+}
@@ -0,0 +1,104 @@
+/*  CPU reference of the scattering shader: the same march of constant, noise and texture density,
+	with the light march, the Henyey-Greenstein phase, the jitter of the blue noise and the transfer
+	function with its pre-integrated tables. The image is split in tiles that the job threads claim
+	while they are left, so the machines without a GPU can render the volumes to compare and profile
+	the integrator. The model of the volume is the identity, the box is in world space.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "texture.h"
+
+#define VOLUME_MARCHER_TILE 16 //pixels per side of the tiles claimed by the threads
+
+class Camera;
+class VolumeGrid;
+class VolumeProxy;
+class NoiseVolume;
+class TransferFunction;
+class VolumeMaterial;
+
+//the uniforms of the scattering shader
+struct sVolumeMarchSettings
+{
+	int density_source = 0; //0 constant, 1 noise, 2 the grid, like u_density_source
+	glm::vec3 box_min = glm::vec3(-1.f);
+	glm::vec3 box_max = glm::vec3(1.f);
+	float absorption_coefficient = 1.f;
+	float scattering_coefficient = 1.f;
+	float density_scale = 1.f;
+	float constant_density = 1.f;
+	float noise_scale = 1.558f;
+	int noise_detail = 5;
+	float step_length = 0.045f; //of the march, the application scales the one of the material
+	int max_light_steps = 100;
+	float isotropy_parameter = 0.f;
+	bool jittering = false;
+	float jitter_seed = 0.f;
+	bool adaptive_step = false; //only with the proxy of the marcher
+	float max_step_scale = 4.f;
+	float step_distance_scale = 0.05f;
+	TransferFunction* transfer = nullptr; //its tables are integrated for the coefficients before the render
+	bool preintegrate = true;
+	glm::vec3 light_position = glm::vec3(2.f, 0.f, 0.f);
+	glm::vec4 light_color = glm::vec4(1.f);
+	glm::vec4 background_color = glm::vec4(0.75f, 0.75f, 0.75f, 1.f);
+	bool premultiplied = false; //radiance and opacity instead of over the background
+
+	//coefficients, steps and transfer function of the material. The density source, the light and the background are the
+	//ones of the application, they are left as they are. step_scale multiplies the step like the application does while it
+	//refines, Application::instance->volume_step_scale
+	void fromMaterial(const VolumeMaterial& material, float step_scale);
+	//the coefficients and the step without a material, for the headless benchmarks
+	void setCoefficients(float absorption, float scattering, float density, float step, float step_scale);
+};
+
+class VolumeMarcher
+{
+public:
+	sVolumeMarchSettings settings;
+	const VolumeGrid* grid = nullptr; //density of the texture source, clamped to [0, 1] like the R8 texture
+	const VolumeProxy* proxy = nullptr; //bricks of the grid for the adaptive step
+	const NoiseVolume* noise = nullptr; //fetched instead of evaluating the octaves when set, like u_baked_noise
+	std::vector<glm::vec4> pixels; //of the last render before clamping to bytes, rows from the bottom like gl_FragCoord
+
+	//stats of the last render
+	float render_time = 0.f; //ms
+	uint64_t samples = 0; //density evaluations of the view and light marches
+	int num_tiles = 0;
+
+	VolumeMarcher() {};
+
+	//every pixel of the image from the camera, the image is made RGBA and keeps its size
+	void render(const Camera& camera, Image& image, bool parallel = true);
+	//FragColor of the pixel at x, y for the ray from the camera position, the density evaluations are added to count
+	glm::vec4 march(const glm::vec3& origin, const glm::vec3& dir, int x, int y, uint64_t& count) const;
+	double getSamplesPerSecond() const { return render_time > 0.f ? samples / (render_time * 0.001) : 0.0; }
+
+	//serial and threaded render of every density source: time, samples/sec and difference, writes marcher_*.tga
+	static void benchmark(const char* filename);
+
+private:
+	Image blue_noise;
+
+	float rayOffset(int x, int y) const;
+	float sampleNoise(const glm::vec3& P) const;
+	float sampleDensity(const glm::vec3& P) const;
+	//albedo and extinction, and emission, of a raw density from the texels of the transfer function
+	glm::vec4 transferFunction(float density) const;
+	glm::vec3 transferEmission(float density) const;
+	float lightTransmittance(const glm::vec3& P, const glm::vec3& light_dir, uint64_t& count) const;
+
+	glm::vec4 marchConstant(const glm::vec3& origin, const glm::vec3& dir, float ta, float tb, float offset, uint64_t& count) const;
+	glm::vec4 marchNoise(const glm::vec3& origin, const glm::vec3& dir, float ta, float tb, uint64_t& count) const;
+	glm::vec4 marchTexture(const glm::vec3& origin, const glm::vec3& dir, float ta, float tb, float offset, uint64_t& count) const;
+
+	VolumeMarcher(const VolumeMarcher&) = delete;
+	VolumeMarcher& operator=(const VolumeMarcher&) = delete;
+};
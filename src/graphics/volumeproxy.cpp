@@ -0,0 +1,202 @@
+#include "volumeproxy.h"
+
+#include "mesh.h"
+#include "texture.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+VolumeProxy::~VolumeProxy()
+{
+	if (mesh)
+		delete mesh;
+	if (brick_texture)
+		delete brick_texture;
+}
+
+void VolumeProxy::build(const float* data, int voxels, int brick_size, float threshold)
+{
+	this->resolution = (voxels + brick_size - 1) / brick_size;
+	this->brick_extent = brick_size / (float)voxels;
+	int num_bricks = resolution * resolution * resolution;
+	this->max_density.assign(num_bricks, 0.f);
+	std::vector<float> min_density(num_bricks, 1.f);
+
+	//the trilinear filter reads the neighbour voxels, so a voxel on the border of a brick also counts in the adjacent one
+	for (int z = 0; z < voxels; ++z)
+		for (int y = 0; y < voxels; ++y)
+			for (int x = 0; x < voxels; ++x)
+			{
+				float density = std::min(std::max(data[x + (y + z * voxels) * voxels], 0.f), 1.f);
+				int x0 = std::max(x - 1, 0) / brick_size, x1 = std::min(x + 1, voxels - 1) / brick_size;
+				int y0 = std::max(y - 1, 0) / brick_size, y1 = std::min(y + 1, voxels - 1) / brick_size;
+				int z0 = std::max(z - 1, 0) / brick_size, z1 = std::min(z + 1, voxels - 1) / brick_size;
+				for (int bz = z0; bz <= z1; ++bz)
+					for (int by = y0; by <= y1; ++by)
+						for (int bx = x0; bx <= x1; ++bx)
+						{
+							int brick = bx + (by + bz * resolution) * resolution;
+							max_density[brick] = std::max(max_density[brick], density);
+							min_density[brick] = std::min(min_density[brick], density);
+						}
+			}
+
+	this->occupancy.resize(num_bricks);
+	this->density_range.resize(num_bricks);
+	this->num_occupied = 0;
+	for (int i = 0; i < num_bricks; ++i)
+	{
+		occupancy[i] = max_density[i] > threshold;
+		density_range[i] = max_density[i] - min_density[i];
+		num_occupied += occupancy[i];
+	}
+
+	//the bricks changed, the mesh and the texture are built again when requested
+	if (mesh)
+		delete mesh;
+	mesh = nullptr;
+	if (brick_texture)
+		delete brick_texture;
+	brick_texture = nullptr;
+}
+
+bool VolumeProxy::isOccupied(int x, int y, int z) const
+{
+	if (x < 0 || y < 0 || z < 0 || x >= resolution || y >= resolution || z >= resolution)
+		return false;
+	return occupancy[x + (y + z * resolution) * resolution] != 0;
+}
+
+Mesh* VolumeProxy::getMesh(const glm::vec3& box_min, const glm::vec3& box_max)
+{
+	if (mesh && mesh_min == box_min && mesh_max == box_max)
+		return mesh;
+	if (mesh)
+		delete mesh;
+	mesh = new Mesh();
+	mesh_min = box_min;
+	mesh_max = box_max;
+
+	//brick coordinates to the local space of the box
+	glm::vec3 size = box_max - box_min;
+	auto toLocal = [&](glm::vec3 brick) {
+		return box_min + glm::min(brick * brick_extent, glm::vec3(1.f)) * size;
+	};
+
+	//faces between an occupied brick and an empty one, merged greedily in every slice. The three axes
+	//(axis, u, v) are a cyclic permutation of xyz so u x v points to +axis and the quads are counterclockwise
+	std::vector<uint8_t> mask(resolution * resolution);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		int u = (axis + 1) % 3;
+		int v = (axis + 2) % 3;
+		for (int side = -1; side <= 1; side += 2)
+			for (int d = 0; d < resolution; ++d)
+			{
+				glm::ivec3 cell;
+				cell[axis] = d;
+				for (int j = 0; j < resolution; ++j)
+					for (int i = 0; i < resolution; ++i)
+					{
+						cell[u] = i;
+						cell[v] = j;
+						glm::ivec3 next = cell;
+						next[axis] += side;
+						mask[i + j * resolution] = isOccupied(cell.x, cell.y, cell.z) && !isOccupied(next.x, next.y, next.z);
+					}
+
+				for (int j = 0; j < resolution; ++j)
+					for (int i = 0; i < resolution; )
+					{
+						if (!mask[i + j * resolution])
+						{
+							++i;
+							continue;
+						}
+
+						//widest run along u, then as many rows along v as match it
+						int w = 1;
+						while (i + w < resolution && mask[i + w + j * resolution])
+							++w;
+						int h = 1;
+						for (; j + h < resolution; ++h)
+						{
+							bool full = true;
+							for (int k = 0; k < w && full; ++k)
+								full = mask[i + k + (j + h) * resolution] != 0;
+							if (!full)
+								break;
+						}
+						for (int l = 0; l < h; ++l)
+							std::fill(mask.begin() + i + (j + l) * resolution, mask.begin() + i + w + (j + l) * resolution, 0);
+
+						glm::vec3 corners[4];
+						for (int c = 0; c < 4; ++c)
+						{
+							corners[c][axis] = (float)(side > 0 ? d + 1 : d);
+							corners[c][u] = (float)(c == 1 || c == 2 ? i + w : i);
+							corners[c][v] = (float)(c >= 2 ? j + h : j);
+							corners[c] = toLocal(corners[c]);
+						}
+						int order[6] = { 0, 1, 2, 0, 2, 3 };
+						if (side < 0)
+						{
+							std::swap(order[1], order[2]);
+							std::swap(order[4], order[5]);
+						}
+						for (int c = 0; c < 6; ++c)
+							mesh->vertices.push_back(corners[order[c]]);
+
+						i += w;
+					}
+			}
+	}
+
+	std::cout << " + Volume proxy: " << num_occupied << "/" << occupancy.size() << " bricks, " << mesh->vertices.size() / 3 << " triangles" << std::endl;
+
+	//an empty volume still gets a valid mesh, it is never drawn since there are no occupied bricks
+	if (mesh->vertices.empty())
+		mesh->vertices.resize(3, box_min);
+	mesh->updateBoundingBox();
+	mesh->uploadToVRAM();
+	return mesh;
+}
+
+Texture* VolumeProxy::getBrickTexture()
+{
+	if (brick_texture)
+		return brick_texture;
+
+	std::vector<float> texels(max_density.size() * 2);
+	for (size_t i = 0; i < max_density.size(); ++i)
+	{
+		texels[i * 2] = max_density[i];
+		texels[i * 2 + 1] = density_range[i];
+	}
+	brick_texture = new Texture();
+	brick_texture->create3D(resolution, resolution, resolution, GL_RG, GL_FLOAT, false, &texels[0], GL_RG8);
+	brick_texture->upload3D(&texels[0], GL_NEAREST, GL_NEAREST);
+	return brick_texture;
+}
+
+float VolumeProxy::getStep(const glm::vec3& P, const glm::vec3& dir, float t, const glm::vec3& box_min, const glm::vec3& box_max, const sAdaptiveStep& settings) const
+{
+	glm::vec3 size = box_max - box_min;
+	glm::vec3 uvw = glm::clamp((P - box_min) / size, glm::vec3(0.f), glm::vec3(1.f));
+	glm::ivec3 cell = glm::min(glm::ivec3(uvw / brick_extent), glm::ivec3(resolution - 1));
+	int brick = cell.x + (cell.y + cell.z * resolution) * resolution;
+
+	//long steps where a fixed step would barely add opacity, short where the density changes a lot
+	float scale = max_density[brick] > 0.f ? settings.tau / (max_density[brick] * settings.sigma * settings.step_length) : settings.max_step_scale;
+	scale = std::min(scale, settings.max_step_scale + (1.f - settings.max_step_scale) * density_range[brick]);
+	float dt = settings.step_length * std::min(std::max(scale, 1.f), settings.max_step_scale) * (1.f + settings.distance_scale * t);
+
+	//never past the exit of the brick, so a denser one is not skipped
+	glm::vec3 lo = box_min + glm::vec3(cell) * brick_extent * size;
+	float to_exit = 3.4e+38F;
+	for (int i = 0; i < 3; ++i)
+		if (dir[i] != 0.f)
+			to_exit = std::min(to_exit, (lo[i] + (dir[i] > 0.f ? brick_extent * size[i] : 0.f) - P[i]) / dir[i]);
+	return std::max(std::min(dt, to_exit + settings.step_length * 0.01f), settings.step_length);
+}
@@ -0,0 +1,59 @@
+/*  Occupancy hull of a volume: the voxels are grouped in bricks and the faces between occupied
+	and empty bricks are merged into a low poly mesh. The offscreen volume pass rasterizes it to
+	get the entry and exit of every ray, so the pixels over the empty parts of the box don't march.
+	The max density and variation of the bricks also drive the length of the steps of the march.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/vec3.hpp>
+
+#define VOLUME_PROXY_BRICK_SIZE 8 //voxels per brick side
+#define VOLUME_ADAPTIVE_TAU 0.05f //optical depth allowed in a step at the max density of the brick
+
+class Mesh;
+class Texture;
+
+struct sAdaptiveStep
+{
+	float step_length; //fixed step, the shortest one
+	float sigma; //extinction of a unit density
+	float max_step_scale = 8.f;
+	float distance_scale = 0.f; //longer steps away from the camera, per unit of distance
+	float tau = VOLUME_ADAPTIVE_TAU;
+};
+
+class VolumeProxy
+{
+public:
+	int resolution = 0; //bricks per axis
+	float brick_extent = 0.f; //side of a brick in texture space, the last one can go past 1
+	std::vector<uint8_t> occupancy;
+	std::vector<float> max_density; //per brick, of the density clamped to [0, 1] like the texture
+	std::vector<float> density_range; //max - min
+	int num_occupied = 0;
+
+	VolumeProxy() {};
+	~VolumeProxy();
+
+	//marks the bricks with any voxel over the threshold, data is a cube of voxels^3 values
+	void build(const float* data, int voxels, int brick_size = VOLUME_PROXY_BRICK_SIZE, float threshold = 0.f);
+	bool isOccupied(int x, int y, int z) const;
+
+	//hull in the local space of a mesh whose box maps to the whole texture, rebuilt when the box changes
+	Mesh* getMesh(const glm::vec3& box_min, const glm::vec3& box_max);
+	//max density in r and range in g, nearest so the bricks don't blend
+	Texture* getBrickTexture();
+
+	//same as adaptiveStep in the volume shaders: P and dir in the local space of the box, t is the distance to the camera
+	float getStep(const glm::vec3& P, const glm::vec3& dir, float t, const glm::vec3& box_min, const glm::vec3& box_max, const sAdaptiveStep& settings) const;
+
+private:
+	Mesh* mesh = nullptr;
+	Texture* brick_texture = nullptr;
+	glm::vec3 mesh_min;
+	glm::vec3 mesh_max;
+};
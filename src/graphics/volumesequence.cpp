@@ -0,0 +1,355 @@
+#include "volumesequence.h"
+
+#include "texture.h"
+#include "volumegrid.h"
+#include "volumeproxy.h"
+#include "../framework/jobs.h"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <cctype>
+
+VolumeSequence::VolumeSequence(int ring_size, int prefetch, int resolution, float radius) : slots(std::max(ring_size, prefetch + 1))
+{
+	this->prefetch = prefetch;
+	this->resolution = resolution;
+	this->radius = radius;
+}
+
+VolumeSequence::~VolumeSequence()
+{
+	wait();
+	for (sSlot& slot : slots)
+		if (slot.proxy)
+			delete slot.proxy;
+	for (Texture* texture : textures)
+		if (texture)
+			delete texture;
+	if (proxy)
+		delete proxy;
+}
+
+void VolumeSequence::open(const std::string& pattern, int first, int last)
+{
+	wait();
+	for (sSlot& slot : slots)
+		release(slot);
+	this->pattern = pattern;
+	this->first = first;
+	this->last = last;
+	time = 0.0;
+	shown_frame = -1;
+	due_frame.store(0);
+	frames_shown = frames_dropped = num_latencies = 0;
+	last_latency = average_latency = max_latency = 0.f;
+}
+
+static bool fileExists(const std::string& filename)
+{
+	std::ifstream file(filename);
+	return file.good();
+}
+
+bool VolumeSequence::findFrames(const std::string& filename, std::string& pattern, int& first, int& last)
+{
+	size_t dot = filename.find_last_of('.');
+	size_t end = dot == std::string::npos ? filename.size() : dot;
+	size_t begin = end;
+	while (begin > 0 && isdigit((unsigned char)filename[begin - 1]))
+		--begin;
+	if (begin == end)
+		return false;
+
+	//cloud_0001.vdb -> cloud_%04d.vdb
+	pattern = filename.substr(0, begin) + "%0" + std::to_string(end - begin) + "d" + filename.substr(end);
+	int frame = std::stoi(filename.substr(begin, end - begin));
+	char name[1024];
+	auto exists = [&](int number) {
+		snprintf(name, sizeof(name), pattern.c_str(), number);
+		return number >= 0 && fileExists(name);
+	};
+	if (!exists(frame))
+		return false;
+	for (first = frame; exists(first - 1); --first);
+	for (last = frame; exists(last + 1); ++last);
+	return last > first;
+}
+
+int VolumeSequence::findSlot(int frame) const
+{
+	for (size_t i = 0; i < slots.size(); ++i)
+		if (slots[i].frame == frame && slots[i].state.load() != SLOT_FREE)
+			return (int)i;
+	return -1;
+}
+
+int VolumeSequence::distance(int from, int to) const
+{
+	int frames = to - from;
+	if (loop && frames < 0)
+		frames += getNumFrames();
+	return frames;
+}
+
+bool VolumeSequence::isPending(int frame, int due) const
+{
+	if (shown_frame == -1)
+		return distance(due, frame) >= 0 && distance(due, frame) <= prefetch;
+	int played = distance(shown_frame, frame);
+	return played > 0 && played <= distance(shown_frame, due) + prefetch;
+}
+
+void VolumeSequence::request(int frame)
+{
+	auto it = std::find_if(slots.begin(), slots.end(), [](const sSlot& slot) { return slot.state.load() == SLOT_FREE; });
+	if (it == slots.end())
+		return;
+
+	sSlot& slot = *it;
+	slot.frame = frame;
+	slot.requested = std::chrono::high_resolution_clock::now();
+	slot.counted = false;
+	slot.skipped = false;
+	slot.state.store(SLOT_LOADING);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		loading++;
+	}
+
+	char name[1024];
+	snprintf(name, sizeof(name), pattern.c_str(), first + frame);
+	std::string filename = name;
+	int count = getNumFrames();
+	bool looping = loop;
+	runJob([this, &slot, filename, count, looping]() {
+		//the queue is behind the playback, the frame would be dropped anyway
+		int ahead = slot.frame - due_frame.load();
+		if (looping && ahead < 0)
+			ahead += count;
+		slot.skipped = ahead < 0 || ahead > prefetch;
+
+		//the bricks are built here, the GL objects of the proxy are only created once it is shown
+		VolumeGrid grid;
+		slot.levels.clear();
+		if (!slot.skipped && grid.load(filename.c_str(), resolution, radius))
+		{
+			grid.buildMips(slot.levels, false, false);
+			slot.proxy = new VolumeProxy();
+			slot.proxy->build(&grid.data[0], resolution);
+		}
+		else if (!slot.skipped)
+			std::cout << "[WARN] " << filename << " could not be read" << std::endl;
+		slot.latency = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - slot.requested).count() * 1000.f;
+		slot.state.store(SLOT_READY);
+		//notified with the lock held, the sequence may be destroyed as soon as wait returns
+		std::lock_guard<std::mutex> lock(mutex);
+		loading--;
+		condition.notify_all();
+	});
+}
+
+void VolumeSequence::release(sSlot& slot)
+{
+	if (slot.state.load() == SLOT_LOADING)
+		return;
+	if (slot.proxy)
+		delete slot.proxy;
+	slot.proxy = nullptr;
+	slot.frame = -1;
+	slot.state.store(SLOT_FREE);
+}
+
+bool VolumeSequence::show(sSlot& slot)
+{
+	shown_frame = slot.frame;
+	if (slot.levels.empty())
+	{
+		frames_dropped++;
+		return false;
+	}
+
+	//the texture on screen may still be read by the draws in flight, the other one is updated
+	auto start = std::chrono::high_resolution_clock::now();
+	if (upload)
+	{
+		std::vector<uint8_t*> levels;
+		for (std::vector<uint8_t>& level : slot.levels)
+			levels.push_back(&level[0]);
+		int back = textures[front] ? 1 - front : front;
+		if (!textures[back])
+		{
+			textures[back] = new Texture();
+			textures[back]->create3DMipmaps(resolution, resolution, resolution, GL_RED, GL_UNSIGNED_BYTE, &levels[0], (int)levels.size(), GL_R8);
+		}
+		else
+			textures[back]->update3DMipmaps(&levels[0], (int)levels.size());
+		front = back;
+	}
+	upload_time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count() * 1000.f;
+
+	if (proxy)
+		delete proxy;
+	proxy = slot.proxy;
+	slot.proxy = nullptr;
+	frames_shown++;
+	return upload;
+}
+
+bool VolumeSequence::update(float dt)
+{
+	int count = getNumFrames();
+	if (count <= 0)
+		return false;
+
+	//the clock starts with the first frame on screen
+	if (playing && shown_frame != -1)
+		time += dt;
+	int due = (int)(time * fps);
+	if (loop)
+		due %= count;
+	else if (due >= count)
+	{
+		due = count - 1;
+		time = due / fps;
+	}
+
+	due_frame.store(due);
+
+	//the newest ready frame up to the due one, usually the due one itself
+	int newest = -1, newest_played = 0;
+	for (size_t i = 0; i < slots.size(); ++i)
+	{
+		sSlot& slot = slots[i];
+		if (slot.state.load() != SLOT_READY)
+			continue;
+		if (!slot.counted && !slot.skipped)
+		{
+			slot.counted = true;
+			last_latency = slot.latency;
+			max_latency = std::max(max_latency, slot.latency);
+			average_latency += (slot.latency - average_latency) / ++num_latencies;
+		}
+		int played = shown_frame == -1 ? (slot.frame == due) : distance(shown_frame, slot.frame);
+		bool due_or_late = played > 0 && (shown_frame == -1 || played <= distance(shown_frame, due));
+		if (!slot.skipped && due_or_late && played > newest_played)
+		{
+			newest = (int)i;
+			newest_played = played;
+		}
+	}
+
+	bool changed = false;
+	if (newest != -1)
+	{
+		if (shown_frame != -1)
+			frames_dropped += newest_played - 1;
+		changed = show(slots[newest]);
+		release(slots[newest]);
+	}
+
+	//behind the frame on screen, skipped, or out of the window after a seek
+	for (sSlot& slot : slots)
+		if (slot.state.load() == SLOT_READY && (slot.skipped || !isPending(slot.frame, due)))
+			release(slot);
+
+	for (int i = 0; i <= prefetch; ++i)
+	{
+		int frame = due + i;
+		if (loop)
+			frame %= count;
+		else if (frame >= count)
+			break;
+		if (frame != shown_frame && findSlot(frame) == -1)
+			request(frame);
+	}
+	return changed;
+}
+
+void VolumeSequence::seek(int frame)
+{
+	//like the start, the clock waits for the frame and the old one stays on screen
+	time = std::min(std::max(frame, 0), getNumFrames() - 1) / fps;
+	shown_frame = -1;
+}
+
+int VolumeSequence::getFramesAhead() const
+{
+	int ahead = 0;
+	for (int i = 1; i <= prefetch; ++i)
+	{
+		int frame = shown_frame + i;
+		if (loop)
+			frame %= getNumFrames();
+		int index = findSlot(frame);
+		if (index == -1 || slots[index].state.load() != SLOT_READY)
+			break;
+		ahead++;
+	}
+	return ahead;
+}
+
+void VolumeSequence::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	condition.wait(lock, [this]() { return loading == 0; });
+}
+
+void VolumeSequence::renderInMenu()
+{
+	if (ImGui::TreeNode("Sequence"))
+	{
+		ImGui::Checkbox("Play", &this->playing);
+		ImGui::SameLine();
+		ImGui::Checkbox("Loop", &this->loop);
+		ImGui::SliderFloat("FPS", &this->fps, 1.f, 60.f);
+		int frame = std::max(this->shown_frame, 0);
+		if (ImGui::SliderInt("Frame", &frame, 0, getNumFrames() - 1))
+			seek(frame);
+		ImGui::Text("Shown %d, dropped %d, %d ready ahead", this->frames_shown, this->frames_dropped, getFramesAhead());
+		ImGui::Text("Prefetch latency %.1f ms (avg %.1f, max %.1f), upload %.2f ms", this->last_latency, this->average_latency, this->max_latency, this->upload_time);
+		ImGui::TreePop();
+	}
+}
+
+void VolumeSequence::benchmark(const char* filename)
+{
+	std::string pattern;
+	int first, last;
+	if (!findFrames(filename, pattern, first, last))
+	{
+		std::cout << "   " << filename << " is not part of a numbered sequence" << std::endl;
+		return;
+	}
+
+	//the loads are real time, so is the playback: at most 4 seconds of the sequence
+	for (int prefetch : { 1, 4 })
+	{
+		VolumeSequence sequence(prefetch + 4, prefetch);
+		sequence.upload = false;
+		sequence.loop = false;
+		sequence.open(pattern, first, std::min(last, first + (int)(sequence.fps * 4.f) - 1));
+
+		const float dt = 1.f / 60.f;
+		float update_ms = 0.f, max_update_ms = 0.f;
+		int updates = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		while (sequence.getFrame() < sequence.getNumFrames() - 1)
+		{
+			auto frame_start = std::chrono::high_resolution_clock::now();
+			sequence.update(dt);
+			float ms = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - frame_start).count() * 1000.f;
+			update_ms += ms;
+			max_update_ms = std::max(max_update_ms, ms);
+			updates++;
+			std::this_thread::sleep_until(frame_start + std::chrono::microseconds((int)(dt * 1e6f)));
+			if (std::chrono::high_resolution_clock::now() - start > std::chrono::seconds(30))
+				break;
+		}
+		std::cout << "   prefetch " << prefetch << ", " << sequence.getNumFrames() << " frames at " << sequence.fps << " fps: " << sequence.frames_shown << " shown, "
+			<< sequence.frames_dropped << " dropped, latency " << sequence.average_latency << " ms (max " << sequence.max_latency << "), update "
+			<< update_ms / std::max(updates, 1) << " ms (max " << max_update_ms << ") with " << getNumJobThreads() << " threads" << std::endl;
+	}
+}
@@ -0,0 +1,111 @@
+/*  Animated volume from a numbered sequence of VDB files (cloud_0001.vdb ... cloud_0240.vdb). The
+	frames ahead of the playback are loaded by background jobs into a ring of slots: the workers
+	voxelize the grid and build its mip chain and its bricks, the render thread only copies the
+	levels to the texture that is not on screen and swaps the two when the frame is due.
+	The render thread never waits: while the due frame is loading the previous one stays on screen,
+	and when the loads fall behind the newest ready frame is shown and the ones before it dropped.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+class Texture;
+class VolumeProxy;
+
+class VolumeSequence
+{
+public:
+	float fps = 24.f;
+	bool playing = true;
+	bool loop = true;
+	bool upload = true; //false for the headless benchmark, the frames are shown without touching GL
+
+	//stats
+	int frames_shown = 0;
+	int frames_dropped = 0; //never shown: late, skipped by a slow render or unreadable
+	float last_latency = 0.f; //ms from the request of a frame to its levels being ready
+	float average_latency = 0.f;
+	float max_latency = 0.f;
+	float upload_time = 0.f; //ms of the last texture update in the render thread
+
+	//the ring holds at least the due frame and the prefetched ones after it
+	VolumeSequence(int ring_size = 8, int prefetch = 4, int resolution = 128, float radius = 2.f);
+	~VolumeSequence();
+
+	//printf pattern of the file names, the frames first to last included
+	void open(const std::string& pattern, int first, int last);
+	//the numbered files around filename: the digits before the extension and the frames that exist on each side
+	static bool findFrames(const std::string& filename, std::string& pattern, int& first, int& last);
+
+	//render thread: advances the playback, shows the due frame if it is ready and requests the next ones.
+	//True when the texture changed
+	bool update(float dt);
+	void seek(int frame); //the clock waits for the frame to be ready
+
+	int getFrame() const { return shown_frame; } //from 0, -1 until the first one is ready
+	int getNumFrames() const { return last - first + 1; }
+	int getFramesAhead() const; //ready in a row after the shown one
+	Texture* getTexture() const { return textures[front]; } //null until the first frame is shown
+	VolumeProxy* getProxy() const { return proxy; } //bricks of the frame on screen, owned by the sequence
+
+	void renderInMenu();
+
+	//playback of a sequence at its fps with 60 Hz updates: drops, latency and time in the render thread
+	static void benchmark(const char* filename);
+
+private:
+	enum eSlotState { SLOT_FREE, SLOT_LOADING, SLOT_READY };
+
+	struct sSlot
+	{
+		int frame = -1;
+		std::atomic<int> state{ SLOT_FREE }; //the workers only touch the slots in SLOT_LOADING
+		std::vector<std::vector<uint8_t>> levels; //mip chain of the density, empty if the file couldn't be read
+		VolumeProxy* proxy = nullptr; //built by the worker, handed to the sequence when shown
+		std::chrono::high_resolution_clock::time_point requested;
+		float latency = 0.f;
+		bool counted = false; //latency added to the stats
+		bool skipped = false; //behind the playback when its job started, not loaded
+	};
+
+	std::vector<sSlot> slots;
+	Texture* textures[2] = { nullptr, nullptr }; //the one on screen and the one being updated
+	int front = 0;
+	VolumeProxy* proxy = nullptr;
+
+	std::string pattern;
+	int first = 0;
+	int last = -1;
+	int prefetch;
+	int resolution;
+	float radius;
+	double time = 0.0;
+	int shown_frame = -1;
+	std::atomic<int> due_frame{ 0 }; //read by the jobs to skip the frames that are already late
+	int num_latencies = 0;
+
+	//jobs in flight, waited for before the slots go away
+	int loading = 0;
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	int findSlot(int frame) const;
+	//frames played from one to the other, wrapping when looping
+	int distance(int from, int to) const;
+	//after the shown one and at most prefetch frames past the due one
+	bool isPending(int frame, int due) const;
+	void request(int frame);
+	void release(sSlot& slot);
+	bool show(sSlot& slot); //true when the texture was updated
+	void wait();
+
+	VolumeSequence(const VolumeSequence&) = delete;
+	VolumeSequence& operator=(const VolumeSequence&) = delete;
+};
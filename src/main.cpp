@@ -10,6 +10,8 @@
 #include "ImGuizmo.h"
 
 #include "application.h"
+#include "benchmark.h"
+#include "graphics/marchingcubes.h"
 
 // Globals
 Application* app;
@@ -173,8 +175,35 @@ void mainLoop(GLFWwindow* window)
 	}
 }
 
-int main(void) 
+int main(int argc, char** argv) 
 {
+	/* Headless benchmarks, no window is created */
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--benchmark") != 0)
+			continue;
+		if (i + 1 >= argc)
+		{
+			printBenchmarks();
+			return -1;
+		}
+		return runBenchmark(argv[i + 1]) ? 0 : -1;
+	}
+
+	/* Headless isosurface extraction: --isomesh file.vdb isovalue [resolution] */
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--isomesh") != 0)
+			continue;
+		if (i + 2 >= argc)
+		{
+			std::cerr << "usage: --isomesh file.vdb isovalue [resolution]" << std::endl;
+			return -1;
+		}
+		int resolution = i + 3 < argc ? atoi(argv[i + 3]) : 128;
+		return MarchingCubes::extractFile(argv[i + 1], (float)atof(argv[i + 2]), resolution) ? 0 : -1;
+	}
+
 	/* Glfw (Window API) */
 	if (!glfwInit())
 		return -1;